@@ -0,0 +1,382 @@
+/*
+aksara.c - Segment token streams into Balinese syllable clusters
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Every token is mapped to a class by one table lookup and every (state,
+class) pair to a transition byte by a second one: the top bit says
+whether the token opens a new cluster, bits 4 - 6 hold the next state
+and the low nibble the type of the current cluster. A consonant opens a
+dead cluster, and the vowel that closes it only rewrites its type.
+
+Inside an as-is section only the closing bracket matters, so the rest
+of the section is skipped four tokens at a time when SSE2 is available.
+*/
+
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include "def.h"
+#include "utf.h"
+#include "tokenizer.h"
+#include "aksara.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum CmlAksara_Class {
+    CmlAksara_CONSONANT_CLASS,
+    CmlAksara_VOWEL_CLASS,
+    CmlAksara_SPACE_CLASS,
+    CmlAksara_NUMBER_CLASS,
+    CmlAksara_PUNCTUATION_CLASS,
+    CmlAksara_AS_IS_START_CLASS,
+    CmlAksara_AS_IS_END_CLASS,
+    CmlAksara_RAW_CLASS
+};
+
+enum CmlAksara_State {
+    CmlAksara_NONE_STATE,
+    CmlAksara_CONSONANTS_STATE,
+    CmlAksara_SPACE_STATE,
+    CmlAksara_NUMBER_STATE,
+    CmlAksara_RAW_STATE,
+    CmlAksara_AS_IS_STATE
+};
+
+#define CmlAksara_OPEN(type, state) (0x80 | ((state) << 4) | (type))
+#define CmlAksara_KEEP(type, state) (((state) << 4) | (type))
+
+#define CmlAksara_C CmlAksara_CONSONANT_CLASS
+#define CmlAksara_V CmlAksara_VOWEL_CLASS
+#define CmlAksara_N CmlAksara_NUMBER_CLASS
+#define CmlAksara_P CmlAksara_PUNCTUATION_CLASS
+#define CmlAksara_R CmlAksara_RAW_CLASS
+
+static const unsigned char CmlAksara_classes[CmlTokenizer_RAW_TOKEN(0)] = {
+    CmlAksara_R, CmlAksara_R, CmlAksara_SPACE_CLASS,
+    CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V,
+    CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V, CmlAksara_V,
+    CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C,
+    CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C,
+    CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C, CmlAksara_C,
+    CmlAksara_N, CmlAksara_N, CmlAksara_N, CmlAksara_N, CmlAksara_N,
+    CmlAksara_N, CmlAksara_N, CmlAksara_N, CmlAksara_N, CmlAksara_N,
+    CmlAksara_P, CmlAksara_P, CmlAksara_P, CmlAksara_P, CmlAksara_P, CmlAksara_P, CmlAksara_P, CmlAksara_P,
+    CmlAksara_AS_IS_START_CLASS, CmlAksara_AS_IS_END_CLASS, CmlAksara_R
+};
+
+#define CmlAksara_OPENING_ROW(consonant, space, number, asIsEnd, raw) \
+    consonant, \
+    CmlAksara_OPEN(CmlAksara_VOWEL, CmlAksara_NONE_STATE), \
+    space, \
+    number, \
+    CmlAksara_OPEN(CmlAksara_PUNCTUATION, CmlAksara_NONE_STATE), \
+    CmlAksara_OPEN(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE), \
+    asIsEnd, \
+    raw
+
+#define CmlAksara_OPEN_CONSONANTS CmlAksara_OPEN(CmlAksara_DEAD_CONSONANTS, CmlAksara_CONSONANTS_STATE)
+#define CmlAksara_OPEN_SPACE CmlAksara_OPEN(CmlAksara_SPACE, CmlAksara_SPACE_STATE)
+#define CmlAksara_OPEN_NUMBER CmlAksara_OPEN(CmlAksara_NUMBER, CmlAksara_NUMBER_STATE)
+#define CmlAksara_OPEN_RAW CmlAksara_OPEN(CmlAksara_RAW, CmlAksara_RAW_STATE)
+
+static const unsigned char CmlAksara_transitions[6][8] = {
+    { CmlAksara_OPENING_ROW(CmlAksara_OPEN_CONSONANTS, CmlAksara_OPEN_SPACE, CmlAksara_OPEN_NUMBER, CmlAksara_OPEN_RAW, CmlAksara_OPEN_RAW) },
+    {
+        CmlAksara_KEEP(CmlAksara_DEAD_CONSONANTS, CmlAksara_CONSONANTS_STATE),
+        CmlAksara_KEEP(CmlAksara_SYLLABLE, CmlAksara_NONE_STATE),
+        CmlAksara_OPEN_SPACE,
+        CmlAksara_OPEN_NUMBER,
+        CmlAksara_OPEN(CmlAksara_PUNCTUATION, CmlAksara_NONE_STATE),
+        CmlAksara_OPEN(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE),
+        CmlAksara_OPEN_RAW,
+        CmlAksara_OPEN_RAW
+    },
+    { CmlAksara_OPENING_ROW(CmlAksara_OPEN_CONSONANTS, CmlAksara_KEEP(CmlAksara_SPACE, CmlAksara_SPACE_STATE), CmlAksara_OPEN_NUMBER, CmlAksara_OPEN_RAW, CmlAksara_OPEN_RAW) },
+    { CmlAksara_OPENING_ROW(CmlAksara_OPEN_CONSONANTS, CmlAksara_OPEN_SPACE, CmlAksara_KEEP(CmlAksara_NUMBER, CmlAksara_NUMBER_STATE), CmlAksara_OPEN_RAW, CmlAksara_OPEN_RAW) },
+    {
+        CmlAksara_OPENING_ROW(CmlAksara_OPEN_CONSONANTS, CmlAksara_OPEN_SPACE, CmlAksara_OPEN_NUMBER,
+            CmlAksara_KEEP(CmlAksara_RAW, CmlAksara_RAW_STATE), CmlAksara_KEEP(CmlAksara_RAW, CmlAksara_RAW_STATE))
+    },
+    {
+        CmlAksara_KEEP(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE),
+        CmlAksara_KEEP(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE),
+        CmlAksara_KEEP(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE),
+        CmlAksara_KEEP(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE),
+        CmlAksara_KEEP(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE),
+        CmlAksara_KEEP(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE),
+        CmlAksara_KEEP(CmlAksara_AS_IS, CmlAksara_NONE_STATE),
+        CmlAksara_KEEP(CmlAksara_AS_IS, CmlAksara_AS_IS_STATE)
+    }
+};
+
+static __Cml_INLINE unsigned char CmlAksara_classOf(unsigned int token)
+{
+    if (token < CmlTokenizer_RAW_TOKEN(0))
+        return CmlAksara_classes[token];
+    return CmlTokenizer_IS_SPAN_TOKEN(token) ? CmlAksara_AS_IS_START_CLASS : CmlAksara_RAW_CLASS;
+}
+
+static __Cml_INLINE size_t CmlAksara_findAsIsEnd(CmlTokenizer_TokenStream tokenStream, size_t i, size_t end)
+{
+#ifdef __SSE2__
+    __m128i asIsEnd = _mm_set1_epi32(CmlTokenizer_TRANSLITERATION_AS_IS_END_TOKEN);
+    for (; i + 4 <= end; i += 4) {
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i *) (tokenStream + i)), asIsEnd)) != 0)
+            break;
+    }
+#endif
+    for (; i < end; i++) {
+        if (tokenStream[i] == CmlTokenizer_TRANSLITERATION_AS_IS_END_TOKEN)
+            break;
+    }
+
+    return i;
+}
+
+#ifdef __SSE2__
+/*
+Outside as-is sections, whether a token opens a cluster depends only on
+its own class and the class of the token before it, so a block of 64
+tokens is classified into bitmasks at once. Tokens are narrowed to bytes
+with saturation, which maps every raw token to 60, and each class is a
+range between two of the thresholds below.
+*/
+#define CmlAksara_BLOCK_SIZE 64
+
+static __Cml_INLINE unsigned int CmlAksara_lowestBit(unsigned long long mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#else
+    unsigned int i = 0;
+    for (; !(mask & 1); mask >>= 1)
+        i++;
+    return i;
+#endif
+}
+
+static __Cml_INLINE unsigned long long CmlAksara_greater(__m128i *p_bytes, char value)
+{
+    __m128i bound = _mm_set1_epi8(value);
+    return (unsigned long long) _mm_movemask_epi8(_mm_cmpgt_epi8(p_bytes[0], bound))
+        | (unsigned long long) _mm_movemask_epi8(_mm_cmpgt_epi8(p_bytes[1], bound)) << 16
+        | (unsigned long long) _mm_movemask_epi8(_mm_cmpgt_epi8(p_bytes[2], bound)) << 32
+        | (unsigned long long) _mm_movemask_epi8(_mm_cmpgt_epi8(p_bytes[3], bound)) << 48;
+}
+
+static int CmlAksara_feedBlock(struct CmlAksara_Segmenter *p_seg, CmlTokenizer_TokenStream tokenStream, size_t index, size_t *p_count, unsigned char *p_state)
+{
+    __m128i bytes[4];
+    int spans = 0;
+    size_t j = 0;
+    for (; j < 4; j++) {
+        __m128i *p_tokens = (__m128i *) (tokenStream + 16 * j);
+        __m128i low = _mm_packs_epi32(_mm_loadu_si128(p_tokens), _mm_loadu_si128(p_tokens + 1));
+        __m128i high = _mm_packs_epi32(_mm_loadu_si128(p_tokens + 2), _mm_loadu_si128(p_tokens + 3));
+        bytes[j] = _mm_packs_epi16(low, high);
+        spans |= _mm_movemask_epi8(bytes[j]);
+        bytes[j] = _mm_min_epu8(bytes[j], _mm_set1_epi8(CmlTokenizer_RAW_TOKEN(0) - 1));
+    }
+
+    /* Span tokens saturate to negative bytes; leave them to the scalar path. */
+    if (spans)
+        return 0;
+
+    unsigned long long aboveEnd = CmlAksara_greater(bytes, CmlTokenizer_END_OF_TOKEN);
+    unsigned long long aboveSpace = CmlAksara_greater(bytes, CmlTokenizer_SPACE_TOKEN);
+    unsigned long long aboveVowel = CmlAksara_greater(bytes, CmlTokenizer_LONG_SYLLABIC_CONSONANT_R_TOKEN);
+    unsigned long long aboveConsonant = CmlAksara_greater(bytes, CmlTokenizer_PALATAL_CONSONANT_S_TOKEN);
+    unsigned long long aboveNumber = CmlAksara_greater(bytes, CmlTokenizer_NUMBER_9_TOKEN);
+    unsigned long long abovePunctuation = CmlAksara_greater(bytes, CmlTokenizer_PUNCTUATION_IDEM_TOKEN);
+    unsigned long long aboveAsIsStart = CmlAksara_greater(bytes, CmlTokenizer_TRANSLITERATION_AS_IS_START_TOKEN);
+    if (abovePunctuation & ~aboveAsIsStart)
+        return 0;
+
+    unsigned long long space = aboveEnd & ~aboveSpace;
+    unsigned long long vowel = aboveSpace & ~aboveVowel;
+    unsigned long long consonant = aboveVowel & ~aboveConsonant;
+    unsigned long long number = aboveConsonant & ~aboveNumber;
+    unsigned long long raw = aboveAsIsStart | ~aboveEnd;
+
+    unsigned char state = *p_state;
+    unsigned long long afterConsonant = consonant << 1 | (state == CmlAksara_CONSONANTS_STATE);
+    unsigned long long isContinuing = (afterConsonant & (consonant | vowel))
+        | ((space << 1 | (state == CmlAksara_SPACE_STATE)) & space)
+        | ((number << 1 | (state == CmlAksara_NUMBER_STATE)) & number)
+        | ((raw << 1 | (state == CmlAksara_RAW_STATE)) & raw);
+    unsigned long long events = ~isContinuing | (afterConsonant & vowel);
+
+    unsigned char narrowed[CmlAksara_BLOCK_SIZE];
+    for (j = 0; j < 4; j++)
+        _mm_storeu_si128((__m128i *) (narrowed + 16 * j), bytes[j]);
+
+    unsigned int *p_starts = p_seg->starts;
+    unsigned char *p_types = p_seg->types;
+    size_t count = *p_count;
+
+    /* A vowel that closes a syllable is looked up in the consonants row. */
+    while (events != 0) {
+        unsigned int k = CmlAksara_lowestBit(events);
+        events &= events - 1;
+        size_t isOpening = ~isContinuing >> k & 1;
+        p_starts[count] = index + k;
+        count += isOpening;
+        p_types[count - 1] = CmlAksara_transitions[!isOpening][CmlAksara_classes[narrowed[k]]] & 0x0F;
+    }
+
+    *p_count = count;
+    *p_state = (CmlAksara_transitions[CmlAksara_NONE_STATE][CmlAksara_classes[narrowed[CmlAksara_BLOCK_SIZE - 1]]] >> 4) & 0x07;
+    return 1;
+}
+#endif
+
+void CmlAksara_new(struct CmlAksara_Segmenter *p_seg, unsigned int *p_starts, unsigned char *p_types, size_t len)
+{
+    p_seg->starts = p_starts;
+    p_seg->types = p_types;
+    p_seg->len = len;
+    p_seg->count = 0;
+    p_seg->index = 0;
+    p_seg->state = CmlAksara_NONE_STATE;
+}
+
+size_t CmlAksara_feed(struct CmlAksara_Segmenter *p_seg, CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen)
+{
+    if (p_seg->len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (tokenStreamLen > UINT_MAX - p_seg->index) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    unsigned int *p_starts = p_seg->starts;
+    unsigned char *p_types = p_seg->types;
+    size_t count = p_seg->count;
+    unsigned char state = p_seg->state;
+
+    size_t i = 0;
+#ifdef __SSE2__
+    size_t scalarEnd = 0;
+#endif
+    while (i < tokenStreamLen) {
+#ifdef __SSE2__
+        if (i >= scalarEnd && state != CmlAksara_AS_IS_STATE
+            && i + CmlAksara_BLOCK_SIZE <= tokenStreamLen && p_seg->len - 1 - count >= CmlAksara_BLOCK_SIZE) {
+            if (CmlAksara_feedBlock(p_seg, tokenStream + i, p_seg->index + i, &count, &state)) {
+                i += CmlAksara_BLOCK_SIZE;
+                continue;
+            }
+
+            scalarEnd = i + CmlAksara_BLOCK_SIZE;
+        }
+#endif
+        if (state == CmlAksara_AS_IS_STATE) {
+            i = CmlAksara_findAsIsEnd(tokenStream, i, tokenStreamLen);
+            if (i == tokenStreamLen)
+                break;
+        }
+
+        unsigned int token = tokenStream[i];
+        unsigned char transition = CmlAksara_transitions[state][CmlAksara_classOf(token)];
+        if (transition & 0x80) {
+            if (count == p_seg->len - 1) {
+                errno = ENOBUFS;
+                break;
+            }
+
+            p_starts[count++] = p_seg->index + i;
+        }
+
+        p_types[count - 1] = transition & 0x0F;
+        state = (transition >> 4) & 0x07;
+        i++;
+    }
+
+    p_seg->count = count;
+    p_seg->state = state;
+    p_seg->index += i;
+    return i;
+}
+
+size_t CmlAksara_finish(struct CmlAksara_Segmenter *p_seg)
+{
+    if (p_seg->len != 0)
+        p_seg->starts[p_seg->count] = p_seg->index;
+
+    p_seg->state = CmlAksara_NONE_STATE;
+    return p_seg->count;
+}
+
+size_t CmlAksara_segment(CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen, unsigned int *p_starts, unsigned char *p_types, size_t len)
+{
+    struct CmlAksara_Segmenter seg;
+    CmlAksara_new(&seg, p_starts, p_types, len);
+    if (CmlAksara_feed(&seg, tokenStream, tokenStreamLen) == -1)
+        return -1;
+
+    return CmlAksara_finish(&seg);
+}
+
+/*
+Tokenizes CmlAksara_CHUNK_SIZE tokens at a time and segments each chunk
+while it is still in cache. On ENOBUFS from a full token stream the
+segmenter is left open, so the caller can continue with the rest of the
+input; when the clusters run out the return value still counts every
+token written and p_seg->index tells how many were segmented.
+*/
+size_t CmlAksara_tokenizationUTFInto(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, struct CmlAksara_Segmenter *p_seg)
+{
+    if (len == 0 || p_seg->len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int currErrno = errno;
+    size_t n = 0;
+    for (;;) {
+        size_t chunkLen = len - n < CmlAksara_CHUNK_SIZE + 1 ? len - n : CmlAksara_CHUNK_SIZE + 1;
+        errno = 0;
+        size_t m = CmlTokenizer_tokenizationUTFInto(p_utf, tokenStream + n, chunkLen);
+        if (m == -1)
+            return -1;
+
+        int tokenizerErrno = errno;
+        size_t fed = CmlAksara_feed(p_seg, tokenStream + n, m);
+        n += m;
+        if (fed != m)
+            return fed == -1 ? -1 : n;
+        if (m < chunkLen - 1)
+            break;
+        if (n == len - 1) {
+            errno = tokenizerErrno;
+            if (errno == ENOBUFS)
+                return n;
+            break;
+        }
+    }
+
+    errno = currErrno;
+    CmlAksara_finish(p_seg);
+    return n;
+}
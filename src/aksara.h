@@ -0,0 +1,65 @@
+/*
+aksara.h - Segment token streams into Balinese syllable clusters
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __AKSARA_H
+#define __AKSARA_H
+
+#include <stddef.h>
+#include "def.h"
+#include "utf.h"
+#include "tokenizer.h"
+
+/*
+Cluster i covers tokens starts[i] up to starts[i + 1]. A syllable is one
+or more consonants closed by a vowel or syllabic consonant; consonants
+that no vowel closes are left as a dead cluster. Spaces, digits and raw
+tokens are grouped into runs, and an as-is section is one cluster from
+its opening bracket to its closing one.
+*/
+
+#define CmlAksara_CHUNK_SIZE 1024
+
+enum CmlAksara_Type {
+    CmlAksara_SYLLABLE = 1,
+    CmlAksara_DEAD_CONSONANTS,
+    CmlAksara_VOWEL,
+    CmlAksara_SPACE,
+    CmlAksara_NUMBER,
+    CmlAksara_PUNCTUATION,
+    CmlAksara_AS_IS,
+    CmlAksara_RAW
+};
+
+struct CmlAksara_Segmenter {
+    unsigned int *starts;
+    unsigned char *types;
+    size_t len;
+    size_t count;
+    size_t index;
+    unsigned char state;
+};
+
+void CmlAksara_new(struct CmlAksara_Segmenter *p_seg, unsigned int *p_starts, unsigned char *p_types, size_t len);
+size_t CmlAksara_feed(struct CmlAksara_Segmenter *p_seg, CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen);
+size_t CmlAksara_finish(struct CmlAksara_Segmenter *p_seg);
+size_t CmlAksara_segment(CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen, unsigned int *p_starts, unsigned char *p_types, size_t len);
+size_t CmlAksara_tokenizationUTFInto(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, struct CmlAksara_Segmenter *p_seg);
+
+#endif
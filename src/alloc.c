@@ -0,0 +1,105 @@
+/*
+alloc.c - Route the library's allocations through caller supplied hooks
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Every object that allocates takes an allocator when it is created, NULL
+meaning the default one, and keeps it until it is destroyed, so changing
+the default never makes an object free with the wrong hooks. The default
+is libc until CmlAlloc_setDefault is called; set it before other threads
+start using the library.
+*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "def.h"
+#include "alloc.h"
+
+static void *CmlAlloc_libcAlloc(size_t size, void *p_data)
+{
+    return malloc(size);
+}
+
+static void *CmlAlloc_libcRealloc(void *p_ptr, size_t size, void *p_data)
+{
+    return realloc(p_ptr, size);
+}
+
+static void CmlAlloc_libcFree(void *p_ptr, void *p_data)
+{
+    free(p_ptr);
+}
+
+static struct CmlAlloc_Allocator CmlAlloc_libc = {
+    &CmlAlloc_libcAlloc,
+    &CmlAlloc_libcRealloc,
+    &CmlAlloc_libcFree,
+    NULL
+};
+
+static _Atomic(struct CmlAlloc_Allocator *) CmlAlloc_default = &CmlAlloc_libc;
+
+void CmlAlloc_setDefault(struct CmlAlloc_Allocator *p_allocator)
+{
+    atomic_store(&CmlAlloc_default, p_allocator != NULL ? p_allocator : &CmlAlloc_libc);
+}
+
+struct CmlAlloc_Allocator *CmlAlloc_getDefault(void)
+{
+    return atomic_load_explicit(&CmlAlloc_default, memory_order_acquire);
+}
+
+struct CmlAlloc_Allocator *CmlAlloc_resolve(struct CmlAlloc_Allocator *p_allocator)
+{
+    return p_allocator != NULL ? p_allocator : CmlAlloc_getDefault();
+}
+
+void *CmlAlloc_alloc(struct CmlAlloc_Allocator *p_allocator, size_t size)
+{
+    p_allocator = CmlAlloc_resolve(p_allocator);
+    return p_allocator->alloc(size, p_allocator->data);
+}
+
+void *CmlAlloc_calloc(struct CmlAlloc_Allocator *p_allocator, size_t n, size_t size)
+{
+    if (size != 0 && n > (size_t) -1 / size)
+        return NULL;
+
+    void *p_ptr = CmlAlloc_alloc(p_allocator, n * size);
+    if (p_ptr != NULL)
+        memset(p_ptr, 0, n * size);
+    return p_ptr;
+}
+
+void *CmlAlloc_realloc(struct CmlAlloc_Allocator *p_allocator, void *p_ptr, size_t size)
+{
+    p_allocator = CmlAlloc_resolve(p_allocator);
+    return p_allocator->realloc(p_ptr, size, p_allocator->data);
+}
+
+void CmlAlloc_free(struct CmlAlloc_Allocator *p_allocator, void *p_ptr)
+{
+    if (p_ptr == NULL)
+        return;
+
+    p_allocator = CmlAlloc_resolve(p_allocator);
+    p_allocator->free(p_ptr, p_allocator->data);
+}
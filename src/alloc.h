@@ -0,0 +1,42 @@
+/*
+alloc.h - Route the library's allocations through caller supplied hooks
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __ALLOC_H
+#define __ALLOC_H
+
+#include <stddef.h>
+#include "def.h"
+
+struct CmlAlloc_Allocator {
+    void *(*alloc)(size_t size, void *p_data);
+    void *(*realloc)(void *p_ptr, size_t size, void *p_data);
+    void (*free)(void *p_ptr, void *p_data);
+    void *data;
+};
+
+void CmlAlloc_setDefault(struct CmlAlloc_Allocator *p_allocator);
+struct CmlAlloc_Allocator *CmlAlloc_getDefault(void);
+struct CmlAlloc_Allocator *CmlAlloc_resolve(struct CmlAlloc_Allocator *p_allocator);
+void *CmlAlloc_alloc(struct CmlAlloc_Allocator *p_allocator, size_t size);
+void *CmlAlloc_calloc(struct CmlAlloc_Allocator *p_allocator, size_t n, size_t size);
+void *CmlAlloc_realloc(struct CmlAlloc_Allocator *p_allocator, void *p_ptr, size_t size);
+void CmlAlloc_free(struct CmlAlloc_Allocator *p_allocator, void *p_ptr);
+
+#endif
@@ -0,0 +1,328 @@
+/*
+cdict.c - Override dictionary keys while other threads read them
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Overrides live in an immutable snapshot, a small open-addressing table
+in front of the static dictionary. A removed key stays in the snapshot
+with a NULL value so that it also hides the static entry.
+
+Readers never take the lock. A reader publishes the global epoch it saw
+in CmlCDict_enter, and everything it reads stays valid until
+CmlCDict_leave. A writer swaps in a new snapshot, stamps the old one
+with the epoch before bumping it, and frees it once every reader inside
+a critical section has published a later epoch.
+*/
+
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "def.h"
+#include "alloc.h"
+#include "dict.h"
+#include "cdict.h"
+
+#define CmlCDict_MIN_SIZE 16
+
+static struct CmlCDict_Entry *CmlCDict_find(struct CmlCDict_Entry *p_entries, size_t size, unsigned long long digest, char *p_key)
+{
+    size_t mask = size - 1;
+    size_t i = digest & mask;
+    for (; p_entries[i].key != NULL; i = (i + 1) & mask) {
+        if (p_entries[i].digest == digest && !strcmp(p_entries[i].key, p_key))
+            return p_entries + i;
+    }
+
+    return p_entries + i;
+}
+
+static char *CmlCDict_copy(struct CmlAlloc_Allocator *p_allocator, char *p_string)
+{
+    size_t len = strlen(p_string) + 1;
+    char *p_copy = CmlAlloc_alloc(p_allocator, len);
+    return p_copy != NULL ? memcpy(p_copy, p_string, len) : NULL;
+}
+
+void CmlCDict_new(struct CmlCDict_Dict *p_dict, struct CmlDict_Dict *p_base, struct CmlAlloc_Allocator *p_allocator)
+{
+    p_dict->base = p_base;
+    p_dict->allocator = CmlAlloc_resolve(p_allocator);
+    atomic_init(&p_dict->snapshot, NULL);
+    atomic_init(&p_dict->epoch, 1);
+    p_dict->readers = NULL;
+    p_dict->retired = NULL;
+    pthread_mutex_init(&p_dict->lock, NULL);
+}
+
+void CmlCDict_destroy(struct CmlCDict_Dict *p_dict)
+{
+    CmlAlloc_free(p_dict->allocator, atomic_load(&p_dict->snapshot));
+    while (p_dict->retired != NULL) {
+        struct CmlCDict_Snapshot *p_next = p_dict->retired->next;
+        CmlAlloc_free(p_dict->allocator, p_dict->retired);
+        p_dict->retired = p_next;
+    }
+
+    atomic_store(&p_dict->snapshot, NULL);
+    pthread_mutex_destroy(&p_dict->lock);
+}
+
+void CmlCDict_register(struct CmlCDict_Dict *p_dict, struct CmlCDict_Reader *p_reader)
+{
+    atomic_init(&p_reader->epoch, 0);
+    pthread_mutex_lock(&p_dict->lock);
+    p_reader->next = p_dict->readers;
+    p_dict->readers = p_reader;
+    pthread_mutex_unlock(&p_dict->lock);
+}
+
+void CmlCDict_unregister(struct CmlCDict_Dict *p_dict, struct CmlCDict_Reader *p_reader)
+{
+    pthread_mutex_lock(&p_dict->lock);
+    struct CmlCDict_Reader **p_p_reader = &p_dict->readers;
+    while (*p_p_reader != NULL && *p_p_reader != p_reader)
+        p_p_reader = &(*p_p_reader)->next;
+    if (*p_p_reader != NULL)
+        *p_p_reader = p_reader->next;
+
+    atomic_store(&p_reader->epoch, 0);
+    pthread_mutex_unlock(&p_dict->lock);
+}
+
+/*
+The fence keeps the snapshot loads of the critical section behind the
+epoch store. Without it a reader could load a snapshot before its epoch
+is visible, and a writer reclaiming right after the swap would see no
+reader and free that snapshot under it.
+*/
+void CmlCDict_enter(struct CmlCDict_Dict *p_dict, struct CmlCDict_Reader *p_reader)
+{
+    atomic_store(&p_reader->epoch, atomic_load(&p_dict->epoch));
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void CmlCDict_leave(struct CmlCDict_Reader *p_reader)
+{
+    atomic_store_explicit(&p_reader->epoch, 0, memory_order_release);
+}
+
+int CmlCDict_get(struct CmlCDict_Dict *p_dict, char *p_key, struct CmlDict_Field *p_value)
+{
+    struct CmlCDict_Snapshot *p_snapshot = atomic_load_explicit(&p_dict->snapshot, memory_order_acquire);
+    size_t keyLen;
+    unsigned long long digest = CmlDict_digest(p_key, &keyLen);
+
+    if (p_snapshot != NULL) {
+        struct CmlCDict_Entry *p_entry = CmlCDict_find(p_snapshot->entries, p_snapshot->size, digest, p_key);
+        if (p_entry->key != NULL) {
+            if (p_entry->value == NULL)
+                return ENOENT;
+
+            p_value->value = p_entry->value;
+            p_value->flag = p_entry->flag;
+            return 0;
+        }
+    }
+
+    if (p_dict->base == NULL)
+        return ENOENT;
+
+    return CmlDict_getDigest(p_dict->base, p_key, keyLen, digest, p_value);
+}
+
+void CmlCDict_newDelta(struct CmlCDict_Delta *p_delta, struct CmlAlloc_Allocator *p_allocator)
+{
+    p_delta->allocator = CmlAlloc_resolve(p_allocator);
+    p_delta->entries = NULL;
+    p_delta->len = 0;
+    p_delta->capacity = 0;
+}
+
+void CmlCDict_destroyDelta(struct CmlCDict_Delta *p_delta)
+{
+    size_t i = 0;
+    for (; i < p_delta->len; i++) {
+        CmlAlloc_free(p_delta->allocator, p_delta->entries[i].key);
+        CmlAlloc_free(p_delta->allocator, p_delta->entries[i].value);
+    }
+
+    CmlAlloc_free(p_delta->allocator, p_delta->entries);
+    CmlCDict_newDelta(p_delta, p_delta->allocator);
+}
+
+static int CmlCDict_append(struct CmlCDict_Delta *p_delta, char *p_key, char *p_value, unsigned char flag)
+{
+    if (p_delta->len == p_delta->capacity) {
+        size_t capacity = p_delta->capacity == 0 ? CmlCDict_MIN_SIZE : p_delta->capacity * 2;
+        struct CmlCDict_Entry *p_entries = CmlAlloc_realloc(p_delta->allocator, p_delta->entries, sizeof(struct CmlCDict_Entry) * capacity);
+        if (p_entries == NULL)
+            return ENOMEM;
+
+        p_delta->entries = p_entries;
+        p_delta->capacity = capacity;
+    }
+
+    struct CmlCDict_Entry *p_entry = p_delta->entries + p_delta->len;
+    size_t keyLen;
+    p_entry->digest = CmlDict_digest(p_key, &keyLen);
+    p_entry->key = CmlCDict_copy(p_delta->allocator, p_key);
+    p_entry->value = p_value != NULL ? CmlCDict_copy(p_delta->allocator, p_value) : NULL;
+    p_entry->flag = flag;
+    if (p_entry->key == NULL || (p_value != NULL && p_entry->value == NULL)) {
+        CmlAlloc_free(p_delta->allocator, p_entry->key);
+        CmlAlloc_free(p_delta->allocator, p_entry->value);
+        return ENOMEM;
+    }
+
+    p_delta->len++;
+    return 0;
+}
+
+int CmlCDict_put(struct CmlCDict_Delta *p_delta, char *p_key, char *p_value, unsigned char flag)
+{
+    return CmlCDict_append(p_delta, p_key, p_value, flag | 0b1);
+}
+
+int CmlCDict_remove(struct CmlCDict_Delta *p_delta, char *p_key)
+{
+    return CmlCDict_append(p_delta, p_key, NULL, 0);
+}
+
+static size_t CmlCDict_reclaimLocked(struct CmlCDict_Dict *p_dict)
+{
+    unsigned long minEpoch = ULONG_MAX;
+    struct CmlCDict_Reader *p_reader = p_dict->readers;
+    for (; p_reader != NULL; p_reader = p_reader->next) {
+        unsigned long epoch = atomic_load(&p_reader->epoch);
+        if (epoch != 0 && epoch < minEpoch)
+            minEpoch = epoch;
+    }
+
+    size_t pending = 0;
+    struct CmlCDict_Snapshot **p_p_snapshot = &p_dict->retired;
+    while (*p_p_snapshot != NULL) {
+        struct CmlCDict_Snapshot *p_snapshot = *p_p_snapshot;
+        if (p_snapshot->retiredEpoch < minEpoch) {
+            *p_p_snapshot = p_snapshot->next;
+            CmlAlloc_free(p_dict->allocator, p_snapshot);
+        } else {
+            p_p_snapshot = &p_snapshot->next;
+            pending++;
+        }
+    }
+
+    return pending;
+}
+
+size_t CmlCDict_reclaim(struct CmlCDict_Dict *p_dict)
+{
+    pthread_mutex_lock(&p_dict->lock);
+    size_t pending = CmlCDict_reclaimLocked(p_dict);
+    pthread_mutex_unlock(&p_dict->lock);
+    return pending;
+}
+
+static void CmlCDict_insert(struct CmlCDict_Entry *p_entries, size_t size, struct CmlCDict_Entry *p_source)
+{
+    struct CmlCDict_Entry *p_entry = CmlCDict_find(p_entries, size, p_source->digest, p_source->key);
+    *p_entry = *p_source;
+}
+
+int CmlCDict_publish(struct CmlCDict_Dict *p_dict, struct CmlCDict_Delta *p_delta)
+{
+    if (p_delta->len == 0)
+        return 0;
+
+    pthread_mutex_lock(&p_dict->lock);
+    struct CmlCDict_Snapshot *p_old = atomic_load(&p_dict->snapshot);
+    size_t count = p_delta->len + (p_old != NULL ? p_old->count : 0);
+    size_t size = CmlCDict_MIN_SIZE;
+    while (size < count * 2)
+        size *= 2;
+
+    struct CmlCDict_Entry *p_entries = CmlAlloc_calloc(p_dict->allocator, size, sizeof(struct CmlCDict_Entry));
+    if (p_entries == NULL) {
+        pthread_mutex_unlock(&p_dict->lock);
+        return ENOMEM;
+    }
+
+    size_t i = 0;
+    for (; p_old != NULL && i < p_old->size; i++) {
+        if (p_old->entries[i].key != NULL)
+            CmlCDict_insert(p_entries, size, p_old->entries + i);
+    }
+    for (i = 0; i < p_delta->len; i++)
+        CmlCDict_insert(p_entries, size, p_delta->entries + i);
+
+    size_t arenaLen = 0;
+    for (i = 0, count = 0; i < size; i++) {
+        if (p_entries[i].key == NULL)
+            continue;
+
+        arenaLen += strlen(p_entries[i].key) + 1;
+        if (p_entries[i].value != NULL)
+            arenaLen += strlen(p_entries[i].value) + 1;
+        count++;
+    }
+
+    struct CmlCDict_Snapshot *p_snapshot = CmlAlloc_alloc(p_dict->allocator, sizeof(struct CmlCDict_Snapshot) + sizeof(struct CmlCDict_Entry) * size + arenaLen);
+    if (p_snapshot == NULL) {
+        CmlAlloc_free(p_dict->allocator, p_entries);
+        pthread_mutex_unlock(&p_dict->lock);
+        return ENOMEM;
+    }
+
+    p_snapshot->entries = (struct CmlCDict_Entry *) (p_snapshot + 1);
+    p_snapshot->size = size;
+    p_snapshot->count = count;
+    p_snapshot->next = NULL;
+
+    char *p_arena = (char *) (p_snapshot->entries + size);
+    for (i = 0; i < size; i++) {
+        struct CmlCDict_Entry *p_entry = p_snapshot->entries + i;
+        *p_entry = p_entries[i];
+        if (p_entry->key == NULL)
+            continue;
+
+        size_t len = strlen(p_entry->key) + 1;
+        p_entry->key = memcpy(p_arena, p_entry->key, len);
+        p_arena += len;
+        if (p_entry->value != NULL) {
+            len = strlen(p_entry->value) + 1;
+            p_entry->value = memcpy(p_arena, p_entry->value, len);
+            p_arena += len;
+        }
+    }
+    CmlAlloc_free(p_dict->allocator, p_entries);
+
+    atomic_store(&p_dict->snapshot, p_snapshot);
+    if (p_old != NULL) {
+        p_old->retiredEpoch = atomic_fetch_add(&p_dict->epoch, 1);
+        p_old->next = p_dict->retired;
+        p_dict->retired = p_old;
+        CmlCDict_reclaimLocked(p_dict);
+    }
+
+    pthread_mutex_unlock(&p_dict->lock);
+    CmlCDict_destroyDelta(p_delta);
+    return 0;
+}
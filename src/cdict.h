@@ -0,0 +1,82 @@
+/*
+cdict.h - Override dictionary keys while other threads read them
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CDICT_H
+#define __CDICT_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "def.h"
+#include "alloc.h"
+#include "dict.h"
+
+struct CmlCDict_Entry {
+    unsigned long long digest;
+    char *key;
+    char *value;
+    unsigned char flag;
+};
+
+struct CmlCDict_Snapshot {
+    struct CmlCDict_Entry *entries;
+    size_t size;
+    size_t count;
+    unsigned long retiredEpoch;
+    struct CmlCDict_Snapshot *next;
+};
+
+struct CmlCDict_Reader {
+    _Atomic unsigned long epoch;
+    struct CmlCDict_Reader *next;
+};
+
+struct CmlCDict_Delta {
+    struct CmlCDict_Entry *entries;
+    size_t len;
+    size_t capacity;
+    struct CmlAlloc_Allocator *allocator;
+};
+
+struct CmlCDict_Dict {
+    struct CmlDict_Dict *base;
+    _Atomic(struct CmlCDict_Snapshot *) snapshot;
+    _Atomic unsigned long epoch;
+    struct CmlCDict_Reader *readers;
+    struct CmlCDict_Snapshot *retired;
+    struct CmlAlloc_Allocator *allocator;
+    pthread_mutex_t lock;
+};
+
+void CmlCDict_new(struct CmlCDict_Dict *p_dict, struct CmlDict_Dict *p_base, struct CmlAlloc_Allocator *p_allocator);
+void CmlCDict_destroy(struct CmlCDict_Dict *p_dict);
+void CmlCDict_register(struct CmlCDict_Dict *p_dict, struct CmlCDict_Reader *p_reader);
+void CmlCDict_unregister(struct CmlCDict_Dict *p_dict, struct CmlCDict_Reader *p_reader);
+void CmlCDict_enter(struct CmlCDict_Dict *p_dict, struct CmlCDict_Reader *p_reader);
+void CmlCDict_leave(struct CmlCDict_Reader *p_reader);
+int CmlCDict_get(struct CmlCDict_Dict *p_dict, char *p_key, struct CmlDict_Field *p_value);
+void CmlCDict_newDelta(struct CmlCDict_Delta *p_delta, struct CmlAlloc_Allocator *p_allocator);
+void CmlCDict_destroyDelta(struct CmlCDict_Delta *p_delta);
+int CmlCDict_put(struct CmlCDict_Delta *p_delta, char *p_key, char *p_value, unsigned char flag);
+int CmlCDict_remove(struct CmlCDict_Delta *p_delta, char *p_key);
+int CmlCDict_publish(struct CmlCDict_Dict *p_dict, struct CmlCDict_Delta *p_delta);
+size_t CmlCDict_reclaim(struct CmlCDict_Dict *p_dict);
+
+#endif
@@ -0,0 +1,350 @@
+/*
+client.c - Tokenize and look up keys through the cmld daemon
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+The calls mirror CmlTokenizer_tokenizationUTFInto,
+CmlTokenizer_tokenizationUTF and CmlDict_get, including how they advance
+the buffer and report ENOBUFS, with the client as an extra first
+argument. A client serves one thread at a time. When the daemon refuses
+a shared mapping, or a request does not fit in it, the payload goes over
+the socket instead.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "alloc.h"
+#include "client.h"
+
+static int CmlClient_send(int fd, struct iovec *p_iov, size_t iovLen)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    while (iovLen != 0) {
+        msg.msg_iov = p_iov;
+        msg.msg_iovlen = iovLen;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+
+        for (; iovLen != 0 && (size_t) n >= p_iov->iov_len; p_iov++, iovLen--)
+            n -= p_iov->iov_len;
+        if (iovLen != 0) {
+            p_iov->iov_base = (unsigned char *) p_iov->iov_base + n;
+            p_iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+static int CmlClient_receive(int fd, void *p_buff, size_t len)
+{
+    unsigned char *p_curr = p_buff;
+    while (len != 0) {
+        ssize_t n = recv(fd, p_curr, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n == 0 ? ECONNRESET : errno;
+
+        p_curr += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int CmlClient_skip(int fd, size_t len)
+{
+    unsigned char buff[4096];
+    while (len != 0) {
+        size_t n = len < sizeof(buff) ? len : sizeof(buff);
+        int err = CmlClient_receive(fd, buff, n);
+        if (err != 0)
+            return err;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static void CmlClient_attach(struct CmlClient_Client *p_client, size_t sharedLen)
+{
+    struct CmlClient_Request request = { CmlClient_ATTACH, 0, 0, 0, sharedLen, 0 };
+    struct iovec iov = { &request, sizeof(request) };
+    if (CmlClient_send(p_client->fd, &iov, 1) != 0)
+        return;
+
+    struct CmlClient_Response response;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &response;
+    iov.iov_len = sizeof(response);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(p_client->fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return;
+
+    int sharedFd = -1;
+    struct cmsghdr *p_cmsg = CMSG_FIRSTHDR(&msg);
+    if (p_cmsg != NULL && p_cmsg->cmsg_level == SOL_SOCKET && p_cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&sharedFd, CMSG_DATA(p_cmsg), sizeof(int));
+
+    if ((size_t) n < sizeof(response) && CmlClient_receive(p_client->fd, (unsigned char *) &response + n, sizeof(response) - n) != 0)
+        response.status = EPROTO;
+
+    if (response.status == 0 && sharedFd >= 0) {
+        void *p_shared = mmap(NULL, response.count, PROT_READ | PROT_WRITE, MAP_SHARED, sharedFd, 0);
+        if (p_shared != MAP_FAILED) {
+            p_client->shared = p_shared;
+            p_client->sharedLen = response.count;
+        }
+    }
+
+    if (sharedFd >= 0)
+        close(sharedFd);
+}
+
+int CmlClient_connect(struct CmlClient_Client *p_client, const char *p_path, size_t sharedLen)
+{
+    p_client->fd = -1;
+    p_client->shared = NULL;
+    p_client->sharedLen = 0;
+    p_client->value = NULL;
+    p_client->valueCapacity = 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (p_path == NULL)
+        p_path = CmlClient_DEFAULT_PATH;
+    if (strlen(p_path) >= sizeof(addr.sun_path))
+        return errno = ENAMETOOLONG;
+    strcpy(addr.sun_path, p_path);
+
+    p_client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (p_client->fd < 0)
+        return errno;
+
+    if (connect(p_client->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(p_client->fd);
+        p_client->fd = -1;
+        return errno = err;
+    }
+
+    if (sharedLen != 0)
+        CmlClient_attach(p_client, sharedLen);
+
+    return 0;
+}
+
+void CmlClient_close(struct CmlClient_Client *p_client)
+{
+    if (p_client->shared != NULL)
+        munmap(p_client->shared, p_client->sharedLen);
+    if (p_client->fd >= 0)
+        close(p_client->fd);
+    CmlAlloc_free(NULL, p_client->value);
+
+    p_client->fd = -1;
+    p_client->shared = NULL;
+    p_client->sharedLen = 0;
+    p_client->value = NULL;
+    p_client->valueCapacity = 0;
+}
+
+static size_t CmlClient_remaining(struct CmlUTF_Buffer *p_utf)
+{
+    size_t len = p_utf->len - p_utf->currIndex;
+    size_t i = p_utf->currSegment + 1;
+    for (; p_utf->segments != NULL && i < p_utf->segmentsLen; i++)
+        len += p_utf->segments[i].iov_len;
+
+    return len;
+}
+
+static int CmlClient_tokenize(struct CmlClient_Client *p_client, struct CmlClient_Request *p_request, struct CmlUTF_Buffer *p_utf, struct CmlClient_Response *p_response)
+{
+    unsigned char *p_payload = NULL;
+    unsigned char *p_gathered = NULL;
+    if (p_request->isShared) {
+        CmlUTF_gather(p_utf, p_client->shared, p_request->len);
+    } else if (p_utf->segments == NULL) {
+        p_payload = p_utf->buff + p_utf->currIndex;
+    } else {
+        p_gathered = p_payload = CmlAlloc_alloc(NULL, p_request->len + 1);
+        if (p_gathered == NULL)
+            return ENOMEM;
+        CmlUTF_gather(p_utf, p_gathered, p_request->len);
+    }
+
+    struct iovec iov[2] = {
+        { p_request, sizeof(*p_request) },
+        { p_payload, p_payload != NULL ? p_request->len : 0 }
+    };
+    int err = CmlClient_send(p_client->fd, iov, 2);
+    CmlAlloc_free(NULL, p_gathered);
+    if (err == 0)
+        err = CmlClient_receive(p_client->fd, p_response, sizeof(*p_response));
+
+    return err;
+}
+
+static void CmlClient_advance(struct CmlUTF_Buffer *p_utf, struct CmlClient_Response *p_response)
+{
+    p_utf->currIndex += p_response->bytes;
+    p_utf->offset += p_response->codes;
+    while (p_utf->currIndex >= p_utf->len && p_utf->segments != NULL && p_utf->currSegment + 1 < p_utf->segmentsLen) {
+        p_utf->currIndex -= p_utf->len;
+        p_utf->segmentOffset += p_utf->len;
+        p_utf->currSegment++;
+        p_utf->buff = p_utf->segments[p_utf->currSegment].iov_base;
+        p_utf->len = p_utf->segments[p_utf->currSegment].iov_len;
+    }
+}
+
+size_t CmlClient_tokenizationUTFInto(struct CmlClient_Client *p_client, struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len)
+{
+    size_t utfLen = CmlClient_remaining(p_utf);
+    if (len > utfLen + 1)
+        len = utfLen + 1;
+
+    struct CmlClient_Request request = { CmlClient_TOKENIZE_INTO, p_utf->codec->encoding, p_utf->endian, 0, utfLen, len };
+    request.isShared = p_client->shared != NULL && CmlClient_ALIGN(utfLen) + len * sizeof(unsigned int) <= p_client->sharedLen;
+
+    struct CmlClient_Response response;
+    int err = CmlClient_tokenize(p_client, &request, p_utf, &response);
+    if (err == 0 && response.count != CmlClient_FAILED && response.count >= len)
+        err = EPROTO;
+    if (err == 0 && response.count != CmlClient_FAILED) {
+        if (response.isShared)
+            memcpy(tokenStream, p_client->shared + CmlClient_ALIGN(utfLen), response.count * sizeof(unsigned int));
+        else
+            err = CmlClient_receive(p_client->fd, tokenStream, response.count * sizeof(unsigned int));
+    }
+
+    if (err != 0 || response.count == CmlClient_FAILED) {
+        errno = err != 0 ? err : response.status;
+        return -1;
+    }
+
+    /* The terminator is not sent, the daemon left room for it as the tokenizer does */
+    tokenStream[response.count] = CmlTokenizer_END_OF_TOKEN;
+    CmlClient_advance(p_utf, &response);
+    if (response.status != 0)
+        errno = response.status;
+    return response.count;
+}
+
+CmlTokenizer_TokenStream CmlClient_tokenizationUTF(struct CmlClient_Client *p_client, struct CmlUTF_Buffer *p_utf)
+{
+    size_t utfLen = CmlClient_remaining(p_utf);
+    struct CmlClient_Request request = { CmlClient_TOKENIZE, p_utf->codec->encoding, p_utf->endian, 0, utfLen, 0 };
+    request.isShared = p_client->shared != NULL && utfLen <= p_client->sharedLen;
+
+    struct CmlClient_Response response;
+    int err = CmlClient_tokenize(p_client, &request, p_utf, &response);
+    if (err == 0 && response.count == CmlClient_FAILED)
+        err = response.status;
+    else if (err == 0 && (response.count == 0 || response.count > utfLen + 1))
+        err = EPROTO;
+    if (err != 0) {
+        errno = err;
+        return NULL;
+    }
+
+    size_t size = response.count * sizeof(unsigned int);
+    CmlTokenizer_TokenStream tokenStream = CmlAlloc_alloc(NULL, size);
+    if (tokenStream == NULL) {
+        if (!response.isShared)
+            CmlClient_skip(p_client->fd, size);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (response.isShared) {
+        memcpy(tokenStream, p_client->shared + CmlClient_ALIGN(utfLen), size);
+    } else if ((err = CmlClient_receive(p_client->fd, tokenStream, size)) != 0) {
+        CmlAlloc_free(NULL, tokenStream);
+        errno = err;
+        return NULL;
+    }
+
+    CmlClient_advance(p_utf, &response);
+    return tokenStream;
+}
+
+int CmlClient_get(struct CmlClient_Client *p_client, char *p_key, struct CmlDict_Field *p_value)
+{
+    struct CmlClient_Request request = { CmlClient_GET, 0, 0, 0, strlen(p_key) + 1, 0 };
+    struct iovec iov[2] = {
+        { &request, sizeof(request) },
+        { p_key, request.len }
+    };
+
+    struct CmlClient_Response response;
+    int err = CmlClient_send(p_client->fd, iov, 2);
+    if (err == 0)
+        err = CmlClient_receive(p_client->fd, &response, sizeof(response));
+    if (err != 0)
+        return errno = err;
+    if (response.status != 0)
+        return response.status;
+
+    size_t len = CmlClient_ALIGN(response.count);
+    if (len > p_client->valueCapacity) {
+        char *p_buff = CmlAlloc_realloc(NULL, p_client->value, len);
+        if (p_buff == NULL) {
+            CmlClient_skip(p_client->fd, len);
+            return errno = ENOMEM;
+        }
+
+        p_client->value = p_buff;
+        p_client->valueCapacity = len;
+    }
+
+    if ((err = CmlClient_receive(p_client->fd, p_client->value, len)) != 0)
+        return errno = err;
+    if (response.count == 0 || p_client->value[response.count - 1] != 0)
+        return errno = EPROTO;
+
+    p_value->value = p_client->value;
+    p_value->flag = response.flag;
+    return 0;
+}
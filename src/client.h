@@ -0,0 +1,88 @@
+/*
+client.h - Tokenize and look up keys through the cmld daemon
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CLIENT_H
+#define __CLIENT_H
+
+#include <stddef.h>
+#include "def.h"
+#include "utf.h"
+#include "tokenizer.h"
+#include "dict.h"
+
+/*
+Every request is a CmlClient_Request followed by len payload bytes, and
+every response a CmlClient_Response followed by its payload padded to a
+multiple of four bytes. Both are in native byte order; the daemon only
+listens on a Unix domain socket.
+
+After CmlClient_ATTACH the daemon passes a shared mapping of the granted
+size along with its response. A request with isShared set leaves its
+payload at the start of the mapping instead of on the socket, and the
+daemon writes the tokens back into the mapping at
+CmlClient_ALIGN(len), so only the fixed-size headers cross the socket.
+*/
+
+#define CmlClient_DEFAULT_PATH "/tmp/cmld.sock"
+#define CmlClient_ALIGN(len) (((len) + 3) & ~(size_t) 3)
+#define CmlClient_FAILED ((unsigned long long) -1)
+
+enum CmlClient_Op {
+    CmlClient_TOKENIZE = 1,
+    CmlClient_TOKENIZE_INTO,
+    CmlClient_GET,
+    CmlClient_ATTACH
+};
+
+struct CmlClient_Request {
+    unsigned int op;
+    unsigned int encoding;
+    unsigned int endian;
+    unsigned int isShared;
+    unsigned long long len;
+    unsigned long long capacity;
+};
+
+struct CmlClient_Response {
+    int status;
+    unsigned int flag;
+    unsigned int isShared;
+    unsigned int reserved;
+    unsigned long long count;
+    unsigned long long bytes;
+    unsigned long long codes;
+};
+
+struct CmlClient_Client {
+    int fd;
+    unsigned char *shared;
+    size_t sharedLen;
+    char *value;
+    size_t valueCapacity;
+};
+
+int CmlClient_connect(struct CmlClient_Client *p_client, const char *p_path, size_t sharedLen);
+void CmlClient_close(struct CmlClient_Client *p_client);
+size_t CmlClient_tokenizationUTFInto(struct CmlClient_Client *p_client, struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len);
+/* The stream comes from the default allocator, as CmlTokenizer_tokenizationUTF's does */
+CmlTokenizer_TokenStream CmlClient_tokenizationUTF(struct CmlClient_Client *p_client, struct CmlUTF_Buffer *p_utf);
+int CmlClient_get(struct CmlClient_Client *p_client, char *p_key, struct CmlDict_Field *p_value);
+
+#endif
@@ -0,0 +1,554 @@
+/*
+cml.c - Tokenize files or standard input to standard output
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Regular files are mapped and tokenized in one pass; pipes and terminals
+are read in CmlCli_CHUNK_SIZE chunks, keeping the last
+CmlTokenizer_MAX_LOOKAHEAD bytes back until more input arrives so that
+no token is cut short. The encoding comes from the byte order mark, or
+from where the zero bytes fall in the first bytes, or defaults to UTF-8.
+
+Output is the token stream written back as canonical text in UTF-8
+(-f text), or as native unsigned ints (-f tokens). In text mode the
+contents of a [ ... ] section come through as span tokens and are copied
+out as they stand instead of token by token. With -j N, N files
+are converted at once; the file whose turn it is writes straight
+through, the others buffer until their turn comes.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "def.h"
+#include "utf.h"
+#include "utf8.h"
+#include "utf16.h"
+#include "utf32.h"
+#include "tokenizer.h"
+
+#define CmlCli_CHUNK_SIZE (1 << 20)
+#define CmlCli_OUTPUT_SIZE (1 << 20)
+#define CmlCli_TOKENS_SIZE 4096
+#define CmlCli_DETECT_SIZE 4096
+#define CmlCli_DETECT_MIN_SIZE 4
+#define CmlCli_PENDING_SIZE (16 * CmlCli_OUTPUT_SIZE)
+
+enum CmlCli_Format {
+    CmlCli_TEXT,
+    CmlCli_TOKENS
+};
+
+struct CmlCli_Input {
+    enum CmlUTF_Encoding encoding;
+    enum Cml_Endianness endian;
+    int isDetected;
+    int error;
+};
+
+struct CmlCli_BOM {
+    enum CmlUTF_Encoding encoding;
+    enum Cml_Endianness endian;
+    char *bytes;
+    size_t len;
+};
+
+/* UTF-32LE first, its mark starts with the UTF-16LE one */
+static struct CmlCli_BOM CmlCli_boms[] = {
+    { CmlUTF_UTF32, Cml_BE, "\x00\x00\xFE\xFF", 4 },
+    { CmlUTF_UTF32, Cml_LE, "\xFF\xFE\x00\x00", 4 },
+    { CmlUTF_UTF8, Cml_BE, "\xEF\xBB\xBF", 3 },
+    { CmlUTF_UTF16, Cml_BE, "\xFE\xFF", 2 },
+    { CmlUTF_UTF16, Cml_LE, "\xFF\xFE", 2 }
+};
+
+struct CmlCli_Sink {
+    size_t index;
+    unsigned char *buff;
+    size_t len;
+    unsigned char *pending;
+    size_t pendingLen;
+    size_t pendingCapacity;
+    int isDirect;
+    int error;
+    size_t tokens;
+    size_t written;
+};
+
+struct CmlCli_State {
+    char **paths;
+    size_t pathsLen;
+    size_t nextPath;
+    size_t nextWrite;
+    enum CmlCli_Format format;
+    enum CmlUTF_Encoding encoding;
+    enum Cml_Endianness endian;
+    int status;
+    size_t inputBytes;
+    size_t tokens;
+    size_t outputBytes;
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+};
+
+static int CmlCli_writeAll(int fd, unsigned char *p_buff, size_t len)
+{
+    while (len != 0) {
+        ssize_t n = write(fd, p_buff, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+
+        p_buff += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static void CmlCli_flush(struct CmlCli_State *p_state, struct CmlCli_Sink *p_sink)
+{
+    if (!p_sink->isDirect) {
+        pthread_mutex_lock(&p_state->lock);
+        /* Wait for our turn rather than buffer a whole file */
+        while (p_sink->pendingLen + p_sink->len > CmlCli_PENDING_SIZE && p_state->nextWrite != p_sink->index)
+            pthread_cond_wait(&p_state->turn, &p_state->lock);
+        p_sink->isDirect = p_state->nextWrite == p_sink->index;
+        pthread_mutex_unlock(&p_state->lock);
+
+        if (p_sink->isDirect && p_sink->pendingLen != 0) {
+            p_sink->error = CmlCli_writeAll(STDOUT_FILENO, p_sink->pending, p_sink->pendingLen);
+            free(p_sink->pending);
+            p_sink->pending = NULL;
+            p_sink->pendingLen = p_sink->pendingCapacity = 0;
+        }
+    }
+
+    if (p_sink->error == 0 && p_sink->isDirect) {
+        p_sink->error = CmlCli_writeAll(STDOUT_FILENO, p_sink->buff, p_sink->len);
+    } else if (p_sink->error == 0) {
+        if (p_sink->pendingLen + p_sink->len > p_sink->pendingCapacity) {
+            size_t capacity = (p_sink->pendingLen + p_sink->len) * 2;
+            unsigned char *p_pending = realloc(p_sink->pending, capacity);
+            if (p_pending == NULL) {
+                p_sink->error = ENOMEM;
+                return;
+            }
+
+            p_sink->pending = p_pending;
+            p_sink->pendingCapacity = capacity;
+        }
+
+        memcpy(p_sink->pending + p_sink->pendingLen, p_sink->buff, p_sink->len);
+        p_sink->pendingLen += p_sink->len;
+    }
+
+    p_sink->written += p_sink->len;
+    p_sink->len = 0;
+}
+
+static void CmlCli_emitSpan(struct CmlCli_State *p_state, struct CmlCli_Sink *p_sink, struct CmlUTF_Buffer *p_utf, unsigned char *p_text, size_t len)
+{
+    if (p_utf->codec->encoding == CmlUTF_UTF8) {
+        while (len != 0) {
+            if (p_sink->len == CmlCli_OUTPUT_SIZE)
+                CmlCli_flush(p_state, p_sink);
+
+            size_t n = CmlCli_OUTPUT_SIZE - p_sink->len < len ? CmlCli_OUTPUT_SIZE - p_sink->len : len;
+            memcpy(p_sink->buff + p_sink->len, p_text, n);
+            p_sink->len += n;
+            p_text += n;
+            len -= n;
+        }
+        return;
+    }
+
+    int isBE = p_utf->endian == Cml_BE;
+    while (len != 0) {
+        if (CmlCli_OUTPUT_SIZE - p_sink->len < CmlUTF_MAX_OCTETS_LENGTH)
+            CmlCli_flush(p_state, p_sink);
+
+        size_t octets = isBE ? p_utf->codec->getOctetsLengthBE(p_text, len) : p_utf->codec->getOctetsLengthLE(p_text, len);
+        if (octets == 0 || octets > len)
+            octets = len;
+
+        CmlUTF_Code code = isBE ? p_utf->codec->decodeBE(p_text, octets) : p_utf->codec->decodeLE(p_text, octets);
+        p_sink->len += CmlUTF8_encode(code, p_sink->buff + p_sink->len, CmlUTF_MAX_OCTETS_LENGTH);
+        p_text += octets;
+        len -= octets;
+    }
+}
+
+static void CmlCli_emit(struct CmlCli_State *p_state, struct CmlCli_Sink *p_sink, struct CmlUTF_Buffer *p_utf, size_t byteOffset, CmlTokenizer_TokenStream tokenStream, unsigned char *p_lengths, size_t n)
+{
+    size_t i = 0;
+    for (; i < n; i++) {
+        if (CmlCli_OUTPUT_SIZE - p_sink->len < 2 * CmlUTF_MAX_OCTETS_LENGTH)
+            CmlCli_flush(p_state, p_sink);
+
+        if (p_state->format == CmlCli_TOKENS) {
+            memcpy(p_sink->buff + p_sink->len, tokenStream + i, sizeof(unsigned int));
+            p_sink->len += sizeof(unsigned int);
+            continue;
+        }
+
+        if (CmlTokenizer_IS_SPAN_TOKEN(tokenStream[i])) {
+            size_t spanLen = CmlTokenizer_SPAN_LENGTH(tokenStream[i]);
+            unsigned char *p_span = p_utf->buff + byteOffset;
+            size_t open = p_utf->endian == Cml_BE
+                ? p_utf->codec->getOctetsLengthBE(p_span, spanLen)
+                : p_utf->codec->getOctetsLengthLE(p_span, spanLen);
+            p_sink->buff[p_sink->len++] = CmlTokenizer_TRANSLITERATION_AS_IS_START_SYMBOL;
+            CmlCli_emitSpan(p_state, p_sink, p_utf, p_span + open, spanLen - open);
+            byteOffset += spanLen;
+            continue;
+        }
+
+        byteOffset += p_lengths[i] >= CmlTokenizer_LONG_LENGTHS ? p_lengths[i] - CmlTokenizer_LONG_LENGTHS + 1 : (p_lengths[i] >> 1) + 1;
+
+        CmlUTF_Code codes[2];
+        size_t codesLen = CmlTokenizer_toCodes(tokenStream[i], codes);
+        size_t j = 0;
+        for (; j < codesLen; j++) {
+            if (codes[j] < 0x80) {
+                p_sink->buff[p_sink->len++] = codes[j];
+            } else {
+                p_sink->len += CmlUTF8_encode(codes[j], p_sink->buff + p_sink->len, CmlUTF_MAX_OCTETS_LENGTH);
+            }
+        }
+    }
+
+    p_sink->tokens += n;
+}
+
+static size_t CmlCli_detect(struct CmlCli_State *p_state, struct CmlCli_Input *p_input, unsigned char *p_buff, size_t len)
+{
+    p_input->isDetected = 1;
+    p_input->encoding = p_state->encoding;
+    p_input->endian = p_state->endian;
+
+    /* With -e only a mark of that very encoding is dropped */
+    size_t j = 0;
+    for (; j < sizeof(CmlCli_boms) / sizeof(CmlCli_boms[0]); j++) {
+        struct CmlCli_BOM *p_bom = CmlCli_boms + j;
+        if (len < p_bom->len || memcmp(p_buff, p_bom->bytes, p_bom->len))
+            continue;
+
+        if (p_state->encoding == 0) {
+            p_input->encoding = p_bom->encoding;
+            p_input->endian = p_bom->endian;
+            return p_bom->len;
+        } else if (p_bom->encoding == p_state->encoding && (p_bom->encoding == CmlUTF_UTF8 || p_bom->endian == p_state->endian)) {
+            return p_bom->len;
+        }
+    }
+
+    if (p_state->encoding != 0)
+        return 0;
+
+    size_t zeros[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+    for (; i < len && i < CmlCli_DETECT_SIZE; i++)
+        zeros[i % 4] += p_buff[i] == 0;
+
+    size_t quarter = (i + 3) / 4;
+    size_t zerosLen = zeros[0] + zeros[1] + zeros[2] + zeros[3];
+    p_input->encoding = CmlUTF_UTF8;
+    p_input->endian = Cml_BE;
+    if (i < CmlCli_DETECT_MIN_SIZE || zerosLen == 0 || zerosLen < quarter / 2)
+        return 0;
+
+    if (zeros[0] * 2 > quarter && zeros[1] * 2 > quarter && zeros[2] * 2 > quarter) {
+        p_input->encoding = CmlUTF_UTF32;
+    } else if (zeros[1] * 2 > quarter && zeros[2] * 2 > quarter && zeros[3] * 2 > quarter) {
+        p_input->encoding = CmlUTF_UTF32;
+        p_input->endian = Cml_LE;
+    } else if ((zeros[0] + zeros[2]) > (zeros[1] + zeros[3])) {
+        p_input->encoding = CmlUTF_UTF16;
+    } else {
+        p_input->encoding = CmlUTF_UTF16;
+        p_input->endian = Cml_LE;
+    }
+
+    return 0;
+}
+
+static void CmlCli_newBuffer(struct CmlCli_Input *p_input, struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t len)
+{
+    switch (p_input->encoding) {
+        case CmlUTF_UTF16: CmlUTF16_new(p_utf, p_buff, 0, len, p_input->endian);
+        break;
+        case CmlUTF_UTF32: CmlUTF32_new(p_utf, p_buff, 0, len, p_input->endian);
+        break;
+        default: CmlUTF8_new(p_utf, p_buff, 0, len);
+    }
+}
+
+static size_t CmlCli_convert(struct CmlCli_State *p_state, struct CmlCli_Sink *p_sink, struct CmlCli_Input *p_input, unsigned char *p_buff, size_t len, int isEof)
+{
+    size_t skip = 0;
+    if (!p_input->isDetected) {
+        if (!isEof && len < CmlCli_DETECT_SIZE)
+            return 0;
+        skip = CmlCli_detect(p_state, p_input, p_buff, len);
+    }
+
+    struct CmlUTF_Buffer utf;
+    utf.codec = NULL;
+    CmlCli_newBuffer(p_input, &utf, p_buff + skip, len - skip);
+    if (utf.codec == NULL)
+        return skip;
+
+    unsigned int tokenStream[CmlCli_TOKENS_SIZE + 1];
+    unsigned char lengths[CmlCli_TOKENS_SIZE + 1];
+    size_t safeEnd = isEof ? utf.len : utf.len > CmlTokenizer_MAX_LOOKAHEAD ? utf.len - CmlTokenizer_MAX_LOOKAHEAD : 0;
+    int currErrno = errno;
+
+    while (utf.currIndex < safeEnd) {
+        size_t capacity = CmlCli_TOKENS_SIZE;
+        if (!isEof && (safeEnd - utf.currIndex - 1) / CmlTokenizer_MAX_TOKEN_OCTETS + 1 < capacity)
+            capacity = (safeEnd - utf.currIndex - 1) / CmlTokenizer_MAX_TOKEN_OCTETS + 1;
+
+        size_t byteOffset = utf.currIndex;
+        size_t n = p_state->format == CmlCli_TEXT
+            ? CmlTokenizer_tokenizationUTFSpans(&utf, tokenStream, capacity + 1, lengths)
+            : CmlTokenizer_tokenizationUTFInto(&utf, tokenStream, capacity + 1);
+        if (n == -1 || utf.currIndex == byteOffset) {
+            p_input->error = n == -1 ? errno : EILSEQ;
+            break;
+        }
+        CmlCli_emit(p_state, p_sink, &utf, byteOffset, tokenStream, lengths, n);
+    }
+
+    errno = currErrno;
+    CmlUTF_destroy(&utf);
+    return skip + utf.currIndex;
+}
+
+static int CmlCli_convertFile(struct CmlCli_State *p_state, struct CmlCli_Sink *p_sink, char *p_path, size_t *p_inputBytes)
+{
+    int fd = STDIN_FILENO;
+    if (strcmp(p_path, "-") && (fd = open(p_path, O_RDONLY)) < 0)
+        return errno;
+
+    struct CmlCli_Input input = { 0, 0, 0, 0 };
+    struct stat st;
+    int err = 0;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        unsigned char *p_buff = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p_buff != MAP_FAILED) {
+            madvise(p_buff, st.st_size, MADV_SEQUENTIAL);
+            CmlCli_convert(p_state, p_sink, &input, p_buff, st.st_size, 1);
+            munmap(p_buff, st.st_size);
+            *p_inputBytes = st.st_size;
+            err = input.error;
+            goto done;
+        }
+    }
+
+    unsigned char *p_buff = malloc(CmlCli_CHUNK_SIZE);
+    if (p_buff == NULL) {
+        err = ENOMEM;
+        goto done;
+    }
+
+    size_t len = 0;
+    while (1) {
+        ssize_t n = read(fd, p_buff + len, CmlCli_CHUNK_SIZE - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            err = errno;
+            break;
+        }
+
+        len += n;
+        *p_inputBytes += n;
+        size_t used = CmlCli_convert(p_state, p_sink, &input, p_buff, len, n == 0);
+        if (input.error == 0 && used == 0 && len == CmlCli_CHUNK_SIZE)
+            input.error = EILSEQ;
+        if (n == 0 || input.error != 0) {
+            err = input.error;
+            break;
+        }
+
+        memmove(p_buff, p_buff + used, len - used);
+        len -= used;
+    }
+    free(p_buff);
+
+    done:
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return err;
+}
+
+static void *CmlCli_work(void *p_data)
+{
+    struct CmlCli_State *p_state = p_data;
+    struct CmlCli_Sink sink;
+    sink.buff = malloc(CmlCli_OUTPUT_SIZE);
+    if (sink.buff == NULL)
+        return NULL;
+
+    while (1) {
+        pthread_mutex_lock(&p_state->lock);
+        size_t index = p_state->nextPath++;
+        pthread_mutex_unlock(&p_state->lock);
+        if (index >= p_state->pathsLen)
+            break;
+
+        size_t inputBytes = 0;
+        sink.index = index;
+        sink.len = sink.pendingLen = sink.pendingCapacity = 0;
+        sink.pending = NULL;
+        sink.isDirect = 0;
+        sink.error = 0;
+        sink.tokens = sink.written = 0;
+
+        int err = CmlCli_convertFile(p_state, &sink, p_state->paths[index], &inputBytes);
+        if (err != 0)
+            fprintf(stderr, "cml: %s: %s\n", p_state->paths[index], strerror(err));
+
+        pthread_mutex_lock(&p_state->lock);
+        while (p_state->nextWrite != index)
+            pthread_cond_wait(&p_state->turn, &p_state->lock);
+        pthread_mutex_unlock(&p_state->lock);
+
+        CmlCli_flush(p_state, &sink);
+        if (sink.error != 0)
+            fprintf(stderr, "cml: write: %s\n", strerror(sink.error));
+
+        pthread_mutex_lock(&p_state->lock);
+        if (err != 0 || sink.error != 0)
+            p_state->status = 1;
+        p_state->inputBytes += inputBytes;
+        p_state->tokens += sink.tokens;
+        p_state->outputBytes += sink.written;
+        p_state->nextWrite++;
+        pthread_cond_broadcast(&p_state->turn);
+        pthread_mutex_unlock(&p_state->lock);
+    }
+
+    free(sink.buff);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct CmlCli_State state;
+    size_t workers = 1;
+    int isStats = 0;
+    char *p_stdin = "-";
+
+    state.format = CmlCli_TEXT;
+    state.encoding = 0;
+    state.endian = Cml_BE;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != 0; i++) {
+        if (!strcmp(argv[i], "--")) {
+            i++;
+            break;
+        } else if (!strcmp(argv[i], "--stats")) {
+            isStats = 1;
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            workers = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "text"))
+                state.format = CmlCli_TEXT;
+            else if (!strcmp(argv[i], "tokens"))
+                state.format = CmlCli_TOKENS;
+            else
+                goto usage;
+        } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "utf8")) {
+                state.encoding = CmlUTF_UTF8;
+            } else if (!strcmp(argv[i], "utf16be") || !strcmp(argv[i], "utf16le")) {
+                state.encoding = CmlUTF_UTF16;
+                state.endian = argv[i][5] == 'l' ? Cml_LE : Cml_BE;
+            } else if (!strcmp(argv[i], "utf32be") || !strcmp(argv[i], "utf32le")) {
+                state.encoding = CmlUTF_UTF32;
+                state.endian = argv[i][5] == 'l' ? Cml_LE : Cml_BE;
+            } else {
+                goto usage;
+            }
+        } else {
+            goto usage;
+        }
+    }
+
+    if (workers == 0)
+        goto usage;
+
+    state.paths = i < argc ? argv + i : &p_stdin;
+    state.pathsLen = i < argc ? argc - i : 1;
+    state.nextPath = state.nextWrite = 0;
+    state.status = 0;
+    state.inputBytes = state.tokens = state.outputBytes = 0;
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.turn, NULL);
+    if (workers > state.pathsLen)
+        workers = state.pathsLen;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t *p_threads = malloc(sizeof(pthread_t) * workers);
+    size_t started = 0;
+    for (; p_threads != NULL && started + 1 < workers; started++) {
+        if (pthread_create(p_threads + started, NULL, &CmlCli_work, &state) != 0)
+            break;
+    }
+
+    CmlCli_work(&state);
+    while (started != 0)
+        pthread_join(p_threads[--started], NULL);
+    free(p_threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (isStats) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "cml: %zu files, %zu bytes in, %zu tokens, %zu bytes out\n",
+            state.pathsLen, state.inputBytes, state.tokens, state.outputBytes);
+        fprintf(stderr, "cml: %.3f s, %.1f MB/s, %.1f Mtokens/s\n",
+            seconds, state.inputBytes / seconds / 1e6, state.tokens / seconds / 1e6);
+    }
+
+    pthread_cond_destroy(&state.turn);
+    pthread_mutex_destroy(&state.lock);
+    return state.status;
+
+    usage:
+    fprintf(stderr, "usage: cml [-j jobs] [-e utf8|utf16be|utf16le|utf32be|utf32le] [-f text|tokens] [--stats] [file...]\n");
+    return 2;
+}
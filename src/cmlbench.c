@@ -0,0 +1,414 @@
+/*
+cmlbench.c - Compare and time tokenization across encodings
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+The corpus is read as UTF-8 and encoded once per cell of the matrix:
+UTF-8, UTF-16 and UTF-32, each byte order, with and without a byte order
+mark. A cell without a mark opens its buffer with the byte order given;
+a cell with a mark opens it with Cml_DETECT and so relies on the mark
+being found. A cell with a reversed mark writes the mark in the other
+byte order and opens its buffer with the byte order given, which must
+win over the mark. The byte order of every buffer is checked and the
+mark is stepped over before tokenizing.
+
+Every cell goes through CmlTokenizer_tokenizationUTF and its token stream
+must match the one from plain UTF-8. Each cell is then timed for -r
+rounds, or for as many rounds as fit in CmlBench_MIN_SECONDS. The exit
+status is 1 when any cell differs.
+
+With -d, every whitespace-separated word of the corpus is also looked up
+in the given dictionary file, once with a CmlDict_get loop and once with
+CmlDict_getMany. Both must return the same fields.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "def.h"
+#include "utf.h"
+#include "utf8.h"
+#include "utf16.h"
+#include "utf32.h"
+#include "tokenizer.h"
+#include "dict.h"
+
+#define CmlBench_READ_SIZE (1 << 16)
+#define CmlBench_MIN_SECONDS 0.25
+#define CmlBench_MIN_ROUNDS 3
+#define CmlBench_BOM 0xFEFF
+
+enum CmlBench_Mark {
+    CmlBench_NO_MARK,
+    CmlBench_MARK,
+    CmlBench_REVERSED_MARK
+};
+
+struct CmlBench_Cell {
+    char *name;
+    enum CmlUTF_Encoding encoding;
+    enum Cml_Endianness endian;
+    enum CmlBench_Mark mark;
+};
+
+static struct CmlBench_Cell CmlBench_cells[] = {
+    { "utf8", CmlUTF_UTF8, Cml_BE, CmlBench_NO_MARK },
+    { "utf8", CmlUTF_UTF8, Cml_BE, CmlBench_MARK },
+    { "utf16be", CmlUTF_UTF16, Cml_BE, CmlBench_NO_MARK },
+    { "utf16be", CmlUTF_UTF16, Cml_BE, CmlBench_MARK },
+    { "utf16be", CmlUTF_UTF16, Cml_BE, CmlBench_REVERSED_MARK },
+    { "utf16le", CmlUTF_UTF16, Cml_LE, CmlBench_NO_MARK },
+    { "utf16le", CmlUTF_UTF16, Cml_LE, CmlBench_MARK },
+    { "utf16le", CmlUTF_UTF16, Cml_LE, CmlBench_REVERSED_MARK },
+    { "utf32be", CmlUTF_UTF32, Cml_BE, CmlBench_NO_MARK },
+    { "utf32be", CmlUTF_UTF32, Cml_BE, CmlBench_MARK },
+    { "utf32be", CmlUTF_UTF32, Cml_BE, CmlBench_REVERSED_MARK },
+    { "utf32le", CmlUTF_UTF32, Cml_LE, CmlBench_NO_MARK },
+    { "utf32le", CmlUTF_UTF32, Cml_LE, CmlBench_MARK },
+    { "utf32le", CmlUTF_UTF32, Cml_LE, CmlBench_REVERSED_MARK }
+};
+
+static char *CmlBench_marks[] = { "no", "yes", "rev" };
+
+static int CmlBench_readAll(FILE *p_file, unsigned char **pp_buff, size_t *p_len, size_t *p_capacity)
+{
+    while (1) {
+        if (*p_capacity - *p_len < CmlBench_READ_SIZE) {
+            size_t capacity = *p_capacity * 2 + CmlBench_READ_SIZE;
+            unsigned char *p_buff = realloc(*pp_buff, capacity);
+            if (p_buff == NULL)
+                return ENOMEM;
+
+            *pp_buff = p_buff;
+            *p_capacity = capacity;
+        }
+
+        size_t n = fread(*pp_buff + *p_len, 1, *p_capacity - *p_len, p_file);
+        *p_len += n;
+        if (n == 0)
+            return ferror(p_file) ? EIO : 0;
+    }
+}
+
+static void CmlBench_newBuffer(struct CmlUTF_Buffer *p_utf, enum CmlUTF_Encoding encoding, unsigned char *p_buff, size_t len, enum Cml_Endianness endian)
+{
+    switch (encoding) {
+        case CmlUTF_UTF16: CmlUTF16_new(p_utf, p_buff, 0, len, endian);
+        break;
+        case CmlUTF_UTF32: CmlUTF32_new(p_utf, p_buff, 0, len, endian);
+        break;
+        default: CmlUTF8_new(p_utf, p_buff, 0, len);
+    }
+}
+
+static size_t CmlBench_encode(struct CmlBench_Cell *p_cell, CmlUTF_Code *p_codes, size_t n, unsigned char *p_buff, size_t len)
+{
+    struct CmlUTF_Buffer utf;
+    CmlBench_newBuffer(&utf, p_cell->encoding, p_buff, len, p_cell->endian);
+
+    size_t written = 0;
+    if (p_cell->mark == CmlBench_REVERSED_MARK)
+        utf.endian = p_cell->endian == Cml_BE ? Cml_LE : Cml_BE;
+    if (p_cell->mark != CmlBench_NO_MARK)
+        written += CmlUTF_write(&utf, CmlBench_BOM);
+    utf.endian = p_cell->endian;
+    written += CmlUTF_writeCodes(&utf, p_codes, n);
+    CmlUTF_destroy(&utf);
+    return written;
+}
+
+static CmlTokenizer_TokenStream CmlBench_tokenize(struct CmlBench_Cell *p_cell, unsigned char *p_buff, size_t len)
+{
+    struct CmlUTF_Buffer utf;
+    CmlBench_newBuffer(&utf, p_cell->encoding, p_buff, len, p_cell->mark == CmlBench_MARK ? Cml_DETECT : p_cell->endian);
+    if (utf.endian != p_cell->endian) {
+        errno = EILSEQ;
+        return NULL;
+    }
+
+    if (p_cell->mark != CmlBench_NO_MARK)
+        CmlUTF_next(&utf, 1);
+
+    CmlTokenizer_TokenStream tokenStream = CmlTokenizer_tokenizationUTF(&utf);
+    CmlUTF_destroy(&utf);
+    return tokenStream;
+}
+
+static size_t CmlBench_mismatch(CmlTokenizer_TokenStream expected, CmlTokenizer_TokenStream actual)
+{
+    size_t i = 0;
+    for (; expected[i] == actual[i]; i++) {
+        if (expected[i] == CmlTokenizer_END_OF_TOKEN)
+            return -1;
+    }
+
+    return i;
+}
+
+static double CmlBench_seconds(struct timespec *p_start, struct timespec *p_end)
+{
+    return (p_end->tv_sec - p_start->tv_sec) + (p_end->tv_nsec - p_start->tv_nsec) / 1e9;
+}
+
+static size_t CmlBench_splitWords(char *p_text, size_t len, char **p_words)
+{
+    size_t n = 0;
+    size_t i = 0;
+    for (; i < len; i++) {
+        int isSpace = p_text[i] == ' ' || p_text[i] == '\t' || p_text[i] == '\n' || p_text[i] == '\r';
+        if (isSpace)
+            p_text[i] = 0;
+        else if (i == 0 || p_text[i - 1] == 0)
+            p_words[n++] = p_text + i;
+    }
+
+    return n;
+}
+
+static size_t CmlBench_getLoop(struct CmlDict_Dict *p_dict, char **p_keys, size_t n, struct CmlDict_Field *p_values)
+{
+    size_t found = 0;
+    size_t i = 0;
+    for (; i < n; i++) {
+        if (CmlDict_get(p_dict, p_keys[i], p_values + i) == 0) {
+            found++;
+        } else {
+            p_values[i].value = NULL;
+            p_values[i].flag = 0;
+        }
+    }
+
+    return found;
+}
+
+static int CmlBench_lookups(struct CmlDict_Dict *p_dict, char **p_keys, size_t n, size_t rounds)
+{
+    struct CmlDict_Field *p_expected = malloc(sizeof(struct CmlDict_Field) * (n + 1));
+    struct CmlDict_Field *p_values = malloc(sizeof(struct CmlDict_Field) * (n + 1));
+    if (p_expected == NULL || p_values == NULL) {
+        fprintf(stderr, "cmlbench: %s\n", strerror(ENOMEM));
+        free(p_expected);
+        free(p_values);
+        return 1;
+    }
+
+    int status = 0;
+    printf("\n%-8s %12s %12s %10s %9s  %s\n", "lookup", "keys", "found", "Mkeys/s", "rounds", "result");
+    int isMany = 0;
+    for (; isMany <= 1; isMany++) {
+        size_t found = isMany ? CmlDict_getMany(p_dict, p_keys, n, p_values) : CmlBench_getLoop(p_dict, p_keys, n, p_expected);
+        size_t mismatch = -1;
+        size_t i = 0;
+        for (; isMany && i < n && mismatch == -1; i++) {
+            if (p_values[i].value != p_expected[i].value || p_values[i].flag != p_expected[i].flag)
+                mismatch = i;
+        }
+
+        struct timespec start, end;
+        size_t k = 0;
+        double seconds = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (rounds != 0 ? k < rounds : k < CmlBench_MIN_ROUNDS || seconds < CmlBench_MIN_SECONDS) {
+            if (isMany)
+                CmlDict_getMany(p_dict, p_keys, n, p_values);
+            else
+                CmlBench_getLoop(p_dict, p_keys, n, p_values);
+            k++;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            seconds = CmlBench_seconds(&start, &end);
+        }
+
+        char result[48] = "ok";
+        if (mismatch != -1) {
+            snprintf(result, sizeof(result), "differs at key %zu", mismatch);
+            status = 1;
+        }
+
+        printf("%-8s %12zu %12zu %10.1f %9zu  %s\n",
+            isMany ? "getMany" : "get", n, found, (double) n * k / seconds / 1e6, k, result);
+    }
+
+    free(p_expected);
+    free(p_values);
+    return status;
+}
+
+static int CmlBench_dict(char *p_path, char *p_text, size_t len, size_t rounds)
+{
+    unsigned char *p_file = NULL;
+    size_t fileLen = 0, fileCapacity = 0;
+    FILE *p_stream = fopen(p_path, "rb");
+    int err = p_stream != NULL ? CmlBench_readAll(p_stream, &p_file, &fileLen, &fileCapacity) : errno;
+    if (p_stream != NULL)
+        fclose(p_stream);
+
+    struct CmlDict_Dict dict;
+    if (err == 0)
+        err = CmlDict_open(&dict, p_file, fileLen);
+
+    char **p_words = err == 0 ? malloc(sizeof(char *) * (len / 2 + 1)) : NULL;
+    if (err == 0 && p_words == NULL)
+        err = ENOMEM;
+    if (err != 0) {
+        fprintf(stderr, "cmlbench: %s: %s\n", p_path, strerror(err));
+        free(p_file);
+        return 1;
+    }
+
+    int status = CmlBench_lookups(&dict, p_words, CmlBench_splitWords(p_text, len, p_words), rounds);
+    free(p_words);
+    free(p_file);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    size_t rounds = 0;
+    char *p_dictPath = NULL;
+    int status = 0;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != 0; i++) {
+        if (!strcmp(argv[i], "--")) {
+            i++;
+            break;
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rounds = strtoul(argv[++i], NULL, 0);
+            if (rounds == 0)
+                goto usage;
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            p_dictPath = argv[++i];
+        } else {
+            goto usage;
+        }
+    }
+
+    unsigned char *p_corpus = NULL;
+    size_t corpusLen = 0, corpusCapacity = 0;
+    char *p_stdin = "-";
+    char **pp_paths = i < argc ? argv + i : &p_stdin;
+    size_t pathsLen = i < argc ? argc - i : 1;
+    size_t j = 0;
+    for (; j < pathsLen; j++) {
+        int isStdin = !strcmp(pp_paths[j], "-");
+        FILE *p_file = isStdin ? stdin : fopen(pp_paths[j], "rb");
+        int err = p_file != NULL ? CmlBench_readAll(p_file, &p_corpus, &corpusLen, &corpusCapacity) : errno;
+        if (p_file != NULL && !isStdin)
+            fclose(p_file);
+        if (err != 0) {
+            fprintf(stderr, "cmlbench: %s: %s\n", pp_paths[j], strerror(err));
+            free(p_corpus);
+            return 1;
+        }
+    }
+
+    struct CmlUTF_Buffer utf;
+    CmlUTF8_new(&utf, p_corpus != NULL ? p_corpus : (unsigned char *) "", 0, corpusLen);
+    if (CmlUTF_read(&utf) == CmlBench_BOM)
+        CmlUTF_next(&utf, 1);
+
+    size_t codesLen = 0;
+    CmlUTF_Code *p_codes = malloc(sizeof(CmlUTF_Code) * (CmlUTF_count(&utf) + 1));
+    while (p_codes != NULL) {
+        errno = 0;
+        CmlUTF_Code code = CmlUTF_read(&utf);
+        if (code == -1 && errno != 0)
+            break;
+
+        p_codes[codesLen++] = code;
+        if (CmlUTF_next(&utf, 1) == -1)
+            break;
+    }
+
+    if (p_codes == NULL || utf.currIndex < utf.len) {
+        fprintf(stderr, "cmlbench: %s\n", p_codes == NULL ? strerror(ENOMEM) : "corpus is not valid UTF-8");
+        free(p_corpus);
+        free(p_codes);
+        return 1;
+    }
+
+    size_t capacity = (codesLen + 1) * CmlUTF_MAX_OCTETS_LENGTH;
+    unsigned char *p_buff = malloc(capacity);
+    if (p_buff == NULL) {
+        fprintf(stderr, "cmlbench: %s\n", strerror(ENOMEM));
+        free(p_corpus);
+        free(p_codes);
+        return 1;
+    }
+
+    CmlTokenizer_TokenStream expected = NULL;
+    size_t cellsLen = sizeof(CmlBench_cells) / sizeof(CmlBench_cells[0]);
+    printf("%-8s %-3s %12s %12s %10s %10s %9s  %s\n", "encoding", "bom", "bytes", "tokens", "MB/s", "Mcodes/s", "rounds", "result");
+    for (j = 0; j < cellsLen; j++) {
+        struct CmlBench_Cell *p_cell = CmlBench_cells + j;
+        size_t len = CmlBench_encode(p_cell, p_codes, codesLen, p_buff, capacity);
+        CmlTokenizer_TokenStream tokenStream = CmlBench_tokenize(p_cell, p_buff, len);
+        if (tokenStream == NULL) {
+            fprintf(stderr, "cmlbench: %s: %s\n", p_cell->name, errno == EILSEQ ? "wrong byte order" : strerror(errno != 0 ? errno : ENOMEM));
+            status = 1;
+            continue;
+        }
+
+        size_t tokens = 0;
+        while (tokenStream[tokens] != CmlTokenizer_END_OF_TOKEN)
+            tokens++;
+
+        if (expected == NULL)
+            expected = tokenStream;
+        size_t mismatch = CmlBench_mismatch(expected, tokenStream);
+        if (tokenStream != expected)
+            CmlTokenizer_destroyTokenStream(tokenStream, NULL);
+
+        struct timespec start, end;
+        size_t n = 0;
+        double seconds = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (rounds != 0 ? n < rounds : n < CmlBench_MIN_ROUNDS || seconds < CmlBench_MIN_SECONDS) {
+            CmlTokenizer_destroyTokenStream(CmlBench_tokenize(p_cell, p_buff, len), NULL);
+            n++;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            seconds = CmlBench_seconds(&start, &end);
+        }
+
+        char result[48] = "ok";
+        if (mismatch != -1) {
+            snprintf(result, sizeof(result), "differs at token %zu", mismatch);
+            status = 1;
+        }
+
+        printf("%-8s %-3s %12zu %12zu %10.1f %10.1f %9zu  %s\n",
+            p_cell->name, CmlBench_marks[p_cell->mark], len, tokens,
+            (double) len * n / seconds / 1e6, (double) codesLen * n / seconds / 1e6, n, result);
+    }
+
+    CmlTokenizer_destroyTokenStream(expected, NULL);
+    free(p_buff);
+    free(p_codes);
+    if (p_dictPath != NULL && CmlBench_dict(p_dictPath, (char *) p_corpus, corpusLen, rounds))
+        status = 1;
+    free(p_corpus);
+    return status;
+
+    usage:
+    fprintf(stderr, "usage: cmlbench [-r rounds] [-d dict] [file...]\n");
+    return 2;
+}
@@ -0,0 +1,1872 @@
+/*
+cmlcheck.c - Check the tokenizer, cml and rule tables against naive models
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Every input is decoded by CmlCheck_decode, a model of the rule that an
+octet sequence which does not decode, or decodes above U+10FFFF, stands
+for U+FFFD, taking one octet when it does not decode. The reference
+token stream comes from the input split into one-octet segments, which
+leaves every code to the generic loop. Against it are checked:
+tokenization into streams of several sizes, the lengths and the count
+paths, random segmentations, UTF-16 and UTF-32 encodings of the decoded
+codes in both byte orders, and CmlTokenizer_tokenizationUTF over the
+same buffers. Each must leave the cursor at the end with one offset per
+decoded code. The lengths must agree with the position map and with the
+span tokenization, both streams must come back from every pack block
+size, and the decoded codes must encode in bulk as one at a time and
+read back the same both ways. An edit at a random place must leave
+CmlEdit_apply with the tokens and offsets of the edited text. The inputs
+are every string of up to CmlCheck_TINY_LENGTH octets over
+CmlCheck_octets, then random mixes of text, digraphs, escapes,
+decomposed marks, long ASCII runs and invalid octets.
+
+Decomposed letters must tokenize and compose as their precomposed forms.
+Random inputs are also run as jobs on a worker pool. Reader threads look
+a key up in a concurrent dictionary while a writer keeps republishing
+it, with reclaimed blocks poisoned.
+
+With -c, short inputs are run through cml, which must not take them for
+UTF-16 and must honour -e and byte order marks. With -r, random rule
+files are compiled with mkrule -b and applied, in one call and fed in
+chunks, to random token strings; the output must match a direct reading
+of the rules. With -m, a random lexicon is built with mkdict in both
+layouts and every key looked up, and corrupt copies must be refused or
+stay in bounds. With -d, random inputs and lookups are sent to cmld on a
+temporary socket, the lookups against a dictionary from -m if given.
+
+With -p only a digest of the token streams and clusters of the random
+inputs is printed, so that builds with and without the SSE2 paths can
+be compared. The exit status is 1 when any check fails.
+*/
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+#include "def.h"
+#include "alloc.h"
+#include "utf.h"
+#include "utf8.h"
+#include "utf16.h"
+#include "utf32.h"
+#include "norm.h"
+#include "tokenizer.h"
+#include "aksara.h"
+#include "job.h"
+#include "pack.h"
+#include "pos.h"
+#include "edit.h"
+#include "rule.h"
+#include "dict.h"
+#include "cdict.h"
+#include "client.h"
+
+#define CmlCheck_TINY_LENGTH 3
+#define CmlCheck_MAX_INPUT 1024
+#define CmlCheck_MAX_TOKENS (2 * CmlCheck_MAX_INPUT + 2)
+#define CmlCheck_INPUTS 3000
+#define CmlCheck_RULE_SETS 200
+#define CmlCheck_RULE_INPUT 40
+#define CmlCheck_MAX_RULES 12
+#define CmlCheck_MAX_FAILURES 10
+#define CmlCheck_REPLACEMENT_CODE 0xFFFD
+#define CmlCheck_MAX_CODE 0x10FFFF
+#define CmlCheck_JOBS 48
+#define CmlCheck_JOB_CHUNK 16
+#define CmlCheck_LONG_JOB (1 << 20)
+#define CmlCheck_CDICT_READERS 4
+#define CmlCheck_CDICT_PUBLISHES 20000
+#define CmlCheck_POISON 0xDD
+#define CmlCheck_ENTRIES 500
+#define CmlCheck_LONG_KEY 300
+#define CmlCheck_CORRUPTIONS 300
+#define CmlCheck_REMOTE_INPUTS 200
+#define CmlCheck_SHARED_LEN 65536
+
+static unsigned char CmlCheck_octets[] = {
+    'a', 'k', 'n', 'g', ' ', '[', ']', '$', 0x80, 0xA0, 0xBF, 0xC3, 0xCC, 0x84, 0xE0, 0xF0, 0xF7, 0xFF
+};
+
+static char *CmlCheck_fragments[] = {
+    "ka", "nga", "ca", "ta", "sa", "ya", "e", "o", "u", "i", " ", "  ", "$", "$$", "[", "]", "[as is]",
+    "12", "0", ",", ".", "\xc4\x81", "a\xcc\x84", "i\xcc\x84", "\xe1\xb9\x85", "n\xcc\x87", "l\xcc\xa3\xcc\x84", "e\xcc\x84\xcc\x81",
+    "\xcd\x80", "\xf0\x9d\x84\x9e",
+    "\x80", "\xbf", "\xc3", "\xe0\xa4", "\xf0\x9d", "\xf7\xbf\xbf\xbf", "\xed\xa0\x80", "\xff", "\xfe"
+};
+
+struct CmlCheck_Encoding {
+    char *name;
+    enum CmlUTF_Encoding encoding;
+    enum Cml_Endianness endian;
+};
+
+static struct CmlCheck_Encoding CmlCheck_encodings[] = {
+    { "utf16be", CmlUTF_UTF16, Cml_BE },
+    { "utf16le", CmlUTF_UTF16, Cml_LE },
+    { "utf32be", CmlUTF_UTF32, Cml_BE },
+    { "utf32le", CmlUTF_UTF32, Cml_LE }
+};
+
+struct CmlCheck_Cli {
+    char *input;
+    size_t inputLen;
+    char *encoding;
+    char *output;
+    size_t outputLen;
+};
+
+static struct CmlCheck_Cli CmlCheck_cliCases[] = {
+    { "", 0, NULL, "", 0 },
+    { "a", 1, NULL, "a", 1 },
+    { "ab", 2, NULL, "ab", 2 },
+    { "abc", 3, NULL, "abc", 3 },
+    { "abcd", 4, NULL, "abcd", 4 },
+    { "ab\x80" "cd", 5, NULL, "ab\xef\xbf\xbd" "cd", 7 },
+    { "\xc3" "a", 2, NULL, "\xef\xbf\xbd" "a", 4 },
+    { "\xef\xbb\xbf" "ab", 5, NULL, "ab", 2 },
+    { "\xff\xfe" "a\0", 4, NULL, "a", 1 },
+    { "\xfe\xff\0" "a", 4, NULL, "a", 1 },
+    { "a\0b\0", 4, "utf16le", "ab", 2 },
+    { "\0a\0b", 4, "utf16be", "ab", 2 },
+    { "\xff\xfe" "a\0", 4, "utf16le", "a", 1 },
+    { "\xff\xfe" "a\0", 4, "utf8", "\xef\xbf\xbd\xef\xbf\xbd" "a\0", 8 },
+    { "a\0\0\0", 4, "utf32le", "a", 1 },
+    { "a\xcc\x84", 3, NULL, "\xc4\x81", 2 }
+};
+
+struct CmlCheck_Word {
+    char *text;
+    unsigned int token;
+};
+
+static struct CmlCheck_Word CmlCheck_words[] = {
+    { "a", 0 }, { "i", 0 }, { "u", 0 }, { "e", 0 }, { "o", 0 }, { "h", 0 }, { "n", 0 }, { "k", 0 },
+    { "t", 0 }, { "s", 0 }, { "m", 0 }, { "g", 0 }, { "0", 0 }, { "1", 0 }, { "5", 0 }, { "x", 0 },
+    { "q", 0 }, { " ", 0 }
+};
+
+#define CmlCheck_WORDS (sizeof(CmlCheck_words) / sizeof(CmlCheck_words[0]))
+#define CmlCheck_SYMBOLS CmlRule_SYMBOLS
+#define CmlCheck_CLASSES (8 + 3)
+
+struct CmlCheck_Class {
+    char name[16];
+    unsigned char symbols[CmlCheck_SYMBOLS];
+};
+
+struct CmlCheck_Rule {
+    size_t leftLen, targetLen, rightLen, replacementLen;
+    unsigned char left[2][CmlCheck_SYMBOLS];
+    unsigned char target[3][CmlCheck_SYMBOLS];
+    unsigned char right[2][CmlCheck_SYMBOLS];
+    unsigned int replacement[3];
+};
+
+static unsigned long long CmlCheck_state = 1;
+static size_t CmlCheck_failures = 0;
+
+static unsigned int CmlCheck_random(unsigned int n)
+{
+    CmlCheck_state ^= CmlCheck_state << 13;
+    CmlCheck_state ^= CmlCheck_state >> 7;
+    CmlCheck_state ^= CmlCheck_state << 17;
+    return (CmlCheck_state >> 11) % n;
+}
+
+static void CmlCheck_fail(char *p_what, unsigned char *p_input, size_t len)
+{
+    if (CmlCheck_failures++ >= CmlCheck_MAX_FAILURES)
+        return;
+
+    fprintf(stderr, "cmlcheck: %s%s", p_what, len != 0 ? ":" : "");
+    size_t i = 0;
+    for (; i < len && i < 64; i++)
+        fprintf(stderr, " %02x", p_input[i]);
+    fprintf(stderr, "%s\n", i < len ? " ..." : "");
+}
+
+static size_t CmlCheck_decode(unsigned char *p_buff, size_t len, CmlUTF_Code *p_codes)
+{
+    size_t n = 0, i = 0;
+    while (i < len) {
+        unsigned char lead = p_buff[i];
+        size_t octetsLength = lead < 0x80 ? 1 : lead >= 0xC0 && lead < 0xE0 ? 2 : lead >= 0xE0 && lead < 0xF0 ? 3 : lead >= 0xF0 && lead < 0xF8 ? 4 : 0;
+        CmlUTF_Code code = octetsLength == 2 ? lead & 0x1F : octetsLength == 3 ? lead & 0xF : octetsLength == 4 ? lead & 0x7 : lead;
+
+        size_t j = 1;
+        for (; j < octetsLength && i + j < len && (p_buff[i + j] & 0xC0) == 0x80; j++)
+            code = (code << 6) | (p_buff[i + j] & 0x3F);
+
+        if (octetsLength == 0 || j < octetsLength) {
+            p_codes[n++] = CmlCheck_REPLACEMENT_CODE;
+            i++;
+        } else {
+            p_codes[n++] = code > CmlCheck_MAX_CODE ? CmlCheck_REPLACEMENT_CODE : code;
+            i += octetsLength;
+        }
+    }
+
+    return n;
+}
+
+static size_t CmlCheck_encode(CmlUTF_Code *p_codes, size_t n, struct CmlCheck_Encoding *p_encoding, unsigned char *p_buff)
+{
+    size_t len = 0, i = 0;
+    for (; i < n; i++) {
+        CmlUTF_Code units[2] = { p_codes[i], 0 };
+        size_t unitsLen = 1, unitSize = p_encoding->encoding == CmlUTF_UTF16 ? 2 : 4;
+        if (unitSize == 2 && p_codes[i] > 0xFFFF) {
+            units[0] = 0xD800 + ((p_codes[i] - 0x10000) >> 10);
+            units[1] = 0xDC00 + ((p_codes[i] - 0x10000) & 0x3FF);
+            unitsLen = 2;
+        }
+
+        size_t j = 0;
+        for (; j < unitsLen; j++) {
+            size_t k = 0;
+            for (; k < unitSize; k++) {
+                size_t shift = 8 * (p_encoding->endian == Cml_BE ? unitSize - 1 - k : k);
+                p_buff[len++] = units[j] >> shift;
+            }
+        }
+    }
+
+    return len;
+}
+
+static void CmlCheck_newBuffer(struct CmlUTF_Buffer *p_utf, enum CmlUTF_Encoding encoding, enum Cml_Endianness endian, unsigned char *p_buff, size_t len)
+{
+    switch (encoding) {
+        case CmlUTF_UTF16: CmlUTF16_new(p_utf, p_buff, 0, len, endian);
+        break;
+        case CmlUTF_UTF32: CmlUTF32_new(p_utf, p_buff, 0, len, endian);
+        break;
+        default: CmlUTF8_new(p_utf, p_buff, 0, len);
+    }
+}
+
+static void CmlCheck_newSegments(struct CmlUTF_Buffer *p_utf, enum CmlUTF_Encoding encoding, enum Cml_Endianness endian, struct iovec *p_segments, size_t segmentsLen)
+{
+    switch (encoding) {
+        case CmlUTF_UTF16: CmlUTF16_newv(p_utf, p_segments, segmentsLen, 0, endian);
+        break;
+        case CmlUTF_UTF32: CmlUTF32_newv(p_utf, p_segments, segmentsLen, 0, endian);
+        break;
+        default: CmlUTF8_newv(p_utf, p_segments, segmentsLen, 0);
+    }
+}
+
+static int CmlCheck_isAtEnd(struct CmlUTF_Buffer *p_utf, size_t codesLen)
+{
+    return p_utf->currIndex == p_utf->len && p_utf->offset == codesLen
+        && (p_utf->segments == NULL || p_utf->currSegment + 1 == p_utf->segmentsLen);
+}
+
+/* Tokenizes into a stream of room tokens at a time, as a caller with a fixed buffer would */
+static size_t CmlCheck_tokenize(struct CmlUTF_Buffer *p_utf, unsigned int *p_tokens, size_t room)
+{
+    size_t n = 0;
+    while (n + room <= CmlCheck_MAX_TOKENS) {
+        errno = 0;
+        size_t written = CmlTokenizer_tokenizationUTFInto(p_utf, p_tokens + n, room);
+        if (written == -1)
+            return -1;
+
+        n += written;
+        if (errno != ENOBUFS)
+            return n;
+        if (written == 0)
+            return -1;
+    }
+
+    return -1;
+}
+
+static int CmlCheck_isSame(unsigned int *p_expected, size_t expectedLen, unsigned int *p_tokens, size_t n)
+{
+    return n == expectedLen && p_tokens[n] == CmlTokenizer_END_OF_TOKEN && !memcmp(p_expected, p_tokens, sizeof(unsigned int) * n);
+}
+
+static size_t CmlCheck_split(unsigned char *p_buff, size_t len, struct iovec *p_segments, size_t maxSegments)
+{
+    size_t n = 0, i = 0;
+    while (n + 1 < maxSegments && i < len) {
+        size_t segmentLen = 1 + CmlCheck_random(CmlCheck_random(4) == 0 ? 16 : 4);
+        if (segmentLen > len - i)
+            segmentLen = len - i;
+
+        p_segments[n].iov_base = p_buff + i;
+        p_segments[n++].iov_len = segmentLen;
+        i += segmentLen;
+    }
+
+    p_segments[n].iov_base = p_buff + i;
+    p_segments[n++].iov_len = len - i;
+    return n;
+}
+
+static size_t CmlCheck_reference(unsigned char *p_input, size_t len, unsigned int *p_tokens)
+{
+    static struct iovec segments[CmlCheck_MAX_INPUT + 1];
+    static unsigned char empty;
+    size_t i = 0;
+    for (; i < len; i++) {
+        segments[i].iov_base = p_input + i;
+        segments[i].iov_len = 1;
+    }
+
+    if (len == 0) {
+        segments[0].iov_base = &empty;
+        segments[0].iov_len = 0;
+    }
+
+    struct CmlUTF_Buffer utf;
+    CmlUTF8_newv(&utf, segments, len != 0 ? len : 1, 0);
+    size_t n = CmlTokenizer_tokenizationUTFInto(&utf, p_tokens, CmlCheck_MAX_TOKENS);
+    CmlUTF_destroy(&utf);
+    return n;
+}
+
+static void CmlCheck_composed(struct CmlUTF_Buffer *p_utf, size_t codesLen, CmlTokenizer_TokenStream *p_expected, size_t *p_expectedLen, char *p_what, unsigned char *p_input, size_t len)
+{
+    CmlTokenizer_TokenStream tokenStream = CmlTokenizer_tokenizationUTF(p_utf);
+    if (tokenStream == NULL) {
+        CmlCheck_fail(p_what, p_input, len);
+        return;
+    }
+
+    size_t n = 0;
+    while (tokenStream[n] != CmlTokenizer_END_OF_TOKEN)
+        n++;
+
+    if (!CmlCheck_isAtEnd(p_utf, codesLen))
+        CmlCheck_fail(p_what, p_input, len);
+    if (*p_expected == NULL) {
+        *p_expected = tokenStream;
+        *p_expectedLen = n;
+        return;
+    }
+
+    if (!CmlCheck_isSame(*p_expected, *p_expectedLen, tokenStream, n))
+        CmlCheck_fail(p_what, p_input, len);
+    CmlTokenizer_destroyTokenStream(tokenStream, NULL);
+}
+
+static size_t CmlCheck_tokenLength(unsigned char lengthByte, unsigned int token)
+{
+    if (lengthByte == CmlTokenizer_SPAN_LENGTHS)
+        return CmlTokenizer_SPAN_LENGTH(token);
+
+    return lengthByte >= CmlTokenizer_LONG_LENGTHS ? lengthByte - CmlTokenizer_LONG_LENGTHS + 1 : (lengthByte >> 1) + 1;
+}
+
+/* The map must agree with the lengths of the same tokenization at every token, byte and code */
+static void CmlCheck_positions(unsigned char *p_input, size_t len, int isSpanning, unsigned int *p_expected, unsigned char *p_lengths, size_t expectedLen)
+{
+    static unsigned int tokens[CmlCheck_MAX_TOKENS + 1];
+    static size_t byteStarts[CmlCheck_MAX_TOKENS + 1], codeStarts[CmlCheck_MAX_TOKENS + 1];
+    static CmlUTF_Code codes[CmlCheck_MAX_INPUT];
+    char *p_what = isSpanning ? "span positions differ from the lengths" : "positions differ from the lengths";
+    unsigned char empty = 0;
+
+    size_t i = 0, j;
+    byteStarts[0] = codeStarts[0] = 0;
+    for (; i < expectedLen; i++) {
+        size_t tokenLen = CmlCheck_tokenLength(p_lengths[i], p_expected[i]), codesLen = 0;
+        if (tokenLen > len - byteStarts[i]) {
+            CmlCheck_fail(p_what, p_input, len);
+            return;
+        }
+
+        /* A span counts its codes as the codec does, one per octet that does not continue a sequence */
+        if (p_lengths[i] == CmlTokenizer_SPAN_LENGTHS) {
+            for (j = 0; j < tokenLen; j++)
+                codesLen += (p_input[byteStarts[i] + j] & 0xC0) != 0x80;
+        } else {
+            codesLen = CmlCheck_decode(p_input + byteStarts[i], tokenLen, codes);
+        }
+
+        byteStarts[i + 1] = byteStarts[i] + tokenLen;
+        codeStarts[i + 1] = codeStarts[i] + codesLen;
+    }
+
+    struct CmlUTF_Buffer utf;
+    struct CmlPos_Map map;
+    CmlUTF8_new(&utf, len != 0 ? p_input : &empty, 0, len);
+    size_t n = CmlPos_tokenizationUTFInto(&utf, tokens, CmlCheck_MAX_TOKENS + 1, isSpanning, &map, NULL);
+    if (n == -1) {
+        CmlCheck_fail(p_what, p_input, len);
+        return;
+    }
+
+    size_t byteOffset, codeOffset;
+    int isSame = CmlCheck_isSame(p_expected, expectedLen, tokens, n) && byteStarts[n] == len && utf.offset == codeStarts[n];
+    for (i = 0; isSame && i <= n; i++)
+        isSame = CmlPos_position(&map, i, &byteOffset, &codeOffset) == 0 && byteOffset == byteStarts[i] && codeOffset == codeStarts[i];
+    if (isSame)
+        isSame = CmlPos_position(&map, n + 1, &byteOffset, &codeOffset) == ERANGE;
+
+    for (i = 0, j = 0; isSame && j < len; j++) {
+        while (byteStarts[i + 1] <= j)
+            i++;
+        isSame = CmlPos_findByte(&map, j) == i;
+    }
+
+    for (i = 0, j = 0; isSame && j < codeStarts[n]; j++) {
+        while (codeStarts[i + 1] <= j)
+            i++;
+        isSame = CmlPos_findCode(&map, j) == i;
+    }
+
+    if (!isSame || CmlPos_findByte(&map, len) != -1 || errno != ERANGE || CmlPos_findCode(&map, codeStarts[n]) != -1 || errno != ERANGE)
+        CmlCheck_fail(p_what, p_input, len);
+    CmlPos_destroy(&map);
+}
+
+/*
+Every span must cover a '[' and the text up to the ']' or '$' after it,
+where the stream without spans holds the as-is start token and the raw
+tokens of that text; every other token must be the same in both.
+*/
+static size_t CmlCheck_spans(unsigned char *p_input, size_t len, unsigned int *p_expected, unsigned char *p_lengths, size_t expectedLen, unsigned int *p_spans, unsigned char *p_spanLengths)
+{
+    unsigned char empty = 0;
+    struct CmlUTF_Buffer utf;
+    CmlUTF8_new(&utf, len != 0 ? p_input : &empty, 0, len);
+    size_t n = CmlTokenizer_tokenizationUTFSpans(&utf, p_spans, CmlCheck_MAX_TOKENS + 1, p_spanLengths);
+    if (n == -1 || p_spans[n] != CmlTokenizer_END_OF_TOKEN || utf.currIndex != len) {
+        CmlCheck_fail("span tokenization does not end at the end", p_input, len);
+        return -1;
+    }
+
+    size_t i = 0, j = 0, at = 0, spanAt = 0;
+    for (; j < n; j++) {
+        size_t spanLen = CmlCheck_tokenLength(p_spanLengths[j], p_spans[j]);
+        int isSame = i < expectedLen && at == spanAt;
+        if (isSame && CmlTokenizer_IS_SPAN_TOKEN(p_spans[j])) {
+            isSame = spanLen >= 2 && spanLen < len - spanAt && p_expected[i] == CmlTokenizer_TRANSLITERATION_AS_IS_START_TOKEN
+                && memchr(p_input + spanAt + 1, ']', spanLen - 1) == NULL && memchr(p_input + spanAt + 1, '$', spanLen - 1) == NULL
+                && (p_input[spanAt + spanLen] == ']' || p_input[spanAt + spanLen] == '$');
+            for (; isSame && i < expectedLen && at < spanAt + spanLen; i++)
+                at += CmlCheck_tokenLength(p_lengths[i], p_expected[i]);
+        } else if (isSame) {
+            isSame = p_expected[i] == p_spans[j] && p_lengths[i] == p_spanLengths[j];
+            at += CmlCheck_tokenLength(p_lengths[i], p_expected[i]);
+            i++;
+        }
+
+        spanAt += spanLen;
+        if (!isSame) {
+            CmlCheck_fail("span tokens differ from the as-is tokens", p_input, len);
+            return -1;
+        }
+    }
+
+    if (i != expectedLen || spanAt != len)
+        CmlCheck_fail("span tokens differ from the as-is tokens", p_input, len);
+    return n;
+}
+
+/* Every block size must give the stream back from any first token, and a flipped bit must fail the checksum */
+static void CmlCheck_pack(unsigned int *p_tokens, size_t n, unsigned char *p_input, size_t len)
+{
+    static size_t blockSizes[] = { 1, 7, CmlPack_DEFAULT_BLOCK_SIZE };
+    static unsigned char packed[CmlPack_HEADER_SIZE + (CmlPack_MAX_TOKEN_SIZE + 8) * CmlCheck_MAX_TOKENS];
+    static unsigned int tokens[CmlCheck_MAX_TOKENS + 1];
+
+    size_t i = 0;
+    for (; i < sizeof(blockSizes) / sizeof(blockSizes[0]); i++) {
+        struct CmlPack_Reader reader;
+        size_t packedLen = CmlPack_encode(p_tokens, n, blockSizes[i], packed, sizeof(packed));
+        if (packedLen == -1 || CmlPack_open(&reader, packed, packedLen, 1) != 0) {
+            CmlCheck_fail("cannot pack tokens", p_input, len);
+            return;
+        }
+
+        size_t first = CmlCheck_random(n + 1), room = 1 + CmlCheck_random(n - first + 1);
+        size_t decoded = CmlPack_decode(&reader, 0, tokens, CmlCheck_MAX_TOKENS + 1);
+        int isSame = CmlCheck_isSame(p_tokens, n, tokens, decoded);
+        decoded = CmlPack_decode(&reader, first, tokens, room);
+        if (!isSame || !CmlCheck_isSame(p_tokens + first, room - 1, tokens, decoded))
+            CmlCheck_fail("unpacked tokens differ", p_input, len);
+
+        /* Bytes 36 to 39 are reserved and left out of the checksum */
+        size_t bit = CmlCheck_random(8 * (packedLen - 4));
+        if (bit >= 8 * 36)
+            bit += 8 * 4;
+        packed[bit >> 3] ^= 1 << (bit & 7);
+        if (CmlPack_open(&reader, packed, packedLen, 1) == 0)
+            CmlCheck_fail("a flipped bit passes the pack checksum", p_input, len);
+
+        /* Without the checksum a corrupt stream may decode to anything but must stay in bounds */
+        packed[CmlCheck_random(packedLen)] = CmlCheck_random(256);
+        if (CmlPack_open(&reader, packed, packedLen, 0) == 0) {
+            decoded = CmlPack_decode(&reader, CmlCheck_random(n + 1), tokens, CmlCheck_MAX_TOKENS + 1);
+            if (decoded != -1 ? decoded > CmlCheck_MAX_TOKENS || tokens[decoded] != CmlTokenizer_END_OF_TOKEN : errno != EILSEQ)
+                CmlCheck_fail("corrupt pack decodes out of bounds", p_input, len);
+        }
+    }
+}
+
+/*
+The bulk encoders must write what CmlUTF_write does one code at a time,
+stop at a code boundary when the buffer is short, and carry codes across
+segments. Reading the result back with CmlUTF_next and CmlUTF_prev must
+visit the same boundaries both ways, and CmlUTF_reset must return to the
+last mark. Surrogates, which no encoding can hold, become U+FFFD.
+*/
+static void CmlCheck_codec(CmlUTF_Code *p_codes, size_t codesLen, unsigned char *p_input, size_t len)
+{
+    static struct CmlCheck_Encoding utf8 = { "utf8", CmlUTF_UTF8, Cml_BE };
+    static CmlUTF_Code codes[CmlCheck_MAX_INPUT];
+    static size_t bounds[CmlCheck_MAX_INPUT + 1];
+    static unsigned char expected[4 * CmlCheck_MAX_INPUT], encoded[4 * CmlCheck_MAX_INPUT], out[4 * CmlCheck_MAX_INPUT + 1];
+    static struct iovec segments[4 * CmlCheck_MAX_INPUT + 1];
+    size_t i = 0, j, n;
+    for (; i < codesLen; i++)
+        codes[i] = p_codes[i] >= 0xD800 && p_codes[i] <= 0xDFFF ? CmlCheck_REPLACEMENT_CODE : p_codes[i];
+
+    for (i = 0; i <= sizeof(CmlCheck_encodings) / sizeof(CmlCheck_encodings[0]); i++) {
+        struct CmlCheck_Encoding *p_encoding = i == 0 ? &utf8 : CmlCheck_encodings + i - 1;
+        struct CmlUTF_Buffer utf;
+        CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, expected, sizeof(expected));
+        bounds[0] = 0;
+        for (j = 0; j < codesLen && (n = CmlUTF_write(&utf, codes[j])) != -1; j++)
+            bounds[j + 1] = bounds[j] + n;
+
+        size_t expectedLen = bounds[j];
+        if (j != codesLen || utf.currIndex != expectedLen || utf.offset != codesLen
+            || (p_encoding->encoding != CmlUTF_UTF8 && (CmlCheck_encode(codes, codesLen, p_encoding, encoded) != expectedLen || memcmp(encoded, expected, expectedLen)))) {
+            CmlCheck_fail(p_encoding->name, p_input, len);
+            continue;
+        }
+
+        CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, out, expectedLen);
+        if (CmlUTF_writeCodes(&utf, codes, codesLen) != expectedLen || utf.offset != codesLen || memcmp(out, expected, expectedLen))
+            CmlCheck_fail("bulk encoding differs", p_input, len);
+
+        if (expectedLen != 0) {
+            CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, out, expectedLen - 1);
+            errno = 0;
+            n = CmlUTF_writeCodes(&utf, codes, codesLen);
+            if (errno != ENOBUFS || utf.offset >= codesLen || n != bounds[utf.offset] || memcmp(out, expected, n))
+                CmlCheck_fail("short bulk encoding differs", p_input, len);
+        }
+
+        size_t segmentsLen = CmlCheck_split(out, expectedLen, segments, 4 * CmlCheck_MAX_INPUT + 1);
+        memset(out, 0, expectedLen);
+        CmlCheck_newSegments(&utf, p_encoding->encoding, p_encoding->endian, segments, segmentsLen);
+        if (CmlUTF_writeCodes(&utf, codes, codesLen) != expectedLen || utf.offset != codesLen || memcmp(out, expected, expectedLen))
+            CmlCheck_fail("segmented bulk encoding differs", p_input, len);
+
+        size_t layout = 0;
+        for (; layout < 2; layout++) {
+            if (layout == 0)
+                CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, expected, expectedLen);
+            else
+                CmlCheck_newSegments(&utf, p_encoding->encoding, p_encoding->endian, segments, segmentsLen);
+
+            memcpy(out, expected, expectedLen);
+            size_t mark = CmlCheck_random(codesLen + 1);
+            int isSame = 1;
+            for (j = 0; isSame && j < codesLen; j++) {
+                if (j == mark)
+                    CmlUTF_mark(&utf);
+                isSame = utf.offset == j && utf.segmentOffset + utf.currIndex == bounds[j] && CmlUTF_read(&utf) == codes[j];
+                n = CmlUTF_next(&utf, 1);
+                isSame &= j + 1 < codesLen ? n == j + 1 : n == -1 && errno == ERANGE;
+            }
+
+            if (mark == codesLen)
+                CmlUTF_mark(&utf);
+            isSame &= utf.offset == codesLen && utf.segmentOffset + utf.currIndex == expectedLen;
+            for (j = codesLen; isSame && j != 0; j--) {
+                isSame = CmlUTF_prev(&utf, 1) == j - 1 && utf.segmentOffset + utf.currIndex == bounds[j - 1] && CmlUTF_read(&utf) == codes[j - 1];
+            }
+
+            if (!isSame || CmlUTF_prev(&utf, 1) != -1 || errno != ERANGE || utf.offset != 0 || utf.segmentOffset + utf.currIndex != 0)
+                CmlCheck_fail(layout == 0 ? "reading back and forth differs" : "reading segments back and forth differs", p_input, len);
+
+            CmlUTF_reset(&utf);
+            if (utf.offset != mark || utf.segmentOffset + utf.currIndex != bounds[mark] || (mark < codesLen && CmlUTF_read(&utf) != codes[mark]))
+                CmlCheck_fail("reset does not return to the mark", p_input, len);
+        }
+    }
+}
+
+static void CmlCheck_input(unsigned char *p_input, size_t len)
+{
+    static CmlUTF_Code codes[CmlCheck_MAX_INPUT];
+    static unsigned int expected[CmlCheck_MAX_TOKENS + 1], tokens[CmlCheck_MAX_TOKENS + 1], spans[CmlCheck_MAX_TOKENS + 1];
+    static unsigned char lengths[CmlCheck_MAX_TOKENS + 1], spanLengths[CmlCheck_MAX_TOKENS + 1], encoded[4 * CmlCheck_MAX_INPUT];
+    static struct iovec segments[CmlCheck_MAX_INPUT + 1];
+    static size_t rooms[] = { 2, 3, 7, CmlCheck_MAX_TOKENS };
+    unsigned char empty = 0;
+    unsigned char *p_buff = len != 0 ? p_input : &empty;
+
+    size_t codesLen = CmlCheck_decode(p_input, len, codes);
+    size_t expectedLen = CmlCheck_reference(p_input, len, expected);
+    if (expectedLen > codesLen) {
+        CmlCheck_fail("more tokens than codes", p_input, len);
+        return;
+    }
+
+    struct CmlUTF_Buffer utf;
+    size_t i = 0;
+    for (; i < sizeof(rooms) / sizeof(rooms[0]); i++) {
+        CmlUTF8_new(&utf, p_buff, 0, len);
+        size_t n = CmlCheck_tokenize(&utf, tokens, rooms[i]);
+        if (!CmlCheck_isSame(expected, expectedLen, tokens, n) || !CmlCheck_isAtEnd(&utf, codesLen))
+            CmlCheck_fail("contiguous utf8 differs from the generic loop", p_input, len);
+    }
+
+    CmlUTF8_new(&utf, p_buff, 0, len);
+    if (CmlTokenizer_countTokensUTF(&utf) != expectedLen || utf.currIndex != 0)
+        CmlCheck_fail("token count differs", p_input, len);
+
+    CmlUTF8_new(&utf, p_buff, 0, len);
+    size_t n = CmlTokenizer_tokenizationUTFLengths(&utf, tokens, CmlCheck_MAX_TOKENS, lengths);
+    size_t octets = 0;
+    for (i = 0; i < n && n != -1; i++)
+        octets += CmlCheck_tokenLength(lengths[i], tokens[i]);
+    if (!CmlCheck_isSame(expected, expectedLen, tokens, n) || octets != len || !CmlCheck_isAtEnd(&utf, codesLen)) {
+        CmlCheck_fail("token lengths differ", p_input, len);
+    } else {
+        CmlCheck_positions(p_input, len, 0, expected, lengths, expectedLen);
+        n = CmlCheck_spans(p_input, len, expected, lengths, expectedLen, spans, spanLengths);
+        if (n != -1) {
+            CmlCheck_positions(p_input, len, 1, spans, spanLengths, n);
+            CmlCheck_pack(spans, n, p_input, len);
+        }
+    }
+
+    CmlCheck_pack(expected, expectedLen, p_input, len);
+    CmlCheck_codec(codes, codesLen, p_input, len);
+
+    for (i = 0; i < 3; i++) {
+        size_t segmentsLen = CmlCheck_split(p_buff, len, segments, CmlCheck_MAX_INPUT + 1);
+        CmlUTF8_newv(&utf, segments, segmentsLen, 0);
+        n = CmlCheck_tokenize(&utf, tokens, i == 0 ? 2 : CmlCheck_MAX_TOKENS);
+        if (!CmlCheck_isSame(expected, expectedLen, tokens, n) || !CmlCheck_isAtEnd(&utf, codesLen))
+            CmlCheck_fail("segmented utf8 differs from contiguous", p_input, len);
+    }
+
+    CmlTokenizer_TokenStream composed = NULL;
+    size_t composedLen = 0;
+    CmlUTF8_new(&utf, p_buff, 0, len);
+    CmlCheck_composed(&utf, codesLen, &composed, &composedLen, "composed utf8 does not end at the end", p_input, len);
+
+    CmlUTF8_newv(&utf, segments, CmlCheck_split(p_buff, len, segments, CmlCheck_MAX_INPUT + 1), 0);
+    CmlCheck_composed(&utf, codesLen, &composed, &composedLen, "composed segmented utf8 differs", p_input, len);
+
+    int hasSurrogates = 0;
+    for (i = 0; i < codesLen; i++)
+        hasSurrogates |= codes[i] >= 0xD800 && codes[i] <= 0xDFFF;
+
+    for (i = 0; i < sizeof(CmlCheck_encodings) / sizeof(CmlCheck_encodings[0]); i++) {
+        struct CmlCheck_Encoding *p_encoding = CmlCheck_encodings + i;
+        if (hasSurrogates && p_encoding->encoding == CmlUTF_UTF16)
+            continue;
+
+        size_t encodedLen = CmlCheck_encode(codes, codesLen, p_encoding, encoded);
+        CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, encoded, encodedLen);
+        n = CmlCheck_tokenize(&utf, tokens, CmlCheck_MAX_TOKENS);
+        if (!CmlCheck_isSame(expected, expectedLen, tokens, n) || !CmlCheck_isAtEnd(&utf, codesLen))
+            CmlCheck_fail(p_encoding->name, p_input, len);
+
+        CmlCheck_newSegments(&utf, p_encoding->encoding, p_encoding->endian, segments, CmlCheck_split(encoded, encodedLen, segments, CmlCheck_MAX_INPUT + 1));
+        n = CmlCheck_tokenize(&utf, tokens, 3);
+        if (!CmlCheck_isSame(expected, expectedLen, tokens, n) || !CmlCheck_isAtEnd(&utf, codesLen))
+            CmlCheck_fail(p_encoding->name, p_input, len);
+
+        CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, encoded, encodedLen);
+        CmlCheck_composed(&utf, codesLen, &composed, &composedLen, p_encoding->name, p_input, len);
+    }
+
+    CmlTokenizer_destroyTokenStream(composed, NULL);
+}
+
+/*
+A decomposed letter must tokenize as its precomposed form in every
+encoding, and CmlNorm_composeUTF must compose it in place even after a
+unit that does not decode.
+*/
+static void CmlCheck_compositions(void)
+{
+    static char *pairs[][2] = {
+        { "a\xcc\x84", "\xc4\x81" }, { "l\xcc\xa3\xcc\x84", "\xe1\xb8\xb9" }, { "e\xcc\x84\xcc\x81", "\xe1\xb8\x97" },
+        { "n\xcc\xa3", "\xe1\xb9\x87" }, { "\xcd\x80", "\xcc\x80" }
+    };
+    static CmlUTF_Code invalids[] = { 0xD800, 0xD800, 0x110000, 0x110000 };
+    unsigned char decomposed[64], composed[64], out[256];
+    CmlUTF_Code codes[16];
+    unsigned int tokens[16], expected[16];
+
+    size_t i = 0, j;
+    for (; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        unsigned char *p_decomposed = (unsigned char *) pairs[i][0], *p_composed = (unsigned char *) pairs[i][1];
+        size_t decomposedLen = strlen(pairs[i][0]), composedLen = strlen(pairs[i][1]);
+        struct CmlUTF_Buffer utf;
+        CmlUTF8_new(&utf, p_composed, 0, composedLen);
+        size_t expectedLen = CmlTokenizer_tokenizationUTFInto(&utf, expected, 16);
+        CmlUTF8_new(&utf, p_decomposed, 0, decomposedLen);
+        size_t n = CmlTokenizer_tokenizationUTFInto(&utf, tokens, 16);
+        if (expectedLen != 1 || !CmlCheck_isSame(expected, expectedLen, tokens, n))
+            CmlCheck_fail("decomposed utf8 differs from precomposed", p_decomposed, decomposedLen);
+
+        CmlUTF8_new(&utf, p_decomposed, 0, decomposedLen);
+        n = CmlNorm_composeUTF(&utf, out, sizeof(out));
+        if (n != composedLen || memcmp(out, p_composed, n))
+            CmlCheck_fail("composed utf8 differs from precomposed", p_decomposed, decomposedLen);
+
+        for (j = 0; j < sizeof(CmlCheck_encodings) / sizeof(CmlCheck_encodings[0]); j++) {
+            struct CmlCheck_Encoding *p_encoding = CmlCheck_encodings + j;
+            codes[0] = invalids[j];
+            size_t codesLen = 1 + CmlCheck_decode(p_decomposed, decomposedLen, codes + 1);
+            size_t len = CmlCheck_encode(codes, codesLen, p_encoding, decomposed);
+            codesLen = 1 + CmlCheck_decode(p_composed, composedLen, codes + 1);
+            size_t expectedComposedLen = CmlCheck_encode(codes, codesLen, p_encoding, composed);
+
+            CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, composed, expectedComposedLen);
+            expectedLen = CmlTokenizer_tokenizationUTFInto(&utf, expected, 16);
+            CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, decomposed, len);
+            n = CmlTokenizer_tokenizationUTFInto(&utf, tokens, 16);
+            if (!CmlCheck_isSame(expected, expectedLen, tokens, n))
+                CmlCheck_fail(p_encoding->name, p_decomposed, decomposedLen);
+
+            CmlCheck_newBuffer(&utf, p_encoding->encoding, p_encoding->endian, decomposed, len);
+            n = CmlNorm_composeUTF(&utf, out, sizeof(out));
+            if (n != expectedComposedLen || memcmp(out, composed, n))
+                CmlCheck_fail(p_encoding->name, p_decomposed, decomposedLen);
+        }
+    }
+}
+
+static void CmlCheck_edit(unsigned char *p_input, size_t len)
+{
+    static unsigned char edited[CmlCheck_MAX_INPUT + 8];
+    size_t fragmentsLen = sizeof(CmlCheck_fragments) / sizeof(CmlCheck_fragments[0]);
+    char *p_fragment = CmlCheck_fragments[CmlCheck_random(fragmentsLen)];
+    size_t start = CmlCheck_random(len + 1);
+    size_t removedLen = CmlCheck_random(len - start < 4 ? len - start + 1 : 4);
+    size_t insertedLen = CmlCheck_random(2) ? strlen(p_fragment) : 0;
+    unsigned char empty = 0;
+
+    memcpy(edited, p_input, start);
+    memcpy(edited + start, p_fragment, insertedLen);
+    memcpy(edited + start + insertedLen, p_input + start + removedLen, len - start - removedLen);
+    size_t editedLen = len - removedLen + insertedLen;
+
+    struct CmlEdit_Document doc, expected;
+    struct CmlEdit_Change change;
+    struct CmlUTF_Buffer utf;
+    CmlUTF8_new(&utf, len != 0 ? p_input : &empty, 0, len);
+    if (CmlEdit_new(&doc, &utf, NULL) != 0) {
+        CmlCheck_fail("cannot open an edit document", p_input, len);
+        return;
+    }
+
+    CmlUTF8_new(&utf, editedLen != 0 ? edited : &empty, 0, editedLen);
+    int isSame = CmlEdit_apply(&doc, &utf, start, removedLen, insertedLen, &change) == 0 && CmlEdit_new(&expected, &utf, NULL) == 0;
+    size_t i = 0;
+    for (; isSame && i <= expected.tokenStreamLen; i++)
+        isSame = CmlEdit_token(&doc, i) == expected.tokenStream[i] && CmlEdit_offset(&doc, i) == expected.offsets[i];
+
+    if (!isSame || doc.tokenStreamLen != expected.tokenStreamLen)
+        CmlCheck_fail("edited document differs from the edited text", edited, editedLen);
+    CmlEdit_destroy(&expected);
+    CmlEdit_destroy(&doc);
+}
+
+static size_t CmlCheck_generate(unsigned char *p_buff)
+{
+    size_t fragmentsLen = sizeof(CmlCheck_fragments) / sizeof(CmlCheck_fragments[0]);
+    size_t maxLen = CmlCheck_random(8) == 0 ? CmlCheck_MAX_INPUT : 64;
+    size_t len = 0;
+    while (len < maxLen && CmlCheck_random(32) != 0) {
+        char *p_fragment = CmlCheck_fragments[CmlCheck_random(fragmentsLen)];
+        size_t fragmentLen = strlen(p_fragment);
+        size_t choice = CmlCheck_random(16);
+        if (choice == 0) {
+            fragmentLen = 16 + CmlCheck_random(80);
+            if (len + fragmentLen > maxLen)
+                break;
+            memset(p_buff + len, 'a' + CmlCheck_random(26), fragmentLen);
+        } else if (choice == 1) {
+            fragmentLen = 1;
+            if (len + fragmentLen > maxLen)
+                break;
+            p_buff[len] = CmlCheck_random(256);
+        } else {
+            if (len + fragmentLen > maxLen)
+                break;
+            memcpy(p_buff + len, p_fragment, fragmentLen);
+        }
+
+        len += fragmentLen;
+    }
+
+    return len;
+}
+
+static void CmlCheck_countJob(struct CmlJob_Job *p_job, void *p_data)
+{
+    atomic_fetch_add((_Atomic size_t *) p_data, 1);
+}
+
+/* Waits on the event pipe until count more jobs have reached a final state */
+static int CmlCheck_waitJobs(int fd, size_t count)
+{
+    unsigned char events[8 * CmlCheck_JOBS];
+    size_t len = 0;
+    while (len < 8 * count) {
+        ssize_t n = read(fd, events, 8 * count - len < sizeof(events) ? 8 * count - len : sizeof(events));
+        if (n <= 0)
+            return 0;
+        len += n;
+    }
+
+    return 1;
+}
+
+/*
+Random inputs are tokenized on a pool small enough that the queue fills
+and with a chunk small enough that jobs are taken in turns, and must come
+back as the generic loop tokenizes them. A long job cancelled right after
+its submission must end either cancelled or done.
+*/
+static void CmlCheck_jobs(void)
+{
+    static unsigned char inputs[CmlCheck_JOBS][CmlCheck_MAX_INPUT];
+    static unsigned int expected[CmlCheck_JOBS][CmlCheck_MAX_TOKENS + 1];
+    static struct CmlJob_Job jobs[CmlCheck_JOBS];
+    size_t lens[CmlCheck_JOBS], expectedLens[CmlCheck_JOBS];
+    _Atomic size_t callbacks;
+    struct CmlJob_Pool pool;
+    struct CmlUTF_Buffer utf;
+    int fds[2];
+
+    atomic_init(&callbacks, 0);
+    if (pipe(fds) != 0 || CmlJob_newPool(&pool, 3, 4, CmlCheck_JOB_CHUNK, NULL) != 0) {
+        CmlCheck_fail("cannot start a job pool", NULL, 0);
+        return;
+    }
+
+    size_t i = 0, submitted = 0;
+    for (; i < CmlCheck_JOBS; i++) {
+        lens[i] = CmlCheck_generate(inputs[i]);
+        expectedLens[i] = CmlCheck_reference(inputs[i], lens[i], expected[i]);
+        CmlUTF8_new(&utf, inputs[i], 0, lens[i]);
+        CmlJob_new(jobs + i, &utf, &CmlCheck_countJob, &callbacks, fds[1]);
+        submitted += CmlJob_submit(&pool, jobs + i, 1) == 0;
+    }
+
+    if (submitted != CmlCheck_JOBS || !CmlCheck_waitJobs(fds[0], submitted))
+        CmlCheck_fail("jobs were not all run", NULL, 0);
+    for (i = 0; i < submitted; i++) {
+        if (atomic_load(&jobs[i].state) != CmlJob_DONE || !CmlCheck_isSame(expected[i], expectedLens[i], jobs[i].tokenStream, jobs[i].tokenStreamLen))
+            CmlCheck_fail("job tokens differ from the generic loop", inputs[i], lens[i]);
+        CmlJob_destroy(jobs + i);
+    }
+
+    if (atomic_load(&callbacks) != submitted)
+        CmlCheck_fail("job callbacks missed", NULL, 0);
+
+    unsigned char *p_long = malloc(CmlCheck_LONG_JOB);
+    if (p_long != NULL) {
+        for (i = 0; i < CmlCheck_LONG_JOB; i++)
+            p_long[i] = "kanga "[i % 6];
+        CmlUTF8_new(&utf, p_long, 0, CmlCheck_LONG_JOB);
+        CmlJob_new(jobs, &utf, NULL, NULL, fds[1]);
+        if (CmlJob_submit(&pool, jobs, 1) != 0) {
+            CmlCheck_fail("cannot submit a long job", NULL, 0);
+        } else {
+            CmlJob_cancel(jobs);
+            int state = CmlCheck_waitJobs(fds[0], 1) ? atomic_load(&jobs[0].state) : 0;
+            if (state == CmlJob_CANCELLED ? jobs[0].tokenStream != NULL : state != CmlJob_DONE)
+                CmlCheck_fail("cancelled job did not end", NULL, 0);
+            CmlJob_destroy(jobs);
+        }
+        free(p_long);
+    }
+
+    CmlJob_destroyPool(&pool);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/*
+Blocks from the poisoning allocator are overwritten when freed, so a
+reader still holding a reclaimed snapshot reads garbage instead of the
+value it expects.
+*/
+static void *CmlCheck_poisonAlloc(size_t size, void *p_data)
+{
+    size_t *p_block = malloc(2 * sizeof(size_t) + size);
+    if (p_block == NULL)
+        return NULL;
+
+    p_block[0] = size;
+    return p_block + 2;
+}
+
+static void *CmlCheck_poisonRealloc(void *p_ptr, size_t size, void *p_data)
+{
+    if (p_ptr == NULL)
+        return CmlCheck_poisonAlloc(size, p_data);
+
+    size_t *p_block = realloc((size_t *) p_ptr - 2, 2 * sizeof(size_t) + size);
+    if (p_block == NULL)
+        return NULL;
+
+    p_block[0] = size;
+    return p_block + 2;
+}
+
+static void CmlCheck_poisonFree(void *p_ptr, void *p_data)
+{
+    if (p_ptr == NULL)
+        return;
+
+    size_t *p_block = (size_t *) p_ptr - 2;
+    memset(p_ptr, CmlCheck_POISON, p_block[0]);
+    free(p_block);
+}
+
+struct CmlCheck_CDict {
+    struct CmlCDict_Dict dict;
+    _Atomic int isDone;
+    _Atomic size_t failures;
+};
+
+static void *CmlCheck_cdictReader(void *p_arg)
+{
+    struct CmlCheck_CDict *p_shared = p_arg;
+    struct CmlCDict_Reader reader;
+    unsigned long last = 0;
+    CmlCDict_register(&p_shared->dict, &reader);
+
+    while (!atomic_load(&p_shared->isDone)) {
+        struct CmlDict_Field field;
+        CmlCDict_enter(&p_shared->dict, &reader);
+        int err = CmlCDict_get(&p_shared->dict, "key", &field);
+        char *p_end = NULL;
+        unsigned long generation = err == 0 && field.value[0] == 'g' ? strtoul(field.value + 1, &p_end, 10) : 0;
+        if (err == 0 ? p_end == NULL || *p_end != 0 || generation < last || field.flag != 0b11 : err != ENOENT || last != 0)
+            atomic_fetch_add(&p_shared->failures, 1);
+        CmlCDict_leave(&reader);
+        last = generation;
+    }
+
+    CmlCDict_unregister(&p_shared->dict, &reader);
+    return NULL;
+}
+
+/*
+Readers look one key up in a loop while the writer publishes a new
+value for it on every round, so every publish retires a snapshot that
+some reader may be inside. Each reader must see a well-formed value that
+never goes back to an older generation.
+*/
+static void CmlCheck_cdict(void)
+{
+    struct CmlAlloc_Allocator allocator = { &CmlCheck_poisonAlloc, &CmlCheck_poisonRealloc, &CmlCheck_poisonFree, NULL };
+    static struct CmlCheck_CDict shared;
+    pthread_t threads[CmlCheck_CDICT_READERS];
+    size_t started = 0, i = 1;
+
+    CmlCDict_new(&shared.dict, NULL, &allocator);
+    atomic_init(&shared.isDone, 0);
+    atomic_init(&shared.failures, 0);
+    for (; started < CmlCheck_CDICT_READERS; started++) {
+        if (pthread_create(threads + started, NULL, &CmlCheck_cdictReader, &shared))
+            break;
+    }
+
+    for (; i <= CmlCheck_CDICT_PUBLISHES; i++) {
+        struct CmlCDict_Delta delta;
+        char value[32];
+        snprintf(value, sizeof(value), "g%zu", i);
+        CmlCDict_newDelta(&delta, &allocator);
+        if (CmlCDict_put(&delta, "key", value, 0b10) || CmlCDict_publish(&shared.dict, &delta)) {
+            CmlCDict_destroyDelta(&delta);
+            CmlCheck_fail("cdict publish failed", NULL, 0);
+            break;
+        }
+    }
+
+    atomic_store(&shared.isDone, 1);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    if (started < CmlCheck_CDICT_READERS)
+        CmlCheck_fail("cannot start cdict readers", NULL, 0);
+    if (atomic_load(&shared.failures) != 0)
+        CmlCheck_fail("cdict reader saw a stale or reclaimed value", NULL, 0);
+    if (CmlCDict_reclaim(&shared.dict) != 0)
+        CmlCheck_fail("cdict snapshots left after the readers left", NULL, 0);
+    CmlCDict_destroy(&shared.dict);
+}
+
+static void CmlCheck_digest(unsigned long long *p_hash, unsigned int value)
+{
+    *p_hash = (*p_hash ^ value) * 0x100000001B3ull;
+}
+
+static unsigned long long CmlCheck_digestInput(unsigned long long hash, unsigned char *p_input, size_t len)
+{
+    static unsigned int tokens[CmlCheck_MAX_TOKENS + 1], starts[CmlCheck_MAX_TOKENS + 1];
+    static unsigned char types[CmlCheck_MAX_TOKENS + 1], encoded[4 * CmlCheck_MAX_INPUT];
+    static CmlUTF_Code codes[CmlCheck_MAX_INPUT];
+    unsigned char empty = 0;
+
+    struct CmlUTF_Buffer utf;
+    CmlUTF8_new(&utf, len != 0 ? p_input : &empty, 0, len);
+    size_t n = CmlCheck_tokenize(&utf, tokens, CmlCheck_MAX_TOKENS);
+    size_t i = 0;
+    for (; i <= n && n != -1; i++)
+        CmlCheck_digest(&hash, tokens[i]);
+
+    size_t clusters = n != -1 ? CmlAksara_segment(tokens, n, starts, types, CmlCheck_MAX_TOKENS + 1) : 0;
+    for (i = 0; i < clusters && clusters != -1; i++) {
+        CmlCheck_digest(&hash, starts[i]);
+        CmlCheck_digest(&hash, types[i]);
+    }
+
+    size_t codesLen = CmlCheck_decode(p_input, len, codes);
+    size_t encodedLen = CmlCheck_encode(codes, codesLen, CmlCheck_encodings + 1, encoded);
+    CmlCheck_newBuffer(&utf, CmlUTF_UTF16, Cml_LE, encodedLen != 0 ? encoded : &empty, encodedLen);
+    CmlTokenizer_TokenStream tokenStream = CmlTokenizer_tokenizationUTF(&utf);
+    for (i = 0; tokenStream != NULL; i++) {
+        CmlCheck_digest(&hash, tokenStream[i]);
+        if (tokenStream[i] == CmlTokenizer_END_OF_TOKEN)
+            break;
+    }
+
+    CmlTokenizer_destroyTokenStream(tokenStream, NULL);
+    return hash;
+}
+
+static char *CmlCheck_temp(char *p_path, size_t len, char *p_suffix)
+{
+    char *p_dir = getenv("TMPDIR");
+    snprintf(p_path, len, "%s/cmlcheck.XXXXXX%s", p_dir != NULL && *p_dir ? p_dir : "/tmp", p_suffix);
+    int fd = mkstemps(p_path, strlen(p_suffix));
+    if (fd < 0)
+        return NULL;
+
+    close(fd);
+    return p_path;
+}
+
+static void CmlCheck_cli(char *p_cml)
+{
+    char inputPath[256], outputPath[256], command[1024];
+    static char output[64];
+    if (CmlCheck_temp(inputPath, sizeof(inputPath), "") == NULL || CmlCheck_temp(outputPath, sizeof(outputPath), "") == NULL) {
+        CmlCheck_fail(strerror(errno), NULL, 0);
+        return;
+    }
+
+    size_t i = 0;
+    for (; i < sizeof(CmlCheck_cliCases) / sizeof(CmlCheck_cliCases[0]); i++) {
+        struct CmlCheck_Cli *p_case = CmlCheck_cliCases + i;
+        FILE *p_file = fopen(inputPath, "wb");
+        if (p_file == NULL || fwrite(p_case->input, 1, p_case->inputLen, p_file) != p_case->inputLen) {
+            if (p_file != NULL)
+                fclose(p_file);
+            CmlCheck_fail("cannot write cml input", NULL, 0);
+            break;
+        }
+        fclose(p_file);
+
+        snprintf(command, sizeof(command), "%s%s%s %s > %s", p_cml, p_case->encoding != NULL ? " -e " : "",
+            p_case->encoding != NULL ? p_case->encoding : "", inputPath, outputPath);
+        int status = system(command);
+
+        size_t outputLen = 0;
+        p_file = fopen(outputPath, "rb");
+        if (p_file != NULL) {
+            outputLen = fread(output, 1, sizeof(output), p_file);
+            fclose(p_file);
+        }
+
+        if (status != 0 || outputLen != p_case->outputLen || memcmp(output, p_case->output, outputLen))
+            CmlCheck_fail(p_case->encoding != NULL ? "cml -e differs" : "cml differs", (unsigned char *) p_case->input, p_case->inputLen);
+    }
+
+    unlink(inputPath);
+    unlink(outputPath);
+}
+
+static void CmlCheck_setRange(unsigned char *p_symbols, unsigned int first, unsigned int last)
+{
+    for (; first <= last; first++)
+        p_symbols[first] = 1;
+}
+
+static size_t CmlCheck_builtins(struct CmlCheck_Class *p_classes)
+{
+    static struct { char *name; unsigned int first, last; } builtins[] = {
+        { "boundary", CmlTokenizer_END_OF_TOKEN, CmlTokenizer_END_OF_TOKEN },
+        { "any", CmlTokenizer_SPACE_TOKEN, CmlRule_SPAN_SYMBOL },
+        { "vowel", CmlTokenizer_VOCAL_A_TOKEN, CmlTokenizer_LONG_SYLLABIC_CONSONANT_R_TOKEN },
+        { "consonant", CmlTokenizer_CONSONANT_H_TOKEN, CmlTokenizer_PALATAL_CONSONANT_S_TOKEN },
+        { "digit", CmlTokenizer_NUMBER_0_TOKEN, CmlTokenizer_NUMBER_9_TOKEN },
+        { "punctuation", CmlTokenizer_PUNCTUATION_CARIK_SIKI_TOKEN, CmlTokenizer_PUNCTUATION_IDEM_TOKEN },
+        { "space", CmlTokenizer_SPACE_TOKEN, CmlTokenizer_SPACE_TOKEN },
+        { "raw", CmlTokenizer_RAW_TOKEN(0), CmlRule_RAW_SYMBOL }
+    };
+
+    size_t i = 0;
+    for (; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        memset(p_classes[i].symbols, 0, CmlCheck_SYMBOLS);
+        snprintf(p_classes[i].name, sizeof(p_classes[i].name), "%s", builtins[i].name);
+        CmlCheck_setRange(p_classes[i].symbols, builtins[i].first, builtins[i].last);
+    }
+
+    return i;
+}
+
+static int CmlCheck_initWords(void)
+{
+    size_t i = 0;
+    for (; i < CmlCheck_WORDS; i++) {
+        unsigned int tokens[4];
+        struct CmlUTF_Buffer utf;
+        CmlUTF8_new(&utf, (unsigned char *) CmlCheck_words[i].text, 0, strlen(CmlCheck_words[i].text));
+        if (CmlTokenizer_tokenizationUTFInto(&utf, tokens, 4) != 1 || tokens[0] >= CmlCheck_SYMBOLS)
+            return EINVAL;
+        CmlCheck_words[i].token = tokens[0];
+    }
+
+    return 0;
+}
+
+/* Writes one pattern element and stores the symbols it matches */
+static void CmlCheck_element(FILE *p_file, struct CmlCheck_Class *p_classes, size_t classesLen, unsigned char *p_symbols)
+{
+    unsigned int choice = CmlCheck_random(100);
+    if (choice < 45) {
+        struct CmlCheck_Word *p_word = CmlCheck_words + CmlCheck_random(CmlCheck_WORDS);
+        memset(p_symbols, 0, CmlCheck_SYMBOLS);
+        p_symbols[p_word->token] = 1;
+        fprintf(p_file, " %s", p_word->token == CmlTokenizer_SPACE_TOKEN ? "\" \"" : p_word->text);
+    } else if (choice < 80) {
+        struct CmlCheck_Class *p_class = p_classes + CmlCheck_random(classesLen);
+        memcpy(p_symbols, p_class->symbols, CmlCheck_SYMBOLS);
+        fprintf(p_file, " %s", p_class->name);
+    } else {
+        size_t inner = CmlCheck_random(CmlCheck_WORDS - 1 + classesLen);
+        size_t i = 0;
+        if (inner < CmlCheck_WORDS - 1) {
+            memset(p_symbols, 1, CmlCheck_SYMBOLS);
+            p_symbols[CmlCheck_words[inner].token] = 0;
+            fprintf(p_file, " !%s", CmlCheck_words[inner].text);
+        } else {
+            struct CmlCheck_Class *p_class = p_classes + inner - (CmlCheck_WORDS - 1);
+            for (; i < CmlCheck_SYMBOLS; i++)
+                p_symbols[i] = !p_class->symbols[i];
+            fprintf(p_file, " !%s", p_class->name);
+        }
+    }
+}
+
+static size_t CmlCheck_writeRules(FILE *p_file, struct CmlCheck_Rule *p_rules)
+{
+    static struct CmlCheck_Class classes[CmlCheck_CLASSES];
+    size_t classesLen = CmlCheck_builtins(classes);
+    size_t defined = CmlCheck_random(4), i = 0, j;
+    for (; i < defined; i++, classesLen++) {
+        struct CmlCheck_Class *p_class = classes + classesLen;
+        snprintf(p_class->name, sizeof(p_class->name), "c%zu", i);
+        memset(p_class->symbols, 0, CmlCheck_SYMBOLS);
+        fprintf(p_file, "class %s =", p_class->name);
+        size_t wordsLen = 1 + CmlCheck_random(3);
+        for (j = 0; j < wordsLen; j++) {
+            struct CmlCheck_Word *p_word = CmlCheck_words + CmlCheck_random(CmlCheck_WORDS - 1);
+            p_class->symbols[p_word->token] = 1;
+            fprintf(p_file, " %s", p_word->text);
+        }
+        fprintf(p_file, "\n");
+    }
+
+    size_t rulesLen = 0, attempts = 1 + CmlCheck_random(CmlCheck_MAX_RULES);
+    for (i = 0; i < attempts; i++) {
+        struct CmlCheck_Rule *p_rule = p_rules + rulesLen;
+        p_rule->leftLen = CmlCheck_random(3);
+        p_rule->targetLen = CmlCheck_random(4);
+        p_rule->rightLen = CmlCheck_random(3);
+        if (p_rule->leftLen + p_rule->targetLen + p_rule->rightLen == 0)
+            continue;
+
+        /* Draw the whole rule before deciding to keep it, so the stream of choices stays the same */
+        char line[1024];
+        FILE *p_line = fmemopen(line, sizeof(line), "w");
+        if (p_line == NULL)
+            return -1;
+
+        for (j = 0; j < p_rule->leftLen; j++)
+            CmlCheck_element(p_line, classes, classesLen, p_rule->left[j]);
+        fprintf(p_line, " (");
+
+        int isEmpty = 0;
+        for (j = 0; j < p_rule->targetLen; j++) {
+            CmlCheck_element(p_line, classes, classesLen, p_rule->target[j]);
+            p_rule->target[j][CmlTokenizer_END_OF_TOKEN] = 0;
+            isEmpty |= memchr(p_rule->target[j], 1, CmlCheck_SYMBOLS) == NULL;
+        }
+        fprintf(p_line, " )");
+
+        for (j = 0; j < p_rule->rightLen; j++)
+            CmlCheck_element(p_line, classes, classesLen, p_rule->right[j]);
+        fprintf(p_line, " ->");
+
+        p_rule->replacementLen = CmlCheck_random(4);
+        for (j = 0; j < p_rule->replacementLen; j++) {
+            struct CmlCheck_Word *p_word = CmlCheck_words + CmlCheck_random(CmlCheck_WORDS - 1);
+            p_rule->replacement[j] = p_word->token;
+            fprintf(p_line, " %s", p_word->text);
+        }
+        fclose(p_line);
+
+        if (isEmpty)
+            continue;
+
+        fprintf(p_file, "%s\n", line + 1);
+        rulesLen++;
+    }
+
+    return rulesLen;
+}
+
+static int CmlCheck_matches(unsigned char (*p_pattern)[CmlCheck_SYMBOLS], size_t patternLen, unsigned int *p_stream, size_t n, size_t at)
+{
+    if (at > n || patternLen > n - at)
+        return 0;
+
+    size_t i = 0;
+    for (; i < patternLen; i++) {
+        if (!p_pattern[i][p_stream[at + i]])
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Every rule is matched at every position of the input framed by boundaries, and the first rule in file order wins */
+static size_t CmlCheck_applyRules(struct CmlCheck_Rule *p_rules, size_t rulesLen, unsigned int *p_input, size_t inputLen, unsigned int *p_out)
+{
+    unsigned int stream[CmlCheck_RULE_INPUT + 2];
+    int inserts[CmlCheck_RULE_INPUT + 3], rewrites[CmlCheck_RULE_INPUT + 3];
+    size_t n = inputLen + 2, q, i;
+    stream[0] = stream[n - 1] = CmlTokenizer_END_OF_TOKEN;
+    memcpy(stream + 1, p_input, sizeof(unsigned int) * inputLen);
+
+    for (q = 0; q <= n; q++) {
+        inserts[q] = rewrites[q] = -1;
+        for (i = 0; i < rulesLen; i++) {
+            struct CmlCheck_Rule *p_rule = p_rules + i;
+            if (q < p_rule->leftLen || !CmlCheck_matches(p_rule->left, p_rule->leftLen, stream, n, q - p_rule->leftLen)
+                || !CmlCheck_matches(p_rule->target, p_rule->targetLen, stream, n, q)
+                || !CmlCheck_matches(p_rule->right, p_rule->rightLen, stream, n, q + p_rule->targetLen))
+                continue;
+
+            int *p_slot = p_rule->targetLen != 0 ? rewrites + q : inserts + q;
+            if (*p_slot == -1)
+                *p_slot = i;
+        }
+    }
+
+    size_t outLen = 0, skip = 0;
+    for (q = 0; q <= n; q++) {
+        if (inserts[q] != -1 && skip == 0) {
+            memcpy(p_out + outLen, p_rules[inserts[q]].replacement, sizeof(unsigned int) * p_rules[inserts[q]].replacementLen);
+            outLen += p_rules[inserts[q]].replacementLen;
+        }
+
+        if (skip != 0) {
+            skip--;
+        } else if (rewrites[q] != -1) {
+            memcpy(p_out + outLen, p_rules[rewrites[q]].replacement, sizeof(unsigned int) * p_rules[rewrites[q]].replacementLen);
+            outLen += p_rules[rewrites[q]].replacementLen;
+            skip = p_rules[rewrites[q]].targetLen - 1;
+        } else if (q != 0 && q + 1 < n) {
+            p_out[outLen++] = stream[q];
+        }
+    }
+
+    return outLen;
+}
+
+static size_t CmlCheck_feedRules(struct CmlRule_Rules *p_rules, unsigned int *p_input, size_t inputLen, size_t chunk, size_t room, unsigned int *p_out)
+{
+    unsigned int buff[CmlCheck_MAX_TOKENS];
+    struct CmlRule_Transducer tr;
+    CmlRule_new(&tr, p_rules, buff, room);
+
+    size_t outLen = 0, i = 0;
+    while (i < inputLen) {
+        size_t n = inputLen - i < chunk ? inputLen - i : chunk;
+        errno = 0;
+        size_t fed = CmlRule_feed(&tr, p_input + i, n);
+        if (fed == -1)
+            return -1;
+
+        i += fed;
+        if (fed < n) {
+            if (errno != ENOBUFS || outLen + tr.count > CmlCheck_MAX_TOKENS)
+                return -1;
+            memcpy(p_out + outLen, buff, sizeof(unsigned int) * tr.count);
+            outLen += tr.count;
+            tr.count = 0;
+        }
+    }
+
+    size_t n;
+    while ((n = CmlRule_finish(&tr)) == -1) {
+        if (errno != ENOBUFS || outLen + tr.count > CmlCheck_MAX_TOKENS)
+            return -1;
+        memcpy(p_out + outLen, buff, sizeof(unsigned int) * tr.count);
+        outLen += tr.count;
+        tr.count = 0;
+    }
+
+    if (buff[n] != CmlTokenizer_END_OF_TOKEN || outLen + n > CmlCheck_MAX_TOKENS)
+        return -1;
+    memcpy(p_out + outLen, buff, sizeof(unsigned int) * n);
+    return outLen + n;
+}
+
+static int CmlCheck_readFile(char *p_path, unsigned char **pp_buff, size_t *p_len)
+{
+    FILE *p_file = fopen(p_path, "rb");
+    if (p_file == NULL)
+        return errno;
+
+    size_t capacity = 4096, len = 0, n;
+    unsigned char *p_buff = malloc(capacity);
+    while (p_buff != NULL && (n = fread(p_buff + len, 1, capacity - len, p_file)) != 0) {
+        len += n;
+        if (len == capacity) {
+            unsigned char *p_grown = realloc(p_buff, capacity * 2);
+            if (p_grown == NULL)
+                free(p_buff);
+            p_buff = p_grown;
+            capacity *= 2;
+        }
+    }
+    fclose(p_file);
+
+    if (p_buff == NULL)
+        return ENOMEM;
+
+    *pp_buff = p_buff;
+    *p_len = len;
+    return 0;
+}
+
+static void CmlCheck_rules(char *p_mkrule, size_t rounds)
+{
+    static struct CmlCheck_Rule rules[CmlCheck_MAX_RULES];
+    static size_t feeds[][2] = { { 1, 8 }, { 3, 12 }, { 5, 200 }, { CmlCheck_RULE_INPUT, CmlCheck_MAX_TOKENS } };
+    unsigned int input[CmlCheck_RULE_INPUT], expected[CmlCheck_MAX_TOKENS], out[CmlCheck_MAX_TOKENS + 1];
+    char sourcePath[256], tablePath[256], command[1024];
+    if (CmlCheck_initWords() != 0 || CmlCheck_temp(sourcePath, sizeof(sourcePath), ".txt") == NULL
+        || CmlCheck_temp(tablePath, sizeof(tablePath), ".bin") == NULL) {
+        CmlCheck_fail("cannot set up the rule checks", NULL, 0);
+        return;
+    }
+
+    size_t round = 0;
+    for (; round < rounds && CmlCheck_failures < CmlCheck_MAX_FAILURES; round++) {
+        FILE *p_file = fopen(sourcePath, "w");
+        if (p_file == NULL) {
+            CmlCheck_fail(strerror(errno), NULL, 0);
+            break;
+        }
+
+        size_t rulesLen = CmlCheck_writeRules(p_file, rules);
+        fclose(p_file);
+        if (rulesLen == -1) {
+            CmlCheck_fail("cannot write rules", NULL, 0);
+            break;
+        }
+
+        snprintf(command, sizeof(command), "%s -b -o %s %s 2> /dev/null", p_mkrule, tablePath, sourcePath);
+        unsigned char *p_table = NULL;
+        size_t tableLen = 0;
+        struct CmlRule_Rules table;
+        if (system(command) != 0 || CmlCheck_readFile(tablePath, &p_table, &tableLen) != 0 || CmlRule_open(&table, p_table, tableLen) != 0) {
+            fprintf(stderr, "cmlcheck: cannot compile the rules in %s\n", sourcePath);
+            CmlCheck_fail("mkrule failed", NULL, 0);
+            free(p_table);
+            return;
+        }
+
+        size_t inputs = 0;
+        for (; inputs < 8; inputs++) {
+            size_t inputLen = CmlCheck_random(CmlCheck_RULE_INPUT + 1), i;
+            for (i = 0; i < inputLen; i++)
+                input[i] = CmlCheck_words[CmlCheck_random(CmlCheck_WORDS)].token;
+
+            size_t expectedLen = CmlCheck_applyRules(rules, rulesLen, input, inputLen, expected);
+            size_t n = CmlRule_apply(&table, input, inputLen, out, CmlCheck_MAX_TOKENS + 1);
+            int isSame = CmlCheck_isSame(expected, expectedLen, out, n);
+            for (i = 0; i < sizeof(feeds) / sizeof(feeds[0]) && isSame; i++) {
+                n = CmlCheck_feedRules(&table, input, inputLen, feeds[i][0], feeds[i][1], out);
+                isSame = n != -1 && n == expectedLen && !memcmp(expected, out, sizeof(unsigned int) * n);
+            }
+
+            if (!isSame) {
+                fprintf(stderr, "cmlcheck: rules in %s differ from the model on", sourcePath);
+                for (i = 0; i < inputLen; i++)
+                    fprintf(stderr, " %u", input[i]);
+                fprintf(stderr, "\n");
+                CmlCheck_fail("rule output differs", NULL, 0);
+                free(p_table);
+                unlink(tablePath);
+                return;
+            }
+        }
+
+        free(p_table);
+    }
+
+    unlink(sourcePath);
+    unlink(tablePath);
+}
+
+struct CmlCheck_Entry {
+    char key[CmlCheck_LONG_KEY + 16];
+    char value[16];
+    unsigned char flag;
+};
+
+static struct CmlCheck_Entry CmlCheck_entries[2 * CmlCheck_ENTRIES];
+
+/*
+Writes a lexicon of CmlCheck_ENTRIES keys made of a few syllables and a
+number, so that sorted neighbours share prefixes, with one key longer
+than the capped key length; as many absent keys are built alike.
+*/
+static int CmlCheck_lexicon(char *p_path)
+{
+    static char *syllables[] = { "ka", "nga", "ta", "sa", "ya", "wa", "ra", "la", "i", "u", "e", "o" };
+    FILE *p_file = fopen(p_path, "w");
+    if (p_file == NULL)
+        return errno;
+
+    size_t i = 0;
+    for (; i < 2 * CmlCheck_ENTRIES; i++) {
+        struct CmlCheck_Entry *p_entry = CmlCheck_entries + i;
+        size_t syllablesLen = i == 0 ? CmlCheck_LONG_KEY / 2 : 1 + CmlCheck_random(4), len = 0, j;
+        for (j = 0; j < syllablesLen; j++)
+            len += snprintf(p_entry->key + len, sizeof(p_entry->key) - len, "%s", i == 0 ? "ka" : syllables[CmlCheck_random(sizeof(syllables) / sizeof(syllables[0]))]);
+        snprintf(p_entry->key + len, sizeof(p_entry->key) - len, "%zu", i);
+        snprintf(p_entry->value, sizeof(p_entry->value), i % 7 == 0 ? "shared" : "v%zu", i);
+        p_entry->flag = CmlCheck_random(128) << 1 | 0b1;
+        if (i < CmlCheck_ENTRIES)
+            fprintf(p_file, "%s\t%s\t%u\n", p_entry->key, p_entry->value, p_entry->flag);
+    }
+
+    return fclose(p_file) != 0 ? errno : 0;
+}
+
+static unsigned char *CmlCheck_buildDict(char *p_mkdict, char *p_options, char *p_lexicon, char *p_path, size_t *p_len)
+{
+    char command[1024];
+    unsigned char *p_buff = NULL;
+    snprintf(command, sizeof(command), "%s -b %s -o %s %s 2> /dev/null", p_mkdict, p_options, p_path, p_lexicon);
+    if (system(command) != 0 || CmlCheck_readFile(p_path, &p_buff, p_len) != 0) {
+        fprintf(stderr, "cmlcheck: cannot build a dictionary with mkdict -b %s from %s\n", p_options, p_lexicon);
+        return NULL;
+    }
+
+    return p_buff;
+}
+
+static int CmlCheck_isEntry(struct CmlCheck_Entry *p_entry, int err, struct CmlDict_Field *p_field)
+{
+    if (p_entry >= CmlCheck_entries + CmlCheck_ENTRIES)
+        return err == ENOENT;
+
+    return err == 0 && !strcmp(p_field->value, p_entry->value) && p_field->flag == p_entry->flag;
+}
+
+/*
+Every present key must be found with its value and flag, one at a time
+and in batches, and no absent key. Keys stored as tokens must be found
+from their token stream but never from one that ends in a span token.
+*/
+static void CmlCheck_lookups(struct CmlDict_Dict *p_dict, int isTokens, char *p_what)
+{
+    static char *keys[2 * CmlCheck_ENTRIES];
+    static struct CmlDict_Field fields[2 * CmlCheck_ENTRIES];
+    static unsigned int tokens[CmlCheck_LONG_KEY + 16];
+    struct CmlDict_Field field;
+
+    size_t i = 0;
+    for (; i < 2 * CmlCheck_ENTRIES; i++) {
+        struct CmlCheck_Entry *p_entry = CmlCheck_entries + i;
+        int err;
+        if (isTokens) {
+            struct CmlUTF_Buffer utf;
+            CmlUTF8_new(&utf, (unsigned char *) p_entry->key, 0, strlen(p_entry->key));
+            size_t n = CmlTokenizer_tokenizationUTFInto(&utf, tokens, sizeof(tokens) / sizeof(tokens[0]) - 1);
+            err = CmlDict_getTokens(p_dict, tokens, n, &field);
+            tokens[n] = CmlTokenizer_SPAN_TOKEN(2);
+            if (CmlDict_getTokens(p_dict, tokens, n + 1, &field) != ENOENT)
+                CmlCheck_fail("a key ending in a span token is found", (unsigned char *) p_entry->key, strlen(p_entry->key));
+        } else {
+            err = CmlDict_get(p_dict, p_entry->key, &field);
+            if (CmlDict_has(p_dict, p_entry->key) != (i < CmlCheck_ENTRIES))
+                CmlCheck_fail(p_what, (unsigned char *) p_entry->key, strlen(p_entry->key));
+        }
+
+        if (!CmlCheck_isEntry(p_entry, err, &field))
+            CmlCheck_fail(p_what, (unsigned char *) p_entry->key, strlen(p_entry->key));
+    }
+
+    if (isTokens)
+        return;
+
+    /* 7919 is prime and walks the keys in an order that mixes present and absent ones */
+    size_t found = 0;
+    for (i = 0; i < 2 * CmlCheck_ENTRIES; i++)
+        keys[i] = CmlCheck_entries[i * 7919 % (2 * CmlCheck_ENTRIES)].key;
+    int isSame = CmlDict_getMany(p_dict, keys, 2 * CmlCheck_ENTRIES, fields) == CmlCheck_ENTRIES;
+    for (i = 0; isSame && i < 2 * CmlCheck_ENTRIES; i++) {
+        struct CmlCheck_Entry *p_entry = CmlCheck_entries + i * 7919 % (2 * CmlCheck_ENTRIES);
+        isSame = CmlCheck_isEntry(p_entry, fields[i].value != NULL ? 0 : ENOENT, fields + i);
+        found += fields[i].value != NULL;
+    }
+
+    if (!isSame || found != CmlCheck_ENTRIES)
+        CmlCheck_fail(p_what, NULL, 0);
+}
+
+/* A corrupt or truncated file must either be refused by CmlDict_open or answer lookups without straying out of it */
+static void CmlCheck_corruptDict(unsigned char *p_buff, size_t len)
+{
+    static struct CmlDict_Field fields[CmlCheck_ENTRIES];
+    static char *keys[CmlCheck_ENTRIES];
+    unsigned char *p_copy = malloc(len);
+    if (p_copy == NULL)
+        return;
+
+    size_t round = 0, i;
+    for (i = 0; i < CmlCheck_ENTRIES; i++)
+        keys[i] = CmlCheck_entries[i].key;
+    for (; round < CmlCheck_CORRUPTIONS; round++) {
+        size_t copyLen = round % 8 == 0 ? 1 + CmlCheck_random(len - 1) : len, flips = 1 + CmlCheck_random(4);
+        memcpy(p_copy, p_buff, copyLen);
+        for (i = 0; i < flips; i++)
+            p_copy[CmlCheck_random(copyLen)] ^= 1 + CmlCheck_random(255);
+
+        struct CmlDict_Dict dict;
+        if (CmlDict_open(&dict, p_copy, copyLen) != 0)
+            continue;
+
+        struct CmlDict_Field field;
+        char *p_end = (char *) p_copy + copyLen;
+        for (i = 0; i < CmlCheck_ENTRIES; i += 1 + CmlCheck_random(16)) {
+            if (CmlDict_get(&dict, keys[i], &field) == 0
+                && (field.value < dict.buff || field.value >= p_end || memchr(field.value, 0, p_end - field.value) == NULL))
+                CmlCheck_fail("a corrupt dictionary gives a value outside it", NULL, 0);
+        }
+        CmlDict_getMany(&dict, keys, CmlCheck_ENTRIES, fields);
+    }
+
+    free(p_copy);
+}
+
+/* Both layouts are built from one lexicon, dense enough for full groups, and with keys as text and as tokens */
+static void CmlCheck_dict(char *p_mkdict)
+{
+    static struct { char *options; int isTokens, isCorrupted; char *what; } layouts[] = {
+        { "", 0, 1, "plain dictionary lookup differs" },
+        { "-c", 0, 1, "front-coded dictionary lookup differs" },
+        { "-l 0.9 -p 64", 0, 0, "dense plain dictionary lookup differs" },
+        { "-c -l 0.9 -p 64", 0, 0, "dense front-coded dictionary lookup differs" },
+        { "-t", 1, 0, "plain token dictionary lookup differs" },
+        { "-c -t", 1, 0, "front-coded token dictionary lookup differs" }
+    };
+    char lexiconPath[256], dictPath[256];
+    if (CmlCheck_temp(lexiconPath, sizeof(lexiconPath), ".tsv") == NULL || CmlCheck_temp(dictPath, sizeof(dictPath), ".bin") == NULL
+        || CmlCheck_lexicon(lexiconPath) != 0) {
+        CmlCheck_fail("cannot set up the dictionary checks", NULL, 0);
+        return;
+    }
+
+    unsigned char packed[CmlDict_MAX_PACKED_TOKEN];
+    errno = 0;
+    if (CmlDict_packToken(CmlTokenizer_SPAN_TOKEN(2), packed) != 0 || errno != ENOENT)
+        CmlCheck_fail("a span token packs", NULL, 0);
+
+    size_t i = 0;
+    for (; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        size_t len;
+        struct CmlDict_Dict dict;
+        unsigned char *p_buff = CmlCheck_buildDict(p_mkdict, layouts[i].options, lexiconPath, dictPath, &len);
+        if (p_buff == NULL || CmlDict_open(&dict, p_buff, len) != 0) {
+            CmlCheck_fail(layouts[i].what, NULL, 0);
+            free(p_buff);
+            continue;
+        }
+
+        CmlCheck_lookups(&dict, layouts[i].isTokens, layouts[i].what);
+        if (layouts[i].isCorrupted)
+            CmlCheck_corruptDict(p_buff, len);
+        free(p_buff);
+    }
+
+    unlink(lexiconPath);
+    unlink(dictPath);
+}
+
+/* Tokenizes into a stream of room tokens at a time through the daemon, as CmlCheck_tokenize does locally */
+static size_t CmlCheck_tokenizeRemote(struct CmlClient_Client *p_client, struct CmlUTF_Buffer *p_utf, unsigned int *p_tokens, size_t room)
+{
+    size_t n = 0;
+    while (n + room <= CmlCheck_MAX_TOKENS) {
+        errno = 0;
+        size_t written = CmlClient_tokenizationUTFInto(p_client, p_utf, p_tokens + n, room);
+        if (written == -1)
+            return -1;
+
+        n += written;
+        if (errno != ENOBUFS)
+            return n;
+        if (written == 0)
+            return -1;
+    }
+
+    return -1;
+}
+
+static pid_t CmlCheck_startDaemon(char *p_cmld, char *p_socketPath, char *p_dictPath, struct CmlClient_Client *p_client)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (p_dictPath != NULL)
+            execl(p_cmld, p_cmld, "-s", p_socketPath, "-d", p_dictPath, (char *) NULL);
+        else
+            execl(p_cmld, p_cmld, "-s", p_socketPath, (char *) NULL);
+        _exit(127);
+    }
+
+    /* The daemon listens once it has loaded its dictionary, which takes a moment */
+    size_t attempts = 0;
+    for (; pid > 0 && attempts < 500; attempts++) {
+        if (CmlClient_connect(p_client, p_socketPath, 0) == 0)
+            return pid;
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return -1;
+        usleep(10000);
+    }
+
+    if (pid > 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    return -1;
+}
+
+/*
+Random inputs sent to cmld over a socket, through the socket itself and
+through a shared mapping, must come back as they are tokenized locally,
+and every key must come back as the dictionary holds it. The daemon must
+exit cleanly on SIGTERM.
+*/
+static void CmlCheck_daemon(char *p_cmld, char *p_mkdict)
+{
+    static unsigned char input[CmlCheck_MAX_INPUT], encoded[4 * CmlCheck_MAX_INPUT];
+    static unsigned int expected[CmlCheck_MAX_TOKENS + 1], tokens[CmlCheck_MAX_TOKENS + 1];
+    static CmlUTF_Code codes[CmlCheck_MAX_INPUT];
+    static struct iovec segments[CmlCheck_MAX_INPUT + 1];
+    char socketPath[256], lexiconPath[256], dictPath[256];
+    struct CmlClient_Client clients[2];
+    unsigned char *p_dict = NULL;
+    size_t dictLen;
+
+    if (CmlCheck_temp(socketPath, sizeof(socketPath), ".sock") == NULL || CmlCheck_temp(lexiconPath, sizeof(lexiconPath), ".tsv") == NULL
+        || CmlCheck_temp(dictPath, sizeof(dictPath), ".bin") == NULL || CmlCheck_lexicon(lexiconPath) != 0
+        || (p_mkdict != NULL && (p_dict = CmlCheck_buildDict(p_mkdict, "", lexiconPath, dictPath, &dictLen)) == NULL)) {
+        CmlCheck_fail("cannot set up the daemon checks", NULL, 0);
+        return;
+    }
+
+    pid_t pid = CmlCheck_startDaemon(p_cmld, socketPath, p_dict != NULL ? dictPath : NULL, clients);
+    if (pid == -1 || CmlClient_connect(clients + 1, socketPath, CmlCheck_SHARED_LEN) != 0 || clients[1].shared == NULL) {
+        CmlCheck_fail("cannot start cmld", NULL, 0);
+        if (pid != -1) {
+            CmlClient_close(clients);
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        free(p_dict);
+        unlink(lexiconPath);
+        unlink(dictPath);
+        return;
+    }
+
+    size_t i = 0, j;
+    for (; i < CmlCheck_REMOTE_INPUTS && CmlCheck_failures < CmlCheck_MAX_FAILURES; i++) {
+        size_t len = CmlCheck_generate(input);
+        size_t expectedLen = CmlCheck_reference(input, len, expected);
+        size_t codesLen = CmlCheck_decode(input, len, codes);
+        struct CmlCheck_Encoding *p_encoding = CmlCheck_encodings + CmlCheck_random(sizeof(CmlCheck_encodings) / sizeof(CmlCheck_encodings[0]));
+        int isUTF8 = CmlCheck_random(2);
+        for (j = 0; !isUTF8 && j < codesLen && p_encoding->encoding == CmlUTF_UTF16; j++)
+            isUTF8 = codes[j] >= 0xD800 && codes[j] <= 0xDFFF;
+
+        enum CmlUTF_Encoding encoding = isUTF8 ? CmlUTF_UTF8 : p_encoding->encoding;
+        size_t encodedLen = isUTF8 ? len : CmlCheck_encode(codes, codesLen, p_encoding, encoded);
+        if (isUTF8)
+            memcpy(encoded, input, len);
+
+        for (j = 0; j < 2; j++) {
+            struct CmlUTF_Buffer utf;
+            CmlCheck_newBuffer(&utf, encoding, p_encoding->endian, encoded, encodedLen);
+            CmlTokenizer_TokenStream tokenStream = CmlClient_tokenizationUTF(clients + j, &utf);
+            size_t n = 0;
+            while (tokenStream != NULL && tokenStream[n] != CmlTokenizer_END_OF_TOKEN)
+                n++;
+            if (tokenStream == NULL || !CmlCheck_isSame(expected, expectedLen, tokenStream, n) || !CmlCheck_isAtEnd(&utf, codesLen))
+                CmlCheck_fail(j == 0 ? "cmld tokens differ" : "cmld tokens through the mapping differ", input, len);
+            CmlTokenizer_destroyTokenStream(tokenStream, NULL);
+
+            CmlCheck_newSegments(&utf, encoding, p_encoding->endian, segments, CmlCheck_split(encoded, encodedLen, segments, CmlCheck_MAX_INPUT + 1));
+            n = CmlCheck_tokenizeRemote(clients + j, &utf, tokens, 2 + CmlCheck_random(8));
+            if (!CmlCheck_isSame(expected, expectedLen, tokens, n) || !CmlCheck_isAtEnd(&utf, codesLen))
+                CmlCheck_fail(j == 0 ? "cmld tokens into a stream differ" : "cmld tokens into a stream through the mapping differ", input, len);
+        }
+    }
+
+    for (i = 0; p_dict != NULL && i < 2 * CmlCheck_ENTRIES; i++) {
+        struct CmlCheck_Entry *p_entry = CmlCheck_entries + i;
+        struct CmlDict_Field field;
+        if (!CmlCheck_isEntry(p_entry, CmlClient_get(clients + i % 2, p_entry->key, &field), &field))
+            CmlCheck_fail("cmld lookup differs", (unsigned char *) p_entry->key, strlen(p_entry->key));
+    }
+
+    int status = -1;
+    CmlClient_close(clients);
+    CmlClient_close(clients + 1);
+    if (kill(pid, SIGTERM) != 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        CmlCheck_fail("cmld did not exit cleanly", NULL, 0);
+    if (access(socketPath, F_OK) == 0)
+        CmlCheck_fail("cmld left its socket behind", NULL, 0);
+
+    free(p_dict);
+    unlink(lexiconPath);
+    unlink(dictPath);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long seed = 1;
+    size_t inputs = CmlCheck_INPUTS, ruleSets = CmlCheck_RULE_SETS;
+    char *p_cml = NULL, *p_mkrule = NULL, *p_mkdict = NULL, *p_cmld = NULL;
+    int isDigest = 0;
+
+    int i = 1;
+    for (; i < argc; i++) {
+        if (!strcmp(argv[i], "-p")) {
+            isDigest = 1;
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            inputs = strtoul(argv[++i], NULL, 0);
+            ruleSets = inputs / (CmlCheck_INPUTS / CmlCheck_RULE_SETS);
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            p_cml = argv[++i];
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            p_mkrule = argv[++i];
+        } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            p_mkdict = argv[++i];
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            p_cmld = argv[++i];
+        } else {
+            fprintf(stderr, "usage: cmlcheck [-p] [-s seed] [-n inputs] [-c cml] [-r mkrule] [-m mkdict] [-d cmld]\n");
+            return 2;
+        }
+    }
+
+    static unsigned char input[CmlCheck_MAX_INPUT];
+    size_t j = 0, len;
+    CmlCheck_state = seed != 0 ? seed : 1;
+    if (isDigest) {
+        unsigned long long hash = 0xCBF29CE484222325ull;
+        for (j = 0; j < inputs; j++) {
+            len = CmlCheck_generate(input);
+            hash = CmlCheck_digestInput(hash, input, len);
+        }
+
+        printf("%016llx\n", hash);
+        return 0;
+    }
+
+    size_t octetsLen = sizeof(CmlCheck_octets), tiny = 1, k;
+    for (len = 1; len <= CmlCheck_TINY_LENGTH; len++)
+        tiny = tiny * octetsLen + 1;
+
+    for (j = 0; j < tiny; j++) {
+        for (k = j, len = 0; k != 0; k = (k - 1) / octetsLen)
+            input[len++] = CmlCheck_octets[(k - 1) % octetsLen];
+        CmlCheck_input(input, len);
+    }
+
+    for (j = 0; j < inputs; j++) {
+        len = CmlCheck_generate(input);
+        CmlCheck_input(input, len);
+        CmlCheck_edit(input, len);
+    }
+
+    CmlCheck_compositions();
+    CmlCheck_jobs();
+    CmlCheck_cdict();
+    if (p_cml != NULL)
+        CmlCheck_cli(p_cml);
+    if (p_mkrule != NULL)
+        CmlCheck_rules(p_mkrule, ruleSets);
+    if (p_mkdict != NULL)
+        CmlCheck_dict(p_mkdict);
+    if (p_cmld != NULL)
+        CmlCheck_daemon(p_cmld, p_mkdict);
+
+    if (CmlCheck_failures != 0) {
+        fprintf(stderr, "cmlcheck: %zu checks failed\n", CmlCheck_failures);
+        return 1;
+    }
+
+    printf("cmlcheck: %zu tiny and %zu random inputs%s%s%s%s ok\n", tiny, inputs, p_cml != NULL ? ", cml" : "", p_mkrule != NULL ? ", rules" : "",
+        p_mkdict != NULL ? ", dictionaries" : "", p_cmld != NULL ? ", cmld" : "");
+    return 0;
+}
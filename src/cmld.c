@@ -0,0 +1,688 @@
+/*
+cmld.c - Serve tokenization and dictionary lookups over a local socket
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+The daemon maps the dictionary file once and then serves every client
+from a single poll loop; the protocol is described in client.h. Each
+pass first reads whatever the ready connections have sent and then
+answers all complete requests together: the dictionary lookups of the
+pass go through one CmlDict_getMany call, tokens are written straight
+into the connection's output buffer or shared mapping, and each
+connection's responses leave in one send.
+
+A connection that sends a malformed request is dropped. Requests and
+shared mappings are capped at CmlDaemon_MAX_REQUEST bytes and at the -m
+size. A pass takes no more of a connection's requests than fit in
+CmlDaemon_MAX_PENDING bytes of output not yet sent, and the connection
+is not read again until its client has taken enough of that output.
+Reading stops once CmlDaemon_MAX_PENDING bytes of input are waiting, or
+more than that if the next request is larger.
+*/
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "def.h"
+#include "utf.h"
+#include "utf8.h"
+#include "utf16.h"
+#include "utf32.h"
+#include "tokenizer.h"
+#include "dict.h"
+#include "client.h"
+
+#define CmlDaemon_MAX_CONNS 256
+#define CmlDaemon_MAX_REQUEST (64 << 20)
+#define CmlDaemon_MAX_SHARED (16 << 20)
+#define CmlDaemon_READ_SIZE 65536
+#define CmlDaemon_MAX_PENDING (4 << 20)
+#define CmlDaemon_PENDING(p_conn) ((p_conn)->outLen - (p_conn)->outOffset)
+
+struct CmlDaemon_Conn {
+    int fd;
+    unsigned char *in;
+    size_t inLen;
+    size_t inUsed;
+    size_t inCapacity;
+    unsigned char *out;
+    size_t outLen;
+    size_t outOffset;
+    size_t outCapacity;
+    unsigned char *shared;
+    size_t sharedLen;
+    int isClosing;
+    int isBlocked;
+};
+
+struct CmlDaemon_Item {
+    struct CmlDaemon_Conn *conn;
+    struct CmlClient_Request request;
+    unsigned char *payload;
+    size_t key;
+};
+
+struct CmlDaemon_State {
+    int listenFd;
+    struct CmlDaemon_Conn *conns[CmlDaemon_MAX_CONNS];
+    size_t connsLen;
+    struct CmlDict_Dict dict;
+    int hasDict;
+    size_t maxShared;
+    struct CmlDaemon_Item *items;
+    size_t itemsLen;
+    size_t itemsCapacity;
+    char **keys;
+    struct CmlDict_Field *fields;
+    size_t keysLen;
+    size_t keysCapacity;
+};
+
+static volatile sig_atomic_t CmlDaemon_isStopping;
+
+static void CmlDaemon_stop(int signum)
+{
+    CmlDaemon_isStopping = 1;
+}
+
+static int CmlDaemon_grow(unsigned char **p_buff, size_t *p_capacity, size_t len)
+{
+    if (len <= *p_capacity)
+        return 0;
+
+    size_t capacity = *p_capacity != 0 ? *p_capacity : CmlDaemon_READ_SIZE;
+    while (capacity < len)
+        capacity *= 2;
+
+    unsigned char *p_new = realloc(*p_buff, capacity);
+    if (p_new == NULL)
+        return ENOMEM;
+
+    *p_buff = p_new;
+    *p_capacity = capacity;
+    return 0;
+}
+
+static void CmlDaemon_closeConn(struct CmlDaemon_State *p_state, size_t i)
+{
+    struct CmlDaemon_Conn *p_conn = p_state->conns[i];
+    if (p_conn->shared != NULL)
+        munmap(p_conn->shared, p_conn->sharedLen);
+    close(p_conn->fd);
+    free(p_conn->in);
+    free(p_conn->out);
+    free(p_conn);
+    p_state->conns[i] = p_state->conns[--p_state->connsLen];
+}
+
+static void CmlDaemon_accept(struct CmlDaemon_State *p_state)
+{
+    while (1) {
+        int fd = accept4(p_state->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        struct CmlDaemon_Conn *p_conn = p_state->connsLen < CmlDaemon_MAX_CONNS ? calloc(1, sizeof(*p_conn)) : NULL;
+        if (p_conn == NULL) {
+            close(fd);
+            continue;
+        }
+
+        p_conn->fd = fd;
+        p_state->conns[p_state->connsLen++] = p_conn;
+    }
+}
+
+static size_t CmlDaemon_wanted(struct CmlDaemon_Conn *p_conn)
+{
+    struct CmlClient_Request request;
+    if (p_conn->inLen < sizeof(request))
+        return CmlDaemon_MAX_PENDING;
+
+    memcpy(&request, p_conn->in, sizeof(request));
+    if (request.isShared || request.op == CmlClient_ATTACH || request.len > CmlDaemon_MAX_REQUEST)
+        return CmlDaemon_MAX_PENDING;
+
+    return request.len + sizeof(request) > CmlDaemon_MAX_PENDING ? request.len + sizeof(request) : CmlDaemon_MAX_PENDING;
+}
+
+static void CmlDaemon_read(struct CmlDaemon_Conn *p_conn)
+{
+    while (p_conn->inLen < CmlDaemon_wanted(p_conn)) {
+        if (CmlDaemon_grow(&p_conn->in, &p_conn->inCapacity, p_conn->inLen + CmlDaemon_READ_SIZE) != 0) {
+            p_conn->isClosing = 1;
+            return;
+        }
+
+        ssize_t n = recv(p_conn->fd, p_conn->in + p_conn->inLen, p_conn->inCapacity - p_conn->inLen, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                p_conn->isClosing = 1;
+            return;
+        }
+
+        p_conn->inLen += n;
+    }
+}
+
+static int CmlDaemon_addItem(struct CmlDaemon_State *p_state, struct CmlDaemon_Conn *p_conn, struct CmlClient_Request *p_request, unsigned char *p_payload)
+{
+    if (p_state->itemsLen == p_state->itemsCapacity) {
+        size_t capacity = p_state->itemsCapacity != 0 ? p_state->itemsCapacity * 2 : 64;
+        struct CmlDaemon_Item *p_items = realloc(p_state->items, sizeof(struct CmlDaemon_Item) * capacity);
+        if (p_items == NULL)
+            return ENOMEM;
+
+        p_state->items = p_items;
+        p_state->itemsCapacity = capacity;
+    }
+
+    struct CmlDaemon_Item *p_item = p_state->items + p_state->itemsLen++;
+    p_item->conn = p_conn;
+    p_item->request = *p_request;
+    p_item->payload = p_payload;
+    p_item->key = -1;
+    if (p_request->op != CmlClient_GET || !p_state->hasDict || p_request->len == 0 || p_payload[p_request->len - 1] != 0)
+        return 0;
+
+    if (p_state->keysLen == p_state->keysCapacity) {
+        size_t capacity = p_state->keysCapacity != 0 ? p_state->keysCapacity * 2 : 64;
+        char **p_keys = realloc(p_state->keys, sizeof(char *) * capacity);
+        if (p_keys != NULL)
+            p_state->keys = p_keys;
+
+        struct CmlDict_Field *p_fields = realloc(p_state->fields, sizeof(struct CmlDict_Field) * capacity);
+        if (p_fields != NULL)
+            p_state->fields = p_fields;
+        if (p_keys == NULL || p_fields == NULL)
+            return ENOMEM;
+
+        p_state->keysCapacity = capacity;
+    }
+
+    p_item->key = p_state->keysLen;
+    p_state->keys[p_state->keysLen++] = (char *) p_payload;
+    return 0;
+}
+
+static void CmlDaemon_collect(struct CmlDaemon_State *p_state, struct CmlDaemon_Conn *p_conn)
+{
+    size_t used = 0, budget = CmlDaemon_PENDING(p_conn);
+    p_conn->isBlocked = 0;
+    while (p_conn->inLen - used >= sizeof(struct CmlClient_Request)) {
+        if (budget > CmlDaemon_MAX_PENDING) {
+            p_conn->isBlocked = 1;
+            break;
+        }
+
+        struct CmlClient_Request request;
+        memcpy(&request, p_conn->in + used, sizeof(request));
+        if ((request.op != CmlClient_ATTACH && request.len > CmlDaemon_MAX_REQUEST) || request.op < CmlClient_TOKENIZE || request.op > CmlClient_ATTACH) {
+            p_conn->isClosing = 1;
+            break;
+        }
+
+        size_t payloadLen = request.isShared || request.op == CmlClient_ATTACH ? 0 : request.len;
+        if (p_conn->inLen - used - sizeof(request) < payloadLen)
+            break;
+
+        if (CmlDaemon_addItem(p_state, p_conn, &request, p_conn->in + used + sizeof(request)) != 0) {
+            p_conn->isClosing = 1;
+            break;
+        }
+
+        used += sizeof(request) + payloadLen;
+        budget += sizeof(struct CmlClient_Response) + payloadLen * sizeof(unsigned int);
+    }
+
+    p_conn->inUsed = used;
+}
+
+static unsigned char *CmlDaemon_reserve(struct CmlDaemon_Conn *p_conn, size_t len)
+{
+    if (p_conn->outOffset == p_conn->outLen)
+        p_conn->outOffset = p_conn->outLen = 0;
+
+    if (CmlDaemon_grow(&p_conn->out, &p_conn->outCapacity, p_conn->outLen + len) != 0) {
+        p_conn->isClosing = 1;
+        return NULL;
+    }
+
+    return p_conn->out + p_conn->outLen;
+}
+
+static void CmlDaemon_respond(struct CmlDaemon_Conn *p_conn, struct CmlClient_Response *p_response, const void *p_payload, size_t len)
+{
+    unsigned char *p_out = CmlDaemon_reserve(p_conn, sizeof(*p_response) + CmlClient_ALIGN(len));
+    if (p_out == NULL)
+        return;
+
+    memcpy(p_out, p_response, sizeof(*p_response));
+    if (len != 0)
+        memcpy(p_out + sizeof(*p_response), p_payload, len);
+    memset(p_out + sizeof(*p_response) + len, 0, CmlClient_ALIGN(len) - len);
+    p_conn->outLen += sizeof(*p_response) + CmlClient_ALIGN(len);
+}
+
+static void CmlDaemon_fail(struct CmlDaemon_Conn *p_conn, int status)
+{
+    struct CmlClient_Response response = { status, 0, 0, 0, CmlClient_FAILED, 0, 0 };
+    CmlDaemon_respond(p_conn, &response, NULL, 0);
+}
+
+static int CmlDaemon_newBuffer(struct CmlClient_Request *p_request, struct CmlUTF_Buffer *p_utf, unsigned char *p_payload)
+{
+    p_utf->codec = NULL;
+    switch (p_request->encoding) {
+        case CmlUTF_UTF8: CmlUTF8_new(p_utf, p_payload, 0, p_request->len);
+        break;
+        case CmlUTF_UTF16: CmlUTF16_new(p_utf, p_payload, 0, p_request->len, p_request->endian);
+        break;
+        case CmlUTF_UTF32: CmlUTF32_new(p_utf, p_payload, 0, p_request->len, p_request->endian);
+        break;
+    }
+
+    return p_utf->codec != NULL && p_request->endian <= Cml_LE;
+}
+
+static unsigned char *CmlDaemon_payload(struct CmlDaemon_Item *p_item)
+{
+    if (!p_item->request.isShared)
+        return p_item->payload;
+
+    struct CmlDaemon_Conn *p_conn = p_item->conn;
+    return p_conn->shared != NULL && p_item->request.len <= p_conn->sharedLen ? p_conn->shared : NULL;
+}
+
+static void CmlDaemon_tokenizeInto(struct CmlDaemon_Item *p_item)
+{
+    struct CmlDaemon_Conn *p_conn = p_item->conn;
+    struct CmlClient_Request *p_request = &p_item->request;
+    size_t tokensOffset = CmlClient_ALIGN(p_request->len);
+    size_t capacity = p_request->capacity < p_request->len + 1 ? p_request->capacity : p_request->len + 1;
+
+    unsigned char *p_payload = CmlDaemon_payload(p_item);
+    struct CmlUTF_Buffer utf;
+    if (p_payload == NULL || !CmlDaemon_newBuffer(p_request, &utf, p_payload)
+        || (p_request->isShared && tokensOffset + capacity * sizeof(unsigned int) > p_conn->sharedLen)) {
+        CmlDaemon_fail(p_conn, EINVAL);
+        return;
+    }
+
+    unsigned char *p_out = CmlDaemon_reserve(p_conn, sizeof(struct CmlClient_Response) + (p_request->isShared ? 0 : capacity * sizeof(unsigned int)));
+    if (p_out == NULL) {
+        CmlUTF_destroy(&utf);
+        return;
+    }
+
+    CmlTokenizer_TokenStream tokenStream = (CmlTokenizer_TokenStream) (p_request->isShared
+        ? p_conn->shared + tokensOffset
+        : p_out + sizeof(struct CmlClient_Response));
+
+    errno = 0;
+    size_t n = CmlTokenizer_tokenizationUTFInto(&utf, tokenStream, capacity);
+    struct CmlClient_Response response = { 0, 0, p_request->isShared, 0, n, utf.currIndex, utf.offset };
+    if (n == -1) {
+        response.status = errno;
+        response.count = CmlClient_FAILED;
+    } else if (errno == ENOBUFS) {
+        response.status = ENOBUFS;
+    }
+
+    memcpy(p_out, &response, sizeof(response));
+    p_conn->outLen += sizeof(response);
+    if (!p_request->isShared && n != -1)
+        p_conn->outLen += n * sizeof(unsigned int);
+    CmlUTF_destroy(&utf);
+}
+
+static void CmlDaemon_tokenize(struct CmlDaemon_Item *p_item)
+{
+    struct CmlDaemon_Conn *p_conn = p_item->conn;
+    struct CmlClient_Request *p_request = &p_item->request;
+    unsigned char *p_payload = CmlDaemon_payload(p_item);
+    struct CmlUTF_Buffer utf;
+    if (p_payload == NULL || !CmlDaemon_newBuffer(p_request, &utf, p_payload)) {
+        CmlDaemon_fail(p_conn, EINVAL);
+        return;
+    }
+
+    errno = 0;
+    CmlTokenizer_TokenStream tokenStream = CmlTokenizer_tokenizationUTF(&utf);
+    if (tokenStream == NULL) {
+        CmlDaemon_fail(p_conn, errno != 0 ? errno : ENOMEM);
+        CmlUTF_destroy(&utf);
+        return;
+    }
+
+    size_t n = 0;
+    while (tokenStream[n] != CmlTokenizer_END_OF_TOKEN)
+        n++;
+    n++;
+
+    size_t tokensOffset = CmlClient_ALIGN(p_request->len);
+    size_t size = n * sizeof(unsigned int);
+    struct CmlClient_Response response = { 0, 0, 0, 0, n, utf.currIndex, utf.offset };
+    if (p_request->isShared && tokensOffset + size <= p_conn->sharedLen) {
+        memcpy(p_conn->shared + tokensOffset, tokenStream, size);
+        response.isShared = 1;
+        CmlDaemon_respond(p_conn, &response, NULL, 0);
+    } else {
+        CmlDaemon_respond(p_conn, &response, tokenStream, size);
+    }
+
+    CmlTokenizer_destroyTokenStream(tokenStream, NULL);
+    CmlUTF_destroy(&utf);
+}
+
+static void CmlDaemon_get(struct CmlDaemon_State *p_state, struct CmlDaemon_Item *p_item)
+{
+    if (!p_state->hasDict) {
+        CmlDaemon_fail(p_item->conn, ENOTSUP);
+        return;
+    } else if (p_item->key == -1) {
+        CmlDaemon_fail(p_item->conn, EINVAL);
+        return;
+    }
+
+    struct CmlDict_Field *p_field = p_state->fields + p_item->key;
+    if (p_field->value == NULL) {
+        CmlDaemon_fail(p_item->conn, ENOENT);
+        return;
+    }
+
+    size_t len = strlen(p_field->value) + 1;
+    struct CmlClient_Response response = { 0, p_field->flag, 0, 0, len, 0, 0 };
+    CmlDaemon_respond(p_item->conn, &response, p_field->value, len);
+}
+
+static void CmlDaemon_attach(struct CmlDaemon_State *p_state, struct CmlDaemon_Item *p_item)
+{
+    struct CmlDaemon_Conn *p_conn = p_item->conn;
+    size_t len = p_item->request.len < p_state->maxShared ? p_item->request.len : p_state->maxShared;
+    if (p_conn->shared != NULL || p_conn->outLen != p_conn->outOffset || len == 0) {
+        CmlDaemon_fail(p_conn, p_conn->shared != NULL ? EBUSY : EINVAL);
+        return;
+    }
+
+    int fd = memfd_create("cmld", MFD_CLOEXEC);
+    void *p_shared = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, len) == 0)
+        p_shared = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p_shared == MAP_FAILED) {
+        int err = errno;
+        if (fd >= 0)
+            close(fd);
+        CmlDaemon_fail(p_conn, err);
+        return;
+    }
+
+    struct CmlClient_Response response = { 0, 0, 1, 0, len, 0, 0 };
+    struct iovec iov = { &response, sizeof(response) };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *p_cmsg = CMSG_FIRSTHDR(&msg);
+    p_cmsg->cmsg_level = SOL_SOCKET;
+    p_cmsg->cmsg_type = SCM_RIGHTS;
+    p_cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(p_cmsg), &fd, sizeof(int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(p_conn->fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+
+    if (n != sizeof(response)) {
+        munmap(p_shared, len);
+        p_conn->isClosing = 1;
+        return;
+    }
+
+    p_conn->shared = p_shared;
+    p_conn->sharedLen = len;
+}
+
+static void CmlDaemon_write(struct CmlDaemon_Conn *p_conn)
+{
+    while (p_conn->outOffset < p_conn->outLen) {
+        ssize_t n = send(p_conn->fd, p_conn->out + p_conn->outOffset, p_conn->outLen - p_conn->outOffset, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                p_conn->isClosing = 1;
+            return;
+        }
+
+        p_conn->outOffset += n;
+    }
+
+    p_conn->outOffset = p_conn->outLen = 0;
+}
+
+static void CmlDaemon_serve(struct CmlDaemon_State *p_state, struct pollfd *p_fds)
+{
+    size_t i = 0;
+    p_state->itemsLen = p_state->keysLen = 0;
+    for (; i < p_state->connsLen; i++) {
+        struct CmlDaemon_Conn *p_conn = p_state->conns[i];
+        if (p_fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+            CmlDaemon_read(p_conn);
+        CmlDaemon_collect(p_state, p_conn);
+    }
+
+    if (p_state->keysLen != 0)
+        CmlDict_getMany(&p_state->dict, p_state->keys, p_state->keysLen, p_state->fields);
+
+    for (i = 0; i < p_state->itemsLen; i++) {
+        struct CmlDaemon_Item *p_item = p_state->items + i;
+        switch (p_item->request.op) {
+            case CmlClient_TOKENIZE: CmlDaemon_tokenize(p_item);
+            break;
+            case CmlClient_TOKENIZE_INTO: CmlDaemon_tokenizeInto(p_item);
+            break;
+            case CmlClient_GET: CmlDaemon_get(p_state, p_item);
+            break;
+            case CmlClient_ATTACH: CmlDaemon_attach(p_state, p_item);
+            break;
+        }
+    }
+
+    for (i = 0; i < p_state->connsLen; i++) {
+        struct CmlDaemon_Conn *p_conn = p_state->conns[i];
+        if (p_conn->inUsed != 0) {
+            memmove(p_conn->in, p_conn->in + p_conn->inUsed, p_conn->inLen - p_conn->inUsed);
+            p_conn->inLen -= p_conn->inUsed;
+            p_conn->inUsed = 0;
+        }
+        if (!p_conn->isClosing)
+            CmlDaemon_write(p_conn);
+    }
+
+    for (i = p_state->connsLen; i != 0; i--) {
+        if (p_state->conns[i - 1]->isClosing)
+            CmlDaemon_closeConn(p_state, i - 1);
+    }
+}
+
+static int CmlDaemon_listen(const char *p_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(p_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, p_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    struct CmlClient_Client client;
+    if (CmlClient_connect(&client, p_path, 0) == 0) {
+        CmlClient_close(&client);
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    unlink(p_path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+static int CmlDaemon_loadDict(struct CmlDaemon_State *p_state, const char *p_path)
+{
+    int fd = open(p_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno;
+
+    struct stat st;
+    void *p_buff = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        p_buff = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = p_buff == MAP_FAILED ? (errno != 0 ? errno : EINVAL) : 0;
+    close(fd);
+    if (err != 0)
+        return err;
+
+    if (CmlDict_open(&p_state->dict, p_buff, st.st_size) != 0) {
+        munmap(p_buff, st.st_size);
+        return EINVAL;
+    }
+
+    p_state->hasDict = 1;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct CmlDaemon_State state;
+    memset(&state, 0, sizeof(state));
+    state.maxShared = CmlDaemon_MAX_SHARED;
+    char *p_path = CmlClient_DEFAULT_PATH;
+    char *p_dictPath = NULL;
+
+    int i = 1;
+    for (; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            p_path = argv[++i];
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            p_dictPath = argv[++i];
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+            state.maxShared = strtoul(argv[++i], NULL, 0);
+        else
+            goto usage;
+    }
+
+    int err;
+    if (p_dictPath != NULL && (err = CmlDaemon_loadDict(&state, p_dictPath)) != 0) {
+        fprintf(stderr, "cmld: %s: %s\n", p_dictPath, strerror(err));
+        return 1;
+    }
+
+    state.listenFd = CmlDaemon_listen(p_path);
+    if (state.listenFd < 0) {
+        fprintf(stderr, "cmld: %s: %s\n", p_path, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &CmlDaemon_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct pollfd fds[CmlDaemon_MAX_CONNS + 1];
+    while (!CmlDaemon_isStopping) {
+        fds[0].fd = state.listenFd;
+        fds[0].events = POLLIN;
+        int timeout = -1;
+        size_t j = 0;
+        for (; j < state.connsLen; j++) {
+            struct CmlDaemon_Conn *p_conn = state.conns[j];
+            int isFull = CmlDaemon_PENDING(p_conn) > CmlDaemon_MAX_PENDING;
+            fds[j + 1].fd = p_conn->fd;
+            fds[j + 1].events = (isFull ? 0 : POLLIN) | (CmlDaemon_PENDING(p_conn) != 0 ? POLLOUT : 0);
+            fds[j + 1].revents = 0;
+
+            /* Requests held back by a full output buffer are taken without waiting for more input */
+            if (p_conn->isBlocked && !isFull)
+                timeout = 0;
+        }
+
+        if (poll(fds, state.connsLen + 1, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "cmld: poll: %s\n", strerror(errno));
+            break;
+        }
+
+        CmlDaemon_serve(&state, fds);
+        if (fds[0].revents & POLLIN)
+            CmlDaemon_accept(&state);
+    }
+
+    while (state.connsLen != 0)
+        CmlDaemon_closeConn(&state, state.connsLen - 1);
+    close(state.listenFd);
+    unlink(p_path);
+    free(state.items);
+    free(state.keys);
+    free(state.fields);
+    return 0;
+
+    usage:
+    fprintf(stderr, "usage: cmld [-s socket] [-d dictionary] [-m max-shared-bytes]\n");
+    return 2;
+}
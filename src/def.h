@@ -21,15 +21,35 @@ along with this program; if not, see
 #ifndef __DEF_H
 #define __DEF_H
 
-#if __STDC__ != 1
+#if defined(__GNUC__) || defined(__clang__)
+#define __Cml_INLINE __inline__
+#define __Cml_FORCE_INLINE __inline__ __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define __Cml_INLINE __inline
+#define __Cml_FORCE_INLINE __forceinline
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
 #define __Cml_INLINE inline
+#define __Cml_FORCE_INLINE inline
 #else
 #define __Cml_INLINE
+#define __Cml_FORCE_INLINE
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#define __Cml_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define __Cml_PREFETCH(p) ((void) 0)
+#endif
+
+/*
+Cml_DETECT is only ever passed to the UTF-16 and UTF-32 constructors,
+which then take the byte order from the mark; a buffer always holds
+Cml_BE or Cml_LE.
+*/
 enum Cml_Endianness {
     Cml_BE,
-    Cml_LE
+    Cml_LE,
+    Cml_DETECT
 };
 
 #endif
@@ -21,50 +21,595 @@ along with this program; if not, see
 #include <stddef.h>
 #include <string.h>
 #include <errno.h>
+#include "alloc.h"
+#include "tokenizer.h"
 #include "dict.h"
 
-static size_t CmlDict_hash(char *p_key, size_t max)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static __Cml_INLINE unsigned int CmlDict_matchGroup(unsigned char *p_ctrl, unsigned char fingerprint, unsigned int *p_empty)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((__m128i *) p_ctrl);
+    *p_empty = _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_setzero_si128()));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(fingerprint)));
+#else
+    unsigned int match = 0, empty = 0;
+    size_t i = 0;
+    for (; i < CmlDict_GROUP_SIZE; i++) {
+        match |= (unsigned int) (p_ctrl[i] == fingerprint) << i;
+        empty |= (unsigned int) (p_ctrl[i] == 0) << i;
+    }
+
+    *p_empty = empty;
+    return match;
+#endif
+}
+
+static __Cml_INLINE unsigned int CmlDict_lowestBit(unsigned int mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    unsigned int i = 0;
+    for (; !(mask & 1); mask >>= 1)
+        i++;
+    return i;
+#endif
+}
+
+unsigned long long CmlDict_digest(char *p_key, size_t *p_len)
 {
-    size_t digest = 0x43;
+    unsigned long long digest = CmlDict_DIGEST_BASIS;
     size_t i = 0;
     for (; p_key[i] != 0; i++)
-        digest += p_key[i] * 31;
-    return digest % max;
+        digest = (digest ^ (unsigned char) p_key[i]) * CmlDict_DIGEST_PRIME;
+    *p_len = i;
+    return digest;
 }
 
-static size_t CmlDict_findKey(struct CmlDict_Dict *p_dict, char *p_key)
+static __Cml_INLINE size_t CmlDict_readWord(unsigned char *p_byte)
 {
-    size_t i = CmlDict_hash(p_key, p_dict->size * 0.8);
+    return (size_t) p_byte[0] << 24 | p_byte[1] << 16 | p_byte[2] << 8 | p_byte[3];
+}
+
+static __Cml_INLINE size_t CmlDict_readVarint(unsigned char **p_p_byte)
+{
+    unsigned char *p_byte = *p_p_byte;
+    size_t value = 0;
+    unsigned int shift = 0;
+    for (; *p_byte & 0x80; shift += 7)
+        value |= (size_t) (*p_byte++ & 0x7F) << shift;
+    value |= (size_t) *p_byte++ << shift;
+    *p_p_byte = p_byte;
+    return value;
+}
+
+static size_t CmlDict_stringLength(unsigned char *p_buff, size_t len, size_t offset)
+{
+    unsigned char *p_end = offset < len ? memchr(p_buff + offset, 0, len - offset) : NULL;
+    return p_end != NULL ? (size_t) (p_end - p_buff) - offset : (size_t) -1;
+}
+
+static int CmlDict_checkVarint(unsigned char **p_p_byte, unsigned char *p_end, size_t *p_value)
+{
+    unsigned char *p_byte = *p_p_byte;
+    size_t value = 0;
+    unsigned int shift = 0;
+    for (; p_byte < p_end && shift <= 28; shift += 7) {
+        value |= (size_t) (*p_byte & 0x7F) << shift;
+        if (!(*p_byte++ & 0x80)) {
+            *p_p_byte = p_byte;
+            *p_value = value;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static size_t CmlDict_checkBlocks(unsigned char *p_buff, size_t len, size_t size, size_t blocks)
+{
+    size_t table = CmlDict_FRONT_BLOCKS_OFFSET(size);
+    size_t entries = 0;
+    size_t block = 0;
+
+    for (; block < blocks; block++) {
+        size_t start = CmlDict_readWord(p_buff + table + block * 4);
+        size_t end = block + 1 < blocks ? CmlDict_readWord(p_buff + table + block * 4 + 4) : len;
+        if (start < table + blocks * 4 || start >= end || end > len)
+            return -1;
+
+        unsigned char *p_byte = p_buff + start;
+        size_t keyLen = 0, prefix, suffixLen, ref;
+        size_t i = 0;
+        for (; p_byte < p_buff + end; i++) {
+            if (i == CmlDict_FRONT_BLOCK_SIZE
+                || !CmlDict_checkVarint(&p_byte, p_buff + end, &prefix)
+                || !CmlDict_checkVarint(&p_byte, p_buff + end, &suffixLen)
+                || prefix > keyLen || suffixLen >= (size_t) (p_buff + end - p_byte))
+                return -1;
+
+            p_byte += suffixLen + 1;
+            keyLen = prefix + suffixLen;
+            if (!CmlDict_checkVarint(&p_byte, p_buff + end, &ref) || CmlDict_stringLength(p_buff, len, ref) == -1)
+                return -1;
+        }
+
+        if (i < CmlDict_FRONT_BLOCK_SIZE && block + 1 < blocks)
+            return -1;
+        entries += i;
+    }
+
+    return entries;
+}
+
+/*
+Every slot, entry and block is checked here, once, so that lookups can
+follow the offsets they find without bounds checks.
+*/
+static int CmlDict_check(unsigned char *p_buff, size_t len, size_t size, size_t blocks)
+{
+    size_t entries = blocks != 0 ? CmlDict_checkBlocks(p_buff, len, size, blocks) : 0;
+    if (entries == -1)
+        return 0;
+
+    size_t i = size;
+    for (; i < size + CmlDict_GROUP_SIZE; i++) {
+        if (p_buff[i] != 0)
+            return 0;
+    }
+
+    for (i = 0; i < size; i++) {
+        if (p_buff[i] == 0)
+            continue;
+
+        if (blocks != 0) {
+            unsigned char *p_header = p_buff + CmlDict_FRONT_HEADER_OFFSET(size, i);
+            if (((size_t) p_header[1] << 16 | p_header[2] << 8 | p_header[3]) >= entries)
+                return 0;
+            continue;
+        }
+
+        unsigned char *p_header = p_buff + CmlDict_HEADER_OFFSET(size, i);
+        size_t keyLen = CmlDict_stringLength(p_buff, len, (p_header[4] << 8) | p_header[5]);
+        if (keyLen == -1 || (keyLen < CmlDict_MAX_KEY_LENGTH ? keyLen : CmlDict_MAX_KEY_LENGTH) != p_header[1]
+            || CmlDict_stringLength(p_buff, len, (p_header[2] << 8) | p_header[3]) == -1)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+A dictionary file written by mkdict -b is CmlDict_FILE_MAGIC, the slot
+count as four big-endian bytes, then the blob itself. A front-coded one
+(mkdict -b -c) is CmlDict_FRONT_FILE_MAGIC, the slot count and the block
+count, then the blob. A blob with any offset, entry index or block that
+points outside it is rejected with EINVAL.
+*/
+int CmlDict_open(struct CmlDict_Dict *p_dict, unsigned char *p_buff, size_t len)
+{
+    if (len < CmlDict_FILE_HEADER_SIZE)
+        return errno = EINVAL;
+
+    size_t size = CmlDict_readWord(p_buff + 4);
+    size_t headerSize, end, blocks = 0;
+    if (!memcmp(p_buff, CmlDict_FILE_MAGIC, 4)) {
+        headerSize = CmlDict_FILE_HEADER_SIZE;
+        end = CmlDict_HEADER_OFFSET(size, size);
+    } else if (!memcmp(p_buff, CmlDict_FRONT_FILE_MAGIC, 4) && len >= CmlDict_FRONT_FILE_HEADER_SIZE) {
+        headerSize = CmlDict_FRONT_FILE_HEADER_SIZE;
+        blocks = CmlDict_readWord(p_buff + 8);
+        end = CmlDict_FRONT_BLOCKS_OFFSET(size) + blocks * 4;
+    } else {
+        return errno = EINVAL;
+    }
+
+    /* Lookups take digests modulo the home range, which must not be empty */
+    if ((size_t) (size * 0.8) == 0 || end > len - headerSize || !CmlDict_check(p_buff + headerSize, len - headerSize, size, blocks))
+        return errno = EINVAL;
+
+    p_dict->buff = (char *) p_buff + headerSize;
+    p_dict->len = len - headerSize;
+    p_dict->size = size;
+    p_dict->blocks = blocks;
+    return 0;
+}
+
+size_t CmlDict_hash(char *p_key, size_t max)
+{
+    size_t len;
+    return CmlDict_digest(p_key, &len) % max;
+}
+
+/*
+Keys are tokenized without spans, so a span token has no packed form:
+it packs to nothing with errno set to ENOENT, and a token key holding
+one is never found.
+*/
+size_t CmlDict_packToken(unsigned int token, unsigned char *p_buff)
+{
+    if (CmlTokenizer_IS_SPAN_TOKEN(token)) {
+        errno = ENOENT;
+        return 0;
+    }
+
+    if (!CmlTokenizer_IS_RAW_TOKEN(token)) {
+        p_buff[0] = token;
+        return 1;
+    }
+
+    unsigned int code = token - CmlTokenizer_RAW_TOKEN(0);
+    if (code < 0x80) {
+        p_buff[0] = 0x80 | code;
+        return 1;
+    }
+
+    size_t len = 0;
+    p_buff[len++] = CmlDict_TOKEN_ESCAPE;
+    while (code >= 0x80) {
+        p_buff[len++] = 0x80 | (code & 0x7F);
+        code >>= 7;
+    }
+    p_buff[len++] = code;
+    return len;
+}
+
+size_t CmlDict_unpackToken(unsigned char *p_buff, unsigned int *p_token)
+{
+    if (p_buff[0] & 0x80) {
+        *p_token = CmlTokenizer_RAW_TOKEN(p_buff[0] & 0x7F);
+        return 1;
+    }
+
+    if (p_buff[0] != CmlDict_TOKEN_ESCAPE) {
+        *p_token = p_buff[0];
+        return 1;
+    }
+
+    unsigned char *p_byte = p_buff + 1;
+    *p_token = CmlTokenizer_RAW_TOKEN(CmlDict_readVarint(&p_byte));
+    return p_byte - p_buff;
+}
+
+unsigned long long CmlDict_digestToken(unsigned long long digest, unsigned int token, size_t *p_len)
+{
+    unsigned char packed[CmlDict_MAX_PACKED_TOKEN];
+    size_t n = CmlDict_packToken(token, packed);
+    size_t i = 0;
+    for (; i < n; i++)
+        digest = (digest ^ packed[i]) * CmlDict_DIGEST_PRIME;
+    *p_len += n;
+    return digest;
+}
+
+static __Cml_INLINE unsigned char *CmlDict_header(struct CmlDict_Dict *p_dict, size_t i)
+{
+    return (unsigned char *) p_dict->buff + (p_dict->blocks != 0
+        ? CmlDict_FRONT_HEADER_OFFSET(p_dict->size, i)
+        : CmlDict_HEADER_OFFSET(p_dict->size, i));
+}
+
+static int CmlDict_equalsString(struct CmlDict_Dict *p_dict, unsigned char *p_header, void *p_key, size_t keyLen)
+{
+    char *p_stored = p_dict->buff + ((p_header[4] << 8) | p_header[5]);
+    return keyLen < CmlDict_MAX_KEY_LENGTH
+        ? !memcmp(p_stored, p_key, keyLen)
+        : !strcmp(p_stored, p_key);
+}
+
+struct CmlDict_TokenKey {
+    CmlTokenizer_TokenStream tokens;
+    size_t n;
+};
+
+static int CmlDict_equalsTokens(struct CmlDict_Dict *p_dict, unsigned char *p_header, void *p_key, size_t keyLen)
+{
+    struct CmlDict_TokenKey *p_tokenKey = p_key;
+    unsigned char *p_byte = (unsigned char *) p_dict->buff + ((p_header[4] << 8) | p_header[5]);
+    size_t i = 0;
+
+    for (; i < p_tokenKey->n; i++) {
+        unsigned char packed[CmlDict_MAX_PACKED_TOKEN];
+        size_t n = CmlDict_packToken(p_tokenKey->tokens[i], packed);
+        if (n == 0 || memcmp(p_byte, packed, n))
+            return 0;
+        p_byte += n;
+    }
+
+    return *p_byte == 0;
+}
+
+/*
+In the front-coded layout the slot header holds the capped key length
+and the key's 24-bit index in sorted order. Keys are stored in blocks of
+CmlDict_FRONT_BLOCK_SIZE, each key as the length of the prefix it shares
+with the previous key in its block, the length of the rest, the rest,
+the flag byte and the value offset, all lengths and offsets as LEB128.
+Matching walks the block up to the key while tracking how much of the
+wanted key the current one shares, so no key is ever rebuilt.
+*/
+struct CmlDict_FrontKey {
+    unsigned char *key;
+    size_t ref;
+    unsigned char flag;
+};
+
+static int CmlDict_equalsFront(struct CmlDict_Dict *p_dict, unsigned char *p_header, void *p_key, size_t keyLen)
+{
+    struct CmlDict_FrontKey *p_frontKey = p_key;
+    size_t entry = (size_t) p_header[1] << 16 | p_header[2] << 8 | p_header[3];
+    size_t block = entry / CmlDict_FRONT_BLOCK_SIZE;
+    size_t last = entry % CmlDict_FRONT_BLOCK_SIZE;
+    if (block >= p_dict->blocks)
+        return 0;
+
+    unsigned char *p_byte = (unsigned char *) p_dict->buff + CmlDict_readWord((unsigned char *) p_dict->buff + CmlDict_FRONT_BLOCKS_OFFSET(p_dict->size) + block * 4);
+    size_t matched = 0, prefix, suffixLen;
+    unsigned char *p_suffix;
+    size_t i = 0;
+
+    for (;; i++) {
+        prefix = CmlDict_readVarint(&p_byte);
+        suffixLen = CmlDict_readVarint(&p_byte);
+        p_suffix = p_byte;
+        p_byte += suffixLen;
+        if (i == last)
+            break;
+
+        p_byte++;
+        CmlDict_readVarint(&p_byte);
+        if (prefix <= matched) {
+            size_t max = prefix + (keyLen - prefix < suffixLen ? keyLen - prefix : suffixLen);
+            matched = prefix;
+            while (matched < max && p_suffix[matched - prefix] == p_frontKey->key[matched])
+                matched++;
+        }
+    }
+
+    if (prefix > matched || prefix + suffixLen != keyLen || memcmp(p_suffix, p_frontKey->key + prefix, suffixLen))
+        return 0;
+
+    p_frontKey->flag = *p_byte++;
+    p_frontKey->ref = CmlDict_readVarint(&p_byte);
+    return 1;
+}
+
+static __Cml_INLINE int CmlDict_isSlot(struct CmlDict_Dict *p_dict, size_t slot, unsigned char shortLen, int (*equals)(struct CmlDict_Dict *, unsigned char *, void *, size_t), void *p_key, size_t keyLen)
+{
+    unsigned char *p_header = CmlDict_header(p_dict, slot);
+    return p_header[p_dict->blocks != 0 ? 0 : 1] == shortLen && equals(p_dict, p_header, p_key, keyLen);
+}
+
+static __Cml_INLINE size_t CmlDict_probe(struct CmlDict_Dict *p_dict, unsigned long long digest, size_t keyLen, int (*equals)(struct CmlDict_Dict *, unsigned char *, void *, size_t), void *p_key)
+{
+    unsigned char *p_ctrl = (unsigned char *) p_dict->buff;
+    unsigned char fingerprint = CmlDict_FINGERPRINT(digest);
+    unsigned char shortLen = keyLen < CmlDict_MAX_KEY_LENGTH ? keyLen : CmlDict_MAX_KEY_LENGTH;
+    size_t i = digest % (size_t) (p_dict->size * 0.8);
 
     size_t j = i;
-    for (; j < p_dict->size && (j - i) < CmlDict_MAX_SEARCH; j++) {
-        size_t headerOffset = j * CmlDict_HEADER_SIZE;
-        size_t keyRef = (p_dict->buff[headerOffset + 3] << 8) | p_dict->buff[headerOffset + 4];
-        if ((p_dict->buff[headerOffset] & 0b1) && !strcmp(p_dict->buff + keyRef, p_key))
-            return j;
+    for (; j < p_dict->size && (j - i) < CmlDict_MAX_SEARCH; j += CmlDict_GROUP_SIZE) {
+        unsigned int empty;
+        unsigned int match = CmlDict_matchGroup(p_ctrl + j, fingerprint, &empty);
+        if (empty)
+            match &= (empty & -empty) - 1;
+
+        for (; match != 0; match &= match - 1) {
+            size_t slot = j + CmlDict_lowestBit(match);
+            if (slot - i >= CmlDict_MAX_SEARCH)
+                break;
+
+            if (CmlDict_isSlot(p_dict, slot, shortLen, equals, p_key, keyLen))
+                return slot;
+        }
+
+        if (empty)
+            break;
     }
 
     errno = ENOENT;
     return -1;
 }
 
-int CmlDict_get(struct CmlDict_Dict *p_dict, char *p_key, struct CmlDict_Field *p_value)
+static size_t CmlDict_find(struct CmlDict_Dict *p_dict, unsigned long long digest, char *p_key, size_t keyLen, struct CmlDict_FrontKey *p_frontKey)
 {
-    size_t i = CmlDict_findKey(p_dict, p_key);
-    if (i == -1 && errno == ENOENT)
-        return ENOENT;
+    if (p_dict->blocks == 0)
+        return CmlDict_probe(p_dict, digest, keyLen, &CmlDict_equalsString, p_key);
+
+    p_frontKey->key = (unsigned char *) p_key;
+    return CmlDict_probe(p_dict, digest, keyLen, &CmlDict_equalsFront, p_frontKey);
+}
+
+static size_t CmlDict_findKey(struct CmlDict_Dict *p_dict, char *p_key, struct CmlDict_FrontKey *p_frontKey)
+{
+    size_t keyLen;
+    unsigned long long digest = CmlDict_digest(p_key, &keyLen);
+    return CmlDict_find(p_dict, digest, p_key, keyLen, p_frontKey);
+}
+
+static int CmlDict_read(struct CmlDict_Dict *p_dict, size_t i, struct CmlDict_FrontKey *p_frontKey, struct CmlDict_Field *p_value)
+{
+    size_t ref;
+    unsigned char flag;
+    if (p_dict->blocks != 0) {
+        ref = p_frontKey->ref;
+        flag = p_frontKey->flag;
+    } else {
+        unsigned char *p_header = CmlDict_header(p_dict, i);
+        ref = (p_header[2] << 8) | p_header[3];
+        flag = p_header[0];
+    }
 
-    size_t headerOffset = i * CmlDict_HEADER_SIZE;
-    size_t ref = (p_dict->buff[headerOffset + 1] << 8) | p_dict->buff[headerOffset + 2];
     if (p_dict->len <= ref)
         return errno = EINVAL;
 
     p_value->value = p_dict->buff + ref;
-    p_value->flag = p_dict->buff[headerOffset];
+    p_value->flag = flag;
     return 0;
 }
 
-__Cml_INLINE int CmlDict_has(struct CmlDict_Dict *p_dict, char *p_key)
+int CmlDict_get(struct CmlDict_Dict *p_dict, char *p_key, struct CmlDict_Field *p_value)
+{
+    struct CmlDict_FrontKey frontKey;
+    size_t i = CmlDict_findKey(p_dict, p_key, &frontKey);
+    if (i == -1 && errno == ENOENT)
+        return ENOENT;
+
+    return CmlDict_read(p_dict, i, &frontKey, p_value);
+}
+
+int CmlDict_getDigest(struct CmlDict_Dict *p_dict, char *p_key, size_t keyLen, unsigned long long digest, struct CmlDict_Field *p_value)
+{
+    struct CmlDict_FrontKey frontKey;
+    size_t i = CmlDict_find(p_dict, digest, p_key, keyLen, &frontKey);
+    if (i == -1 && errno == ENOENT)
+        return ENOENT;
+
+    return CmlDict_read(p_dict, i, &frontKey, p_value);
+}
+
+static int CmlDict_getPackedDigest(struct CmlDict_Dict *p_dict, CmlTokenizer_TokenStream p_tokens, size_t n, unsigned long long digest, size_t keyLen, struct CmlDict_Field *p_value)
+{
+    unsigned char buff[CmlDict_MAX_KEY_LENGTH + 1];
+    unsigned char *p_packed = keyLen < sizeof(buff) ? buff : CmlAlloc_alloc(NULL, keyLen + 1);
+    if (p_packed == NULL)
+        return errno = ENOMEM;
+
+    size_t len = 0;
+    size_t i = 0;
+    for (; i < n; i++) {
+        size_t packedLen = CmlDict_packToken(p_tokens[i], p_packed + len);
+        if (packedLen == 0)
+            break;
+        len += packedLen;
+    }
+    p_packed[len] = 0;
+
+    int err = i < n ? ENOENT : CmlDict_getDigest(p_dict, (char *) p_packed, keyLen, digest, p_value);
+    if (p_packed != buff)
+        CmlAlloc_free(NULL, p_packed);
+    return err;
+}
+
+int CmlDict_getTokensDigest(struct CmlDict_Dict *p_dict, CmlTokenizer_TokenStream p_tokens, size_t n, unsigned long long digest, size_t keyLen, struct CmlDict_Field *p_value)
+{
+    if (p_dict->blocks != 0)
+        return CmlDict_getPackedDigest(p_dict, p_tokens, n, digest, keyLen, p_value);
+
+    struct CmlDict_TokenKey tokenKey = { p_tokens, n };
+    size_t i = CmlDict_probe(p_dict, digest, keyLen, &CmlDict_equalsTokens, &tokenKey);
+    if (i == -1 && errno == ENOENT)
+        return ENOENT;
+
+    return CmlDict_read(p_dict, i, NULL, p_value);
+}
+
+int CmlDict_getTokens(struct CmlDict_Dict *p_dict, CmlTokenizer_TokenStream p_tokens, size_t n, struct CmlDict_Field *p_value)
+{
+    unsigned long long digest = CmlDict_DIGEST_BASIS;
+    size_t keyLen = 0;
+    size_t i = 0;
+    for (; i < n; i++)
+        digest = CmlDict_digestToken(digest, p_tokens[i], &keyLen);
+
+    return CmlDict_getTokensDigest(p_dict, p_tokens, n, digest, keyLen, p_value);
+}
+
+/*
+Each batch walks its keys in passes so that the loads of one pass are in
+flight together: the control groups, then the header of every candidate
+slot in each home group, then the key or block offset behind every
+candidate whose length matches. The last pass compares against those
+candidates directly; only a key whose home group is full and holds no
+match goes on to an ordinary probe.
+*/
+size_t CmlDict_getMany(struct CmlDict_Dict *p_dict, char **p_keys, size_t n, struct CmlDict_Field *p_values)
+{
+    unsigned long long digests[CmlDict_BATCH_SIZE];
+    size_t keyLens[CmlDict_BATCH_SIZE];
+    unsigned int matches[CmlDict_BATCH_SIZE];
+    unsigned int empties[CmlDict_BATCH_SIZE];
+    int (*equals)(struct CmlDict_Dict *, unsigned char *, void *, size_t) = p_dict->blocks != 0 ? &CmlDict_equalsFront : &CmlDict_equalsString;
+    unsigned char *p_ctrl = (unsigned char *) p_dict->buff;
+    size_t max = p_dict->size * 0.8;
+    size_t found = 0;
+    size_t base = 0;
+
+    for (; base < n; base += CmlDict_BATCH_SIZE) {
+        size_t batch = n - base < CmlDict_BATCH_SIZE ? n - base : CmlDict_BATCH_SIZE;
+        size_t i = 0;
+
+        for (; i < batch; i++) {
+            digests[i] = CmlDict_digest(p_keys[base + i], &keyLens[i]);
+            __Cml_PREFETCH(p_ctrl + digests[i] % max);
+        }
+
+        for (i = 0; i < batch; i++) {
+            size_t home = digests[i] % max;
+            unsigned int match = CmlDict_matchGroup(p_ctrl + home, CmlDict_FINGERPRINT(digests[i]), &empties[i]);
+            if (empties[i])
+                match &= (empties[i] & -empties[i]) - 1;
+
+            matches[i] = match;
+            for (; match != 0; match &= match - 1)
+                __Cml_PREFETCH(CmlDict_header(p_dict, home + CmlDict_lowestBit(match)));
+        }
+
+        for (i = 0; i < batch; i++) {
+            size_t home = digests[i] % max;
+            unsigned char shortLen = keyLens[i] < CmlDict_MAX_KEY_LENGTH ? keyLens[i] : CmlDict_MAX_KEY_LENGTH;
+            unsigned int match = matches[i];
+            for (; match != 0; match &= match - 1) {
+                unsigned char *p_header = CmlDict_header(p_dict, home + CmlDict_lowestBit(match));
+                if (p_dict->blocks != 0) {
+                    size_t block = ((size_t) p_header[1] << 16 | p_header[2] << 8 | p_header[3]) / CmlDict_FRONT_BLOCK_SIZE;
+                    if (p_header[0] == shortLen)
+                        __Cml_PREFETCH(p_dict->buff + CmlDict_FRONT_BLOCKS_OFFSET(p_dict->size) + block * 4);
+                } else if (p_header[1] == shortLen) {
+                    __Cml_PREFETCH(p_dict->buff + ((p_header[4] << 8) | p_header[5]));
+                }
+            }
+        }
+
+        for (i = 0; i < batch; i++) {
+            struct CmlDict_FrontKey frontKey;
+            void *p_key = p_keys[base + i];
+            if (p_dict->blocks != 0) {
+                frontKey.key = (unsigned char *) p_keys[base + i];
+                p_key = &frontKey;
+            }
+
+            size_t home = digests[i] % max;
+            unsigned char shortLen = keyLens[i] < CmlDict_MAX_KEY_LENGTH ? keyLens[i] : CmlDict_MAX_KEY_LENGTH;
+            size_t j = -1;
+            unsigned int match = matches[i];
+            for (; match != 0 && j == -1; match &= match - 1) {
+                size_t slot = home + CmlDict_lowestBit(match);
+                if (CmlDict_isSlot(p_dict, slot, shortLen, equals, p_key, keyLens[i]))
+                    j = slot;
+            }
+
+            if (j == -1 && !empties[i])
+                j = CmlDict_find(p_dict, digests[i], p_keys[base + i], keyLens[i], &frontKey);
+            if (j == -1 || CmlDict_read(p_dict, j, &frontKey, p_values + base + i)) {
+                p_values[base + i].value = NULL;
+                p_values[base + i].flag = 0;
+                continue;
+            }
+
+            found++;
+        }
+    }
+
+    return found;
+}
+
+int CmlDict_has(struct CmlDict_Dict *p_dict, char *p_key)
 {
-    return CmlDict_findKey(p_dict, p_key) != -1 || errno != ENOENT;
+    struct CmlDict_FrontKey frontKey;
+    return CmlDict_findKey(p_dict, p_key, &frontKey) != -1 || errno != ENOENT;
 }
@@ -23,17 +23,41 @@ along with this program; if not, see
 
 #include <stddef.h>
 #include "def.h"
+#include "tokenizer.h"
 
 #define CmlDict_DICT_SIZE 1024
 #define CmlDict_MAX_SEARCH 512
-#define CmlDict_HEADER_SIZE 5
+#define CmlDict_HEADER_SIZE 6
+#define CmlDict_BATCH_SIZE 16
+#define CmlDict_GROUP_SIZE 16
+#define CmlDict_MAX_KEY_LENGTH 0xFF
+#define CmlDict_DIGEST_BASIS 0xCBF29CE484222325ULL
+#define CmlDict_DIGEST_PRIME 0x100000001B3ULL
+#define CmlDict_TOKEN_ESCAPE 0x3D
+#define CmlDict_MAX_PACKED_TOKEN 6
+#define CmlDict_FILE_MAGIC "CmlD"
+#define CmlDict_FILE_HEADER_SIZE 8
+#define CmlDict_FRONT_FILE_MAGIC "CmlF"
+#define CmlDict_FRONT_FILE_HEADER_SIZE 12
+#define CmlDict_FRONT_HEADER_SIZE 4
+#define CmlDict_FRONT_BLOCK_SIZE 16
+#define CmlDict_FRONT_MAX_ENTRIES 0x1000000
+#define CmlDict_FINGERPRINT(digest) (0x80 | ((digest) >> 57))
+#define CmlDict_HEADERS_OFFSET(size) ((size) + CmlDict_GROUP_SIZE)
+#define CmlDict_HEADER_OFFSET(size, i) (CmlDict_HEADERS_OFFSET(size) + (i) * CmlDict_HEADER_SIZE)
+#define CmlDict_FRONT_HEADER_OFFSET(size, i) (CmlDict_HEADERS_OFFSET(size) + (i) * CmlDict_FRONT_HEADER_SIZE)
+#define CmlDict_FRONT_BLOCKS_OFFSET(size) CmlDict_FRONT_HEADER_OFFSET(size, size)
 
 extern unsigned char *___Dict_bin;
+extern size_t ___Dict_bin_len;
+extern size_t ___Dict_bin_size;
+extern size_t ___Dict_bin_blocks;
 
 struct CmlDict_Dict {
     char *buff;
     size_t len;
     size_t size;
+    size_t blocks;
 };
 
 struct CmlDict_Field {
@@ -41,7 +65,17 @@ struct CmlDict_Field {
     unsigned char flag;
 };
 
+int CmlDict_open(struct CmlDict_Dict *p_dict, unsigned char *p_buff, size_t len);
+unsigned long long CmlDict_digest(char *p_key, size_t *p_len);
+size_t CmlDict_hash(char *p_key, size_t max);
+size_t CmlDict_packToken(unsigned int token, unsigned char *p_buff);
+size_t CmlDict_unpackToken(unsigned char *p_buff, unsigned int *p_token);
+unsigned long long CmlDict_digestToken(unsigned long long digest, unsigned int token, size_t *p_len);
 int CmlDict_get(struct CmlDict_Dict *p_dict, char *p_key, struct CmlDict_Field *p_value);
+int CmlDict_getDigest(struct CmlDict_Dict *p_dict, char *p_key, size_t keyLen, unsigned long long digest, struct CmlDict_Field *p_value);
+int CmlDict_getTokens(struct CmlDict_Dict *p_dict, CmlTokenizer_TokenStream p_tokens, size_t n, struct CmlDict_Field *p_value);
+int CmlDict_getTokensDigest(struct CmlDict_Dict *p_dict, CmlTokenizer_TokenStream p_tokens, size_t n, unsigned long long digest, size_t keyLen, struct CmlDict_Field *p_value);
+size_t CmlDict_getMany(struct CmlDict_Dict *p_dict, char **p_keys, size_t n, struct CmlDict_Field *p_values);
 int CmlDict_has(struct CmlDict_Dict *p_dict, char *p_key);
 
 #endif
@@ -0,0 +1,260 @@
+/*
+edit.c - Re-tokenize only the part of a document touched by an edit
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+A token covers one or two code points, or more when combining marks
+compose into them, and what it is depends only on the
+CmlTokenizer_MAX_LOOKAHEAD bytes from its start, so tokenizing from any
+token boundary gives the same tokens as tokenizing from the start. That
+holds for digraphs, '$' escapes, '[' ']' and composed marks alike.
+
+An edit can only change the tokens that start fewer than
+CmlTokenizer_MAX_LOOKAHEAD bytes before its first byte, so
+re-tokenization begins at the last token before those. It stops at the
+first new token past the inserted bytes whose start maps onto an old
+token start; everything from that token on is unchanged apart from its
+byte offset.
+
+Tokens before the gap hold their byte offset, tokens after it their
+distance from the end of the document, which an edit in front of them
+does not change. Each edit moves the gap to the token it starts at and
+replaces the re-tokenized window there, so its cost grows with the edit
+and its distance from the previous one rather than with the document.
+*/
+
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include "def.h"
+#include "utf.h"
+#include "alloc.h"
+#include "tokenizer.h"
+#include "edit.h"
+
+#define CmlEdit_MIN_WINDOW 16
+#define CmlEdit_AFTER_GAP(p_doc, i) ((i) + (p_doc)->capacity - (p_doc)->tokenStreamLen)
+
+static int CmlEdit_reserve(struct CmlEdit_Document *p_doc, size_t capacity)
+{
+    if (capacity <= p_doc->capacity && p_doc->tokenStream != NULL)
+        return 0;
+
+    CmlTokenizer_TokenStream tokenStream = CmlAlloc_realloc(p_doc->allocator, p_doc->tokenStream, sizeof(unsigned int) * (capacity + 1));
+    if (tokenStream == NULL)
+        return ENOMEM;
+    p_doc->tokenStream = tokenStream;
+
+    size_t *p_offsets = CmlAlloc_realloc(p_doc->allocator, p_doc->offsets, sizeof(size_t) * (capacity + 1));
+    if (p_offsets == NULL)
+        return ENOMEM;
+    p_doc->offsets = p_offsets;
+
+    /* The tokens after the gap move up to the new end */
+    size_t tailLen = p_doc->tokenStreamLen + 1 - p_doc->gapStart;
+    size_t from = CmlEdit_AFTER_GAP(p_doc, p_doc->gapStart);
+    size_t to = p_doc->gapStart + capacity - p_doc->tokenStreamLen;
+    memmove(p_doc->tokenStream + to, p_doc->tokenStream + from, sizeof(unsigned int) * tailLen);
+    memmove(p_doc->offsets + to, p_doc->offsets + from, sizeof(size_t) * tailLen);
+
+    p_doc->capacity = capacity;
+    return 0;
+}
+
+static void CmlEdit_moveGap(struct CmlEdit_Document *p_doc, size_t gapStart)
+{
+    unsigned int *p_tokens = p_doc->tokenStream;
+    size_t *p_offsets = p_doc->offsets;
+    while (p_doc->gapStart < gapStart) {
+        size_t i = p_doc->gapStart++;
+        p_tokens[i] = p_tokens[CmlEdit_AFTER_GAP(p_doc, i)];
+        p_offsets[i] = p_doc->len - p_offsets[CmlEdit_AFTER_GAP(p_doc, i)];
+    }
+
+    while (p_doc->gapStart > gapStart) {
+        size_t i = --p_doc->gapStart;
+        p_tokens[CmlEdit_AFTER_GAP(p_doc, i)] = p_tokens[i];
+        p_offsets[CmlEdit_AFTER_GAP(p_doc, i)] = p_doc->len - p_offsets[i];
+    }
+}
+
+static size_t CmlEdit_nextToken(struct CmlUTF_Buffer *p_utf, unsigned int *p_token)
+{
+    unsigned int tokens[2];
+    size_t n = CmlTokenizer_tokenizationUTFInto(p_utf, tokens, 2);
+    *p_token = tokens[0];
+    return n;
+}
+
+int CmlEdit_new(struct CmlEdit_Document *p_doc, struct CmlUTF_Buffer *p_utf, struct CmlAlloc_Allocator *p_allocator)
+{
+    p_doc->allocator = CmlAlloc_resolve(p_allocator);
+    p_doc->tokenStream = NULL;
+    p_doc->offsets = NULL;
+    p_doc->tokenStreamLen = 0;
+    p_doc->capacity = 0;
+    p_doc->gapStart = 1;
+    p_doc->len = 0;
+    if (p_utf->segments != NULL)
+        return EINVAL;
+
+    int currErrno = errno;
+    if (CmlEdit_reserve(p_doc, CmlUTF_count(p_utf))) {
+        CmlEdit_destroy(p_doc);
+        return ENOMEM;
+    }
+
+    struct CmlUTF_Buffer utf = *p_utf;
+    size_t i = 0;
+    while (utf.currIndex < utf.len) {
+        if (i == p_doc->capacity && CmlEdit_reserve(p_doc, i + CmlUTF_maxCount(&utf))) {
+            CmlEdit_destroy(p_doc);
+            return ENOMEM;
+        }
+
+        p_doc->offsets[i] = utf.currIndex;
+        if (CmlEdit_nextToken(&utf, p_doc->tokenStream + i) == 0)
+            break;
+        i++;
+    }
+
+    p_doc->offsets[i] = utf.len;
+    p_doc->tokenStream[i] = CmlTokenizer_END_OF_TOKEN;
+    p_doc->tokenStreamLen = i;
+    p_doc->gapStart = i + 1;
+    p_doc->len = utf.len;
+    errno = currErrno;
+    return 0;
+}
+
+void CmlEdit_destroy(struct CmlEdit_Document *p_doc)
+{
+    CmlAlloc_free(p_doc->allocator, p_doc->tokenStream);
+    CmlAlloc_free(p_doc->allocator, p_doc->offsets);
+    p_doc->tokenStream = NULL;
+    p_doc->offsets = NULL;
+    p_doc->tokenStreamLen = 0;
+    p_doc->capacity = 0;
+    p_doc->gapStart = 1;
+    p_doc->len = 0;
+}
+
+unsigned int CmlEdit_token(struct CmlEdit_Document *p_doc, size_t i)
+{
+    return p_doc->tokenStream[i < p_doc->gapStart ? i : CmlEdit_AFTER_GAP(p_doc, i)];
+}
+
+size_t CmlEdit_offset(struct CmlEdit_Document *p_doc, size_t i)
+{
+    return i < p_doc->gapStart ? p_doc->offsets[i] : p_doc->len - p_doc->offsets[CmlEdit_AFTER_GAP(p_doc, i)];
+}
+
+CmlTokenizer_TokenStream CmlEdit_tokenStream(struct CmlEdit_Document *p_doc)
+{
+    CmlEdit_moveGap(p_doc, p_doc->tokenStreamLen + 1);
+    return p_doc->tokenStream;
+}
+
+int CmlEdit_apply(struct CmlEdit_Document *p_doc, struct CmlUTF_Buffer *p_utf, size_t start, size_t removedLen, size_t insertedLen, struct CmlEdit_Change *p_change)
+{
+    size_t n = p_doc->tokenStreamLen;
+    size_t oldLen = p_doc->len;
+    if (p_utf->segments != NULL || start + removedLen > oldLen || p_utf->len != oldLen - removedLen + insertedLen)
+        return EINVAL;
+
+    size_t from = start > CmlTokenizer_MAX_LOOKAHEAD ? start - CmlTokenizer_MAX_LOOKAHEAD : 0;
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (CmlEdit_offset(p_doc, mid) < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    size_t first = lo != 0 ? lo - 1 : 0;
+    size_t editEnd = start + insertedLen;
+    size_t capacity = CmlEdit_MIN_WINDOW;
+    unsigned int *p_tokens = CmlAlloc_alloc(p_doc->allocator, sizeof(unsigned int) * capacity);
+    size_t *p_windowOffsets = CmlAlloc_alloc(p_doc->allocator, sizeof(size_t) * capacity);
+    if (p_tokens == NULL || p_windowOffsets == NULL)
+        goto noMemory;
+
+    int currErrno = errno;
+    struct CmlUTF_Buffer utf = *p_utf;
+    if (first != 0)
+        utf.currIndex = CmlEdit_offset(p_doc, first);
+
+    size_t j = first;
+    size_t m = 0;
+    while (1) {
+        size_t currIndex = utf.currIndex;
+        if (currIndex >= editEnd) {
+            size_t oldIndex = currIndex - insertedLen + removedLen;
+            while (j < n && CmlEdit_offset(p_doc, j) < oldIndex)
+                j++;
+            if (CmlEdit_offset(p_doc, j) == oldIndex)
+                break;
+        }
+
+        if (m == capacity) {
+            capacity *= 2;
+            unsigned int *p_newTokens = CmlAlloc_realloc(p_doc->allocator, p_tokens, sizeof(unsigned int) * capacity);
+            if (p_newTokens != NULL)
+                p_tokens = p_newTokens;
+            size_t *p_newOffsets = CmlAlloc_realloc(p_doc->allocator, p_windowOffsets, sizeof(size_t) * capacity);
+            if (p_newOffsets != NULL)
+                p_windowOffsets = p_newOffsets;
+            if (p_newTokens == NULL || p_newOffsets == NULL)
+                goto noMemory;
+        }
+
+        p_windowOffsets[m] = currIndex;
+        if (CmlEdit_nextToken(&utf, p_tokens + m) == 0)
+            break;
+        m++;
+    }
+    errno = currErrno;
+
+    /* Grow geometrically, a gap that is used up would otherwise be regrown on every edit */
+    size_t removed = j - first;
+    if (n - removed + m > p_doc->capacity && CmlEdit_reserve(p_doc, n - removed + m > p_doc->capacity * 2 ? n - removed + m : p_doc->capacity * 2))
+        goto noMemory;
+
+    /* The removed tokens sit just after the gap, which swallows them; the tail keeps its distance from the end */
+    CmlEdit_moveGap(p_doc, first);
+    p_doc->tokenStreamLen = n - removed;
+    memcpy(p_doc->tokenStream + first, p_tokens, sizeof(unsigned int) * m);
+    memcpy(p_doc->offsets + first, p_windowOffsets, sizeof(size_t) * m);
+    p_doc->gapStart = first + m;
+    p_doc->tokenStreamLen += m;
+    p_doc->len = p_utf->len;
+
+    p_change->first = first;
+    p_change->removed = removed;
+    p_change->inserted = m;
+    CmlAlloc_free(p_doc->allocator, p_tokens);
+    CmlAlloc_free(p_doc->allocator, p_windowOffsets);
+    return 0;
+
+    noMemory:
+    CmlAlloc_free(p_doc->allocator, p_tokens);
+    CmlAlloc_free(p_doc->allocator, p_windowOffsets);
+    return ENOMEM;
+}
@@ -0,0 +1,61 @@
+/*
+edit.h - Re-tokenize only the part of a document touched by an edit
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EDIT_H
+#define __EDIT_H
+
+#include <stddef.h>
+#include "def.h"
+#include "utf.h"
+#include "alloc.h"
+#include "tokenizer.h"
+
+/*
+The tokens and their offsets are kept in a gap buffer that stays where
+the last edit was, so tokenStream and offsets are not plain arrays.
+Read them through CmlEdit_token and CmlEdit_offset, or call
+CmlEdit_tokenStream first, which closes the gap and leaves both arrays
+in order, ending with CmlTokenizer_END_OF_TOKEN and the document length,
+until the next edit.
+*/
+struct CmlEdit_Document {
+    CmlTokenizer_TokenStream tokenStream;
+    size_t *offsets;
+    size_t tokenStreamLen;
+    size_t capacity;
+    size_t gapStart;
+    size_t len;
+    struct CmlAlloc_Allocator *allocator;
+};
+
+struct CmlEdit_Change {
+    size_t first;
+    size_t removed;
+    size_t inserted;
+};
+
+int CmlEdit_new(struct CmlEdit_Document *p_doc, struct CmlUTF_Buffer *p_utf, struct CmlAlloc_Allocator *p_allocator);
+void CmlEdit_destroy(struct CmlEdit_Document *p_doc);
+int CmlEdit_apply(struct CmlEdit_Document *p_doc, struct CmlUTF_Buffer *p_utf, size_t start, size_t removedLen, size_t insertedLen, struct CmlEdit_Change *p_change);
+unsigned int CmlEdit_token(struct CmlEdit_Document *p_doc, size_t i);
+size_t CmlEdit_offset(struct CmlEdit_Document *p_doc, size_t i);
+CmlTokenizer_TokenStream CmlEdit_tokenStream(struct CmlEdit_Document *p_doc);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+job.c - Run tokenization jobs on a pool of worker threads
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "def.h"
+#include "utf.h"
+#include "alloc.h"
+#include "tokenizer.h"
+#include "job.h"
+
+static void CmlJob_push(struct CmlJob_Queue *p_queue, struct CmlJob_Job *p_job)
+{
+    p_job->next = NULL;
+    pthread_mutex_lock(&p_queue->lock);
+    if (p_queue->tail == NULL)
+        p_queue->head = p_job;
+    else
+        p_queue->tail->next = p_job;
+    p_queue->tail = p_job;
+    pthread_mutex_unlock(&p_queue->lock);
+}
+
+static struct CmlJob_Job *CmlJob_pop(struct CmlJob_Queue *p_queue)
+{
+    pthread_mutex_lock(&p_queue->lock);
+    struct CmlJob_Job *p_job = p_queue->head;
+    if (p_job != NULL) {
+        p_queue->head = p_job->next;
+        if (p_queue->head == NULL)
+            p_queue->tail = NULL;
+    }
+    pthread_mutex_unlock(&p_queue->lock);
+    return p_job;
+}
+
+static struct CmlJob_Job *CmlJob_take(struct CmlJob_Pool *p_pool, size_t self)
+{
+    struct CmlJob_Job *p_job = NULL;
+    while (p_job == NULL) {
+        size_t i = 0;
+        for (; i < p_pool->workers && p_job == NULL; i++)
+            p_job = CmlJob_pop(&p_pool->queues[(self + i) % p_pool->workers]);
+    }
+
+    return p_job;
+}
+
+static void CmlJob_finish(struct CmlJob_Pool *p_pool, struct CmlJob_Job *p_job, enum CmlJob_State state)
+{
+    int eventFd = p_job->eventFd;
+    if (p_job->callback != NULL)
+        p_job->callback(p_job, p_job->p_data);
+
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool->depth--;
+    pthread_cond_signal(&p_pool->notFull);
+    pthread_mutex_unlock(&p_pool->lock);
+
+    /* The owner may release the job as soon as the state is final, so it is published last */
+    atomic_store(&p_job->state, state);
+    if (eventFd >= 0) {
+        uint64_t one = 1;
+        while (write(eventFd, &one, sizeof(one)) == -1 && errno == EINTR);
+    }
+}
+
+static int CmlJob_step(struct CmlJob_Pool *p_pool, struct CmlJob_Job *p_job)
+{
+    if (atomic_load(&p_job->cancel)) {
+        CmlAlloc_free(p_job->allocator, p_job->tokenStream);
+        p_job->tokenStream = NULL;
+        p_job->tokenStreamLen = 0;
+        CmlJob_finish(p_pool, p_job, CmlJob_CANCELLED);
+        return 1;
+    }
+
+    if (p_job->tokenStream == NULL) {
+        atomic_store(&p_job->state, CmlJob_RUNNING);
+        p_job->capacity = CmlUTF_count(&p_job->utf) + 1;
+        p_job->tokenStream = CmlAlloc_alloc(p_job->allocator, sizeof(enum CmlTokenizer_Token) * p_job->capacity);
+        if (p_job->tokenStream == NULL) {
+            p_job->error = ENOMEM;
+            CmlJob_finish(p_pool, p_job, CmlJob_FAILED);
+            return 1;
+        }
+    }
+
+    size_t room = p_job->capacity - p_job->tokenStreamLen;
+    size_t len = room > p_pool->chunk + 1 ? p_pool->chunk + 1 : room;
+    errno = 0;
+    p_job->tokenStreamLen += CmlTokenizer_tokenizationUTFInto(&p_job->utf, p_job->tokenStream + p_job->tokenStreamLen, len);
+    if (errno == ENOBUFS) {
+        if (len < room)
+            return 0;
+
+        /* The count only covers lead octets, invalid input can need more room */
+        size_t capacity = p_job->tokenStreamLen + CmlUTF_maxCount(&p_job->utf) + 1;
+        CmlTokenizer_TokenStream tokenStream = CmlAlloc_realloc(p_job->allocator, p_job->tokenStream, sizeof(enum CmlTokenizer_Token) * capacity);
+        if (tokenStream == NULL) {
+            p_job->error = ENOMEM;
+            CmlJob_finish(p_pool, p_job, CmlJob_FAILED);
+            return 1;
+        }
+
+        p_job->tokenStream = tokenStream;
+        p_job->capacity = capacity;
+        return 0;
+    }
+
+    CmlJob_finish(p_pool, p_job, CmlJob_DONE);
+    return 1;
+}
+
+static void *CmlJob_work(void *p_arg)
+{
+    struct CmlJob_Pool *p_pool = p_arg;
+
+    pthread_mutex_lock(&p_pool->lock);
+    size_t self = p_pool->started++;
+    while (1) {
+        while (p_pool->queued == 0 && !p_pool->stopping)
+            pthread_cond_wait(&p_pool->notEmpty, &p_pool->lock);
+        if (p_pool->queued == 0)
+            break;
+
+        p_pool->queued--;
+        pthread_mutex_unlock(&p_pool->lock);
+
+        struct CmlJob_Job *p_job = CmlJob_take(p_pool, self);
+        while (!CmlJob_step(p_pool, p_job)) {
+            pthread_mutex_lock(&p_pool->lock);
+            int isContended = p_pool->queued != 0;
+            pthread_mutex_unlock(&p_pool->lock);
+
+            if (isContended) {
+                CmlJob_push(&p_pool->queues[self], p_job);
+                pthread_mutex_lock(&p_pool->lock);
+                p_pool->queued++;
+                pthread_cond_signal(&p_pool->notEmpty);
+                pthread_mutex_unlock(&p_pool->lock);
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&p_pool->lock);
+    }
+
+    pthread_mutex_unlock(&p_pool->lock);
+    return NULL;
+}
+
+int CmlJob_newPool(struct CmlJob_Pool *p_pool, size_t workers, size_t maxDepth, size_t chunk, struct CmlAlloc_Allocator *p_allocator)
+{
+    if (workers == 0 || maxDepth == 0)
+        return EINVAL;
+
+    p_pool->workers = workers;
+    p_pool->chunk = chunk == 0 ? CmlJob_DEFAULT_CHUNK : chunk;
+    p_pool->maxDepth = maxDepth;
+    p_pool->depth = 0;
+    p_pool->queued = 0;
+    p_pool->nextQueue = 0;
+    p_pool->started = 0;
+    p_pool->stopping = 0;
+    p_pool->allocator = CmlAlloc_resolve(p_allocator);
+    p_pool->threads = CmlAlloc_alloc(p_pool->allocator, sizeof(pthread_t) * workers);
+    p_pool->queues = CmlAlloc_alloc(p_pool->allocator, sizeof(struct CmlJob_Queue) * workers);
+    if (p_pool->threads == NULL || p_pool->queues == NULL) {
+        CmlAlloc_free(p_pool->allocator, p_pool->threads);
+        CmlAlloc_free(p_pool->allocator, p_pool->queues);
+        return ENOMEM;
+    }
+
+    pthread_mutex_init(&p_pool->lock, NULL);
+    pthread_cond_init(&p_pool->notEmpty, NULL);
+    pthread_cond_init(&p_pool->notFull, NULL);
+
+    size_t i = 0;
+    for (; i < workers; i++) {
+        pthread_mutex_init(&p_pool->queues[i].lock, NULL);
+        p_pool->queues[i].head = NULL;
+        p_pool->queues[i].tail = NULL;
+    }
+
+    for (i = 0; i < workers; i++) {
+        int err = pthread_create(&p_pool->threads[i], NULL, &CmlJob_work, p_pool);
+        if (err != 0) {
+            p_pool->workers = i;
+            CmlJob_destroyPool(p_pool);
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+void CmlJob_destroyPool(struct CmlJob_Pool *p_pool)
+{
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool->stopping = 1;
+    pthread_cond_broadcast(&p_pool->notEmpty);
+    pthread_cond_broadcast(&p_pool->notFull);
+    pthread_mutex_unlock(&p_pool->lock);
+
+    size_t i = 0;
+    for (; i < p_pool->workers; i++)
+        pthread_join(p_pool->threads[i], NULL);
+
+    for (i = 0; i < p_pool->workers; i++)
+        pthread_mutex_destroy(&p_pool->queues[i].lock);
+
+    pthread_cond_destroy(&p_pool->notFull);
+    pthread_cond_destroy(&p_pool->notEmpty);
+    pthread_mutex_destroy(&p_pool->lock);
+    CmlAlloc_free(p_pool->allocator, p_pool->queues);
+    CmlAlloc_free(p_pool->allocator, p_pool->threads);
+    p_pool->queues = NULL;
+    p_pool->threads = NULL;
+}
+
+void CmlJob_new(struct CmlJob_Job *p_job, struct CmlUTF_Buffer *p_utf, CmlJob_Callback callback, void *p_data, int eventFd)
+{
+    p_job->utf = *p_utf;
+    p_job->tokenStream = NULL;
+    p_job->tokenStreamLen = 0;
+    p_job->capacity = 0;
+    atomic_init(&p_job->state, 0);
+    atomic_init(&p_job->cancel, 0);
+    p_job->error = 0;
+    p_job->callback = callback;
+    p_job->p_data = p_data;
+    p_job->eventFd = eventFd;
+    p_job->allocator = CmlAlloc_getDefault();
+    p_job->next = NULL;
+}
+
+void CmlJob_destroy(struct CmlJob_Job *p_job)
+{
+    CmlAlloc_free(p_job->allocator, p_job->tokenStream);
+    p_job->tokenStream = NULL;
+    p_job->tokenStreamLen = 0;
+    p_job->capacity = 0;
+}
+
+int CmlJob_submit(struct CmlJob_Pool *p_pool, struct CmlJob_Job *p_job, int isBlocking)
+{
+    pthread_mutex_lock(&p_pool->lock);
+    while (p_pool->depth >= p_pool->maxDepth && !p_pool->stopping) {
+        if (!isBlocking) {
+            pthread_mutex_unlock(&p_pool->lock);
+            return EAGAIN;
+        }
+
+        pthread_cond_wait(&p_pool->notFull, &p_pool->lock);
+    }
+
+    if (p_pool->stopping) {
+        pthread_mutex_unlock(&p_pool->lock);
+        return ECANCELED;
+    }
+
+    p_pool->depth++;
+    p_job->allocator = p_pool->allocator;
+    struct CmlJob_Queue *p_queue = &p_pool->queues[p_pool->nextQueue++ % p_pool->workers];
+    pthread_mutex_unlock(&p_pool->lock);
+
+    atomic_store(&p_job->state, CmlJob_QUEUED);
+    CmlJob_push(p_queue, p_job);
+
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool->queued++;
+    pthread_cond_signal(&p_pool->notEmpty);
+    pthread_mutex_unlock(&p_pool->lock);
+    return 0;
+}
+
+void CmlJob_cancel(struct CmlJob_Job *p_job)
+{
+    atomic_store(&p_job->cancel, 1);
+}
@@ -0,0 +1,99 @@
+/*
+job.h - Run tokenization jobs on a pool of worker threads
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __JOB_H
+#define __JOB_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "def.h"
+#include "utf.h"
+#include "alloc.h"
+#include "tokenizer.h"
+
+#define CmlJob_DEFAULT_CHUNK 65536
+
+enum CmlJob_State {
+    CmlJob_QUEUED = 1,
+    CmlJob_RUNNING,
+    CmlJob_DONE,
+    CmlJob_CANCELLED,
+    CmlJob_FAILED
+};
+
+/*
+A job's callback runs on the worker thread while the job is still owned
+by the pool, so it may read the job but must not release it. The final
+state, CmlJob_DONE, CmlJob_CANCELLED or CmlJob_FAILED, is stored after
+the callback has returned and the event file descriptor is signalled
+after that. Once the owner sees a final state the pool no longer touches
+the job, which may then be destroyed; the event file descriptor must stay
+open until its event has been read.
+*/
+struct CmlJob_Job;
+typedef void (*CmlJob_Callback)(struct CmlJob_Job *p_job, void *p_data);
+
+struct CmlJob_Job {
+    struct CmlUTF_Buffer utf;
+    CmlTokenizer_TokenStream tokenStream;
+    size_t tokenStreamLen;
+    size_t capacity;
+    _Atomic int state;
+    _Atomic int cancel;
+    int error;
+    CmlJob_Callback callback;
+    void *p_data;
+    int eventFd;
+    struct CmlAlloc_Allocator *allocator;
+    struct CmlJob_Job *next;
+};
+
+struct CmlJob_Queue {
+    pthread_mutex_t lock;
+    struct CmlJob_Job *head;
+    struct CmlJob_Job *tail;
+};
+
+struct CmlJob_Pool {
+    pthread_t *threads;
+    struct CmlJob_Queue *queues;
+    size_t workers;
+    size_t chunk;
+    size_t maxDepth;
+    size_t depth;
+    size_t queued;
+    size_t nextQueue;
+    size_t started;
+    int stopping;
+    struct CmlAlloc_Allocator *allocator;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+};
+
+int CmlJob_newPool(struct CmlJob_Pool *p_pool, size_t workers, size_t maxDepth, size_t chunk, struct CmlAlloc_Allocator *p_allocator);
+void CmlJob_destroyPool(struct CmlJob_Pool *p_pool);
+void CmlJob_new(struct CmlJob_Job *p_job, struct CmlUTF_Buffer *p_utf, CmlJob_Callback callback, void *p_data, int eventFd);
+void CmlJob_destroy(struct CmlJob_Job *p_job);
+int CmlJob_submit(struct CmlJob_Pool *p_pool, struct CmlJob_Job *p_job, int isBlocking);
+void CmlJob_cancel(struct CmlJob_Job *p_job);
+
+#endif
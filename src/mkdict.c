@@ -0,0 +1,570 @@
+/*
+mkdict.c - Compile a TSV lexicon into the dictionary format
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Each input line is "key<TAB>value[<TAB>flag]". Empty lines and lines
+starting with '#' are skipped, and a repeated key keeps its last value.
+
+The blob starts with one control byte per slot, zero for an empty slot
+and CmlDict_FINGERPRINT of the key's digest otherwise, padded with
+CmlDict_GROUP_SIZE zero bytes. CmlDict_HEADER_SIZE bytes per slot follow:
+the flag byte (bit 0 marks the slot as occupied), the key length capped
+at CmlDict_MAX_KEY_LENGTH, the big-endian offset of the value and the
+big-endian offset of the key. NUL-terminated strings come last, laid out
+in slot order so that neighbouring slots share cache lines.
+
+Keys are placed first-fit in order of their home slot, which keeps every
+key inside an unbroken run of occupied slots starting at its home, so a
+lookup may stop at the first empty control byte.
+
+With -c the blob uses the front-coded layout instead: 4-byte slot
+headers holding the capped key length and the key's index in sorted
+order, one big-endian block offset per CmlDict_FRONT_BLOCK_SIZE keys,
+the shared pool of NUL-terminated values, then the key blocks (see
+CmlDict_equalsFront in dict.c). It has no 16-bit limits and stores
+shared key prefixes once per block, at the cost of decoding up to one
+block per lookup.
+
+With -b the blob is written as a dictionary file for CmlDict_open
+instead of as C source.
+
+With -t, each key is run through the tokenizer and stored as its packed
+token sequence (see CmlDict_packToken) so that it can be looked up with
+CmlDict_getTokens straight from a token stream. With -T, each value is
+stored the same way and can be read back with CmlDict_unpackToken.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "utf8.h"
+#include "tokenizer.h"
+#include "dict.h"
+
+#define CmlMkdict_MAX_BLOB 0x10000
+
+struct CmlMkdict_Entry {
+    char *key;
+    char *value;
+    unsigned char flag;
+    size_t line;
+    size_t index;
+    size_t home;
+    size_t slot;
+    size_t valueRef;
+};
+
+static int CmlMkdict_compareKey(const void *p_a, const void *p_b)
+{
+    const struct CmlMkdict_Entry *p_x = p_a, *p_y = p_b;
+    int cmp = strcmp(p_x->key, p_y->key);
+    return cmp != 0 ? cmp : (p_x->line > p_y->line) - (p_x->line < p_y->line);
+}
+
+static int CmlMkdict_compareHome(const void *p_a, const void *p_b)
+{
+    const struct CmlMkdict_Entry *p_x = p_a, *p_y = p_b;
+    if (p_x->home != p_y->home)
+        return p_x->home < p_y->home ? -1 : 1;
+    return strcmp(p_x->key, p_y->key);
+}
+
+static char *CmlMkdict_readFile(const char *p_path, size_t *p_len)
+{
+    FILE *p_file = fopen(p_path, "rb");
+    if (p_file == NULL)
+        return NULL;
+
+    size_t cap = 4096, len = 0;
+    char *p_buff = malloc(cap + 1);
+    size_t n;
+    while (p_buff != NULL && (n = fread(p_buff + len, 1, cap - len, p_file)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            p_buff = realloc(p_buff, cap + 1);
+        }
+    }
+
+    fclose(p_file);
+    if (p_buff != NULL)
+        p_buff[len] = 0;
+    *p_len = len;
+    return p_buff;
+}
+
+static char *CmlMkdict_packKey(char *p_key)
+{
+    struct CmlUTF_Buffer utf;
+    CmlUTF8_new(&utf, (unsigned char *) p_key, 0, strlen(p_key));
+    CmlTokenizer_TokenStream tokenStream = CmlTokenizer_tokenizationUTF(&utf);
+    CmlUTF_destroy(&utf);
+    if (tokenStream == NULL)
+        return NULL;
+
+    size_t n = 0;
+    while (tokenStream[n] != CmlTokenizer_END_OF_TOKEN)
+        n++;
+
+    char *p_packed = malloc(n * CmlDict_MAX_PACKED_TOKEN + 1);
+    if (p_packed != NULL) {
+        size_t len = 0;
+        size_t i = 0;
+        for (; i < n; i++)
+            len += CmlDict_packToken(tokenStream[i], (unsigned char *) p_packed + len);
+        p_packed[len] = 0;
+    }
+
+    CmlTokenizer_destroyTokenStream(tokenStream, NULL);
+    return p_packed;
+}
+
+static size_t CmlMkdict_parse(char *p_text, struct CmlMkdict_Entry **p_p_entries)
+{
+    size_t cap = 256, n = 0, line = 0;
+    struct CmlMkdict_Entry *p_entries = malloc(sizeof(struct CmlMkdict_Entry) * cap);
+    char *p_line = p_text;
+
+    while (p_line != NULL && *p_line != 0) {
+        char *p_next = strchr(p_line, '\n');
+        if (p_next != NULL)
+            *p_next++ = 0;
+        line++;
+
+        size_t lineLen = strlen(p_line);
+        if (lineLen != 0 && p_line[lineLen - 1] == '\r')
+            p_line[--lineLen] = 0;
+
+        if (lineLen != 0 && p_line[0] != '#') {
+            char *p_value = strchr(p_line, '\t');
+            if (p_value == NULL || p_value == p_line) {
+                fprintf(stderr, "mkdict: line %zu: expected key<TAB>value\n", line);
+                exit(1);
+            }
+
+            *p_value++ = 0;
+            char *p_flag = strchr(p_value, '\t');
+            unsigned long flag = 0;
+            if (p_flag != NULL) {
+                *p_flag++ = 0;
+                flag = strtoul(p_flag, NULL, 0);
+            }
+
+            if (n == cap) {
+                cap *= 2;
+                p_entries = realloc(p_entries, sizeof(struct CmlMkdict_Entry) * cap);
+            }
+
+            p_entries[n].key = p_line;
+            p_entries[n].value = p_value;
+            p_entries[n].flag = (flag & 0xFF) | 0b1;
+            p_entries[n].line = line;
+            n++;
+        }
+
+        p_line = p_next;
+    }
+
+    *p_p_entries = p_entries;
+    return n;
+}
+
+static size_t CmlMkdict_dedupKeys(struct CmlMkdict_Entry *p_entries, size_t n)
+{
+    qsort(p_entries, n, sizeof(struct CmlMkdict_Entry), &CmlMkdict_compareKey);
+
+    size_t i = 0, kept = 0;
+    for (; i < n; i++) {
+        if (i + 1 < n && !strcmp(p_entries[i].key, p_entries[i + 1].key)) {
+            fprintf(stderr, "mkdict: line %zu: key \"%s\" redefined on line %zu\n",
+                p_entries[i].line, p_entries[i].key, p_entries[i + 1].line);
+            continue;
+        }
+        p_entries[kept++] = p_entries[i];
+    }
+
+    return kept;
+}
+
+static size_t CmlMkdict_place(struct CmlMkdict_Entry *p_entries, size_t n, size_t size)
+{
+    size_t i = 0;
+    for (; i < n; i++)
+        p_entries[i].home = CmlDict_hash(p_entries[i].key, size * 0.8);
+    qsort(p_entries, n, sizeof(struct CmlMkdict_Entry), &CmlMkdict_compareHome);
+
+    size_t next = 0, maxProbe = 0;
+    for (i = 0; i < n; i++) {
+        size_t slot = p_entries[i].home > next ? p_entries[i].home : next;
+        if (slot >= size || slot - p_entries[i].home >= CmlDict_MAX_SEARCH)
+            return -1;
+
+        p_entries[i].slot = slot;
+        next = slot + 1;
+        if (slot - p_entries[i].home + 1 > maxProbe)
+            maxProbe = slot - p_entries[i].home + 1;
+    }
+
+    return maxProbe;
+}
+
+static size_t CmlMkdict_findValue(unsigned char *p_blob, size_t *p_table, size_t tableSize, char *p_value, int *p_isFound)
+{
+    size_t digest = 0xCBF29CE484222325ULL;
+    size_t i = 0;
+    for (; p_value[i] != 0; i++)
+        digest = (digest ^ (unsigned char) p_value[i]) * 0x100000001B3ULL;
+
+    size_t j = digest % tableSize;
+    while (p_table[j] != 0 && strcmp((char *) p_blob + p_table[j], p_value))
+        j = (j + 1) % tableSize;
+
+    *p_isFound = p_table[j] != 0;
+    return j;
+}
+
+static size_t CmlMkdict_writeVarint(unsigned char *p_buff, size_t value)
+{
+    size_t len = 0;
+    for (; value >= 0x80; value >>= 7)
+        p_buff[len++] = 0x80 | (value & 0x7F);
+    p_buff[len++] = value;
+    return len;
+}
+
+static size_t CmlMkdict_frontBound(struct CmlMkdict_Entry *p_entries, size_t n, size_t size)
+{
+    size_t len = CmlDict_FRONT_BLOCKS_OFFSET(size) + (n / CmlDict_FRONT_BLOCK_SIZE + 1) * 4;
+    size_t i = 0;
+    for (; i < n; i++)
+        len += strlen(p_entries[i].key) + strlen(p_entries[i].value) + 2 + 3 * 10;
+    return len;
+}
+
+static size_t CmlMkdict_layoutFront(struct CmlMkdict_Entry *p_entries, size_t n, size_t size, unsigned char *p_blob, size_t *p_uniqueValues, size_t *p_blocks)
+{
+    size_t tableSize = n * 2 + 1;
+    size_t *p_table = calloc(tableSize, sizeof(size_t));
+    size_t blocks = (n + CmlDict_FRONT_BLOCK_SIZE - 1) / CmlDict_FRONT_BLOCK_SIZE;
+    size_t len = CmlDict_FRONT_BLOCKS_OFFSET(size) + blocks * 4;
+    size_t i = 0;
+
+    memset(p_blob, 0, len);
+    *p_uniqueValues = 0;
+    for (; i < n; i++) {
+        size_t keyLen;
+        unsigned long long digest = CmlDict_digest(p_entries[i].key, &keyLen);
+        size_t headerOffset = CmlDict_FRONT_HEADER_OFFSET(size, p_entries[i].slot);
+        p_blob[p_entries[i].slot] = CmlDict_FINGERPRINT(digest);
+        p_blob[headerOffset] = keyLen < CmlDict_MAX_KEY_LENGTH ? keyLen : CmlDict_MAX_KEY_LENGTH;
+        p_blob[headerOffset + 1] = p_entries[i].index >> 16;
+        p_blob[headerOffset + 2] = (p_entries[i].index >> 8) & 0xFF;
+        p_blob[headerOffset + 3] = p_entries[i].index & 0xFF;
+
+        int isFound;
+        size_t j = CmlMkdict_findValue(p_blob, p_table, tableSize, p_entries[i].value, &isFound);
+        if (!isFound) {
+            size_t valueLen = strlen(p_entries[i].value) + 1;
+            p_table[j] = len;
+            memcpy(p_blob + len, p_entries[i].value, valueLen);
+            len += valueLen;
+            (*p_uniqueValues)++;
+        }
+        p_entries[i].valueRef = p_table[j];
+    }
+
+    qsort(p_entries, n, sizeof(struct CmlMkdict_Entry), &CmlMkdict_compareKey);
+    for (i = 0; i < n; i++) {
+        size_t prefix = 0;
+        if (i % CmlDict_FRONT_BLOCK_SIZE == 0) {
+            unsigned char *p_offset = p_blob + CmlDict_FRONT_BLOCKS_OFFSET(size) + i / CmlDict_FRONT_BLOCK_SIZE * 4;
+            p_offset[0] = len >> 24;
+            p_offset[1] = (len >> 16) & 0xFF;
+            p_offset[2] = (len >> 8) & 0xFF;
+            p_offset[3] = len & 0xFF;
+        } else {
+            while (p_entries[i].key[prefix] != 0 && p_entries[i].key[prefix] == p_entries[i - 1].key[prefix])
+                prefix++;
+        }
+
+        size_t suffixLen = strlen(p_entries[i].key + prefix);
+        len += CmlMkdict_writeVarint(p_blob + len, prefix);
+        len += CmlMkdict_writeVarint(p_blob + len, suffixLen);
+        memcpy(p_blob + len, p_entries[i].key + prefix, suffixLen);
+        len += suffixLen;
+        p_blob[len++] = p_entries[i].flag;
+        len += CmlMkdict_writeVarint(p_blob + len, p_entries[i].valueRef);
+    }
+
+    free(p_table);
+    *p_blocks = blocks;
+    return len;
+}
+
+static size_t CmlMkdict_layout(struct CmlMkdict_Entry *p_entries, size_t n, size_t size, unsigned char *p_blob, size_t *p_uniqueValues)
+{
+    size_t tableSize = n * 2 + 1;
+    size_t *p_table = calloc(tableSize, sizeof(size_t));
+    size_t len = CmlDict_HEADER_OFFSET(size, size);
+    size_t i = 0;
+
+    memset(p_blob, 0, len);
+    *p_uniqueValues = 0;
+    for (; i < n; i++) {
+        size_t keyLen;
+        unsigned long long digest = CmlDict_digest(p_entries[i].key, &keyLen);
+        size_t shortLen = keyLen < CmlDict_MAX_KEY_LENGTH ? keyLen : CmlDict_MAX_KEY_LENGTH;
+        keyLen++;
+        size_t valueLen = strlen(p_entries[i].value) + 1;
+        if (len + keyLen + valueLen > CmlMkdict_MAX_BLOB) {
+            free(p_table);
+            return -1;
+        }
+
+        size_t keyRef = len;
+        memcpy(p_blob + len, p_entries[i].key, keyLen);
+        len += keyLen;
+
+        int isFound;
+        size_t j = CmlMkdict_findValue(p_blob, p_table, tableSize, p_entries[i].value, &isFound);
+        if (!isFound) {
+            p_table[j] = len;
+            memcpy(p_blob + len, p_entries[i].value, valueLen);
+            len += valueLen;
+            (*p_uniqueValues)++;
+        }
+
+        size_t headerOffset = CmlDict_HEADER_OFFSET(size, p_entries[i].slot);
+        p_blob[p_entries[i].slot] = CmlDict_FINGERPRINT(digest);
+        p_blob[headerOffset] = p_entries[i].flag;
+        p_blob[headerOffset + 1] = shortLen;
+        p_blob[headerOffset + 2] = p_table[j] >> 8;
+        p_blob[headerOffset + 3] = p_table[j] & 0xFF;
+        p_blob[headerOffset + 4] = keyRef >> 8;
+        p_blob[headerOffset + 5] = keyRef & 0xFF;
+    }
+
+    free(p_table);
+    return len;
+}
+
+static void CmlMkdict_printStats(struct CmlMkdict_Entry *p_entries, size_t n, size_t size, size_t len, size_t uniqueValues, size_t blocks)
+{
+    size_t histogram[10] = {0};
+    size_t total = 0, maxProbe = 0, i = 0;
+    for (; i < n; i++) {
+        size_t probe = p_entries[i].slot - p_entries[i].home + 1;
+        size_t bucket = 0;
+        while ((size_t) 1 << bucket < probe && bucket < 9)
+            bucket++;
+        histogram[bucket]++;
+        total += probe;
+        if (probe > maxProbe)
+            maxProbe = probe;
+    }
+
+    fprintf(stderr, "mkdict: %zu entries, %zu slots, load factor %.2f\n", n, size, size ? (double) n / size : 0.0);
+    fprintf(stderr, "mkdict: %zu unique values, %zu bytes\n", uniqueValues, len);
+    if (blocks != 0)
+        fprintf(stderr, "mkdict: %zu front-coded blocks\n", blocks);
+    fprintf(stderr, "mkdict: probe length mean %.2f, max %zu\n", n ? (double) total / n : 0.0, maxProbe);
+    for (i = 0; i < 10; i++) {
+        if (histogram[i] != 0)
+            fprintf(stderr, "mkdict:   <= %4zu%s %zu\n", (size_t) 1 << i, i == 9 ? "+" : " ", histogram[i]);
+    }
+}
+
+static void CmlMkdict_writeC(FILE *p_file, const char *p_input, unsigned char *p_blob, size_t len, size_t size, size_t blocks)
+{
+    fprintf(p_file, "/* Generated by mkdict from %s, do not edit. */\n\n", p_input);
+    fprintf(p_file, "#include <stddef.h>\n\n");
+    fprintf(p_file, "static unsigned char ___Dict_data[%zu] = {", len ? len : 1);
+    size_t i = 0;
+    for (; i < len; i++)
+        fprintf(p_file, "%s0x%02X,", i % 12 == 0 ? "\n    " : " ", p_blob[i]);
+    fprintf(p_file, "\n};\n\n");
+    fprintf(p_file, "unsigned char *___Dict_bin = ___Dict_data;\n");
+    fprintf(p_file, "size_t ___Dict_bin_len = %zu;\n", len);
+    fprintf(p_file, "size_t ___Dict_bin_size = %zu;\n", size);
+    fprintf(p_file, "size_t ___Dict_bin_blocks = %zu;\n", blocks);
+}
+
+static void CmlMkdict_writeBinary(FILE *p_file, unsigned char *p_blob, size_t len, size_t size, size_t blocks)
+{
+    unsigned char header[CmlDict_FRONT_FILE_HEADER_SIZE];
+    memcpy(header, blocks != 0 ? CmlDict_FRONT_FILE_MAGIC : CmlDict_FILE_MAGIC, 4);
+    header[4] = size >> 24;
+    header[5] = (size >> 16) & 0xFF;
+    header[6] = (size >> 8) & 0xFF;
+    header[7] = size & 0xFF;
+    header[8] = blocks >> 24;
+    header[9] = (blocks >> 16) & 0xFF;
+    header[10] = (blocks >> 8) & 0xFF;
+    header[11] = blocks & 0xFF;
+    fwrite(header, 1, blocks != 0 ? CmlDict_FRONT_FILE_HEADER_SIZE : CmlDict_FILE_HEADER_SIZE, p_file);
+    fwrite(p_blob, 1, len, p_file);
+}
+
+int main(int argc, char **argv)
+{
+    const char *p_output = NULL;
+    double loadFactor = 0.5;
+    size_t maxProbe = 8;
+    int isTokenKeys = 0;
+    int isTokenValues = 0;
+    int isFront = 0;
+    int isBinary = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:l:p:tTcb")) != -1) {
+        switch (opt) {
+            case 'o': p_output = optarg;
+            break;
+            case 'l': loadFactor = strtod(optarg, NULL);
+            break;
+            case 'p': maxProbe = strtoul(optarg, NULL, 0);
+            break;
+            case 't': isTokenKeys = 1;
+            break;
+            case 'T': isTokenValues = 1;
+            break;
+            case 'c': isFront = 1;
+            break;
+            case 'b': isBinary = 1;
+            break;
+            default: goto usage;
+        }
+    }
+
+    if (optind + 1 != argc || loadFactor <= 0 || loadFactor > 1 || maxProbe == 0)
+        goto usage;
+
+    size_t textLen;
+    char *p_text = CmlMkdict_readFile(argv[optind], &textLen);
+    if (p_text == NULL) {
+        fprintf(stderr, "mkdict: %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    struct CmlMkdict_Entry *p_entries;
+    size_t n = CmlMkdict_parse(p_text, &p_entries);
+    size_t i = 0;
+    for (; isTokenKeys && i < n; i++) {
+        p_entries[i].key = CmlMkdict_packKey(p_entries[i].key);
+        if (p_entries[i].key == NULL || p_entries[i].key[0] == 0) {
+            fprintf(stderr, "mkdict: line %zu: key has no tokens\n", p_entries[i].line);
+            return 1;
+        }
+    }
+    for (i = 0; isTokenValues && i < n; i++) {
+        p_entries[i].value = CmlMkdict_packKey(p_entries[i].value);
+        if (p_entries[i].value == NULL) {
+            fprintf(stderr, "mkdict: line %zu: cannot tokenize value\n", p_entries[i].line);
+            return 1;
+        }
+    }
+
+    n = CmlMkdict_dedupKeys(p_entries, n);
+    if (isFront && n >= CmlDict_FRONT_MAX_ENTRIES) {
+        fprintf(stderr, "mkdict: cannot fit %zu entries in 24-bit references\n", n);
+        return 1;
+    }
+    for (i = 0; i < n; i++)
+        p_entries[i].index = i;
+
+    size_t stringsLen = 0;
+    for (i = 0; i < n; i++)
+        stringsLen += strlen(p_entries[i].key) + strlen(p_entries[i].value) + 2;
+
+    if (n == 0)
+        isFront = 0;
+
+    size_t size = n / loadFactor + 2;
+    size_t maxSize = size * 4;
+    size_t bestSize = 0, bestProbe = -1, probe;
+    for (; isFront ? size <= maxSize : CmlDict_HEADER_OFFSET(size, size) + stringsLen <= CmlMkdict_MAX_BLOB; size += size / 16 + 1) {
+        probe = CmlMkdict_place(p_entries, n, size);
+        if (probe < bestProbe) {
+            bestSize = size;
+            bestProbe = probe;
+        }
+        if (probe <= maxProbe)
+            break;
+    }
+
+    if (bestSize == 0 && isFront) {
+        fprintf(stderr, "mkdict: cannot place %zu entries within %d slots of their home, try a lower -l\n", n, CmlDict_MAX_SEARCH);
+        return 1;
+    }
+    if (bestSize == 0) {
+        fprintf(stderr, "mkdict: cannot fit %zu entries in 16-bit references, try -c\n", n);
+        return 1;
+    }
+    if (bestProbe > maxProbe)
+        fprintf(stderr, "mkdict: warning: no table size keeps probes within %zu, using %zu\n", maxProbe, bestProbe);
+
+    size_t uniqueValues, blocks = 0, len;
+    size = bestSize;
+    CmlMkdict_place(p_entries, n, size);
+    unsigned char *p_blob = malloc(isFront ? CmlMkdict_frontBound(p_entries, n, size) : CmlMkdict_MAX_BLOB);
+    if (isFront)
+        len = CmlMkdict_layoutFront(p_entries, n, size, p_blob, &uniqueValues, &blocks);
+    else
+        len = CmlMkdict_layout(p_entries, n, size, p_blob, &uniqueValues);
+    if (isFront && len > 0xFFFFFFFF) {
+        fprintf(stderr, "mkdict: cannot fit %zu bytes in 32-bit block offsets\n", len);
+        return 1;
+    }
+
+    struct CmlDict_Dict dict = { (char *) p_blob, len, size, blocks };
+    for (i = 0; i < n; i++) {
+        struct CmlDict_Field field;
+        if (CmlDict_get(&dict, p_entries[i].key, &field) || strcmp(field.value, p_entries[i].value)) {
+            fprintf(stderr, "mkdict: internal error, \"%s\" does not read back\n", p_entries[i].key);
+            return 1;
+        }
+    }
+
+    CmlMkdict_printStats(p_entries, n, size, len, uniqueValues, blocks);
+
+    FILE *p_file = p_output != NULL ? fopen(p_output, isBinary ? "wb" : "w") : stdout;
+    if (p_file == NULL) {
+        fprintf(stderr, "mkdict: %s: %s\n", p_output, strerror(errno));
+        return 1;
+    }
+
+    if (isBinary)
+        CmlMkdict_writeBinary(p_file, p_blob, len, size, blocks);
+    else
+        CmlMkdict_writeC(p_file, argv[optind], p_blob, len, size, blocks);
+    if (p_file != stdout && fclose(p_file) != 0) {
+        fprintf(stderr, "mkdict: %s: %s\n", p_output, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+
+    usage:
+    fprintf(stderr, "usage: mkdict [-o output] [-l load-factor] [-p max-probe] [-t] [-T] [-c] [-b] lexicon.tsv\n");
+    return 2;
+}
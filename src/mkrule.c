@@ -0,0 +1,668 @@
+/*
+mkrule.c - Compile contextual rewrite rules into a rule table
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Each input line is a class definition or a rule, with words separated by
+spaces. Empty lines and lines starting with '#' are skipped.
+
+    class front = i é
+    class end = boundary space punctuation
+    front ( a ) end -> é
+    !digit ( ) digit -> ,
+    digit ( ) !digit -> ,
+
+A rule rewrites the tokens between the parentheses into the tokens after
+the arrow when the tokens before and after the parentheses match too;
+empty parentheses insert the tokens and nothing after the arrow deletes
+them. A word is a class name, a '!' and a word for every token the word
+does not match, or text that tokenizes to exactly one token. Text in
+double quotes is never taken as a class, so " " is the space token.
+
+The built-in classes are boundary, which matches before the first token
+and after the last, any, vowel, consonant, digit, punctuation, space and
+raw. A target never matches the boundary.
+
+The patterns are compiled into one DFA by subset construction over the
+classes of tokens that no pattern tells apart, and written out as C
+source or, with -b, as a file for CmlRule_open.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "utf8.h"
+#include "tokenizer.h"
+#include "rule.h"
+
+#define CmlMkrule_MAX_WORDS 256
+
+struct CmlMkrule_Class {
+    char *name;
+    unsigned char members[CmlRule_SYMBOLS];
+};
+
+struct CmlMkrule_Rule {
+    size_t start;
+    size_t len;
+    size_t targetLen;
+    size_t rightLen;
+    size_t replacementStart;
+    size_t replacementLen;
+};
+
+struct CmlMkrule_State {
+    size_t *items;
+    size_t len;
+};
+
+struct CmlMkrule_Compiler {
+    struct CmlMkrule_Class *classes;
+    size_t classesLen;
+    unsigned char (*elements)[CmlRule_SYMBOLS];
+    size_t elementsLen;
+    struct CmlMkrule_Rule *rules;
+    size_t rulesLen;
+    unsigned int *replacements;
+    size_t replacementsLen;
+    size_t line;
+};
+
+static void *CmlMkrule_grow(void *p_array, size_t len, size_t size)
+{
+    if (len != 0 && (len & (len - 1)) != 0)
+        return p_array;
+
+    p_array = realloc(p_array, (len ? len * 2 : 1) * size);
+    if (p_array == NULL) {
+        fprintf(stderr, "mkrule: %s\n", strerror(ENOMEM));
+        exit(1);
+    }
+    return p_array;
+}
+
+static void CmlMkrule_fail(struct CmlMkrule_Compiler *p_compiler, const char *p_message, const char *p_word)
+{
+    fprintf(stderr, "mkrule: line %zu: %s%s%s%s\n", p_compiler->line, p_message,
+        p_word != NULL ? " \"" : "", p_word != NULL ? p_word : "", p_word != NULL ? "\"" : "");
+    exit(1);
+}
+
+static char *CmlMkrule_readFile(const char *p_path, size_t *p_len)
+{
+    FILE *p_file = fopen(p_path, "rb");
+    if (p_file == NULL)
+        return NULL;
+
+    size_t cap = 4096, len = 0;
+    char *p_buff = malloc(cap + 1);
+    size_t n;
+    while (p_buff != NULL && (n = fread(p_buff + len, 1, cap - len, p_file)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            p_buff = realloc(p_buff, cap + 1);
+        }
+    }
+
+    fclose(p_file);
+    if (p_buff != NULL)
+        p_buff[len] = 0;
+    *p_len = len;
+    return p_buff;
+}
+
+static void CmlMkrule_addClass(struct CmlMkrule_Compiler *p_compiler, char *p_name, unsigned int first, unsigned int last)
+{
+    p_compiler->classes = CmlMkrule_grow(p_compiler->classes, p_compiler->classesLen, sizeof(struct CmlMkrule_Class));
+    struct CmlMkrule_Class *p_class = p_compiler->classes + p_compiler->classesLen++;
+    p_class->name = p_name;
+    memset(p_class->members, 0, CmlRule_SYMBOLS);
+    for (; first <= last; first++)
+        p_class->members[first] = 1;
+}
+
+static void CmlMkrule_addBuiltins(struct CmlMkrule_Compiler *p_compiler)
+{
+    CmlMkrule_addClass(p_compiler, "boundary", CmlTokenizer_END_OF_TOKEN, CmlTokenizer_END_OF_TOKEN);
+    CmlMkrule_addClass(p_compiler, "any", CmlTokenizer_SPACE_TOKEN, CmlRule_SPAN_SYMBOL);
+    CmlMkrule_addClass(p_compiler, "vowel", CmlTokenizer_VOCAL_A_TOKEN, CmlTokenizer_LONG_SYLLABIC_CONSONANT_R_TOKEN);
+    CmlMkrule_addClass(p_compiler, "consonant", CmlTokenizer_CONSONANT_H_TOKEN, CmlTokenizer_PALATAL_CONSONANT_S_TOKEN);
+    CmlMkrule_addClass(p_compiler, "digit", CmlTokenizer_NUMBER_0_TOKEN, CmlTokenizer_NUMBER_9_TOKEN);
+    CmlMkrule_addClass(p_compiler, "punctuation", CmlTokenizer_PUNCTUATION_CARIK_SIKI_TOKEN, CmlTokenizer_PUNCTUATION_IDEM_TOKEN);
+    CmlMkrule_addClass(p_compiler, "space", CmlTokenizer_SPACE_TOKEN, CmlTokenizer_SPACE_TOKEN);
+    CmlMkrule_addClass(p_compiler, "raw", CmlTokenizer_RAW_TOKEN(0), CmlRule_RAW_SYMBOL);
+}
+
+static size_t CmlMkrule_split(char *p_line, char **p_words, int *p_isQuoted, struct CmlMkrule_Compiler *p_compiler)
+{
+    size_t n = 0;
+    while (*p_line != 0) {
+        if (*p_line == ' ' || *p_line == '\t') {
+            p_line++;
+            continue;
+        }
+        if (n == CmlMkrule_MAX_WORDS)
+            CmlMkrule_fail(p_compiler, "too many words", NULL);
+
+        p_isQuoted[n] = *p_line == '"';
+        if (p_isQuoted[n]) {
+            p_words[n++] = ++p_line;
+            p_line = strchr(p_line, '"');
+            if (p_line == NULL)
+                CmlMkrule_fail(p_compiler, "unterminated quote", NULL);
+        } else {
+            p_words[n++] = p_line;
+            while (*p_line != 0 && *p_line != ' ' && *p_line != '\t')
+                p_line++;
+            if (*p_line == 0)
+                break;
+        }
+        *p_line++ = 0;
+    }
+
+    return n;
+}
+
+static int CmlMkrule_isWord(char *p_word, int isQuoted, const char *p_syntax)
+{
+    return !isQuoted && !strcmp(p_word, p_syntax);
+}
+
+static unsigned int CmlMkrule_token(struct CmlMkrule_Compiler *p_compiler, char *p_text)
+{
+    struct CmlUTF_Buffer utf;
+    CmlUTF8_new(&utf, (unsigned char *) p_text, 0, strlen(p_text));
+    CmlTokenizer_TokenStream tokenStream = CmlTokenizer_tokenizationUTF(&utf);
+    CmlUTF_destroy(&utf);
+    if (tokenStream == NULL)
+        CmlMkrule_fail(p_compiler, strerror(errno), NULL);
+
+    unsigned int token = tokenStream[0];
+    int isSingle = token != CmlTokenizer_END_OF_TOKEN && tokenStream[1] == CmlTokenizer_END_OF_TOKEN
+        && !CmlTokenizer_IS_SPAN_TOKEN(token);
+    CmlTokenizer_destroyTokenStream(tokenStream, NULL);
+    if (!isSingle)
+        CmlMkrule_fail(p_compiler, "not a class or a single token:", p_text);
+    return token;
+}
+
+static void CmlMkrule_members(struct CmlMkrule_Compiler *p_compiler, char *p_word, int isQuoted, unsigned char *p_members)
+{
+    if (!isQuoted && p_word[0] == '!' && p_word[1] != 0) {
+        CmlMkrule_members(p_compiler, p_word + 1, 0, p_members);
+        size_t i = 0;
+        for (; i < CmlRule_SYMBOLS; i++)
+            p_members[i] = !p_members[i];
+        return;
+    }
+
+    size_t i = 0;
+    for (; !isQuoted && i < p_compiler->classesLen; i++) {
+        if (!strcmp(p_compiler->classes[i].name, p_word)) {
+            memcpy(p_members, p_compiler->classes[i].members, CmlRule_SYMBOLS);
+            return;
+        }
+    }
+
+    unsigned int token = CmlMkrule_token(p_compiler, p_word);
+    memset(p_members, 0, CmlRule_SYMBOLS);
+    p_members[token < CmlRule_RAW_SYMBOL ? token : CmlRule_RAW_SYMBOL] = 1;
+}
+
+static void CmlMkrule_parseClass(struct CmlMkrule_Compiler *p_compiler, char **p_words, int *p_isQuoted, size_t n)
+{
+    if (n < 4 || p_isQuoted[1] || !CmlMkrule_isWord(p_words[2], p_isQuoted[2], "="))
+        CmlMkrule_fail(p_compiler, "expected class name = words", NULL);
+
+    size_t i = 0;
+    for (; i < p_compiler->classesLen; i++) {
+        if (!strcmp(p_compiler->classes[i].name, p_words[1]))
+            CmlMkrule_fail(p_compiler, "class redefined:", p_words[1]);
+    }
+
+    unsigned char members[CmlRule_SYMBOLS];
+    CmlMkrule_addClass(p_compiler, p_words[1], 1, 0);
+    for (i = 3; i < n; i++) {
+        CmlMkrule_members(p_compiler, p_words[i], p_isQuoted[i], members);
+        size_t j = 0;
+        for (; j < CmlRule_SYMBOLS; j++)
+            p_compiler->classes[p_compiler->classesLen - 1].members[j] |= members[j];
+    }
+}
+
+static void CmlMkrule_parseRule(struct CmlMkrule_Compiler *p_compiler, char **p_words, int *p_isQuoted, size_t n)
+{
+    size_t open = n, close = n, arrow = n, i = 0;
+    for (; i < n; i++) {
+        size_t *p_mark = CmlMkrule_isWord(p_words[i], p_isQuoted[i], "(") ? &open
+            : CmlMkrule_isWord(p_words[i], p_isQuoted[i], ")") ? &close
+            : CmlMkrule_isWord(p_words[i], p_isQuoted[i], "->") ? &arrow
+            : NULL;
+        if (p_mark != NULL && *p_mark != n)
+            CmlMkrule_fail(p_compiler, "repeated", p_words[i]);
+        if (p_mark != NULL)
+            *p_mark = i;
+    }
+
+    if (open > close || close > arrow || arrow == n)
+        CmlMkrule_fail(p_compiler, "expected context ( target ) context -> replacement", NULL);
+
+    struct CmlMkrule_Rule rule;
+    rule.start = p_compiler->elementsLen;
+    rule.len = arrow - 2;
+    rule.targetLen = close - open - 1;
+    rule.rightLen = arrow - close - 1;
+    if (rule.len == 0)
+        CmlMkrule_fail(p_compiler, "an insertion needs a context", NULL);
+    if (rule.targetLen + rule.rightLen > CmlRule_MAX_DELAY)
+        CmlMkrule_fail(p_compiler, "target and right context too long", NULL);
+
+    for (i = 0; i < arrow; i++) {
+        if (i == open || i == close)
+            continue;
+
+        p_compiler->elements = CmlMkrule_grow(p_compiler->elements, p_compiler->elementsLen, CmlRule_SYMBOLS);
+        unsigned char *p_members = p_compiler->elements[p_compiler->elementsLen++];
+        CmlMkrule_members(p_compiler, p_words[i], p_isQuoted[i], p_members);
+        if (i > open && i < close) {
+            p_members[CmlTokenizer_END_OF_TOKEN] = 0;
+            if (memchr(p_members, 1, CmlRule_SYMBOLS) == NULL)
+                CmlMkrule_fail(p_compiler, "target never matches:", p_words[i]);
+        }
+    }
+
+    rule.replacementStart = p_compiler->replacementsLen;
+    rule.replacementLen = n - arrow - 1;
+    for (i = arrow + 1; i < n; i++) {
+        if (!p_isQuoted[i] && p_words[i][0] == '!')
+            CmlMkrule_fail(p_compiler, "replacement is not a token:", p_words[i]);
+
+        size_t j = 0;
+        for (; !p_isQuoted[i] && j < p_compiler->classesLen; j++) {
+            if (!strcmp(p_compiler->classes[j].name, p_words[i]))
+                CmlMkrule_fail(p_compiler, "replacement is not a token:", p_words[i]);
+        }
+
+        p_compiler->replacements = CmlMkrule_grow(p_compiler->replacements, p_compiler->replacementsLen, sizeof(unsigned int));
+        p_compiler->replacements[p_compiler->replacementsLen++] = CmlMkrule_token(p_compiler, p_words[i]);
+    }
+
+    if (p_compiler->rulesLen == CmlRule_MAX_RULES)
+        CmlMkrule_fail(p_compiler, "too many rules", NULL);
+    p_compiler->rules = CmlMkrule_grow(p_compiler->rules, p_compiler->rulesLen, sizeof(struct CmlMkrule_Rule));
+    p_compiler->rules[p_compiler->rulesLen++] = rule;
+}
+
+static void CmlMkrule_parse(struct CmlMkrule_Compiler *p_compiler, char *p_text)
+{
+    char *p_words[CmlMkrule_MAX_WORDS];
+    int isQuoted[CmlMkrule_MAX_WORDS];
+    char *p_line = p_text;
+
+    while (p_line != NULL && *p_line != 0) {
+        char *p_next = strchr(p_line, '\n');
+        if (p_next != NULL)
+            *p_next++ = 0;
+        p_compiler->line++;
+
+        size_t lineLen = strlen(p_line);
+        if (lineLen != 0 && p_line[lineLen - 1] == '\r')
+            p_line[--lineLen] = 0;
+
+        if (p_line[0] != '#') {
+            size_t n = CmlMkrule_split(p_line, p_words, isQuoted, p_compiler);
+            if (n != 0 && CmlMkrule_isWord(p_words[0], isQuoted[0], "class"))
+                CmlMkrule_parseClass(p_compiler, p_words, isQuoted, n);
+            else if (n != 0)
+                CmlMkrule_parseRule(p_compiler, p_words, isQuoted, n);
+        }
+
+        p_line = p_next;
+    }
+}
+
+/* Symbols that every pattern element takes or leaves together share a class. */
+static size_t CmlMkrule_classify(struct CmlMkrule_Compiler *p_compiler, unsigned char *p_classes, size_t *p_representatives)
+{
+    size_t classCount = 0, i = 0;
+    for (; i < CmlRule_SYMBOLS; i++) {
+        size_t c = 0;
+        for (; c < classCount; c++) {
+            size_t e = 0;
+            for (; e < p_compiler->elementsLen; e++) {
+                if (p_compiler->elements[e][i] != p_compiler->elements[e][p_representatives[c]])
+                    break;
+            }
+            if (e == p_compiler->elementsLen)
+                break;
+        }
+
+        if (c == classCount)
+            p_representatives[classCount++] = i;
+        p_classes[i] = c;
+    }
+
+    return classCount;
+}
+
+static int CmlMkrule_compareItem(const void *p_a, const void *p_b)
+{
+    size_t x = *(const size_t *) p_a, y = *(const size_t *) p_b;
+    return (x > y) - (x < y);
+}
+
+static size_t CmlMkrule_hashItems(size_t *p_items, size_t len)
+{
+    size_t digest = 0xCBF29CE484222325ULL;
+    size_t i = 0;
+    for (; i < len; i++)
+        digest = (digest ^ p_items[i]) * 0x100000001B3ULL;
+    return digest;
+}
+
+/*
+Item base + i of a rule whose elements start at base means that its
+first i elements have matched; every rule is also tried from its first
+element at every token, so the start state is the empty set.
+*/
+static size_t CmlMkrule_build(struct CmlMkrule_Compiler *p_compiler, size_t classCount, size_t *p_representatives, unsigned short **p_p_transitions, struct CmlMkrule_State **p_p_states)
+{
+    size_t itemsLen = p_compiler->elementsLen + p_compiler->rulesLen;
+    size_t *p_itemRule = malloc(sizeof(size_t) * (itemsLen + 1));
+    size_t *p_itemElement = malloc(sizeof(size_t) * (itemsLen + 1));
+    size_t *p_next = malloc(sizeof(size_t) * (itemsLen + p_compiler->rulesLen + 1));
+    size_t r = 0, item = 0;
+    for (; r < p_compiler->rulesLen; r++) {
+        size_t i = 0;
+        for (; i <= p_compiler->rules[r].len; i++) {
+            p_itemRule[item] = r;
+            p_itemElement[item++] = p_compiler->rules[r].start + i;
+        }
+    }
+
+    size_t tableSize = 1024;
+    size_t *p_table = calloc(tableSize, sizeof(size_t));
+    struct CmlMkrule_State *p_states = NULL;
+    unsigned short *p_transitions = NULL;
+    size_t stateCount = 1, capacity = 0;
+
+    p_states = CmlMkrule_grow(p_states, 0, sizeof(struct CmlMkrule_State));
+    p_states[0].items = NULL;
+    p_states[0].len = 0;
+
+    size_t s = 0;
+    for (; s < stateCount; s++) {
+        while (capacity < stateCount * classCount) {
+            capacity = capacity ? capacity * 2 : 1024;
+            p_transitions = realloc(p_transitions, sizeof(unsigned short) * capacity);
+        }
+
+        size_t c = 0;
+        for (; c < classCount; c++) {
+            size_t symbol = p_representatives[c];
+            size_t n = 0;
+            size_t j = 0, base = 0;
+            for (r = 0; r < p_compiler->rulesLen; r++) {
+                if (p_compiler->elements[p_compiler->rules[r].start][symbol])
+                    p_next[n++] = base + 1;
+                base += p_compiler->rules[r].len + 1;
+            }
+            for (; j < p_states[s].len; j++) {
+                size_t current = p_states[s].items[j];
+                r = p_itemRule[current];
+                size_t element = p_itemElement[current];
+                if (element < p_compiler->rules[r].start + p_compiler->rules[r].len && p_compiler->elements[element][symbol])
+                    p_next[n++] = current + 1;
+            }
+
+            qsort(p_next, n, sizeof(size_t), &CmlMkrule_compareItem);
+            size_t k = 0, unique = 0;
+            for (; k < n; k++) {
+                if (unique == 0 || p_next[unique - 1] != p_next[k])
+                    p_next[unique++] = p_next[k];
+            }
+
+            if (unique == 0) {
+                p_transitions[s * classCount + c] = 0;
+                continue;
+            }
+
+            size_t h = CmlMkrule_hashItems(p_next, unique) % tableSize;
+            while (p_table[h] != 0) {
+                struct CmlMkrule_State *p_state = p_states + p_table[h] - 1;
+                if (p_state->len == unique && !memcmp(p_state->items, p_next, sizeof(size_t) * unique))
+                    break;
+                h = (h + 1) % tableSize;
+            }
+
+            if (p_table[h] != 0) {
+                p_transitions[s * classCount + c] = p_table[h] - 1;
+                continue;
+            }
+
+            if (stateCount == CmlRule_MAX_STATES) {
+                fprintf(stderr, "mkrule: more than %d states\n", CmlRule_MAX_STATES);
+                exit(1);
+            }
+
+            p_states = CmlMkrule_grow(p_states, stateCount, sizeof(struct CmlMkrule_State));
+            p_states[stateCount].items = malloc(sizeof(size_t) * unique);
+            memcpy(p_states[stateCount].items, p_next, sizeof(size_t) * unique);
+            p_states[stateCount].len = unique;
+            p_table[h] = stateCount + 1;
+            p_transitions[s * classCount + c] = stateCount++;
+
+            if (stateCount * 2 > tableSize) {
+                size_t i = 1;
+                free(p_table);
+                tableSize *= 2;
+                p_table = calloc(tableSize, sizeof(size_t));
+                for (; i < stateCount; i++) {
+                    h = CmlMkrule_hashItems(p_states[i].items, p_states[i].len) % tableSize;
+                    while (p_table[h] != 0)
+                        h = (h + 1) % tableSize;
+                    p_table[h] = i + 1;
+                }
+            }
+        }
+    }
+
+    /* Turn items into the rules they complete, in file order. */
+    for (s = 0; s < stateCount; s++) {
+        size_t n = 0, j = 0;
+        for (; j < p_states[s].len; j++) {
+            size_t current = p_states[s].items[j];
+            r = p_itemRule[current];
+            if (p_itemElement[current] == p_compiler->rules[r].start + p_compiler->rules[r].len)
+                p_states[s].items[n++] = r;
+        }
+        p_states[s].len = n;
+    }
+
+    free(p_table);
+    free(p_next);
+    free(p_itemRule);
+    free(p_itemElement);
+    *p_p_transitions = p_transitions;
+    *p_p_states = p_states;
+    return stateCount;
+}
+
+static size_t CmlMkrule_putWord(unsigned char *p_blob, size_t len, size_t value)
+{
+    p_blob[len] = value >> 24;
+    p_blob[len + 1] = (value >> 16) & 0xFF;
+    p_blob[len + 2] = (value >> 8) & 0xFF;
+    p_blob[len + 3] = value & 0xFF;
+    return len + 4;
+}
+
+static size_t CmlMkrule_putShort(unsigned char *p_blob, size_t len, size_t value)
+{
+    p_blob[len] = value >> 8;
+    p_blob[len + 1] = value & 0xFF;
+    return len + 2;
+}
+
+static unsigned char *CmlMkrule_layout(struct CmlMkrule_Compiler *p_compiler, unsigned char *p_classes, size_t classCount, unsigned short *p_transitions, struct CmlMkrule_State *p_states, size_t stateCount, size_t delay, size_t *p_len)
+{
+    size_t acceptCount = 0, s = 0;
+    for (; s < stateCount; s++)
+        acceptCount += p_states[s].len;
+
+    size_t len = CmlRule_HEADER_SIZE + stateCount * classCount * 2 + (stateCount + 1) * 4 + acceptCount * 2
+        + p_compiler->rulesLen * CmlRule_RULE_SIZE + p_compiler->replacementsLen * 4;
+    unsigned char *p_blob = calloc(len, 1);
+    if (p_blob == NULL) {
+        fprintf(stderr, "mkrule: %s\n", strerror(ENOMEM));
+        exit(1);
+    }
+
+    memcpy(p_blob, CmlRule_MAGIC, 4);
+    CmlMkrule_putWord(p_blob, 4, classCount);
+    CmlMkrule_putWord(p_blob, 8, stateCount);
+    CmlMkrule_putWord(p_blob, 12, p_compiler->rulesLen);
+    CmlMkrule_putWord(p_blob, 16, delay);
+    memcpy(p_blob + 20, p_classes, CmlRule_SYMBOLS);
+
+    size_t i = 0, offset = CmlRule_HEADER_SIZE;
+    for (; i < stateCount * classCount; i++)
+        offset = CmlMkrule_putShort(p_blob, offset, p_transitions[i]);
+
+    size_t accepts = 0;
+    for (s = 0; s < stateCount; s++) {
+        offset = CmlMkrule_putWord(p_blob, offset, accepts);
+        accepts += p_states[s].len;
+    }
+    offset = CmlMkrule_putWord(p_blob, offset, accepts);
+
+    for (s = 0; s < stateCount; s++) {
+        for (i = 0; i < p_states[s].len; i++)
+            offset = CmlMkrule_putShort(p_blob, offset, p_states[s].items[i]);
+    }
+
+    for (i = 0; i < p_compiler->rulesLen; i++) {
+        struct CmlMkrule_Rule *p_rule = p_compiler->rules + i;
+        p_blob[offset++] = p_rule->targetLen + p_rule->rightLen;
+        p_blob[offset++] = p_rule->targetLen;
+        offset = CmlMkrule_putShort(p_blob, offset, p_rule->replacementLen);
+        offset = CmlMkrule_putWord(p_blob, offset, p_rule->replacementStart);
+    }
+
+    for (i = 0; i < p_compiler->replacementsLen; i++)
+        offset = CmlMkrule_putWord(p_blob, offset, p_compiler->replacements[i]);
+
+    *p_len = len;
+    return p_blob;
+}
+
+static void CmlMkrule_writeC(FILE *p_file, const char *p_input, unsigned char *p_blob, size_t len)
+{
+    fprintf(p_file, "/* Generated by mkrule from %s, do not edit. */\n\n", p_input);
+    fprintf(p_file, "#include <stddef.h>\n\n");
+    fprintf(p_file, "static unsigned char ___Rule_data[%zu] = {", len);
+    size_t i = 0;
+    for (; i < len; i++)
+        fprintf(p_file, "%s0x%02X,", i % 12 == 0 ? "\n    " : " ", p_blob[i]);
+    fprintf(p_file, "\n};\n\n");
+    fprintf(p_file, "unsigned char *___Rule_bin = ___Rule_data;\n");
+    fprintf(p_file, "size_t ___Rule_bin_len = %zu;\n", len);
+}
+
+int main(int argc, char **argv)
+{
+    const char *p_output = NULL;
+    int isBinary = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:b")) != -1) {
+        switch (opt) {
+            case 'o': p_output = optarg;
+            break;
+            case 'b': isBinary = 1;
+            break;
+            default: goto usage;
+        }
+    }
+
+    if (optind + 1 != argc)
+        goto usage;
+
+    size_t textLen;
+    char *p_text = CmlMkrule_readFile(argv[optind], &textLen);
+    if (p_text == NULL) {
+        fprintf(stderr, "mkrule: %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    struct CmlMkrule_Compiler compiler;
+    memset(&compiler, 0, sizeof(compiler));
+    CmlMkrule_addBuiltins(&compiler);
+    CmlMkrule_parse(&compiler, p_text);
+
+    size_t delay = 1, i = 0;
+    for (; i < compiler.rulesLen; i++) {
+        if (compiler.rules[i].targetLen + compiler.rules[i].rightLen > delay)
+            delay = compiler.rules[i].targetLen + compiler.rules[i].rightLen;
+    }
+
+    unsigned char classes[CmlRule_SYMBOLS];
+    size_t representatives[CmlRule_SYMBOLS];
+    size_t classCount = CmlMkrule_classify(&compiler, classes, representatives);
+
+    unsigned short *p_transitions;
+    struct CmlMkrule_State *p_states;
+    size_t stateCount = CmlMkrule_build(&compiler, classCount, representatives, &p_transitions, &p_states);
+
+    size_t len;
+    unsigned char *p_blob = CmlMkrule_layout(&compiler, classes, classCount, p_transitions, p_states, stateCount, delay, &len);
+    struct CmlRule_Rules rules;
+    if (CmlRule_open(&rules, p_blob, len) != 0) {
+        fprintf(stderr, "mkrule: internal error, the table does not open\n");
+        return 1;
+    }
+
+    fprintf(stderr, "mkrule: %zu rules, %zu classes, %zu states, delay %zu, %zu bytes\n",
+        compiler.rulesLen, classCount, stateCount, delay, len);
+
+    FILE *p_file = p_output != NULL ? fopen(p_output, isBinary ? "wb" : "w") : stdout;
+    if (p_file == NULL) {
+        fprintf(stderr, "mkrule: %s: %s\n", p_output, strerror(errno));
+        return 1;
+    }
+
+    if (isBinary)
+        fwrite(p_blob, 1, len, p_file);
+    else
+        CmlMkrule_writeC(p_file, argv[optind], p_blob, len);
+    if (p_file != stdout && fclose(p_file) != 0) {
+        fprintf(stderr, "mkrule: %s: %s\n", p_output, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+
+    usage:
+    fprintf(stderr, "usage: mkrule [-o output] [-b] rules.txt\n");
+    return 2;
+}
@@ -0,0 +1,387 @@
+/*
+norm.c - Compose decomposed Latin diacritics before tokenization
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Only the Combining Diacritical Marks block (U+0300 - U+036F) is treated
+as non-starters, and a starter only composes into the precomposed
+letters the tokenizer classifies, upper case included. Everything else
+is copied through as is, so the output is canonically equivalent to the
+input and matches NFC for the text the tokenizer cares about.
+
+The quick check looks for code units in U+0300 - U+037F, which for
+UTF-8 means a 0xCC or 0xCD lead byte. Text without any of them is
+already composed and never decoded here.
+*/
+
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include "def.h"
+#include "utf.h"
+#include "norm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const struct {
+    CmlUTF_Code last;
+    unsigned char combiningClass;
+} CmlNorm_classes[] = {
+    { 0x0314, 230 }, { 0x0315, 232 }, { 0x0319, 220 }, { 0x031A, 232 },
+    { 0x031B, 216 }, { 0x0320, 220 }, { 0x0322, 202 }, { 0x0326, 220 },
+    { 0x0328, 202 }, { 0x0333, 220 }, { 0x0338, 1 }, { 0x033C, 220 },
+    { 0x0344, 230 }, { 0x0345, 240 }, { 0x0346, 230 }, { 0x0349, 220 },
+    { 0x034C, 230 }, { 0x034E, 220 }, { 0x034F, 0 }, { 0x0352, 230 },
+    { 0x0356, 220 }, { 0x0357, 230 }, { 0x0358, 232 }, { 0x035A, 220 },
+    { 0x035B, 230 }, { 0x035C, 233 }, { 0x035E, 234 }, { 0x035F, 233 },
+    { 0x0361, 234 }, { 0x0362, 233 }, { 0x036F, 230 }
+};
+
+static __Cml_INLINE unsigned int CmlNorm_lowestBit(unsigned int mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    unsigned int i = 0;
+    for (; !(mask & 1); mask >>= 1)
+        i++;
+    return i;
+#endif
+}
+
+unsigned char CmlNorm_combiningClass(CmlUTF_Code code)
+{
+    if (code < 0x0300 || code > 0x036F)
+        return 0;
+
+    size_t i = 0;
+    while (code > CmlNorm_classes[i].last)
+        i++;
+    return CmlNorm_classes[i].combiningClass;
+}
+
+CmlUTF_Code CmlNorm_compose(CmlUTF_Code starter, CmlUTF_Code mark)
+{
+    switch (mark) {
+        case 0x0301:
+            switch (starter) {
+                case 'e': return 0x00E9;
+                case 'E': return 0x00C9;
+                case 's': return 0x015B;
+                case 'S': return 0x015A;
+                case 0x0113: return 0x1E17;
+                case 0x0112: return 0x1E16;
+            }
+            break;
+        case 0x0304:
+            switch (starter) {
+                case 'a': return 0x0101;
+                case 'A': return 0x0100;
+                case 'i': return 0x012B;
+                case 'I': return 0x012A;
+                case 'u': return 0x016B;
+                case 'U': return 0x016A;
+                case 'e': return 0x0113;
+                case 'E': return 0x0112;
+                case 'o': return 0x014D;
+                case 'O': return 0x014C;
+                case 0x1E37: return 0x1E39;
+                case 0x1E36: return 0x1E38;
+                case 0x1E5B: return 0x1E5D;
+                case 0x1E5A: return 0x1E5C;
+            }
+            break;
+        case 0x0323:
+            switch (starter) {
+                case 'l': return 0x1E37;
+                case 'L': return 0x1E36;
+                case 'r': return 0x1E5B;
+                case 'R': return 0x1E5A;
+                case 'n': return 0x1E47;
+                case 'N': return 0x1E46;
+                case 'd': return 0x1E0D;
+                case 'D': return 0x1E0C;
+                case 't': return 0x1E6D;
+                case 'T': return 0x1E6C;
+                case 's': return 0x1E63;
+                case 'S': return 0x1E62;
+            }
+            break;
+    }
+
+    return 0;
+}
+
+size_t CmlNorm_composeCodes(CmlUTF_Code *p_codes, size_t n)
+{
+    size_t i = 0;
+    for (; i < n; i++) {
+        switch (p_codes[i]) {
+            case 0x0340: p_codes[i] = 0x0300;
+            break;
+            case 0x0341: p_codes[i] = 0x0301;
+            break;
+            case 0x0343: p_codes[i] = 0x0313;
+            break;
+        }
+    }
+
+    /* Canonical ordering: a stable sort of every run of non-starters */
+    for (i = 1; i < n; i++) {
+        CmlUTF_Code code = p_codes[i];
+        unsigned char combiningClass = CmlNorm_combiningClass(code);
+        size_t j = i;
+        for (; combiningClass != 0 && j > 0; j--) {
+            unsigned char previousClass = CmlNorm_combiningClass(p_codes[j - 1]);
+            if (previousClass <= combiningClass)
+                break;
+            p_codes[j] = p_codes[j - 1];
+        }
+        p_codes[j] = code;
+    }
+
+    size_t starter = -1;
+    unsigned char lastClass = 0;
+    size_t len = 0;
+    for (i = 0; i < n; i++) {
+        CmlUTF_Code code = p_codes[i];
+        unsigned char combiningClass = CmlNorm_combiningClass(code);
+        if (starter != -1 && (len == starter + 1 || (lastClass != 0 && lastClass < combiningClass))) {
+            CmlUTF_Code composed = CmlNorm_compose(p_codes[starter], code);
+            if (composed != 0) {
+                p_codes[starter] = composed;
+                continue;
+            }
+        }
+
+        if (combiningClass == 0)
+            starter = len;
+        lastClass = combiningClass;
+        p_codes[len++] = code;
+    }
+
+    return len;
+}
+
+CmlUTF_Code CmlNorm_composeRun(CmlUTF_Code *p_codes, size_t n)
+{
+    CmlUTF_Code codes[CmlNorm_MAX_COMPOSED];
+    if (n == 0 || n > CmlNorm_MAX_COMPOSED)
+        return -1;
+
+    memcpy(codes, p_codes, n * sizeof(CmlUTF_Code));
+    return CmlNorm_composeCodes(codes, n) == 1 ? codes[0] : -1;
+}
+
+size_t CmlNorm_findMark(unsigned char *p_buff, size_t len, enum CmlUTF_Encoding encoding, enum Cml_Endianness endian)
+{
+    size_t i = 0;
+
+    switch (encoding) {
+        case CmlUTF_UTF8:
+#ifdef __SSE2__
+            for (; i + 16 <= len; i += 16) {
+                __m128i bytes = _mm_loadu_si128((__m128i *) (p_buff + i));
+                unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(bytes, _mm_set1_epi8((char) 0xFE)), _mm_set1_epi8((char) 0xCC)));
+                if (mask != 0)
+                    return i + CmlNorm_lowestBit(mask);
+            }
+#endif
+            for (; i < len; i++) {
+                if ((p_buff[i] & 0xFE) == 0xCC)
+                    return i;
+            }
+            break;
+        case CmlUTF_UTF16:
+#ifdef __SSE2__
+            for (; i + 16 <= len; i += 16) {
+                __m128i units = _mm_loadu_si128((__m128i *) (p_buff + i));
+                if (endian == Cml_BE)
+                    units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+                unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short) 0xFF80)), _mm_set1_epi16(0x0300)));
+                if (mask != 0)
+                    return i + CmlNorm_lowestBit(mask);
+            }
+#endif
+            for (; i + 1 < len; i += 2) {
+                unsigned int unit = endian == Cml_BE
+                    ? (p_buff[i] << 8) | p_buff[i + 1]
+                    : (p_buff[i + 1] << 8) | p_buff[i];
+                if ((unit & 0xFF80) == 0x0300)
+                    return i;
+            }
+            break;
+        case CmlUTF_UTF32:
+#ifdef __SSE2__
+            for (; i + 16 <= len; i += 16) {
+                __m128i codes = _mm_loadu_si128((__m128i *) (p_buff + i));
+                if (endian == Cml_BE) {
+                    codes = _mm_shufflehi_epi16(_mm_shufflelo_epi16(codes, 0xB1), 0xB1);
+                    codes = _mm_or_si128(_mm_slli_epi16(codes, 8), _mm_srli_epi16(codes, 8));
+                }
+                unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(codes, _mm_set1_epi32(~0x7F)), _mm_set1_epi32(0x0300)));
+                if (mask != 0)
+                    return i + CmlNorm_lowestBit(mask);
+            }
+#endif
+            for (; i + 3 < len; i += 4) {
+                CmlUTF_Code code = endian == Cml_BE
+                    ? ((CmlUTF_Code) p_buff[i] << 24) | (p_buff[i + 1] << 16) | (p_buff[i + 2] << 8) | p_buff[i + 3]
+                    : ((CmlUTF_Code) p_buff[i + 3] << 24) | (p_buff[i + 2] << 16) | (p_buff[i + 1] << 8) | p_buff[i];
+                if ((code & ~0x7F) == 0x0300)
+                    return i;
+            }
+            break;
+    }
+
+    return len;
+}
+
+static size_t CmlNorm_previous(unsigned char *p_buff, size_t first, size_t index, enum CmlUTF_Encoding encoding, enum Cml_Endianness endian)
+{
+    size_t i = 0;
+
+    switch (encoding) {
+        case CmlUTF_UTF8:
+            for (; index > first && i < CmlUTF_MAX_OCTETS_LENGTH; i++) {
+                index--;
+                if ((p_buff[index] & 0xC0) != 0x80)
+                    break;
+            }
+            return index;
+        case CmlUTF_UTF16:
+            if (index - first < 2)
+                return first;
+            if (index - first >= 4) {
+                unsigned char high = endian == Cml_BE ? p_buff[index - 4] : p_buff[index - 3];
+                unsigned char low = endian == Cml_BE ? p_buff[index - 2] : p_buff[index - 1];
+                if ((high & 0xFC) == 0xD8 && (low & 0xFC) == 0xDC)
+                    return index - 4;
+            }
+            return index - 2;
+        case CmlUTF_UTF32:
+            return index - first < 4 ? first : index - 4;
+    }
+
+    return first;
+}
+
+static size_t CmlNorm_composeSpan(struct CmlUTF_Buffer *p_utf, unsigned char *p_src, size_t srcLen, unsigned char *p_dst)
+{
+    enum CmlUTF_Encoding encoding = p_utf->codec->encoding;
+    int isBigEndian = p_utf->endian == Cml_BE;
+    size_t written = 0;
+    size_t i = 0;
+
+    while (i < srcLen) {
+        size_t mark = i + CmlNorm_findMark(p_src + i, srcLen - i, encoding, p_utf->endian);
+        if (mark >= srcLen)
+            break;
+
+        size_t start = CmlNorm_previous(p_src, i, mark, encoding, p_utf->endian);
+        memmove(p_dst + written, p_src + i, start - i);
+        written += start - i;
+
+        CmlUTF_Code codes[CmlNorm_MAX_COMPOSED + 1];
+        size_t n = 0;
+        size_t end = start;
+        while (end < srcLen && n <= CmlNorm_MAX_COMPOSED) {
+            CmlUTF_Code code = isBigEndian
+                ? p_utf->codec->decodeBE(p_src + end, srcLen - end)
+                : p_utf->codec->decodeLE(p_src + end, srcLen - end);
+            size_t octetsLength = isBigEndian
+                ? p_utf->codec->getOctetsLengthBE(p_src + end, srcLen - end)
+                : p_utf->codec->getOctetsLengthLE(p_src + end, srcLen - end);
+            if (code > 0x10FFFF && n == 0) {
+                /* Not a valid code, keep it as is and look again after it */
+                end += octetsLength < srcLen - end ? octetsLength : srcLen - end;
+                break;
+            }
+            if (code > 0x10FFFF || (n != 0 && CmlNorm_combiningClass(code) == 0))
+                break;
+
+            codes[n++] = code;
+            end += octetsLength;
+        }
+
+        if (n == 0) {
+            memmove(p_dst + written, p_src + start, end - start);
+            written += end - start;
+            i = end;
+            continue;
+        }
+
+        CmlUTF_Code composed = CmlNorm_composeRun(codes, n);
+        if (composed != -1) {
+            codes[0] = composed;
+            n = 1;
+        } else {
+            size_t j = 0;
+            for (; j < n; j++)
+                CmlNorm_composeCodes(codes + j, 1);
+        }
+
+        written += isBigEndian
+            ? p_utf->codec->encodeCodesBE(codes, &n, p_dst + written, end - start)
+            : p_utf->codec->encodeCodesLE(codes, &n, p_dst + written, end - start);
+        i = end;
+    }
+
+    memmove(p_dst + written, p_src + i, srcLen - i);
+    return written + srcLen - i;
+}
+
+int CmlNorm_isComposedUTF(struct CmlUTF_Buffer *p_utf)
+{
+    if (p_utf->currIndex >= p_utf->len)
+        return 1;
+
+    if (p_utf->segments == NULL) {
+        size_t len = p_utf->len - p_utf->currIndex;
+        return CmlNorm_findMark(p_utf->buff + p_utf->currIndex, len, p_utf->codec->encoding, p_utf->endian) == len;
+    }
+
+    struct CmlUTF_Buffer utf = *p_utf;
+    do {
+        if ((CmlUTF_read(&utf) & ~0x7F) == 0x0300)
+            return 0;
+    } while (CmlUTF_next(&utf, 1) != -1);
+
+    return 1;
+}
+
+size_t CmlNorm_composeUTF(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t len)
+{
+    if (len < CmlUTF_maxEncodedLength(p_utf, p_utf->codec->encoding)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (p_utf->segments != NULL) {
+        size_t srcLen = CmlUTF_gather(p_utf, p_buff, len);
+        return CmlNorm_composeSpan(p_utf, p_buff, srcLen, p_buff);
+    }
+
+    if (p_utf->currIndex >= p_utf->len)
+        return 0;
+
+    return CmlNorm_composeSpan(p_utf, p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex, p_buff);
+}
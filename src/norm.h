@@ -0,0 +1,44 @@
+/*
+norm.h - Compose decomposed Latin diacritics before tokenization
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __NORM_H
+#define __NORM_H
+
+#include <stddef.h>
+#include "def.h"
+#include "utf.h"
+
+/*
+A starter and the marks after it are replaced only when they compose into
+a single code point, which never takes more than CmlNorm_MAX_COMPOSED
+codes; any other run keeps its codes, each with its singleton mapping
+applied. CmlNorm_composeRun returns that single code point, or -1.
+*/
+#define CmlNorm_MAX_COMPOSED 3
+
+unsigned char CmlNorm_combiningClass(CmlUTF_Code code);
+CmlUTF_Code CmlNorm_compose(CmlUTF_Code starter, CmlUTF_Code mark);
+size_t CmlNorm_composeCodes(CmlUTF_Code *p_codes, size_t n);
+CmlUTF_Code CmlNorm_composeRun(CmlUTF_Code *p_codes, size_t n);
+size_t CmlNorm_findMark(unsigned char *p_buff, size_t len, enum CmlUTF_Encoding encoding, enum Cml_Endianness endian);
+int CmlNorm_isComposedUTF(struct CmlUTF_Buffer *p_utf);
+size_t CmlNorm_composeUTF(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t len);
+
+#endif
@@ -0,0 +1,307 @@
+/*
+pack.c - Serialise token streams into a compact binary format
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include "def.h"
+#include "tokenizer.h"
+#include "pack.h"
+
+static void CmlPack_writeInt(unsigned char *p_buff, unsigned long long value, size_t size)
+{
+    size_t i = 0;
+    for (; i < size; i++)
+        p_buff[i] = value >> (8 * i) & 0xFF;
+}
+
+static unsigned long long CmlPack_readInt(unsigned char *p_buff, size_t size)
+{
+    unsigned long long value = 0;
+    size_t i = size;
+    while (i != 0) {
+        i--;
+        value = (value << 8) | p_buff[i];
+    }
+
+    return value;
+}
+
+static unsigned char *CmlPack_writeLeb128(unsigned char *p_out, unsigned int value)
+{
+    while (value >= 0x80) {
+        *p_out++ = 0x80 | (value & 0x7F);
+        value >>= 7;
+    }
+    *p_out++ = value;
+    return p_out;
+}
+
+static unsigned int CmlPack_adler32(unsigned int adler, unsigned char *p_buff, size_t len)
+{
+    unsigned int a = adler & 0xFFFF;
+    unsigned int b = adler >> 16;
+    while (len != 0) {
+        size_t n = len < 5552 ? len : 5552;
+        len -= n;
+        for (; n != 0; n--) {
+            a += *p_buff++;
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+static unsigned int CmlPack_checksum(unsigned char *p_buff, size_t len)
+{
+    unsigned int adler = CmlPack_adler32(1, p_buff, 32);
+    return CmlPack_adler32(adler, p_buff + CmlPack_HEADER_SIZE, len - CmlPack_HEADER_SIZE);
+}
+
+/*
+Reads one opcode and returns how many tokens it stands for, or 0 when it
+is not one the encoder writes: an unknown opcode, a run with no token
+before it in the block, or a LEB128 number that is cut short, longer
+than it needs to be or out of range.
+*/
+static __Cml_INLINE size_t CmlPack_next(unsigned char **p_p_in, unsigned char *p_end, unsigned int *p_last)
+{
+    unsigned char *p_in = *p_p_in;
+    unsigned char b = *p_in++;
+    size_t run = 1;
+
+    if (b >= 0x80) {
+        *p_last = CmlTokenizer_RAW_TOKEN(b & 0x7F);
+    } else if (b >= 0x40) {
+        if (*p_last == 0)
+            return 0;
+        run = (b & 0x3F) + 1;
+    } else if (b == 0 || b == CmlPack_SPAN_OPCODE) {
+        unsigned int value = 0;
+        unsigned int shift = 0;
+        unsigned char byte;
+        do {
+            if (p_in == p_end || shift > CmlPack_MAX_LEB128_SHIFT)
+                return 0;
+            byte = *p_in++;
+            value |= (unsigned int) (byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        if ((shift > 7 && byte == 0) || (shift > CmlPack_MAX_LEB128_SHIFT && byte >> (32 - CmlPack_MAX_LEB128_SHIFT) != 0))
+            return 0;
+        if (b == 0 ? value > CmlTokenizer_MAX_SPAN_LENGTH - CmlTokenizer_RAW_TOKEN(0) : value == 0 || value > CmlTokenizer_MAX_SPAN_LENGTH)
+            return 0;
+        *p_last = b == 0 ? CmlTokenizer_RAW_TOKEN(value) : CmlTokenizer_SPAN_TOKEN(value);
+    } else if (b < CmlPack_SPAN_OPCODE) {
+        *p_last = b;
+    } else {
+        return 0;
+    }
+
+    *p_p_in = p_in;
+    return run;
+}
+
+size_t CmlPack_maxLength(size_t tokenStreamLen, size_t blockSize)
+{
+    if (blockSize == 0)
+        blockSize = CmlPack_DEFAULT_BLOCK_SIZE;
+
+    size_t blockCount = (tokenStreamLen + blockSize - 1) / blockSize;
+    return CmlPack_HEADER_SIZE + tokenStreamLen * CmlPack_MAX_TOKEN_SIZE + blockCount * 8;
+}
+
+size_t CmlPack_encode(CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen, size_t blockSize, unsigned char *p_buff, size_t len)
+{
+    if (blockSize == 0)
+        blockSize = CmlPack_DEFAULT_BLOCK_SIZE;
+
+    if (len < CmlPack_maxLength(tokenStreamLen, blockSize)) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    size_t blockCount = (tokenStreamLen + blockSize - 1) / blockSize;
+    unsigned char *p_out = p_buff + CmlPack_HEADER_SIZE;
+    unsigned char *p_index = p_buff + CmlPack_HEADER_SIZE + tokenStreamLen * CmlPack_MAX_TOKEN_SIZE;
+
+    size_t block = 0;
+    for (; block < blockCount; block++) {
+        CmlPack_writeInt(p_index + block * 8, p_out - p_buff, 8);
+
+        size_t i = block * blockSize;
+        size_t end = i + blockSize < tokenStreamLen ? i + blockSize : tokenStreamLen;
+        unsigned int last = 0;
+        size_t run = 0;
+        for (; i < end; i++) {
+            unsigned int token = tokenStream[i];
+            if (token == last && run < CmlPack_MAX_RUN) {
+                run++;
+                continue;
+            }
+
+            if (run != 0) {
+                *p_out++ = 0x40 | (run - 1);
+                run = 0;
+            }
+
+            if (token == last) {
+                run = 1;
+                continue;
+            }
+
+            if (CmlTokenizer_IS_SPAN_TOKEN(token)) {
+                *p_out++ = CmlPack_SPAN_OPCODE;
+                p_out = CmlPack_writeLeb128(p_out, CmlTokenizer_SPAN_LENGTH(token));
+            } else if (CmlTokenizer_IS_RAW_TOKEN(token)) {
+                unsigned int code = token - CmlTokenizer_RAW_TOKEN(0);
+                if (code < 0x80) {
+                    *p_out++ = 0x80 | code;
+                } else {
+                    *p_out++ = 0x00;
+                    p_out = CmlPack_writeLeb128(p_out, code);
+                }
+            } else {
+                *p_out++ = token;
+            }
+
+            last = token;
+        }
+
+        if (run != 0)
+            *p_out++ = 0x40 | (run - 1);
+    }
+
+    size_t indexOffset = p_out - p_buff;
+    memmove(p_out, p_index, blockCount * 8);
+    size_t total = indexOffset + blockCount * 8;
+
+    memcpy(p_buff, CmlPack_MAGIC, 4);
+    CmlPack_writeInt(p_buff + 4, CmlPack_VERSION, 2);
+    CmlPack_writeInt(p_buff + 6, 0, 2);
+    CmlPack_writeInt(p_buff + 8, blockSize, 4);
+    CmlPack_writeInt(p_buff + 12, blockCount, 4);
+    CmlPack_writeInt(p_buff + 16, tokenStreamLen, 8);
+    CmlPack_writeInt(p_buff + 24, indexOffset, 8);
+    CmlPack_writeInt(p_buff + 36, 0, 4);
+    CmlPack_writeInt(p_buff + 32, CmlPack_checksum(p_buff, total), 4);
+    return total;
+}
+
+int CmlPack_open(struct CmlPack_Reader *p_reader, unsigned char *p_buff, size_t len, int isVerifying)
+{
+    if (len < CmlPack_HEADER_SIZE || memcmp(p_buff, CmlPack_MAGIC, 4))
+        return EINVAL;
+    size_t version = CmlPack_readInt(p_buff + 4, 2);
+    if (version == 0 || version > CmlPack_VERSION)
+        return ENOTSUP;
+
+    size_t blockSize = CmlPack_readInt(p_buff + 8, 4);
+    size_t blockCount = CmlPack_readInt(p_buff + 12, 4);
+    size_t tokenCount = CmlPack_readInt(p_buff + 16, 8);
+    size_t indexOffset = CmlPack_readInt(p_buff + 24, 8);
+    if (blockSize == 0
+        || blockCount != tokenCount / blockSize + (tokenCount % blockSize != 0)
+        || indexOffset < CmlPack_HEADER_SIZE
+        || indexOffset > len
+        || (len - indexOffset) / 8 < blockCount)
+        return EINVAL;
+
+    /* Every block holds at least one token, so its offsets strictly increase */
+    size_t previous = CmlPack_HEADER_SIZE - 1;
+    size_t block = 0;
+    for (; block < blockCount; block++) {
+        size_t blockOffset = CmlPack_readInt(p_buff + indexOffset + block * 8, 8);
+        if (blockOffset <= previous || blockOffset >= indexOffset)
+            return EINVAL;
+        previous = blockOffset;
+    }
+
+    if (isVerifying && CmlPack_checksum(p_buff, indexOffset + blockCount * 8) != CmlPack_readInt(p_buff + 32, 4))
+        return EILSEQ;
+
+    p_reader->buff = p_buff;
+    p_reader->len = indexOffset;
+    p_reader->tokenCount = tokenCount;
+    p_reader->blockSize = blockSize;
+    p_reader->blockCount = blockCount;
+    p_reader->index = p_buff + indexOffset;
+    return 0;
+}
+
+size_t CmlPack_decode(struct CmlPack_Reader *p_reader, size_t first, CmlTokenizer_TokenStream tokenStream, size_t len)
+{
+    if (len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t n = first < p_reader->tokenCount ? p_reader->tokenCount - first : 0;
+    if (n > len - 1)
+        n = len - 1;
+
+    size_t block = first / p_reader->blockSize;
+    size_t skip = first % p_reader->blockSize;
+    size_t i = 0;
+    while (i < n) {
+        unsigned char *p_in = p_reader->buff + CmlPack_readInt(p_reader->index + block * 8, 8);
+        unsigned char *p_end = block + 1 < p_reader->blockCount
+            ? p_reader->buff + CmlPack_readInt(p_reader->index + (block + 1) * 8, 8)
+            : p_reader->buff + p_reader->len;
+        size_t left = p_reader->tokenCount - block * p_reader->blockSize;
+        if (left > p_reader->blockSize)
+            left = p_reader->blockSize;
+
+        unsigned int last = 0;
+        while (left != 0 && i < n) {
+            size_t run = p_in < p_end ? CmlPack_next(&p_in, p_end, &last) : 0;
+            if (run == 0 || run > left)
+                goto corrupt;
+
+            left -= run;
+            if (skip >= run) {
+                skip -= run;
+                continue;
+            }
+
+            run -= skip;
+            skip = 0;
+            for (; run != 0 && i < n; run--)
+                tokenStream[i++] = last;
+        }
+
+        if (left == 0 && p_in != p_end)
+            goto corrupt;
+        block++;
+    }
+
+    tokenStream[i] = CmlTokenizer_END_OF_TOKEN;
+    return i;
+
+    corrupt:
+    tokenStream[0] = CmlTokenizer_END_OF_TOKEN;
+    errno = EILSEQ;
+    return -1;
+}
@@ -0,0 +1,82 @@
+/*
+pack.h - Serialise token streams into a compact binary format
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PACK_H
+#define __PACK_H
+
+#include <stddef.h>
+#include "def.h"
+#include "tokenizer.h"
+
+/*
+Layout, all integers little-endian:
+
+    0   magic "CMLT"
+    4   u16 version
+    6   u16 flags
+    8   u32 tokens per block
+    12  u32 block count
+    16  u64 token count
+    24  u64 offset of the block index
+    32  u32 Adler-32 of bytes 0..31 and 40..end
+    36  u32 reserved
+    40  blocks
+        block index, one u64 byte offset per block
+
+Inside a block every token is one opcode:
+
+    0x00        raw token, LEB128 code point follows
+    0x01..0x3C  token 1..60
+    0x3D        span token, LEB128 length follows
+    0x40..0x7F  repeat the previous token 1..64 times
+    0x80..0xFF  raw token for code point 0x00..0x7F
+
+Runs never cross a block, so any block can be decoded on its own.
+Version 1 streams have no span tokens and are still read.
+
+CmlPack_open checks the header and that the block offsets increase and
+stay before the index; CmlPack_decode fails with EILSEQ on a block that
+does not hold exactly its tokens, one opcode after another.
+*/
+
+#define CmlPack_MAGIC "CMLT"
+#define CmlPack_VERSION 2
+#define CmlPack_HEADER_SIZE 40
+#define CmlPack_DEFAULT_BLOCK_SIZE 4096
+#define CmlPack_MAX_TOKEN_SIZE 6
+#define CmlPack_MAX_RUN 64
+#define CmlPack_SPAN_OPCODE 0x3D
+#define CmlPack_MAX_LEB128_SHIFT 28
+
+struct CmlPack_Reader {
+    unsigned char *buff;
+    size_t len;
+    size_t tokenCount;
+    size_t blockSize;
+    size_t blockCount;
+    unsigned char *index;
+};
+
+size_t CmlPack_maxLength(size_t tokenStreamLen, size_t blockSize);
+size_t CmlPack_encode(CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen, size_t blockSize, unsigned char *p_buff, size_t len);
+int CmlPack_open(struct CmlPack_Reader *p_reader, unsigned char *p_buff, size_t len, int isVerifying);
+size_t CmlPack_decode(struct CmlPack_Reader *p_reader, size_t first, CmlTokenizer_TokenStream tokenStream, size_t len);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+pos.c - Map tokens back to their position in the source buffer
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+A token nearly always spans at most two code points of at most
+CmlUTF_MAX_OCTETS_LENGTH bytes each, so its extent fits in a nibble: the
+byte length minus one in the top three bits and whether it took a second
+code point in the low bit. Two tokens share a byte of lengths.
+
+Every CmlPos_BLOCK_SIZE tokens a checkpoint records the absolute byte
+and code point offsets, plus one trailing checkpoint for the end of the
+stream. A lookup binary searches the checkpoints and then walks at most
+one block of nibbles.
+
+A one-code-point token never takes more than four bytes, so the nibble
+CmlPos_SPAN_NIBBLE is free to mark a span token, or a token composed
+from more than two code points. Their extents are kept in order in a
+side array, and each checkpoint records the index of the first span at
+or after it.
+*/
+
+#include <stddef.h>
+#include <errno.h>
+#include "def.h"
+#include "utf.h"
+#include "alloc.h"
+#include "tokenizer.h"
+#include "pos.h"
+
+#define CmlPos_NIBBLE(p_lengths, i) (((p_lengths)[(i) >> 1] >> (((i) & 1) << 2)) & 0xF)
+#define CmlPos_SPAN_NIBBLE 0xE
+
+static __Cml_INLINE void CmlPos_advance(struct CmlPos_Map *p_map, size_t i, size_t *p_span, size_t *p_byteOffset, size_t *p_codeOffset)
+{
+    unsigned char nibble = CmlPos_NIBBLE(p_map->lengths, i);
+    if (nibble == CmlPos_SPAN_NIBBLE) {
+        *p_byteOffset += p_map->spans[*p_span].byteLength;
+        *p_codeOffset += p_map->spans[*p_span].codeLength;
+        (*p_span)++;
+    } else {
+        *p_byteOffset += (nibble >> 1) + 1;
+        *p_codeOffset += (nibble & 1) + 1;
+    }
+}
+
+size_t CmlPos_tokenizationUTFInto(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, int isSpanning, struct CmlPos_Map *p_map, struct CmlAlloc_Allocator *p_allocator)
+{
+    p_map->allocator = CmlAlloc_resolve(p_allocator);
+    p_map->lengths = NULL;
+    p_map->checkpoints = NULL;
+    p_map->checkpointsLen = 0;
+    p_map->spans = NULL;
+    p_map->tokenStreamLen = 0;
+
+    unsigned char *p_bytes = CmlAlloc_alloc(p_map->allocator, len);
+    if (p_bytes == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t byteOffset = p_utf->currIndex;
+    size_t codeOffset = p_utf->offset;
+    size_t n = isSpanning
+        ? CmlTokenizer_tokenizationUTFSpans(p_utf, tokenStream, len, p_bytes)
+        : CmlTokenizer_tokenizationUTFLengths(p_utf, tokenStream, len, p_bytes);
+    if (n == -1) {
+        CmlAlloc_free(p_map->allocator, p_bytes);
+        return -1;
+    }
+
+    size_t spansLen = 0;
+    size_t i = 0;
+    for (; i < n; i++)
+        spansLen += p_bytes[i] >= CmlTokenizer_LONG_LENGTHS;
+
+    p_map->lengths = CmlAlloc_alloc(p_map->allocator, n / 2 + 1);
+    p_map->checkpoints = CmlAlloc_alloc(p_map->allocator, sizeof(struct CmlPos_Checkpoint) * (n / CmlPos_BLOCK_SIZE + 2));
+    p_map->spans = spansLen != 0 ? CmlAlloc_alloc(p_map->allocator, sizeof(struct CmlPos_Span) * spansLen) : NULL;
+    if (p_map->lengths == NULL || p_map->checkpoints == NULL || (spansLen != 0 && p_map->spans == NULL)) {
+        CmlAlloc_free(p_map->allocator, p_bytes);
+        CmlPos_destroy(p_map);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t (*count)(unsigned char *, size_t) = p_utf->endian == Cml_BE ? p_utf->codec->countBE : p_utf->codec->countLE;
+    size_t span = 0;
+    for (i = 0; i < n; i++) {
+        if (i % CmlPos_BLOCK_SIZE == 0) {
+            p_map->checkpoints[p_map->checkpointsLen].byteOffset = byteOffset;
+            p_map->checkpoints[p_map->checkpointsLen].codeOffset = codeOffset;
+            p_map->checkpoints[p_map->checkpointsLen].span = span;
+            p_map->checkpointsLen++;
+        }
+
+        unsigned char nibble = p_bytes[i];
+        if (nibble >= CmlTokenizer_LONG_LENGTHS) {
+            p_map->spans[span].byteLength = nibble == CmlTokenizer_SPAN_LENGTHS
+                ? CmlTokenizer_SPAN_LENGTH(tokenStream[i])
+                : nibble - CmlTokenizer_LONG_LENGTHS + 1;
+            p_map->spans[span].codeLength = count(p_utf->buff + byteOffset, p_map->spans[span].byteLength);
+            nibble = CmlPos_SPAN_NIBBLE;
+        }
+
+        if (i % 2 == 0)
+            p_map->lengths[i >> 1] = nibble;
+        else
+            p_map->lengths[i >> 1] |= nibble << 4;
+
+        if (nibble == CmlPos_SPAN_NIBBLE) {
+            byteOffset += p_map->spans[span].byteLength;
+            codeOffset += p_map->spans[span].codeLength;
+            span++;
+        } else {
+            byteOffset += (nibble >> 1) + 1;
+            codeOffset += (nibble & 1) + 1;
+        }
+    }
+
+    p_map->checkpoints[p_map->checkpointsLen].byteOffset = byteOffset;
+    p_map->checkpoints[p_map->checkpointsLen].codeOffset = codeOffset;
+    p_map->checkpoints[p_map->checkpointsLen].span = span;
+    p_map->tokenStreamLen = n;
+    CmlAlloc_free(p_map->allocator, p_bytes);
+    return n;
+}
+
+void CmlPos_destroy(struct CmlPos_Map *p_map)
+{
+    CmlAlloc_free(p_map->allocator, p_map->lengths);
+    CmlAlloc_free(p_map->allocator, p_map->checkpoints);
+    CmlAlloc_free(p_map->allocator, p_map->spans);
+    p_map->lengths = NULL;
+    p_map->checkpoints = NULL;
+    p_map->spans = NULL;
+    p_map->checkpointsLen = 0;
+    p_map->tokenStreamLen = 0;
+}
+
+int CmlPos_position(struct CmlPos_Map *p_map, size_t i, size_t *p_byteOffset, size_t *p_codeOffset)
+{
+    if (i > p_map->tokenStreamLen)
+        return errno = ERANGE;
+
+    size_t block = i / CmlPos_BLOCK_SIZE;
+    size_t byteOffset = p_map->checkpoints[block].byteOffset;
+    size_t codeOffset = p_map->checkpoints[block].codeOffset;
+    size_t span = p_map->checkpoints[block].span;
+    size_t j = block * CmlPos_BLOCK_SIZE;
+    for (; j < i; j++)
+        CmlPos_advance(p_map, j, &span, &byteOffset, &codeOffset);
+
+    *p_byteOffset = byteOffset;
+    *p_codeOffset = codeOffset;
+    return 0;
+}
+
+static size_t CmlPos_find(struct CmlPos_Map *p_map, size_t target, int isCode)
+{
+    struct CmlPos_Checkpoint *p_checkpoints = p_map->checkpoints;
+    size_t n = p_map->tokenStreamLen;
+    if (n == 0
+        || target < (isCode ? p_checkpoints[0].codeOffset : p_checkpoints[0].byteOffset)
+        || target >= (isCode ? p_checkpoints[p_map->checkpointsLen].codeOffset : p_checkpoints[p_map->checkpointsLen].byteOffset)) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    size_t lo = 0, hi = p_map->checkpointsLen;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((isCode ? p_checkpoints[mid].codeOffset : p_checkpoints[mid].byteOffset) <= target)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    size_t byteOffset = p_checkpoints[lo].byteOffset;
+    size_t codeOffset = p_checkpoints[lo].codeOffset;
+    size_t span = p_checkpoints[lo].span;
+    size_t i = lo * CmlPos_BLOCK_SIZE;
+    for (; i + 1 < n; i++) {
+        CmlPos_advance(p_map, i, &span, &byteOffset, &codeOffset);
+        if ((isCode ? codeOffset : byteOffset) > target)
+            break;
+    }
+
+    return i;
+}
+
+size_t CmlPos_findByte(struct CmlPos_Map *p_map, size_t byteOffset)
+{
+    return CmlPos_find(p_map, byteOffset, 0);
+}
+
+size_t CmlPos_findCode(struct CmlPos_Map *p_map, size_t codeOffset)
+{
+    return CmlPos_find(p_map, codeOffset, 1);
+}
@@ -0,0 +1,58 @@
+/*
+pos.h - Map tokens back to their position in the source buffer
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __POS_H
+#define __POS_H
+
+#include <stddef.h>
+#include "def.h"
+#include "utf.h"
+#include "alloc.h"
+#include "tokenizer.h"
+
+#define CmlPos_BLOCK_SIZE 64
+
+struct CmlPos_Checkpoint {
+    size_t byteOffset;
+    size_t codeOffset;
+    size_t span;
+};
+
+struct CmlPos_Span {
+    size_t byteLength;
+    size_t codeLength;
+};
+
+struct CmlPos_Map {
+    unsigned char *lengths;
+    struct CmlPos_Checkpoint *checkpoints;
+    size_t checkpointsLen;
+    struct CmlPos_Span *spans;
+    size_t tokenStreamLen;
+    struct CmlAlloc_Allocator *allocator;
+};
+
+size_t CmlPos_tokenizationUTFInto(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, int isSpanning, struct CmlPos_Map *p_map, struct CmlAlloc_Allocator *p_allocator);
+void CmlPos_destroy(struct CmlPos_Map *p_map);
+int CmlPos_position(struct CmlPos_Map *p_map, size_t i, size_t *p_byteOffset, size_t *p_codeOffset);
+size_t CmlPos_findByte(struct CmlPos_Map *p_map, size_t byteOffset);
+size_t CmlPos_findCode(struct CmlPos_Map *p_map, size_t codeOffset);
+
+#endif
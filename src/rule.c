@@ -0,0 +1,301 @@
+/*
+rule.c - Rewrite token streams with compiled contextual rules
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+The table is CmlRule_MAGIC, then the class, state and rule counts and
+the delay as big-endian words, then one class byte per symbol padded to
+CmlRule_HEADER_SIZE. Then come two bytes per (state, class) transition,
+one word per state plus one indexing the accept lists, two bytes per
+accepted rule, CmlRule_RULE_SIZE bytes per rule and the replacement
+tokens as words. A rule is the length of its target and right context,
+the length of its target, the length of its replacement in two bytes
+and the index of its first replacement token.
+
+Every position of the stream, the two boundaries included, has a slot
+in a ring of CmlRule_WINDOW_SIZE. A rule that matches records itself in
+the slot where its target starts, as a rewrite or, when the target is
+empty, as an insertion; of the rules that match there, the first in the
+file wins. Contexts are matched against the input, so one rewrite never
+feeds another, and of two overlapping targets the one that starts first
+wins.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include "def.h"
+#include "tokenizer.h"
+#include "rule.h"
+
+#define CmlRule_SLOT(i) ((i) & (CmlRule_WINDOW_SIZE - 1))
+
+static __Cml_INLINE size_t CmlRule_readWord(unsigned char *p_byte)
+{
+    return (size_t) p_byte[0] << 24 | p_byte[1] << 16 | p_byte[2] << 8 | p_byte[3];
+}
+
+static __Cml_INLINE size_t CmlRule_readShort(unsigned char *p_byte)
+{
+    return p_byte[0] << 8 | p_byte[1];
+}
+
+static __Cml_INLINE size_t CmlRule_symbolOf(unsigned int token)
+{
+    if (token < CmlRule_RAW_SYMBOL)
+        return token;
+    return CmlTokenizer_IS_SPAN_TOKEN(token) ? CmlRule_SPAN_SYMBOL : CmlRule_RAW_SYMBOL;
+}
+
+int CmlRule_open(struct CmlRule_Rules *p_rules, unsigned char *p_buff, size_t len)
+{
+    if (len < CmlRule_HEADER_SIZE || memcmp(p_buff, CmlRule_MAGIC, 4))
+        return errno = EINVAL;
+
+    size_t classCount = CmlRule_readWord(p_buff + 4);
+    size_t stateCount = CmlRule_readWord(p_buff + 8);
+    size_t ruleCount = CmlRule_readWord(p_buff + 12);
+    size_t delay = CmlRule_readWord(p_buff + 16);
+    if (classCount == 0 || classCount > 0x100 || stateCount == 0 || stateCount > CmlRule_MAX_STATES
+        || ruleCount > CmlRule_MAX_RULES || delay == 0 || delay > CmlRule_MAX_DELAY)
+        return errno = EINVAL;
+
+    size_t acceptIndexOffset = CmlRule_HEADER_SIZE + stateCount * classCount * 2;
+    size_t acceptsOffset = acceptIndexOffset + (stateCount + 1) * 4;
+    if (acceptsOffset > len)
+        return errno = EINVAL;
+
+    size_t acceptCount = CmlRule_readWord(p_buff + acceptIndexOffset + stateCount * 4);
+    size_t rulesOffset = acceptsOffset + acceptCount * 2;
+    size_t replacementsOffset = rulesOffset + ruleCount * CmlRule_RULE_SIZE;
+    if (replacementsOffset > len || (len - replacementsOffset) % 4 != 0)
+        return errno = EINVAL;
+
+    size_t i = 0;
+    for (; i < CmlRule_SYMBOLS; i++) {
+        if (p_buff[20 + i] >= classCount)
+            return errno = EINVAL;
+    }
+    for (i = 0; i < stateCount * classCount; i++) {
+        if (CmlRule_readShort(p_buff + CmlRule_HEADER_SIZE + i * 2) >= stateCount)
+            return errno = EINVAL;
+    }
+    for (i = 0; i < stateCount; i++) {
+        if (CmlRule_readWord(p_buff + acceptIndexOffset + i * 4) > CmlRule_readWord(p_buff + acceptIndexOffset + i * 4 + 4))
+            return errno = EINVAL;
+    }
+    for (i = 0; i < acceptCount; i++) {
+        if (CmlRule_readShort(p_buff + acceptsOffset + i * 2) >= ruleCount)
+            return errno = EINVAL;
+    }
+
+    size_t replacementCount = (len - replacementsOffset) / 4;
+    size_t maxReplacement = 0;
+    for (i = 0; i < ruleCount; i++) {
+        unsigned char *p_rule = p_buff + rulesOffset + i * CmlRule_RULE_SIZE;
+        size_t replacementLen = CmlRule_readShort(p_rule + 2);
+        size_t replacementStart = CmlRule_readWord(p_rule + 4);
+        if (p_rule[0] > delay || p_rule[1] > p_rule[0]
+            || replacementStart > replacementCount || replacementLen > replacementCount - replacementStart)
+            return errno = EINVAL;
+        if (replacementLen > maxReplacement)
+            maxReplacement = replacementLen;
+    }
+
+    p_rules->buff = p_buff;
+    p_rules->len = len;
+    p_rules->classCount = classCount;
+    p_rules->stateCount = stateCount;
+    p_rules->ruleCount = ruleCount;
+    p_rules->delay = delay;
+    p_rules->room = 2 * maxReplacement + 1;
+    p_rules->classes = p_buff + 20;
+    p_rules->transitions = p_buff + CmlRule_HEADER_SIZE;
+    p_rules->acceptIndex = p_buff + acceptIndexOffset;
+    p_rules->accepts = p_buff + acceptsOffset;
+    p_rules->rules = p_buff + rulesOffset;
+    p_rules->replacements = p_buff + replacementsOffset;
+    return 0;
+}
+
+void CmlRule_new(struct CmlRule_Transducer *p_tr, struct CmlRule_Rules *p_rules, CmlTokenizer_TokenStream tokenStream, size_t len)
+{
+    p_tr->rules = p_rules;
+    p_tr->out = tokenStream;
+    p_tr->len = len;
+    p_tr->count = 0;
+    p_tr->index = 0;
+    p_tr->emitted = 0;
+    p_tr->skip = 0;
+    p_tr->state = 0;
+    p_tr->isEnding = 0;
+    memset(p_tr->rewrites, 0, sizeof(p_tr->rewrites));
+    memset(p_tr->inserts, 0, sizeof(p_tr->inserts));
+}
+
+static __Cml_INLINE void CmlRule_replace(struct CmlRule_Transducer *p_tr, size_t rule)
+{
+    unsigned char *p_rule = p_tr->rules->rules + rule * CmlRule_RULE_SIZE;
+    unsigned char *p_token = p_tr->rules->replacements + CmlRule_readWord(p_rule + 4) * 4;
+    size_t n = CmlRule_readShort(p_rule + 2);
+    size_t i = 0;
+    for (; i < n; i++)
+        p_tr->out[p_tr->count++] = CmlRule_readWord(p_token + i * 4);
+}
+
+static __Cml_INLINE void CmlRule_emit(struct CmlRule_Transducer *p_tr)
+{
+    size_t slot = CmlRule_SLOT(p_tr->emitted++);
+    if (p_tr->inserts[slot] != 0 && p_tr->skip == 0)
+        CmlRule_replace(p_tr, p_tr->inserts[slot] - 1);
+
+    if (p_tr->skip != 0) {
+        p_tr->skip--;
+    } else if (p_tr->rewrites[slot] != 0) {
+        size_t rule = p_tr->rewrites[slot] - 1;
+        CmlRule_replace(p_tr, rule);
+        p_tr->skip = p_tr->rules->rules[rule * CmlRule_RULE_SIZE + 1] - 1;
+    } else if (p_tr->tokens[slot] != 0) {
+        p_tr->out[p_tr->count++] = p_tr->tokens[slot];
+    }
+}
+
+/*
+A boundary is stepped with the end-of-token symbol but kept in the ring
+as 0, so that it is never written out.
+*/
+static __Cml_INLINE void CmlRule_step(struct CmlRule_Transducer *p_tr, unsigned int token, unsigned int kept)
+{
+    struct CmlRule_Rules *p_rules = p_tr->rules;
+    size_t k = p_tr->index;
+    size_t next = CmlRule_SLOT(k + 1);
+    p_tr->tokens[next] = 0;
+    p_tr->rewrites[next] = 0;
+    p_tr->inserts[next] = 0;
+    p_tr->tokens[CmlRule_SLOT(k)] = kept;
+
+    size_t state = CmlRule_readShort(p_rules->transitions + (p_tr->state * p_rules->classCount + p_rules->classes[CmlRule_symbolOf(token)]) * 2);
+    unsigned char *p_index = p_rules->acceptIndex + state * 4;
+    size_t i = CmlRule_readWord(p_index);
+    size_t end = CmlRule_readWord(p_index + 4);
+    for (; i < end; i++) {
+        size_t rule = CmlRule_readShort(p_rules->accepts + i * 2);
+        unsigned char *p_rule = p_rules->rules + rule * CmlRule_RULE_SIZE;
+        size_t slot = CmlRule_SLOT(k + 1 - p_rule[0]);
+        unsigned short *p_slots = p_rule[1] == 0 ? p_tr->inserts : p_tr->rewrites;
+        if (p_slots[slot] == 0 || p_slots[slot] > rule + 1)
+            p_slots[slot] = rule + 1;
+    }
+
+    p_tr->state = state;
+    p_tr->index = k + 1;
+    while (p_tr->emitted + p_rules->delay <= p_tr->index)
+        CmlRule_emit(p_tr);
+}
+
+static __Cml_INLINE int CmlRule_hasRoom(struct CmlRule_Transducer *p_tr)
+{
+    return p_tr->len > p_tr->count && p_tr->len - 1 - p_tr->count >= p_tr->rules->room;
+}
+
+/*
+Stops with ENOBUFS, before the token that might not fit, once fewer than
+CmlRule_Rules.room tokens are left besides the one kept for the end of
+token. The caller can take the count tokens written so far, set count
+back to zero and feed the rest.
+*/
+size_t CmlRule_feed(struct CmlRule_Transducer *p_tr, CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen)
+{
+    if (p_tr->len == 0 || p_tr->isEnding) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (p_tr->index == 0) {
+        if (!CmlRule_hasRoom(p_tr)) {
+            errno = ENOBUFS;
+            return 0;
+        }
+        CmlRule_step(p_tr, CmlTokenizer_END_OF_TOKEN, 0);
+    }
+
+    size_t i = 0;
+    for (; i < tokenStreamLen; i++) {
+        if (!CmlRule_hasRoom(p_tr)) {
+            errno = ENOBUFS;
+            break;
+        }
+        CmlRule_step(p_tr, tokenStream[i], tokenStream[i]);
+    }
+
+    return i;
+}
+
+/*
+Writes out what is still held back and the end of token, and returns the
+count of tokens written without it. It fails with ENOBUFS like
+CmlRule_feed and can be called again once the caller has made room.
+*/
+size_t CmlRule_finish(struct CmlRule_Transducer *p_tr)
+{
+    if (p_tr->len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!p_tr->isEnding) {
+        if (p_tr->index == 0 && CmlRule_feed(p_tr, NULL, 0) == -1)
+            return -1;
+        if (!CmlRule_hasRoom(p_tr)) {
+            errno = ENOBUFS;
+            return -1;
+        }
+
+        CmlRule_step(p_tr, CmlTokenizer_END_OF_TOKEN, 0);
+        p_tr->isEnding = 1;
+    }
+
+    while (p_tr->emitted <= p_tr->index) {
+        if (!CmlRule_hasRoom(p_tr)) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        CmlRule_emit(p_tr);
+    }
+
+    p_tr->out[p_tr->count] = CmlTokenizer_END_OF_TOKEN;
+    return p_tr->count;
+}
+
+size_t CmlRule_apply(struct CmlRule_Rules *p_rules, CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen, CmlTokenizer_TokenStream out, size_t len)
+{
+    struct CmlRule_Transducer tr;
+    CmlRule_new(&tr, p_rules, out, len);
+    size_t fed = CmlRule_feed(&tr, tokenStream, tokenStreamLen);
+    if (fed == -1)
+        return -1;
+    if (fed != tokenStreamLen || CmlRule_finish(&tr) == -1) {
+        if (len != 0)
+            out[tr.count] = CmlTokenizer_END_OF_TOKEN;
+        errno = ENOBUFS;
+        return tr.count;
+    }
+
+    return tr.count;
+}
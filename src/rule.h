@@ -0,0 +1,92 @@
+/*
+rule.h - Rewrite token streams with compiled contextual rules
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RULE_H
+#define __RULE_H
+
+#include <stddef.h>
+#include "def.h"
+#include "tokenizer.h"
+
+/*
+A rule table is compiled by mkrule. Every token maps to a symbol: named
+and ASCII raw tokens to themselves, other raw tokens and span tokens to
+one symbol each. Symbols map to classes, and (state, class) pairs to the
+next DFA state. A state lists the rules whose whole pattern, left
+context, target and right context, ends at the token just read.
+
+The transducer reads the stream once, with the end-of-token value as a
+boundary before the first token and after the last. A token is written
+out CmlRule_Rules.delay tokens later, once every rule whose target could
+start at it has been decided.
+*/
+
+#define CmlRule_MAGIC "CmlR"
+#define CmlRule_HEADER_SIZE 212
+#define CmlRule_SYMBOLS 191
+#define CmlRule_RAW_SYMBOL CmlTokenizer_RAW_TOKEN(128)
+#define CmlRule_SPAN_SYMBOL (CmlRule_RAW_SYMBOL + 1)
+#define CmlRule_WINDOW_SIZE 64
+#define CmlRule_MAX_DELAY (CmlRule_WINDOW_SIZE - 2)
+#define CmlRule_MAX_STATES 0x10000
+#define CmlRule_MAX_RULES 0xFFFF
+#define CmlRule_RULE_SIZE 8
+
+extern unsigned char *___Rule_bin;
+extern size_t ___Rule_bin_len;
+
+struct CmlRule_Rules {
+    unsigned char *buff;
+    size_t len;
+    size_t classCount;
+    size_t stateCount;
+    size_t ruleCount;
+    size_t delay;
+    size_t room;
+    unsigned char *classes;
+    unsigned char *transitions;
+    unsigned char *acceptIndex;
+    unsigned char *accepts;
+    unsigned char *rules;
+    unsigned char *replacements;
+};
+
+struct CmlRule_Transducer {
+    struct CmlRule_Rules *rules;
+    unsigned int *out;
+    size_t len;
+    size_t count;
+    size_t index;
+    size_t emitted;
+    size_t skip;
+    unsigned int state;
+    int isEnding;
+    unsigned int tokens[CmlRule_WINDOW_SIZE];
+    unsigned short rewrites[CmlRule_WINDOW_SIZE];
+    unsigned short inserts[CmlRule_WINDOW_SIZE];
+};
+
+int CmlRule_open(struct CmlRule_Rules *p_rules, unsigned char *p_buff, size_t len);
+void CmlRule_new(struct CmlRule_Transducer *p_tr, struct CmlRule_Rules *p_rules, CmlTokenizer_TokenStream tokenStream, size_t len);
+size_t CmlRule_feed(struct CmlRule_Transducer *p_tr, CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen);
+size_t CmlRule_finish(struct CmlRule_Transducer *p_tr);
+size_t CmlRule_apply(struct CmlRule_Rules *p_rules, CmlTokenizer_TokenStream tokenStream, size_t tokenStreamLen, CmlTokenizer_TokenStream out, size_t len);
+
+#endif
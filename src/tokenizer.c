@@ -20,10 +20,22 @@ along with this program; if not, see
 
 #include <stddef.h>
 #include <errno.h>
-#include <stdlib.h>
 #include "utf.h"
+#include "utf8.h"
+#include "utf16.h"
+#include "utf32.h"
+#include "alloc.h"
+#include "norm.h"
 #include "tokenizer.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CmlTokenizer_AS_IS_START_CODE 0xF0005
+#define CmlTokenizer_REPLACEMENT_CODE 0xFFFD
+#define CmlTokenizer_MAX_CODE 0x10FFFF
+
 static CmlUTF_Code CmlTokenizer_convertToLowerCase(CmlUTF_Code code)
 {
     if (code >= 0x0041 && code <= 0x005A)
@@ -40,7 +52,7 @@ static CmlUTF_Code CmlTokenizer_convertToLowerCase(CmlUTF_Code code)
     return code;
 }
 
-size_t CmlTokenizer_preprocess(CmlUTF_Code c1, CmlUTF_Code c2, CmlUTF_Code *p_code)
+static __Cml_FORCE_INLINE size_t __CmlTokenizer_preprocess(CmlUTF_Code c1, CmlUTF_Code c2, CmlUTF_Code *p_code)
 {
     *p_code = c1;
     c1 = CmlTokenizer_convertToLowerCase(c1);
@@ -48,7 +60,7 @@ size_t CmlTokenizer_preprocess(CmlUTF_Code c1, CmlUTF_Code c2, CmlUTF_Code *p_co
         c1 = 0x00E9;
 
     if (c1 == CmlTokenizer_TRANSLITERATION_AS_IS_START_SYMBOL) {
-        *p_code = 0xF0005;
+        *p_code = CmlTokenizer_AS_IS_START_CODE;
         goto skipOneChar;
     } else if (c1 == CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL) {
         *p_code = 0xF0006;
@@ -131,139 +143,641 @@ size_t CmlTokenizer_preprocess(CmlUTF_Code c1, CmlUTF_Code c2, CmlUTF_Code *p_co
     skipTwoChars: return 2;
 }
 
-CmlTokenizer_TokenStream CmlTokenizer_tokenizationUTF(struct CmlUTF_Buffer *p_utf)
+size_t CmlTokenizer_preprocess(CmlUTF_Code c1, CmlUTF_Code c2, CmlUTF_Code *p_code)
 {
-    size_t utfLen = CmlUTF_len(p_utf);
-    size_t tokenStreamLen = 0;
-    CmlTokenizer_TokenStream tokenStream = malloc(sizeof(enum CmlTokenizer_Token) * (utfLen + 1));
+    return __CmlTokenizer_preprocess(c1, c2, p_code);
+}
 
+static __Cml_INLINE enum CmlTokenizer_Token CmlTokenizer_classify(CmlUTF_Code code)
+{
+    enum CmlTokenizer_Token token = CmlTokenizer_RAW_TOKEN(code);
+    if (code >= '0' && code <= '9') {
+        token = CmlTokenizer_NUMBER_0_TOKEN + code - '0';
+    } else {
+        switch (code) {
+            case ' ': token = CmlTokenizer_SPACE_TOKEN;
+            break;
+            case 'a': token = CmlTokenizer_VOCAL_A_TOKEN;
+            break;
+            case 'i': token = CmlTokenizer_VOCAL_I_TOKEN;
+            break;
+            case 'u': token = CmlTokenizer_VOCAL_U_TOKEN;
+            break;
+            case 'e': token = CmlTokenizer_VOCAL_SCHWA_TOKEN;
+            break;
+            case 0x00E9: token = CmlTokenizer_VOCAL_E_TOKEN;
+            break;
+            case 'o': token = CmlTokenizer_VOCAL_O_TOKEN;
+            break;
+            case 0x1E37: token = CmlTokenizer_SYLLABIC_CONSONANT_L_TOKEN;
+            break;
+            case 0x1E5B: token = CmlTokenizer_SYLLABIC_CONSONANT_R_TOKEN;
+            break;
+            case 0x0101: token = CmlTokenizer_LONG_VOCAL_A_TOKEN;
+            break;
+            case 0x012B: token = CmlTokenizer_LONG_VOCAL_I_TOKEN;
+            break;
+            case 0x016B: token = CmlTokenizer_LONG_VOCAL_U_TOKEN;
+            break;
+            case 0x0113: token = CmlTokenizer_LONG_VOCAL_SCHWA_TOKEN;
+            break;
+            case 0x1E17: token = CmlTokenizer_LONG_VOCAL_E_TOKEN;
+            break;
+            case 0x014D: token = CmlTokenizer_LONG_VOCAL_O_TOKEN;
+            break;
+            case 0x1E39: token = CmlTokenizer_LONG_SYLLABIC_CONSONANT_L_TOKEN;
+            break;
+            case 0x1E5D: token = CmlTokenizer_LONG_SYLLABIC_CONSONANT_R_TOKEN;
+            break;
+            case 'h': token = CmlTokenizer_CONSONANT_H_TOKEN;
+            break;
+            case 'n': token = CmlTokenizer_CONSONANT_N_TOKEN;
+            break;
+            case 'c': token = CmlTokenizer_CONSONANT_C_TOKEN;
+            break;
+            case 'r': token = CmlTokenizer_CONSONANT_R_TOKEN;
+            break;
+            case 'k': token = CmlTokenizer_CONSONANT_K_TOKEN;
+            break;
+            case 'd': token = CmlTokenizer_CONSONANT_D_TOKEN;
+            break;
+            case 't': token = CmlTokenizer_CONSONANT_T_TOKEN;
+            break;
+            case 's': token = CmlTokenizer_CONSONANT_S_TOKEN;
+            break;
+            case 'w': token = CmlTokenizer_CONSONANT_W_TOKEN;
+            break;
+            case 'l': token = CmlTokenizer_CONSONANT_L_TOKEN;
+            break;
+            case 'm': token = CmlTokenizer_CONSONANT_M_TOKEN;
+            break;
+            case 'g': token = CmlTokenizer_CONSONANT_G_TOKEN;
+            break;
+            case 'b': token = CmlTokenizer_CONSONANT_B_TOKEN;
+            break;
+            case 'p': token = CmlTokenizer_CONSONANT_P_TOKEN;
+            break;
+            case 'j': token = CmlTokenizer_CONSONANT_J_TOKEN;
+            break;
+            case 'y': token = CmlTokenizer_CONSONANT_Y_TOKEN;
+            break;
+            case 0x1E47: token = CmlTokenizer_RETROFLEX_CONSONANT_N_TOKEN;
+            break;
+            case 0x1E0D: token = CmlTokenizer_RETROFLEX_CONSONANT_D_TOKEN;
+            break;
+            case 0x1E6D: token = CmlTokenizer_RETROFLEX_CONSONANT_T_TOKEN;
+            break;
+            case 0x1E63: token = CmlTokenizer_RETROFLEX_CONSONANT_S_TOKEN;
+            break;
+            case 0x015B: token = CmlTokenizer_PALATAL_CONSONANT_S_TOKEN;
+            break;
+            case ',': token = CmlTokenizer_PUNCTUATION_CARIK_SIKI_TOKEN;
+            break;
+            case '.': token = CmlTokenizer_PUNCTUATION_CARIK_KALIH_TOKEN;
+            break;
+            case ':': token = CmlTokenizer_PUNCTUATION_CARIK_PAMUNGKAH_TOKEN;
+            break;
+            case 0xF0000: token = CmlTokenizer_PUNCTUATION_PANTEN_TOKEN;
+            break;
+            case 0xF0001: token = CmlTokenizer_PUNCTUATION_PASALINAN_TOKEN;
+            break;
+            case 0xF0002: token = CmlTokenizer_PUNCTUATION_PAMADA_TOKEN;
+            break;
+            case 0xF0003: token = CmlTokenizer_PUNCTUATION_CARIK_AGUNG_TOKEN;
+            break;
+            case 0xF0004: token = CmlTokenizer_PUNCTUATION_IDEM_TOKEN;
+            break;
+            case CmlTokenizer_AS_IS_START_CODE: token = CmlTokenizer_TRANSLITERATION_AS_IS_START_TOKEN;
+            break;
+            case 0xF0006: token = CmlTokenizer_TRANSLITERATION_AS_IS_END_TOKEN;
+            break;
+        }
+    }
+
+    return token;
+}
+
+static const CmlUTF_Code CmlTokenizer_codes[][2] = {
+    { 0, 0 }, { 0, 0 }, { ' ', 0 },
+    { 'a', 0 }, { 'i', 0 }, { 'u', 0 }, { 0x00E9, 0 }, { 'e', 0 }, { 'o', 0 },
+    { 0x1E37, 0 }, { 0x1E5B, 0 },
+    { 0x0101, 0 }, { 0x012B, 0 }, { 0x016B, 0 }, { 0x1E17, 0 }, { 0x0113, 0 }, { 0x014D, 0 },
+    { 0x1E39, 0 }, { 0x1E5D, 0 },
+    { 'h', 0 }, { 'n', 0 }, { 'c', 0 }, { 'r', 0 }, { 'k', 0 }, { 'd', 0 }, { 't', 0 }, { 's', 0 },
+    { 'w', 0 }, { 'l', 0 }, { 'm', 0 }, { 'g', 0 }, { 'b', 0 }, { 'p', 0 }, { 'j', 0 }, { 'y', 0 },
+    { 0x1E47, 0 }, { 0x1E0D, 0 }, { 0x1E6D, 0 }, { 0x1E63, 0 }, { 0x015B, 0 },
+    { '0', 0 }, { '1', 0 }, { '2', 0 }, { '3', 0 }, { '4', 0 }, { '5', 0 }, { '6', 0 }, { '7', 0 }, { '8', 0 }, { '9', 0 },
+    { ',', 0 }, { '.', 0 }, { ':', 0 },
+    { '+', '+' }, { '-', '-' }, { '#', '#' }, { '/', '/' }, { '=', '=' },
+    { CmlTokenizer_TRANSLITERATION_AS_IS_START_SYMBOL, 0 }, { CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL, 0 }
+};
+
+size_t CmlTokenizer_toCodes(unsigned int token, CmlUTF_Code *p_codes)
+{
+    if (CmlTokenizer_IS_RAW_TOKEN(token)) {
+        p_codes[0] = token - CmlTokenizer_RAW_TOKEN(0);
+        return 1;
+    }
+
+    if (token > CmlTokenizer_TRANSLITERATION_AS_IS_END_TOKEN)
+        return 0;
+
+    p_codes[0] = CmlTokenizer_codes[token][0];
+    p_codes[1] = CmlTokenizer_codes[token][1];
+    return (p_codes[0] != 0) + (p_codes[1] != 0);
+}
+
+size_t CmlTokenizer_maxTokensUTF(struct CmlUTF_Buffer *p_utf)
+{
+    return CmlUTF_maxCount(p_utf);
+}
+
+static __Cml_INLINE unsigned int CmlTokenizer_lowestBit(unsigned int mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    unsigned int i = 0;
+    for (; !(mask & 1); mask >>= 1)
+        i++;
+    return i;
+#endif
+}
+
+/*
+The as-is text after a '[' runs up to the first ']' or '$' code unit.
+Both are ASCII, so in UTF-8 they never occur inside a longer sequence
+and a plain byte search finds them. The searches return -1 when neither
+occurs in the buffer.
+*/
+static size_t CmlTokenizer_findAsIsEndUTF8(unsigned char *p_buff, size_t len)
+{
     size_t i = 0;
-    while (1) {
-        CmlUTF_Code c1 = CmlUTF_read(p_utf);
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((__m128i *) (p_buff + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8(CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL)),
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8(CmlTokenizer_ESCAPE_SYMBOL))));
+        if (mask != 0)
+            return i + CmlTokenizer_lowestBit(mask);
+    }
+#endif
+    for (; i < len; i++) {
+        if (p_buff[i] == CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL || p_buff[i] == CmlTokenizer_ESCAPE_SYMBOL)
+            return i;
+    }
+
+    return -1;
+}
+
+static __Cml_FORCE_INLINE size_t CmlTokenizer_findAsIsEndUTF16(unsigned char *p_buff, size_t len, enum Cml_Endianness endian)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i units = _mm_loadu_si128((__m128i *) (p_buff + i));
+        if (endian == Cml_BE)
+            units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi16(units, _mm_set1_epi16(CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL)),
+            _mm_cmpeq_epi16(units, _mm_set1_epi16(CmlTokenizer_ESCAPE_SYMBOL))));
+        if (mask != 0)
+            return i + CmlTokenizer_lowestBit(mask);
+    }
+#endif
+    for (; i + 1 < len; i += 2) {
+        unsigned int unit = endian == Cml_BE
+            ? (p_buff[i] << 8) | p_buff[i + 1]
+            : (p_buff[i + 1] << 8) | p_buff[i];
+        if (unit == CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL || unit == CmlTokenizer_ESCAPE_SYMBOL)
+            return i;
+    }
+
+    return -1;
+}
+
+static __Cml_FORCE_INLINE size_t CmlTokenizer_findAsIsEndUTF32(unsigned char *p_buff, size_t len, enum Cml_Endianness endian)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    int end = endian == Cml_BE ? CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL << 24 : CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL;
+    int escape = endian == Cml_BE ? CmlTokenizer_ESCAPE_SYMBOL << 24 : CmlTokenizer_ESCAPE_SYMBOL;
+    for (; i + 16 <= len; i += 16) {
+        __m128i codes = _mm_loadu_si128((__m128i *) (p_buff + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi32(codes, _mm_set1_epi32(end)),
+            _mm_cmpeq_epi32(codes, _mm_set1_epi32(escape))));
+        if (mask != 0)
+            return i + CmlTokenizer_lowestBit(mask);
+    }
+#endif
+    for (; i + 3 < len; i += 4) {
+        CmlUTF_Code code = endian == Cml_BE
+            ? ((CmlUTF_Code) p_buff[i] << 24) | (p_buff[i + 1] << 16) | (p_buff[i + 2] << 8) | p_buff[i + 3]
+            : ((CmlUTF_Code) p_buff[i + 3] << 24) | (p_buff[i + 2] << 16) | (p_buff[i + 1] << 8) | p_buff[i];
+        if (code == CmlTokenizer_TRANSLITERATION_AS_IS_END_SYMBOL || code == CmlTokenizer_ESCAPE_SYMBOL)
+            return i;
+    }
+
+    return -1;
+}
+
+/*
+A unit is a code together with the marks that compose into it, read
+through the cursor so that it may straddle segments. Anything else is a
+unit of its own code, with its singleton mapping applied.
+*/
+static CmlUTF_Code CmlTokenizer_readUnit(struct CmlUTF_Buffer *p_utf, size_t *p_n)
+{
+    CmlUTF_Code codes[CmlNorm_MAX_COMPOSED + 1];
+    CmlUTF_Code code = CmlUTF_read(p_utf);
+    *p_n = 1;
+    if (code > CmlTokenizer_MAX_CODE)
+        return p_utf->currIndex < p_utf->len ? CmlTokenizer_REPLACEMENT_CODE : code;
+
+    struct CmlUTF_Buffer utf = *p_utf;
+    size_t n = 0;
+    codes[n++] = code;
+    while (n <= CmlNorm_MAX_COMPOSED && CmlUTF_next(&utf, 1) != -1) {
+        CmlUTF_Code mark = CmlUTF_read(&utf);
+        if (mark > CmlTokenizer_MAX_CODE || CmlNorm_combiningClass(mark) == 0)
+            break;
+        codes[n++] = mark;
+    }
+
+    CmlUTF_Code composed = CmlNorm_composeRun(codes, n);
+    if (composed != -1) {
+        *p_n = n;
+        return composed;
+    }
+
+    return CmlNorm_composeRun(codes, 1);
+}
+
+static size_t CmlTokenizer_tokenizationUTFSpecialised(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, size_t stopIndex, int isSpanning, unsigned char *p_lengths);
+
+/*
+Tokenizes unit by unit through the cursor, which composes marks and
+handles segment boundaries, until a token would start at or after
+stopIndex. A '[' is left to the specialised loop when spanning.
+*/
+static size_t CmlTokenizer_tokenizationUTFGeneric(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, size_t stopIndex, int isSpanning, unsigned char *p_lengths)
+{
+    size_t i = 0;
+    while (p_utf->currIndex < stopIndex) {
+        size_t tokenIndex = p_utf->currIndex;
+        size_t tokenOffset = p_utf->offset;
+        size_t n1, n2;
+        CmlUTF_Code c1 = CmlTokenizer_readUnit(p_utf, &n1);
         if (c1 == -1 && errno == ERANGE)
             break;
 
-        CmlUTF_Code c2 = (CmlUTF_next(p_utf, 1), CmlUTF_read(p_utf));
+        if (i == len - 1) {
+            errno = ENOBUFS;
+            break;
+        }
+
+        if (c1 == CmlTokenizer_TRANSLITERATION_AS_IS_START_SYMBOL && isSpanning) {
+            i += CmlTokenizer_tokenizationUTFSpecialised(p_utf, tokenStream + i, len - i, tokenIndex + 1, isSpanning, p_lengths != NULL ? p_lengths + i : NULL);
+            continue;
+        }
+
+        CmlUTF_next(p_utf, n1);
+        CmlUTF_Code c2 = CmlTokenizer_readUnit(p_utf, &n2);
         unsigned short isUseTwoChars = CmlTokenizer_preprocess(c1, c2, &c1) == 2;
-        enum CmlTokenizer_Token token = CmlTokenizer_RAW_TOKEN(c1);
         if (c1 == CmlTokenizer_ESCAPE_SYMBOL) {
-            token = CmlTokenizer_RAW_TOKEN(c2);
-            isUseTwoChars = 2;
-            goto pushToken;
+            tokenStream[i] = CmlTokenizer_RAW_TOKEN(c2);
+            isUseTwoChars = 1;
+        } else {
+            tokenStream[i] = CmlTokenizer_classify(c1);
         }
 
-        if (c1 >= '0' && c1 <= '9') {
-            token = CmlTokenizer_NUMBER_0_TOKEN + c1 - '0';
+        if (isUseTwoChars)
+            CmlUTF_next(p_utf, n2);
+
+        if (p_lengths != NULL) {
+            size_t bytes = p_utf->currIndex - tokenIndex;
+            size_t codes = p_utf->offset - tokenOffset;
+            p_lengths[i] = codes > 2 ? CmlTokenizer_LONG_LENGTHS + bytes - 1 : ((bytes - 1) << 1) | (codes == 2);
+        }
+
+        i++;
+    }
+
+    tokenStream[i] = CmlTokenizer_END_OF_TOKEN;
+    return i;
+}
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationUTF8
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF8_getOctetsLength
+#define CmlTokenizer_IMPL_DECODE __CmlUTF8_decode
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF8(p_buff, len)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF8_count(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationUTF16BE
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF16_getOctetsLengthBE
+#define CmlTokenizer_IMPL_DECODE __CmlUTF16_decodeBE
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF16(p_buff, len, Cml_BE)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF16_countBE(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationUTF16LE
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF16_getOctetsLengthLE
+#define CmlTokenizer_IMPL_DECODE __CmlUTF16_decodeLE
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF16(p_buff, len, Cml_LE)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF16_countLE(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationUTF32BE
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF32_getOctetsLength
+#define CmlTokenizer_IMPL_DECODE __CmlUTF32_BE_decode
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF32(p_buff, len, Cml_BE)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF32_count(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationUTF32LE
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF32_getOctetsLength
+#define CmlTokenizer_IMPL_DECODE __CmlUTF32_LE_decode
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF32(p_buff, len, Cml_LE)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF32_count(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationLengthsUTF8
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF8_getOctetsLength
+#define CmlTokenizer_IMPL_DECODE __CmlUTF8_decode
+#define CmlTokenizer_IMPL_LENGTHS
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF8(p_buff, len)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF8_count(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationLengthsUTF16BE
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF16_getOctetsLengthBE
+#define CmlTokenizer_IMPL_DECODE __CmlUTF16_decodeBE
+#define CmlTokenizer_IMPL_LENGTHS
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF16(p_buff, len, Cml_BE)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF16_countBE(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationLengthsUTF16LE
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF16_getOctetsLengthLE
+#define CmlTokenizer_IMPL_DECODE __CmlUTF16_decodeLE
+#define CmlTokenizer_IMPL_LENGTHS
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF16(p_buff, len, Cml_LE)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF16_countLE(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationLengthsUTF32BE
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF32_getOctetsLength
+#define CmlTokenizer_IMPL_DECODE __CmlUTF32_BE_decode
+#define CmlTokenizer_IMPL_LENGTHS
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF32(p_buff, len, Cml_BE)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF32_count(p_buff, len)
+#include "tokenizer_impl.h"
+
+#define CmlTokenizer_IMPL_NAME CmlTokenizer_tokenizationLengthsUTF32LE
+#define CmlTokenizer_IMPL_GET_OCTETS_LENGTH __CmlUTF32_getOctetsLength
+#define CmlTokenizer_IMPL_DECODE __CmlUTF32_LE_decode
+#define CmlTokenizer_IMPL_LENGTHS
+#define CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff, len) CmlTokenizer_findAsIsEndUTF32(p_buff, len, Cml_LE)
+#define CmlTokenizer_IMPL_COUNT(p_buff, len) CmlUTF32_count(p_buff, len)
+#include "tokenizer_impl.h"
+
+static size_t CmlTokenizer_tokenizationUTFSpecialised(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, size_t stopIndex, int isSpanning, unsigned char *p_lengths)
+{
+    int isBigEndian = p_utf->endian == Cml_BE;
+
+    switch (p_utf->codec->encoding) {
+        case CmlUTF_UTF8:
+            return p_lengths != NULL
+                ? CmlTokenizer_tokenizationLengthsUTF8(p_utf, tokenStream, len, stopIndex, isSpanning, p_lengths)
+                : CmlTokenizer_tokenizationUTF8(p_utf, tokenStream, len, stopIndex, isSpanning);
+        case CmlUTF_UTF16:
+            if (p_lengths != NULL) {
+                return isBigEndian
+                    ? CmlTokenizer_tokenizationLengthsUTF16BE(p_utf, tokenStream, len, stopIndex, isSpanning, p_lengths)
+                    : CmlTokenizer_tokenizationLengthsUTF16LE(p_utf, tokenStream, len, stopIndex, isSpanning, p_lengths);
+            }
+            return isBigEndian
+                ? CmlTokenizer_tokenizationUTF16BE(p_utf, tokenStream, len, stopIndex, isSpanning)
+                : CmlTokenizer_tokenizationUTF16LE(p_utf, tokenStream, len, stopIndex, isSpanning);
+        case CmlUTF_UTF32:
+            if (p_lengths != NULL) {
+                return isBigEndian
+                    ? CmlTokenizer_tokenizationLengthsUTF32BE(p_utf, tokenStream, len, stopIndex, isSpanning, p_lengths)
+                    : CmlTokenizer_tokenizationLengthsUTF32LE(p_utf, tokenStream, len, stopIndex, isSpanning, p_lengths);
+            }
+            return isBigEndian
+                ? CmlTokenizer_tokenizationUTF32BE(p_utf, tokenStream, len, stopIndex, isSpanning)
+                : CmlTokenizer_tokenizationUTF32LE(p_utf, tokenStream, len, stopIndex, isSpanning);
+    }
+
+    return CmlTokenizer_tokenizationUTFGeneric(p_utf, tokenStream, len, stopIndex, 0, p_lengths);
+}
+
+/*
+The specialised loops do not compose, so they only take the tokens that
+end at least two codes before the next code unit CmlNorm_findMark stops
+at, and the generic loop takes the ones from there up to that unit. With
+n tokens left the loops cannot get further than 2 * n codes, so the
+search does not need to either.
+*/
+static size_t CmlTokenizer_findMark(struct CmlUTF_Buffer *p_utf, size_t len)
+{
+    size_t buffLen = p_utf->len - p_utf->currIndex;
+    if (buffLen / (2 * CmlUTF_MAX_OCTETS_LENGTH) > len)
+        buffLen = (len + 1) * 2 * CmlUTF_MAX_OCTETS_LENGTH;
+
+    return p_utf->currIndex + CmlNorm_findMark(p_utf->buff + p_utf->currIndex, buffLen, p_utf->codec->encoding, p_utf->endian);
+}
+
+static size_t CmlTokenizer_tokenizationUTFRange(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, size_t stopIndex, int isSpanning, unsigned char *p_lengths)
+{
+    size_t mark = CmlTokenizer_findMark(p_utf, len);
+    size_t i = 0;
+
+    while (p_utf->currIndex < stopIndex) {
+        size_t currIndex = p_utf->currIndex;
+        if (mark < currIndex)
+            mark = CmlTokenizer_findMark(p_utf, len - i);
+
+        size_t fastStop = mark >= p_utf->len
+            ? stopIndex
+            : mark > currIndex + 2 * CmlUTF_MAX_OCTETS_LENGTH ? mark - 2 * CmlUTF_MAX_OCTETS_LENGTH : currIndex;
+        if (fastStop > stopIndex)
+            fastStop = stopIndex;
+
+        if (currIndex < fastStop) {
+            i += CmlTokenizer_tokenizationUTFSpecialised(p_utf, tokenStream + i, len - i, fastStop, isSpanning, p_lengths != NULL ? p_lengths + i : NULL);
+            if (p_utf->currIndex < fastStop)
+                return i;
         } else {
-            switch (c1) {
-                case ' ': token = CmlTokenizer_SPACE_TOKEN;
-                break;
-                case 'a': token = CmlTokenizer_VOCAL_A_TOKEN;
-                break;
-                case 'i': token = CmlTokenizer_VOCAL_I_TOKEN;
-                break;
-                case 'u': token = CmlTokenizer_VOCAL_U_TOKEN;
-                break;
-                case 'e': token = CmlTokenizer_VOCAL_SCHWA_TOKEN;
-                break;
-                case 0x00E9: token = CmlTokenizer_VOCAL_E_TOKEN;
-                break;
-                case 'o': token = CmlTokenizer_VOCAL_O_TOKEN;
-                break;
-                case 0x1E37: token = CmlTokenizer_SYLLABIC_CONSONANT_L_TOKEN;
-                break;
-                case 0x1E5B: token = CmlTokenizer_SYLLABIC_CONSONANT_R_TOKEN;
-                break;
-                case 0x0101: token = CmlTokenizer_LONG_VOCAL_A_TOKEN;
-                break;
-                case 0x012B: token = CmlTokenizer_LONG_VOCAL_I_TOKEN;
-                break;
-                case 0x016B: token = CmlTokenizer_LONG_VOCAL_U_TOKEN;
-                break;
-                case 0x0113: token = CmlTokenizer_LONG_VOCAL_SCHWA_TOKEN;
-                break;
-                case 0x1E17: token = CmlTokenizer_LONG_VOCAL_E_TOKEN;
-                break;
-                case 0x014D: token = CmlTokenizer_LONG_VOCAL_O_TOKEN;
-                break;
-                case 0x1E39: token = CmlTokenizer_LONG_SYLLABIC_CONSONANT_L_TOKEN;
-                break;
-                case 0x1E5D: token = CmlTokenizer_LONG_SYLLABIC_CONSONANT_R_TOKEN;
-                break;
-                case 'h': token = CmlTokenizer_CONSONANT_H_TOKEN;
-                break;
-                case 'n': token = CmlTokenizer_CONSONANT_N_TOKEN;
-                break;
-                case 'c': token = CmlTokenizer_CONSONANT_C_TOKEN;
-                break;
-                case 'r': token = CmlTokenizer_CONSONANT_R_TOKEN;
-                break;
-                case 'k': token = CmlTokenizer_CONSONANT_K_TOKEN;
-                break;
-                case 'd': token = CmlTokenizer_CONSONANT_D_TOKEN;
-                break;
-                case 't': token = CmlTokenizer_CONSONANT_T_TOKEN;
-                break;
-                case 's': token = CmlTokenizer_CONSONANT_S_TOKEN;
-                break;
-                case 'w': token = CmlTokenizer_CONSONANT_W_TOKEN;
-                break;
-                case 'l': token = CmlTokenizer_CONSONANT_L_TOKEN;
-                break;
-                case 'm': token = CmlTokenizer_CONSONANT_M_TOKEN;
-                break;
-                case 'g': token = CmlTokenizer_CONSONANT_G_TOKEN;
-                break;
-                case 'b': token = CmlTokenizer_CONSONANT_B_TOKEN;
-                break;
-                case 'p': token = CmlTokenizer_CONSONANT_P_TOKEN;
-                break;
-                case 'j': token = CmlTokenizer_CONSONANT_J_TOKEN;
-                break;
-                case 'y': token = CmlTokenizer_CONSONANT_Y_TOKEN;
-                break;
-                case 0x1E47: token = CmlTokenizer_RETROFLEX_CONSONANT_N_TOKEN;
-                break;
-                case 0x1E0D: token = CmlTokenizer_RETROFLEX_CONSONANT_D_TOKEN;
-                break;
-                case 0x1E6D: token = CmlTokenizer_RETROFLEX_CONSONANT_T_TOKEN;
-                break;
-                case 0x1E63: token = CmlTokenizer_RETROFLEX_CONSONANT_S_TOKEN;
-                break;
-                case 0x015B: token = CmlTokenizer_PALATAL_CONSONANT_S_TOKEN;
-                break;
-                case ',': token = CmlTokenizer_PUNCTUATION_CARIK_SIKI_TOKEN;
-                break;
-                case '.': token = CmlTokenizer_PUNCTUATION_CARIK_KALIH_TOKEN;
-                break;
-                case ':': token = CmlTokenizer_PUNCTUATION_CARIK_PAMUNGKAH_TOKEN;
-                break;
-                case 0xF0000: token = CmlTokenizer_PUNCTUATION_PANTEN_TOKEN;
-                break;
-                case 0xF0001: token = CmlTokenizer_PUNCTUATION_PASALINAN_TOKEN;
-                break;
-                case 0xF0002: token = CmlTokenizer_PUNCTUATION_PAMADA_TOKEN;
-                break;
-                case 0xF0003: token = CmlTokenizer_PUNCTUATION_CARIK_AGUNG_TOKEN;
-                break;
-                case 0xF0004: token = CmlTokenizer_PUNCTUATION_IDEM_TOKEN;
-                break;
-                case 0xF0005: token = CmlTokenizer_TRANSLITERATION_AS_IS_START_TOKEN;
-                break;
-                case 0xF0006: token = CmlTokenizer_TRANSLITERATION_AS_IS_END_TOKEN;
-                break;
+            size_t slowStop = mark < stopIndex ? mark + 1 : stopIndex;
+            i += CmlTokenizer_tokenizationUTFGeneric(p_utf, tokenStream + i, len - i, slowStop, isSpanning, p_lengths != NULL ? p_lengths + i : NULL);
+            if (p_utf->currIndex < slowStop)
+                return i;
+        }
+    }
+
+    tokenStream[i] = CmlTokenizer_END_OF_TOKEN;
+    return i;
+}
+
+static size_t CmlTokenizer_tokenizationUTFSegments(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, int isSpanning)
+{
+    int currErrno = errno;
+    size_t i = 0;
+
+    while (1) {
+        int isLastSegment = p_utf->currSegment + 1 >= p_utf->segmentsLen;
+        size_t stopIndex = isLastSegment
+            ? p_utf->len
+            : p_utf->len > CmlTokenizer_MAX_LOOKAHEAD ? p_utf->len - CmlTokenizer_MAX_LOOKAHEAD : 0;
+
+        if (p_utf->currIndex < stopIndex) {
+            i += CmlTokenizer_tokenizationUTFRange(p_utf, tokenStream + i, len - i, stopIndex, isSpanning, NULL);
+            if (p_utf->currIndex < stopIndex)
+                return i;
+        }
+
+        if (isLastSegment)
+            break;
+
+        size_t currSegment = p_utf->currSegment;
+        while (p_utf->currSegment == currSegment && p_utf->currIndex < p_utf->len) {
+            if (i == len - 1) {
+                tokenStream[i] = CmlTokenizer_END_OF_TOKEN;
+                errno = ENOBUFS;
+                return i;
             }
+
+            i += CmlTokenizer_tokenizationUTFGeneric(p_utf, tokenStream + i, 2, -1, 0, NULL);
         }
 
-        pushToken:
-        tokenStream[i] = token;
-        tokenStreamLen++;
-        CmlUTF_next(p_utf, isUseTwoChars ? 1 : 0);
-        i++;
+        if (p_utf->currIndex >= p_utf->len)
+            break;
+    }
+
+    tokenStream[i] = CmlTokenizer_END_OF_TOKEN;
+    errno = currErrno;
+    return i;
+}
+
+size_t CmlTokenizer_tokenizationUTFInto(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len)
+{
+    if (len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (p_utf->segments != NULL)
+        return CmlTokenizer_tokenizationUTFSegments(p_utf, tokenStream, len, 0);
+
+    return CmlTokenizer_tokenizationUTFRange(p_utf, tokenStream, len, p_utf->len, 0, NULL);
+}
+
+static size_t CmlTokenizer_tokenizationUTFWithLengths(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, int isSpanning, unsigned char *p_lengths)
+{
+    if (len == 0 || p_utf->segments != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return CmlTokenizer_tokenizationUTFRange(p_utf, tokenStream, len, p_utf->len, isSpanning, p_lengths);
+}
+
+size_t CmlTokenizer_tokenizationUTFLengths(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, unsigned char *p_lengths)
+{
+    return CmlTokenizer_tokenizationUTFWithLengths(p_utf, tokenStream, len, 0, p_lengths);
+}
+
+size_t CmlTokenizer_tokenizationUTFSpans(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, unsigned char *p_lengths)
+{
+    if (p_lengths != NULL)
+        return CmlTokenizer_tokenizationUTFWithLengths(p_utf, tokenStream, len, 1, p_lengths);
+
+    if (len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (p_utf->segments != NULL)
+        return CmlTokenizer_tokenizationUTFSegments(p_utf, tokenStream, len, 1);
+
+    return CmlTokenizer_tokenizationUTFRange(p_utf, tokenStream, len, p_utf->len, 1, NULL);
+}
+
+#define CmlTokenizer_COUNT_CHUNK 256
+
+/*
+Runs the same loops as the tokenization into a scratch buffer, so it
+agrees with it on every input, and costs about as much as a
+tokenization without the allocation.
+*/
+size_t CmlTokenizer_countTokensUTF(struct CmlUTF_Buffer *p_utf)
+{
+    unsigned int scratch[CmlTokenizer_COUNT_CHUNK];
+    struct CmlUTF_Buffer utf = *p_utf;
+    int currErrno = errno;
+    size_t tokenStreamLen = 0;
+    size_t n;
+
+    do {
+        errno = 0;
+        n = CmlTokenizer_tokenizationUTFInto(&utf, scratch, CmlTokenizer_COUNT_CHUNK);
+        tokenStreamLen += n;
+    } while (errno == ENOBUFS && n != 0);
+
+    errno = currErrno;
+    return tokenStreamLen;
+}
+
+/*
+The stream is sized from CmlUTF_count, which is never less than the
+number of tokens for valid input, and is not shrunk to fit afterwards.
+*/
+static CmlTokenizer_TokenStream CmlTokenizer_tokenizationUTFCounted(struct CmlUTF_Buffer *p_utf, struct CmlAlloc_Allocator *p_allocator)
+{
+    size_t utfLen = CmlUTF_count(p_utf);
+    CmlTokenizer_TokenStream tokenStream = CmlAlloc_alloc(p_allocator, sizeof(enum CmlTokenizer_Token) * (utfLen + 1));
+    if (tokenStream == NULL)
+        return NULL;
+
+    int currErrno = errno;
+    size_t tokenStreamLen = CmlTokenizer_tokenizationUTFInto(p_utf, tokenStream, utfLen + 1);
+
+    /* CmlUTF_count counts lead octets, an invalid octet takes a token of its own */
+    size_t more;
+    while ((more = CmlUTF_maxCount(p_utf)) != 0) {
+        CmlTokenizer_TokenStream grown = CmlAlloc_realloc(p_allocator, tokenStream, sizeof(enum CmlTokenizer_Token) * (tokenStreamLen + more + 1));
+        if (grown == NULL) {
+            CmlAlloc_free(p_allocator, tokenStream);
+            return NULL;
+        }
+
+        tokenStream = grown;
+        size_t n = CmlTokenizer_tokenizationUTFInto(p_utf, tokenStream + tokenStreamLen, more + 1);
+        tokenStreamLen += n;
+        if (n == 0)
+            break;
     }
+    errno = currErrno;
+
+    return tokenStream;
+}
+
+CmlTokenizer_TokenStream CmlTokenizer_tokenizationUTFWith(struct CmlUTF_Buffer *p_utf, struct CmlAlloc_Allocator *p_allocator)
+{
+    return CmlTokenizer_tokenizationUTFCounted(p_utf, CmlAlloc_resolve(p_allocator));
+}
 
-    tokenStream[tokenStreamLen] = CmlTokenizer_END_OF_TOKEN;
-    return utfLen != tokenStreamLen
-        ? realloc(tokenStream, sizeof(enum CmlTokenizer_Token) * (tokenStreamLen + 1))
-        : tokenStream;
+CmlTokenizer_TokenStream CmlTokenizer_tokenizationUTF(struct CmlUTF_Buffer *p_utf)
+{
+    return CmlTokenizer_tokenizationUTFWith(p_utf, NULL);
+}
+
+void CmlTokenizer_destroyTokenStream(CmlTokenizer_TokenStream tokenStream, struct CmlAlloc_Allocator *p_allocator)
+{
+    CmlAlloc_free(p_allocator, tokenStream);
 }
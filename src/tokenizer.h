@@ -22,9 +22,38 @@ along with this program; if not, see
 #define __TOKENIZER_H
 
 #include "utf.h"
+#include "alloc.h"
+#include "norm.h"
 
-#define CmlTokenizer_RAW_TOKEN(c) 61 + c
-#define CmlTokenizer_IS_RAW_TOKEN(c) c >= 61
+#define CmlTokenizer_RAW_TOKEN(c) (61 + (c))
+#define CmlTokenizer_IS_RAW_TOKEN(c) ((c) >= 61 && !CmlTokenizer_IS_SPAN_TOKEN(c))
+
+/*
+CmlTokenizer_tokenizationUTFSpans turns a '[' and the as-is text after it,
+up to but not including the closing ']' or the next '$', into one span
+token holding their length in bytes. The text itself stays in the
+buffer. A span stands for an as-is start token followed by its text, so
+the ']' or '$' escape after it is tokenized as usual. A '[' whose text
+is empty or not closed within the same buffer or segment stays an as-is
+start token.
+*/
+#define CmlTokenizer_SPAN_TOKEN(n) (0x80000000u | (n))
+#define CmlTokenizer_IS_SPAN_TOKEN(c) (((c) & 0x80000000u) != 0)
+#define CmlTokenizer_SPAN_LENGTH(c) ((c) & 0x7FFFFFFFu)
+#define CmlTokenizer_MAX_SPAN_LENGTH 0x7FFFFFFF
+#define CmlTokenizer_SPAN_LENGTHS 0xFF
+
+/*
+Combining marks are composed into the letter before them while
+tokenizing, so a token may take up to CmlTokenizer_MAX_TOKEN_OCTETS
+bytes, and whether it does depends on no more than the
+CmlTokenizer_MAX_LOOKAHEAD bytes from its start. A length byte for a
+token of more than two code points is CmlTokenizer_LONG_LENGTHS plus
+its length in bytes minus one.
+*/
+#define CmlTokenizer_MAX_TOKEN_OCTETS (2 * CmlNorm_MAX_COMPOSED * CmlUTF_MAX_OCTETS_LENGTH)
+#define CmlTokenizer_MAX_LOOKAHEAD ((2 * CmlNorm_MAX_COMPOSED + 1) * CmlUTF_MAX_OCTETS_LENGTH)
+#define CmlTokenizer_LONG_LENGTHS 0x10
 #define CmlTokenizer_RETROFLEX_SYMBOL '^'
 #define CmlTokenizer_SYLLABIC_CONSONANT_SYMBOL '_'
 #define CmlTokenizer_LONG_SYLLABIC_CONSONANT_SYMBOL '*'
@@ -99,6 +128,21 @@ enum CmlTokenizer_Token {
 };
 
 size_t CmlTokenizer_preprocess(CmlUTF_Code c1, CmlUTF_Code c2, CmlUTF_Code *p_code);
+size_t CmlTokenizer_toCodes(unsigned int token, CmlUTF_Code *p_codes);
+size_t CmlTokenizer_maxTokensUTF(struct CmlUTF_Buffer *p_utf);
+size_t CmlTokenizer_countTokensUTF(struct CmlUTF_Buffer *p_utf);
+size_t CmlTokenizer_tokenizationUTFInto(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len);
+size_t CmlTokenizer_tokenizationUTFLengths(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, unsigned char *p_lengths);
+size_t CmlTokenizer_tokenizationUTFSpans(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, unsigned char *p_lengths);
 CmlTokenizer_TokenStream CmlTokenizer_tokenizationUTF(struct CmlUTF_Buffer *p_utf);
+CmlTokenizer_TokenStream CmlTokenizer_tokenizationUTFWith(struct CmlUTF_Buffer *p_utf, struct CmlAlloc_Allocator *p_allocator);
+
+/*
+A token stream is a plain allocation from the allocator it was created
+with, as are the streams held by jobs and edits, so with the libc default
+it may also be passed to free. Release it with the same allocator; NULL
+means whatever the default is at the time of the call.
+*/
+void CmlTokenizer_destroyTokenStream(CmlTokenizer_TokenStream tokenStream, struct CmlAlloc_Allocator *p_allocator);
 
 #endif
@@ -0,0 +1,131 @@
+/*
+tokenizer_impl.h - Tokenization loop specialised for one encoding
+
+Copyright (C) 2025 Yoga
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see
+<https://www.gnu.org/licenses/>.
+*/
+
+/*
+Included by tokenizer.c once per (encoding, endianness) pair with
+CmlTokenizer_IMPL_NAME, CmlTokenizer_IMPL_GET_OCTETS_LENGTH and
+CmlTokenizer_IMPL_DECODE defined. The cursor is kept in locals and
+follows the same rules as CmlUTF_next and CmlUTF_read: a sequence that
+does not decode becomes CmlTokenizer_REPLACEMENT_CODE and the cursor
+moves past it by the octets length, which is never zero. No token is
+started at or after stopIndex, which lets segmented buffers leave the
+bytes near a segment boundary, and any buffer the codes around a
+combining mark, to the generic loop.
+
+With CmlTokenizer_IMPL_LENGTHS defined as well, the instance also takes
+p_lengths and stores one byte per token: its length in bytes minus one,
+shifted left by one, or'ed with one when it took a second code point.
+
+When isSpanning is set, a '[' whose as-is text is closed by a ']' or '$'
+before the end of the buffer becomes one span token covering the '[' and
+the text, found with CmlTokenizer_IMPL_FIND_AS_IS_END and counted with
+CmlTokenizer_IMPL_COUNT. Its length byte is CmlTokenizer_SPAN_LENGTHS.
+*/
+
+#ifdef CmlTokenizer_IMPL_LENGTHS
+static size_t CmlTokenizer_IMPL_NAME(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, size_t stopIndex, int isSpanning, unsigned char *p_lengths)
+#else
+static size_t CmlTokenizer_IMPL_NAME(struct CmlUTF_Buffer *p_utf, CmlTokenizer_TokenStream tokenStream, size_t len, size_t stopIndex, int isSpanning)
+#endif
+{
+    unsigned char *p_buff = p_utf->buff;
+    size_t buffLen = p_utf->len;
+    size_t currIndex = p_utf->currIndex;
+    size_t offset = p_utf->offset;
+
+    size_t i = 0;
+    while (currIndex < stopIndex) {
+        if (i == len - 1) {
+            errno = ENOBUFS;
+            break;
+        }
+
+        size_t tokenIndex = currIndex;
+#ifdef CmlTokenizer_IMPL_LENGTHS
+        unsigned char isTwoCodes = 0;
+#endif
+        CmlUTF_Code c1 = CmlTokenizer_IMPL_DECODE(p_buff + currIndex, buffLen - currIndex);
+        CmlUTF_Code c2 = -1;
+        if (c1 > CmlTokenizer_MAX_CODE)
+            c1 = CmlTokenizer_REPLACEMENT_CODE;
+        currIndex += CmlTokenizer_IMPL_GET_OCTETS_LENGTH(p_buff + currIndex, buffLen - currIndex);
+        offset++;
+        if (currIndex >= buffLen) {
+            currIndex = buffLen;
+        } else {
+            c2 = CmlTokenizer_IMPL_DECODE(p_buff + currIndex, buffLen - currIndex);
+            if (c2 > CmlTokenizer_MAX_CODE)
+                c2 = CmlTokenizer_REPLACEMENT_CODE;
+        }
+
+        unsigned short isUseTwoChars = __CmlTokenizer_preprocess(c1, c2, &c1) == 2;
+        if (c1 == CmlTokenizer_ESCAPE_SYMBOL) {
+            tokenStream[i] = CmlTokenizer_RAW_TOKEN(c2);
+            isUseTwoChars = 1;
+        } else if (c1 == CmlTokenizer_AS_IS_START_CODE && isSpanning && currIndex < buffLen) {
+            size_t textLen = buffLen - currIndex < CmlTokenizer_MAX_SPAN_LENGTH - CmlUTF_MAX_OCTETS_LENGTH
+                ? buffLen - currIndex
+                : CmlTokenizer_MAX_SPAN_LENGTH - CmlUTF_MAX_OCTETS_LENGTH;
+            textLen = CmlTokenizer_IMPL_FIND_AS_IS_END(p_buff + currIndex, textLen);
+            if (textLen == 0 || textLen == -1) {
+                tokenStream[i] = CmlTokenizer_TRANSLITERATION_AS_IS_START_TOKEN;
+            } else {
+                offset += CmlTokenizer_IMPL_COUNT(p_buff + currIndex, textLen);
+                currIndex += textLen;
+                tokenStream[i] = CmlTokenizer_SPAN_TOKEN(currIndex - tokenIndex);
+#ifdef CmlTokenizer_IMPL_LENGTHS
+                p_lengths[i] = CmlTokenizer_SPAN_LENGTHS;
+#endif
+                i++;
+                continue;
+            }
+        } else {
+            tokenStream[i] = CmlTokenizer_classify(c1);
+        }
+
+        if (isUseTwoChars && currIndex < buffLen) {
+            currIndex += CmlTokenizer_IMPL_GET_OCTETS_LENGTH(p_buff + currIndex, buffLen - currIndex);
+            offset++;
+            if (currIndex >= buffLen)
+                currIndex = buffLen;
+#ifdef CmlTokenizer_IMPL_LENGTHS
+            isTwoCodes = 1;
+#endif
+        }
+
+#ifdef CmlTokenizer_IMPL_LENGTHS
+        p_lengths[i] = ((currIndex - tokenIndex - 1) << 1) | isTwoCodes;
+#endif
+
+        i++;
+    }
+
+    p_utf->currIndex = currIndex;
+    p_utf->offset = offset;
+    tokenStream[i] = CmlTokenizer_END_OF_TOKEN;
+    return i;
+}
+
+#undef CmlTokenizer_IMPL_NAME
+#undef CmlTokenizer_IMPL_GET_OCTETS_LENGTH
+#undef CmlTokenizer_IMPL_DECODE
+#undef CmlTokenizer_IMPL_FIND_AS_IS_END
+#undef CmlTokenizer_IMPL_COUNT
+#undef CmlTokenizer_IMPL_LENGTHS
@@ -23,19 +23,154 @@ along with this program; if not, see
 #include "def.h"
 #include "utf.h"
 
-size_t CmlUTF_len(struct CmlUTF_Buffer *p_utf)
+static void CmlUTF_settle(struct CmlUTF_Buffer *p_utf)
+{
+    while (p_utf->currIndex >= p_utf->len && p_utf->segments != NULL && p_utf->currSegment + 1 < p_utf->segmentsLen) {
+        p_utf->currIndex -= p_utf->len;
+        p_utf->segmentOffset += p_utf->len;
+        p_utf->currSegment++;
+        p_utf->buff = p_utf->segments[p_utf->currSegment].iov_base;
+        p_utf->len = p_utf->segments[p_utf->currSegment].iov_len;
+    }
+}
+
+static void CmlUTF_rewind(struct CmlUTF_Buffer *p_utf)
 {
-    size_t len = 0;
-    size_t currOffset = p_utf->offset;
-    size_t currIndex = p_utf->currIndex;
     p_utf->offset = 0;
     p_utf->currIndex = 0;
+    if (p_utf->segments != NULL) {
+        p_utf->currSegment = 0;
+        p_utf->segmentOffset = 0;
+        p_utf->buff = p_utf->segments[0].iov_base;
+        p_utf->len = p_utf->segments[0].iov_len;
+        CmlUTF_settle(p_utf);
+    }
+}
+
+static void CmlUTF_retreat(struct CmlUTF_Buffer *p_utf, size_t octets)
+{
+    while (octets != 0) {
+        if (p_utf->currIndex == 0) {
+            if (p_utf->segments == NULL || p_utf->currSegment == 0)
+                return;
+
+            p_utf->currSegment--;
+            p_utf->buff = p_utf->segments[p_utf->currSegment].iov_base;
+            p_utf->len = p_utf->segments[p_utf->currSegment].iov_len;
+            p_utf->segmentOffset -= p_utf->len;
+            p_utf->currIndex = p_utf->len;
+            continue;
+        }
+
+        size_t step = octets < p_utf->currIndex ? octets : p_utf->currIndex;
+        p_utf->currIndex -= step;
+        octets -= step;
+    }
+}
+
+static __Cml_INLINE int CmlUTF_isStraddling(struct CmlUTF_Buffer *p_utf)
+{
+    return p_utf->segments != NULL && p_utf->len - p_utf->currIndex < CmlUTF_MAX_OCTETS_LENGTH;
+}
+
+static size_t CmlUTF_remaining(struct CmlUTF_Buffer *p_utf)
+{
+    size_t remaining = p_utf->currIndex < p_utf->len ? p_utf->len - p_utf->currIndex : 0;
+    if (p_utf->segments != NULL) {
+        size_t i = p_utf->currSegment + 1;
+        for (; i < p_utf->segmentsLen; i++)
+            remaining += p_utf->segments[i].iov_len;
+    }
+
+    return remaining;
+}
+
+void CmlUTF_setSegments(struct CmlUTF_Buffer *p_utf, struct iovec *p_segments, size_t segmentsLen)
+{
+    if (p_segments == NULL || segmentsLen == 0) {
+        errno = EINVAL;
+        return;
+    }
+
+    p_utf->segments = p_segments;
+    p_utf->segmentsLen = segmentsLen;
+    p_utf->currSegment = 0;
+    p_utf->segmentOffset = 0;
+    p_utf->currIndex = 0;
+    p_utf->mcurrIndex = 0;
+    p_utf->buff = p_segments[0].iov_base;
+    p_utf->len = p_segments[0].iov_len;
+    CmlUTF_settle(p_utf);
+}
+
+void CmlUTF_destroy(struct CmlUTF_Buffer *p_utf)
+{
+    p_utf->codec = NULL;
+    p_utf->segments = NULL;
+    p_utf->segmentsLen = 0;
+}
+
+size_t CmlUTF_gather(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t len)
+{
+    unsigned char *p_segment = p_utf->buff;
+    size_t segmentLen = p_utf->len;
+    size_t segment = p_utf->currSegment;
+    size_t index = p_utf->currIndex;
+    size_t i = 0;
+
+    while (i < len) {
+        if (index < segmentLen) {
+            p_buff[i++] = p_segment[index++];
+            continue;
+        }
+
+        if (p_utf->segments == NULL || segment + 1 >= p_utf->segmentsLen)
+            break;
+
+        segment++;
+        p_segment = p_utf->segments[segment].iov_base;
+        segmentLen = p_utf->segments[segment].iov_len;
+        index = 0;
+    }
+
+    return i;
+}
+
+/* Copies the octets preceding the current index to the end of p_buff */
+static size_t CmlUTF_gatherPrev(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t len)
+{
+    unsigned char *p_segment = p_utf->buff;
+    size_t segment = p_utf->currSegment;
+    size_t index = p_utf->currIndex;
+    size_t i = 0;
+
+    while (i < len) {
+        if (index != 0) {
+            p_buff[len - ++i] = p_segment[--index];
+            continue;
+        }
+
+        if (p_utf->segments == NULL || segment == 0)
+            break;
+
+        segment--;
+        p_segment = p_utf->segments[segment].iov_base;
+        index = p_utf->segments[segment].iov_len;
+    }
+
+    return i;
+}
+
+size_t CmlUTF_len(struct CmlUTF_Buffer *p_utf)
+{
+    size_t len = 0;
+    struct CmlUTF_Buffer curr = *p_utf;
+    CmlUTF_rewind(p_utf);
 
     while (1) {
         len++;
         if (CmlUTF_next(p_utf, 1) == -1 && errno == ERANGE) {
-            p_utf->offset = currOffset;
-            p_utf->currIndex = currIndex;
+            *p_utf = curr;
             return len;
         }
     }
@@ -46,27 +181,93 @@ size_t CmlUTF_next(struct CmlUTF_Buffer *p_utf, size_t n)
     size_t offset = p_utf->offset;
 
     while (n != 0) {
+        if (p_utf->currIndex >= p_utf->len) {
+            errno = ERANGE;
+            p_utf->offset = offset;
+            return -1;
+        }
+
+        unsigned char stitch[CmlUTF_MAX_OCTETS_LENGTH];
+        unsigned char *p_buff = p_utf->buff + p_utf->currIndex;
+        size_t len = p_utf->len - p_utf->currIndex;
+        if (CmlUTF_isStraddling(p_utf)) {
+            len = CmlUTF_gather(p_utf, stitch, sizeof(stitch));
+            p_buff = stitch;
+        }
+
         if (p_utf->endian == Cml_BE) {
-            p_utf->currIndex += p_utf->codec->getOctetsLengthBE(p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex);
+            p_utf->currIndex += p_utf->codec->getOctetsLengthBE(p_buff, len);
         } else {
-            p_utf->currIndex += p_utf->codec->getOctetsLengthLE(p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex);
+            p_utf->currIndex += p_utf->codec->getOctetsLengthLE(p_buff, len);
         }
 
+        CmlUTF_settle(p_utf);
+        offset++;
         if (p_utf->currIndex >= p_utf->len) {
             errno = ERANGE;
             p_utf->currIndex = p_utf->len;
+            p_utf->offset = offset;
             return -1;
         }
 
-        offset++;
         n--;
     }
 
-    p_utf->currIndex = p_utf->currIndex;
     p_utf->offset = offset;
     return offset;
 }
 
+size_t CmlUTF_prev(struct CmlUTF_Buffer *p_utf, size_t n)
+{
+    size_t offset = p_utf->offset;
+
+    while (n != 0) {
+        unsigned char stitch[CmlUTF_MAX_OCTETS_LENGTH];
+        unsigned char *p_buff = p_utf->buff;
+        size_t len = p_utf->currIndex;
+        if (p_utf->segments != NULL && len < CmlUTF_MAX_OCTETS_LENGTH) {
+            len = CmlUTF_gatherPrev(p_utf, stitch, sizeof(stitch));
+            p_buff = stitch + sizeof(stitch) - len;
+        }
+
+        if (len == 0) {
+            errno = ERANGE;
+            p_utf->offset = offset;
+            return -1;
+        }
+
+        size_t octetsLength = p_utf->endian == Cml_BE
+            ? p_utf->codec->getPrevOctetsLengthBE(p_buff, len)
+            : p_utf->codec->getPrevOctetsLengthLE(p_buff, len);
+        CmlUTF_retreat(p_utf, octetsLength < len ? octetsLength : len);
+        offset--;
+        n--;
+    }
+
+    p_utf->offset = offset;
+    return offset;
+}
+
+void CmlUTF_mark(struct CmlUTF_Buffer *p_utf)
+{
+    p_utf->moffset = p_utf->offset;
+    p_utf->mcurrIndex = p_utf->segmentOffset + p_utf->currIndex;
+}
+
+void CmlUTF_reset(struct CmlUTF_Buffer *p_utf)
+{
+    while (p_utf->mcurrIndex < p_utf->segmentOffset && p_utf->currSegment != 0) {
+        p_utf->currSegment--;
+        p_utf->buff = p_utf->segments[p_utf->currSegment].iov_base;
+        p_utf->len = p_utf->segments[p_utf->currSegment].iov_len;
+        p_utf->segmentOffset -= p_utf->len;
+    }
+
+    p_utf->currIndex = p_utf->mcurrIndex - p_utf->segmentOffset;
+    p_utf->offset = p_utf->moffset;
+    CmlUTF_settle(p_utf);
+}
+
 CmlUTF_Code CmlUTF_iter(struct CmlUTF_Buffer *p_utf)
 {
     CmlUTF_Code code = CmlUTF_read(p_utf);
@@ -80,31 +281,211 @@ CmlUTF_Code CmlUTF_read(struct CmlUTF_Buffer *p_utf)
         return -1;
     }
 
+    unsigned char stitch[CmlUTF_MAX_OCTETS_LENGTH];
+    unsigned char *p_buff = p_utf->buff + p_utf->currIndex;
+    size_t len = p_utf->len - p_utf->currIndex;
+    if (CmlUTF_isStraddling(p_utf)) {
+        len = CmlUTF_gather(p_utf, stitch, sizeof(stitch));
+        p_buff = stitch;
+    }
+
     switch (p_utf->endian) {
         case Cml_BE:
-            return p_utf->codec->decodeBE(p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex);
+            return p_utf->codec->decodeBE(p_buff, len);
         case Cml_LE:
-            return p_utf->codec->decodeLE(p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex);
+            return p_utf->codec->decodeLE(p_buff, len);
+        default:
+            break;
     }
 
     return -1;
 }
 
+static void CmlUTF_scatter(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t len)
+{
+    size_t i = 0;
+    for (; i < len; i++) {
+        CmlUTF_settle(p_utf);
+        p_utf->buff[p_utf->currIndex++] = p_buff[i];
+    }
+
+    CmlUTF_settle(p_utf);
+}
+
 size_t CmlUTF_write(struct CmlUTF_Buffer *p_utf, CmlUTF_Code code)
 {
-    if (p_utf->currIndex >= p_utf->len) {
+    unsigned char encoded[CmlUTF_MAX_OCTETS_LENGTH];
+    size_t octetsLength = p_utf->endian == Cml_BE
+        ? p_utf->codec->encodeBE(code, encoded, sizeof(encoded))
+        : p_utf->codec->encodeLE(code, encoded, sizeof(encoded));
+    if (octetsLength == 0)
+        return -1;
+
+    if (CmlUTF_remaining(p_utf) < octetsLength) {
         errno = ERANGE;
         return -1;
     }
 
-    switch (p_utf->endian) {
-        case Cml_BE:
-            p_utf->codec->encodeBE(code, p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex);
+    CmlUTF_scatter(p_utf, encoded, octetsLength);
+    p_utf->offset++;
+    return octetsLength;
+}
+
+size_t CmlUTF_writeCodes(struct CmlUTF_Buffer *p_utf, CmlUTF_Code *p_codes, size_t n)
+{
+    size_t written = 0;
+
+    while (n != 0) {
+        size_t count = n;
+        size_t len = p_utf->currIndex < p_utf->len ? p_utf->len - p_utf->currIndex : 0;
+        size_t octetsLength = p_utf->endian == Cml_BE
+            ? p_utf->codec->encodeCodesBE(p_codes, &count, p_utf->buff + p_utf->currIndex, len)
+            : p_utf->codec->encodeCodesLE(p_codes, &count, p_utf->buff + p_utf->currIndex, len);
+
+        p_utf->currIndex += octetsLength;
+        p_utf->offset += count;
+        written += octetsLength;
+        p_codes += count;
+        n -= count;
+        if (n == 0 || errno != ENOBUFS || p_utf->segments == NULL)
             break;
-        case Cml_LE:
-            p_utf->codec->encodeLE(code, p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex);
+
+        /* The next code straddles two segments */
+        octetsLength = CmlUTF_write(p_utf, *p_codes);
+        if (octetsLength == -1) {
+            if (errno == ERANGE)
+                errno = ENOBUFS;
             break;
+        }
+
+        written += octetsLength;
+        p_codes++;
+        n--;
+    }
+
+    CmlUTF_settle(p_utf);
+    return written;
+}
+
+size_t CmlUTF_count(struct CmlUTF_Buffer *p_utf)
+{
+    if (p_utf->currIndex >= p_utf->len)
+        return 0;
+
+    if (p_utf->segments != NULL && p_utf->codec->encoding == CmlUTF_UTF8) {
+        size_t count = p_utf->codec->countBE(p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex);
+        size_t i = p_utf->currSegment + 1;
+        for (; i < p_utf->segmentsLen; i++)
+            count += p_utf->codec->countBE(p_utf->segments[i].iov_base, p_utf->segments[i].iov_len);
+        return count;
+    } else if (p_utf->segments != NULL) {
+        struct CmlUTF_Buffer utf = *p_utf;
+        size_t count = 1;
+        while (CmlUTF_next(&utf, 1) != -1)
+            count++;
+        return count;
+    }
+
+    return p_utf->endian == Cml_BE
+        ? p_utf->codec->countBE(p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex)
+        : p_utf->codec->countLE(p_utf->buff + p_utf->currIndex, p_utf->len - p_utf->currIndex);
+}
+
+size_t CmlUTF_maxCount(struct CmlUTF_Buffer *p_utf)
+{
+    size_t remaining = CmlUTF_remaining(p_utf);
+    switch (p_utf->codec->encoding) {
+        case CmlUTF_UTF8: return remaining;
+        case CmlUTF_UTF16: return (remaining + 1) / 2;
+        case CmlUTF_UTF32: return (remaining + 3) / 4;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static __Cml_INLINE size_t CmlUTF_codeOctetsLength(CmlUTF_Code code, enum CmlUTF_Encoding encoding)
+{
+    switch (encoding) {
+        case CmlUTF_UTF8: return code < 0x80 ? 1 : code < 0x800 ? 2 : code < 0x10000 ? 3 : 4;
+        case CmlUTF_UTF16: return code < 0x10000 ? 2 : 4;
+        case CmlUTF_UTF32: return 4;
+    }
+
+    return 0;
+}
+
+size_t CmlUTF_encodedLength(struct CmlUTF_Buffer *p_utf, enum CmlUTF_Encoding encoding)
+{
+    if (p_utf->currIndex >= p_utf->len)
+        return 0;
+
+    unsigned char *p_buff = p_utf->buff + p_utf->currIndex;
+    size_t remaining = p_utf->len - p_utf->currIndex;
+    size_t length = 0;
+    size_t i = 0;
+
+    if (encoding == p_utf->codec->encoding)
+        return CmlUTF_remaining(p_utf);
+    if (encoding == CmlUTF_UTF32)
+        return CmlUTF_count(p_utf) * 4;
+
+    if (p_utf->segments != NULL) {
+        struct CmlUTF_Buffer utf = *p_utf;
+        do {
+            length += CmlUTF_codeOctetsLength(CmlUTF_read(&utf), encoding);
+        } while (CmlUTF_next(&utf, 1) != -1);
+        return length;
     }
 
-    return p_utf->offset;
+    switch (p_utf->codec->encoding) {
+        case CmlUTF_UTF8:
+            for (; i < remaining; i++)
+                length += ((p_buff[i] & 0xC0) != 0x80) * 2 + (p_buff[i] >= 0xF0) * 2;
+            return length;
+        case CmlUTF_UTF16:
+            for (; i + 1 < remaining; i += 2) {
+                unsigned int unit = p_utf->endian == Cml_BE
+                    ? (p_buff[i] << 8) | p_buff[i + 1]
+                    : (p_buff[i + 1] << 8) | p_buff[i];
+                length += unit < 0x80 ? 1 : unit < 0x800 ? 2 : (unit & 0xF800) == 0xD800 ? 2 : 3;
+            }
+            return length;
+        case CmlUTF_UTF32:
+            for (; i + 3 < remaining; i += 4) {
+                CmlUTF_Code code = p_utf->endian == Cml_BE
+                    ? ((CmlUTF_Code) p_buff[i] << 24) | (p_buff[i + 1] << 16) | (p_buff[i + 2] << 8) | p_buff[i + 3]
+                    : ((CmlUTF_Code) p_buff[i + 3] << 24) | (p_buff[i + 2] << 16) | (p_buff[i + 1] << 8) | p_buff[i];
+                length += CmlUTF_codeOctetsLength(code, encoding);
+            }
+            return length;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+size_t CmlUTF_maxEncodedLength(struct CmlUTF_Buffer *p_utf, enum CmlUTF_Encoding encoding)
+{
+    size_t remaining = CmlUTF_remaining(p_utf);
+    switch (p_utf->codec->encoding) {
+        case CmlUTF_UTF8:
+            return encoding == CmlUTF_UTF8 ? remaining : encoding == CmlUTF_UTF16 ? remaining * 2 : remaining * 4;
+        case CmlUTF_UTF16:
+            return encoding == CmlUTF_UTF8 ? (remaining + 1) / 2 * 3 : encoding == CmlUTF_UTF16 ? remaining : (remaining + 1) / 2 * 4;
+        case CmlUTF_UTF32:
+            return (remaining + 3) / 4 * 4;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+size_t CmlUTF_codesEncodedLength(CmlUTF_Code *p_codes, size_t n, enum CmlUTF_Encoding encoding)
+{
+    size_t length = 0;
+    size_t i = 0;
+    for (; i < n; i++)
+        length += CmlUTF_codeOctetsLength(p_codes[i], encoding);
+    return length;
 }
@@ -22,17 +22,40 @@ along with this program; if not, see
 #define __UTF_H
 
 #include <stddef.h>
+#ifdef _WIN32
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
 #include "def.h"
 
+#define CmlUTF_MAX_OCTETS_LENGTH 4
+
 typedef unsigned int CmlUTF_Code;
 
+enum CmlUTF_Encoding {
+    CmlUTF_UTF8 = 1,
+    CmlUTF_UTF16,
+    CmlUTF_UTF32
+};
+
 struct CmlUTF_Codec {
-    void (*encodeLE)(CmlUTF_Code code, unsigned char *p_buff, size_t len);
-    void (*encodeBE)(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+    enum CmlUTF_Encoding encoding;
+    size_t (*encodeLE)(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+    size_t (*encodeBE)(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+    size_t (*encodeCodesLE)(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len);
+    size_t (*encodeCodesBE)(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len);
     CmlUTF_Code (*decodeLE)(unsigned char *p_buff, size_t len);
     CmlUTF_Code (*decodeBE)(unsigned char *p_buff, size_t len);
     size_t (*getOctetsLengthBE)(unsigned char *p_buff, size_t len);
     size_t (*getOctetsLengthLE)(unsigned char *p_buff, size_t len);
+    size_t (*countBE)(unsigned char *p_buff, size_t len);
+    size_t (*countLE)(unsigned char *p_buff, size_t len);
+    size_t (*getPrevOctetsLengthBE)(unsigned char *p_buff, size_t len);
+    size_t (*getPrevOctetsLengthLE)(unsigned char *p_buff, size_t len);
 };
 
 struct CmlUTF_Buffer {
@@ -44,12 +67,28 @@ struct CmlUTF_Buffer {
     size_t moffset;
     size_t mcurrIndex;
     struct CmlUTF_Codec *codec;
+    struct iovec *segments;
+    size_t segmentsLen;
+    size_t currSegment;
+    size_t segmentOffset;
 };
 
+void CmlUTF_destroy(struct CmlUTF_Buffer *p_utf);
+void CmlUTF_setSegments(struct CmlUTF_Buffer *p_utf, struct iovec *p_segments, size_t segmentsLen);
+size_t CmlUTF_gather(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t len);
 size_t CmlUTF_len(struct CmlUTF_Buffer *p_utf);
 size_t CmlUTF_next(struct CmlUTF_Buffer *p_utf, size_t n);
+size_t CmlUTF_prev(struct CmlUTF_Buffer *p_utf, size_t n);
+void CmlUTF_mark(struct CmlUTF_Buffer *p_utf);
+void CmlUTF_reset(struct CmlUTF_Buffer *p_utf);
 CmlUTF_Code CmlUTF_iter(struct CmlUTF_Buffer *p_utf);
 CmlUTF_Code CmlUTF_read(struct CmlUTF_Buffer *p_utf);
 size_t CmlUTF_write(struct CmlUTF_Buffer *p_utf, CmlUTF_Code code);
+size_t CmlUTF_writeCodes(struct CmlUTF_Buffer *p_utf, CmlUTF_Code *p_codes, size_t n);
+size_t CmlUTF_count(struct CmlUTF_Buffer *p_utf);
+size_t CmlUTF_maxCount(struct CmlUTF_Buffer *p_utf);
+size_t CmlUTF_encodedLength(struct CmlUTF_Buffer *p_utf, enum CmlUTF_Encoding encoding);
+size_t CmlUTF_maxEncodedLength(struct CmlUTF_Buffer *p_utf, enum CmlUTF_Encoding encoding);
+size_t CmlUTF_codesEncodedLength(CmlUTF_Code *p_codes, size_t n, enum CmlUTF_Encoding encoding);
 
 #endif
@@ -20,11 +20,16 @@ along with this program; if not, see
 
 #include <stddef.h>
 #include <errno.h>
-#include <stdlib.h>
 #include "def.h"
 #include "utf.h"
 #include "utf16.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CmlUTF16_BLOCK_SIZE 8
+
 static __Cml_INLINE void CmlUTF16_encode32bits(CmlUTF_Code code, unsigned short int *p_w1, unsigned short int *p_w2)
 {
     CmlUTF_Code u = code - 0x10000;
@@ -32,27 +37,51 @@ static __Cml_INLINE void CmlUTF16_encode32bits(CmlUTF_Code code, unsigned short
     *p_w2 = (u & 0x3FF) + 0xDC00;
 }
 
-static __Cml_INLINE CmlUTF_Code CmlUTF16_decode32bits(unsigned short int w1, unsigned short int w2)
+size_t CmlUTF16_getOctetsLengthBE(unsigned char *p_buff, size_t len)
+{
+    return __CmlUTF16_getOctetsLengthBE(p_buff, len);
+}
+
+size_t CmlUTF16_getOctetsLengthLE(unsigned char *p_buff, size_t len)
 {
-    return (((w1 - 0xD800) << 10) | (w2 - 0xDC00)) + 0x10000;
+    return __CmlUTF16_getOctetsLengthLE(p_buff, len);
 }
 
-__Cml_INLINE size_t CmlUTF16_getOctetsLengthBE(unsigned char *p_buff, size_t len)
+size_t CmlUTF16_getPrevOctetsLengthBE(unsigned char *p_buff, size_t len)
 {
-    return len >= 4 && (p_buff[0] & 0xFC) == 0xD8 && (p_buff[2] & 0xFC) == 0xDC
-        ? 4
-        : 2;
+    return __CmlUTF16_getPrevOctetsLengthBE(p_buff, len);
 }
 
-__Cml_INLINE size_t CmlUTF16_getOctetsLengthLE(unsigned char *p_buff, size_t len)
+size_t CmlUTF16_getPrevOctetsLengthLE(unsigned char *p_buff, size_t len)
 {
-    return len >= 4 && (p_buff[1] & 0xFC) == 0xD8 && (p_buff[3] & 0xFC) == 0xDC
-        ? 4
-        : 2;
+    return __CmlUTF16_getPrevOctetsLengthLE(p_buff, len);
 }
 
-void CmlUTF16_encodeBE(CmlUTF_Code code, unsigned char *p_buff, size_t len)
+size_t CmlUTF16_countBE(unsigned char *p_buff, size_t len)
 {
+    size_t count = (len + 1) / 2;
+    size_t i = 0;
+    for (; i + 4 <= len; i += 2)
+        count -= (p_buff[i] & 0xFC) == 0xD8 && (p_buff[i + 2] & 0xFC) == 0xDC;
+    return count;
+}
+
+size_t CmlUTF16_countLE(unsigned char *p_buff, size_t len)
+{
+    size_t count = (len + 1) / 2;
+    size_t i = 0;
+    for (; i + 4 <= len; i += 2)
+        count -= (p_buff[i + 1] & 0xFC) == 0xD8 && (p_buff[i + 3] & 0xFC) == 0xDC;
+    return count;
+}
+
+size_t CmlUTF16_encodeBE(CmlUTF_Code code, unsigned char *p_buff, size_t len)
+{
+    if (code > 0x10FFFF) {
+        errno = EINVAL;
+        return 0;
+    }
+
     if (code <= 0xFFFF) {
         if (len < 2) {
             goto bufferTooSmallErr;
@@ -60,6 +89,7 @@ void CmlUTF16_encodeBE(CmlUTF_Code code, unsigned char *p_buff, size_t len)
 
         p_buff[0] = code >> 8;
         p_buff[1] = code & 0xFF;
+        return 2;
     } else {
         if (len < 4) {
             goto bufferTooSmallErr;
@@ -73,34 +103,24 @@ void CmlUTF16_encodeBE(CmlUTF_Code code, unsigned char *p_buff, size_t len)
         p_buff[3] = w2 & 0xFF;
     }
 
-    return;
+    return 4;
     bufferTooSmallErr:
     errno = EINVAL;
+    return 0;
 }
 
 CmlUTF_Code CmlUTF16_decodeBE(unsigned char *p_buff, size_t len)
 {
-    if (CmlUTF16_getOctetsLengthBE(p_buff, len) == 2) {
-        if (len < 2) {
-            goto bufferTooSmallErr;
-        }
-
-        return (p_buff[0] << 8) | p_buff[1];
-    } else {
-        if (len < 4) {
-            goto bufferTooSmallErr;
-        }
-
-        return CmlUTF16_decode32bits((p_buff[0] << 8) | p_buff[1], (p_buff[2] << 8) | p_buff[3]);
-    }
-
-    bufferTooSmallErr:
-    errno = EINVAL;
-    return -1;
+    return __CmlUTF16_decodeBE(p_buff, len);
 }
 
-void CmlUTF16_encodeLE(CmlUTF_Code code, unsigned char *p_buff, size_t len)
+size_t CmlUTF16_encodeLE(CmlUTF_Code code, unsigned char *p_buff, size_t len)
 {
+    if (code > 0x10FFFF) {
+        errno = EINVAL;
+        return 0;
+    }
+
     if (code <= 0xFFFF) {
         if (len < 2) {
             goto bufferTooSmallErr;
@@ -108,6 +128,7 @@ void CmlUTF16_encodeLE(CmlUTF_Code code, unsigned char *p_buff, size_t len)
 
         p_buff[0] = code & 0xFF;
         p_buff[1] = code >> 8;
+        return 2;
     } else {
         if (len < 4) {
             goto bufferTooSmallErr;
@@ -121,30 +142,88 @@ void CmlUTF16_encodeLE(CmlUTF_Code code, unsigned char *p_buff, size_t len)
         p_buff[3] = w2 >> 8;
     }
 
-    return;
+    return 4;
     bufferTooSmallErr:
     errno = EINVAL;
+    return 0;
 }
 
-CmlUTF_Code CmlUTF16_decodeLE(unsigned char *p_buff, size_t len)
+#ifdef __SSE2__
+static __Cml_INLINE int CmlUTF16_encodeBMPBlock(CmlUTF_Code *p_codes, unsigned char *p_buff, int bigEndian)
 {
-    if (CmlUTF16_getOctetsLengthLE(p_buff, len) == 2) {
-        if (len < 2) {
-            goto bufferTooSmallErr;
-        }
+    __m128i a = _mm_loadu_si128((__m128i *) p_codes);
+    __m128i b = _mm_loadu_si128((__m128i *) (p_codes + 4));
+    __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi32(0xFFFF0000));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xFFFF)
+        return 0;
 
-        return (p_buff[1] << 8) | p_buff[0];
-    } else {
-        if (len < 4) {
-            goto bufferTooSmallErr;
+    /* Sign extend the low halves so the saturating pack keeps them as is */
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    __m128i units = _mm_packs_epi32(a, b);
+    if (bigEndian)
+        units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+    _mm_storeu_si128((__m128i *) p_buff, units);
+    return 1;
+}
+#endif
+
+static __Cml_FORCE_INLINE size_t CmlUTF16_encodeCodes(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len, int bigEndian)
+{
+    size_t n = *p_n;
+    size_t written = 0;
+    size_t i = 0;
+
+    while (i < n) {
+        size_t end = n;
+#ifdef __SSE2__
+        if (i + CmlUTF16_BLOCK_SIZE <= n) {
+            if (written + CmlUTF16_BLOCK_SIZE * 2 <= len && CmlUTF16_encodeBMPBlock(p_codes + i, p_buff + written, bigEndian)) {
+                i += CmlUTF16_BLOCK_SIZE;
+                written += CmlUTF16_BLOCK_SIZE * 2;
+                continue;
+            }
+
+            end = i + CmlUTF16_BLOCK_SIZE;
         }
+#endif
 
-        return CmlUTF16_decode32bits((p_buff[1] << 8) | p_buff[0], (p_buff[3] << 8) | p_buff[2]);
+        for (; i < end; i++) {
+            CmlUTF_Code code = p_codes[i];
+            size_t octetsLength = code <= 0xFFFF ? 2 : 4;
+            if (code > 0x10FFFF) {
+                errno = EINVAL;
+                goto done;
+            }
+            if (written + octetsLength > len) {
+                errno = ENOBUFS;
+                goto done;
+            }
+
+            written += bigEndian
+                ? CmlUTF16_encodeBE(code, p_buff + written, octetsLength)
+                : CmlUTF16_encodeLE(code, p_buff + written, octetsLength);
+        }
     }
 
-    bufferTooSmallErr:
-    errno = EINVAL;
-    return -1;
+    done:
+    *p_n = i;
+    return written;
+}
+
+size_t CmlUTF16_encodeCodesBE(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len)
+{
+    return CmlUTF16_encodeCodes(p_codes, p_n, p_buff, len, 1);
+}
+
+size_t CmlUTF16_encodeCodesLE(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len)
+{
+    return CmlUTF16_encodeCodes(p_codes, p_n, p_buff, len, 0);
+}
+
+CmlUTF_Code CmlUTF16_decodeLE(unsigned char *p_buff, size_t len)
+{
+    return __CmlUTF16_decodeLE(p_buff, len);
 }
 
 enum Cml_Endianness CmlUTF16_detectEndianness(unsigned char *buff, size_t len)
@@ -168,6 +247,22 @@ enum Cml_Endianness CmlUTF16_detectEndianness(unsigned char *buff, size_t len)
 
 }
 
+static struct CmlUTF_Codec CmlUTF16_codec = {
+    CmlUTF_UTF16,
+    &CmlUTF16_encodeLE,
+    &CmlUTF16_encodeBE,
+    &CmlUTF16_encodeCodesLE,
+    &CmlUTF16_encodeCodesBE,
+    &CmlUTF16_decodeLE,
+    &CmlUTF16_decodeBE,
+    &CmlUTF16_getOctetsLengthBE,
+    &CmlUTF16_getOctetsLengthLE,
+    &CmlUTF16_countBE,
+    &CmlUTF16_countLE,
+    &CmlUTF16_getPrevOctetsLengthBE,
+    &CmlUTF16_getPrevOctetsLengthLE
+};
+
 void CmlUTF16_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t offset, size_t len, enum Cml_Endianness endian)
 {
     if (p_buff == NULL) {
@@ -178,14 +273,31 @@ void CmlUTF16_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t off
     p_utf->buff = p_buff;
     p_utf->currIndex = 0;
     p_utf->offset = offset;
-    p_utf->endian = endian == 0 ? CmlUTF16_detectEndianness(p_buff, len) : endian;
+    p_utf->moffset = offset;
+    p_utf->mcurrIndex = 0;
+    p_utf->endian = endian == Cml_DETECT ? CmlUTF16_detectEndianness(p_buff, len) : endian;
     p_utf->len = len;
+    p_utf->segments = NULL;
+    p_utf->segmentsLen = 0;
+    p_utf->currSegment = 0;
+    p_utf->segmentOffset = 0;
+
+    p_utf->codec = &CmlUTF16_codec;
+}
+
+void CmlUTF16_newv(struct CmlUTF_Buffer *p_utf, struct iovec *p_segments, size_t segmentsLen, size_t offset, enum Cml_Endianness endian)
+{
+    if (p_segments == NULL || segmentsLen == 0 || p_segments[0].iov_base == NULL) {
+        errno = EINVAL;
+        return;
+    }
 
-    p_utf->codec = malloc(sizeof(struct CmlUTF_Codec));
-    p_utf->codec->encodeLE = &CmlUTF16_encodeLE;
-    p_utf->codec->encodeBE = &CmlUTF16_encodeBE;
-    p_utf->codec->decodeLE = &CmlUTF16_decodeLE;
-    p_utf->codec->decodeBE = &CmlUTF16_decodeBE;
-    p_utf->codec->getOctetsLengthBE = &CmlUTF16_getOctetsLengthBE;
-    p_utf->codec->getOctetsLengthLE = &CmlUTF16_getOctetsLengthLE;
+    CmlUTF16_new(p_utf, p_segments[0].iov_base, offset, p_segments[0].iov_len, Cml_LE);
+    CmlUTF_setSegments(p_utf, p_segments, segmentsLen);
+    if (endian == Cml_DETECT) {
+        unsigned char bom[4];
+        p_utf->endian = CmlUTF16_detectEndianness(bom, CmlUTF_gather(p_utf, bom, sizeof(bom)));
+    } else {
+        p_utf->endian = endian;
+    }
 }
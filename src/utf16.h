@@ -21,16 +21,91 @@ along with this program; if not, see
 #ifndef __UTF16_H
 #define __UTF16_H
 
+#include <errno.h>
 #include "def.h"
 #include "utf.h"
 
+static __Cml_FORCE_INLINE CmlUTF_Code __CmlUTF16_decode32bits(unsigned short int w1, unsigned short int w2)
+{
+    return (((w1 - 0xD800) << 10) | (w2 - 0xDC00)) + 0x10000;
+}
+
+static __Cml_FORCE_INLINE size_t __CmlUTF16_getOctetsLengthBE(unsigned char *p_buff, size_t len)
+{
+    return len >= 4 && (p_buff[0] & 0xFC) == 0xD8 && (p_buff[2] & 0xFC) == 0xDC
+        ? 4
+        : 2;
+}
+
+static __Cml_FORCE_INLINE size_t __CmlUTF16_getOctetsLengthLE(unsigned char *p_buff, size_t len)
+{
+    return len >= 4 && (p_buff[1] & 0xFC) == 0xD8 && (p_buff[3] & 0xFC) == 0xDC
+        ? 4
+        : 2;
+}
+
+static __Cml_FORCE_INLINE size_t __CmlUTF16_getPrevOctetsLengthBE(unsigned char *p_buff, size_t len)
+{
+    return len >= 4 && (p_buff[len - 4] & 0xFC) == 0xD8 && (p_buff[len - 2] & 0xFC) == 0xDC
+        ? 4
+        : 2;
+}
+
+static __Cml_FORCE_INLINE size_t __CmlUTF16_getPrevOctetsLengthLE(unsigned char *p_buff, size_t len)
+{
+    return len >= 4 && (p_buff[len - 3] & 0xFC) == 0xD8 && (p_buff[len - 1] & 0xFC) == 0xDC
+        ? 4
+        : 2;
+}
+
+static __Cml_FORCE_INLINE CmlUTF_Code __CmlUTF16_decodeBE(unsigned char *p_buff, size_t len)
+{
+    if (__CmlUTF16_getOctetsLengthBE(p_buff, len) == 2) {
+        if (len < 2) {
+            goto bufferTooSmallErr;
+        }
+
+        return (p_buff[0] << 8) | p_buff[1];
+    }
+
+    return __CmlUTF16_decode32bits((p_buff[0] << 8) | p_buff[1], (p_buff[2] << 8) | p_buff[3]);
+
+    bufferTooSmallErr:
+    errno = EINVAL;
+    return -1;
+}
+
+static __Cml_FORCE_INLINE CmlUTF_Code __CmlUTF16_decodeLE(unsigned char *p_buff, size_t len)
+{
+    if (__CmlUTF16_getOctetsLengthLE(p_buff, len) == 2) {
+        if (len < 2) {
+            goto bufferTooSmallErr;
+        }
+
+        return (p_buff[1] << 8) | p_buff[0];
+    }
+
+    return __CmlUTF16_decode32bits((p_buff[1] << 8) | p_buff[0], (p_buff[3] << 8) | p_buff[2]);
+
+    bufferTooSmallErr:
+    errno = EINVAL;
+    return -1;
+}
+
 size_t CmlUTF16_getOctetsLengthBE(unsigned char *p_buff, size_t len);
 size_t CmlUTF16_getOctetsLengthLE(unsigned char *p_buff, size_t len);
-void CmlUTF16_encodeBE(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+size_t CmlUTF16_countBE(unsigned char *p_buff, size_t len);
+size_t CmlUTF16_countLE(unsigned char *p_buff, size_t len);
+size_t CmlUTF16_getPrevOctetsLengthBE(unsigned char *p_buff, size_t len);
+size_t CmlUTF16_getPrevOctetsLengthLE(unsigned char *p_buff, size_t len);
+size_t CmlUTF16_encodeBE(CmlUTF_Code code, unsigned char *p_buff, size_t len);
 CmlUTF_Code CmlUTF16_decodeBE(unsigned char *p_buff, size_t len);
-void CmlUTF16_encodeLE(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+size_t CmlUTF16_encodeLE(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+size_t CmlUTF16_encodeCodesBE(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len);
+size_t CmlUTF16_encodeCodesLE(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len);
 CmlUTF_Code CmlUTF16_decodeLE(unsigned char *p_buff, size_t len);
 enum Cml_Endianness CmlUTF16_detectEndianness(unsigned char *p_buff, size_t len);
 void CmlUTF16_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t offset, size_t len, enum Cml_Endianness endian);
+void CmlUTF16_newv(struct CmlUTF_Buffer *p_utf, struct iovec *p_segments, size_t segmentsLen, size_t offset, enum Cml_Endianness endian);
 
 #endif
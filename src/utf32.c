@@ -20,60 +20,129 @@ along with this program; if not, see
 
 #include <stddef.h>
 #include <errno.h>
-#include <stdlib.h>
 #include "def.h"
 #include "utf.h"
 #include "utf32.h"
 
-__Cml_INLINE size_t CmlUTF32_getOctetsLength(unsigned char *p_buff, size_t len)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CmlUTF32_BLOCK_SIZE 4
+
+size_t CmlUTF32_getOctetsLength(unsigned char *p_buff, size_t len)
 {
-    return 4;
+    return __CmlUTF32_getOctetsLength(p_buff, len);
 }
 
-void CmlUTF32_LE_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len)
+size_t CmlUTF32_count(unsigned char *p_buff, size_t len)
 {
-    if (len < 4) {
+    return (len + 3) / 4;
+}
+
+size_t CmlUTF32_LE_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len)
+{
+    if (len < 4 || code > 0x10FFFF) {
         errno = EINVAL;
-        return;
+        return 0;
     }
 
     p_buff[0] = code & 0xFF;
     p_buff[1] = code >> 8 & 0xFF;
     p_buff[2] = code >> 16 & 0xFF;
     p_buff[3] = code >> 24;
+    return 4;
 }
 
 CmlUTF_Code CmlUTF32_LE_decode(unsigned char *p_buff, size_t len)
 {
-    if (len < 4) {
-        errno = EINVAL;
-        return -1;
-    }
-
-    return (p_buff[3] << 24) | (p_buff[2] << 16) | (p_buff[1] << 8) | p_buff[0];
+    return __CmlUTF32_LE_decode(p_buff, len);
 }
 
-void CmlUTF32_BE_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len)
+size_t CmlUTF32_BE_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len)
 {
-    if (len < 4) {
+    if (len < 4 || code > 0x10FFFF) {
         errno = EINVAL;
-        return;
+        return 0;
     }
 
     p_buff[0] = code >> 24;
     p_buff[1] = code >> 16 & 0xFF;
     p_buff[2] = code >> 8 & 0xFF;
     p_buff[3] = code & 0xFF;
+    return 4;
 }
 
 CmlUTF_Code CmlUTF32_BE_decode(unsigned char *p_buff, size_t len)
 {
-    if (len < 4) {
-        errno = EINVAL;
-        return -1;
+    return __CmlUTF32_BE_decode(p_buff, len);
+}
+
+#ifdef __SSE2__
+static __Cml_INLINE int CmlUTF32_encodeBlock(CmlUTF_Code *p_codes, unsigned char *p_buff, int bigEndian)
+{
+    __m128i codes = _mm_loadu_si128((__m128i *) p_codes);
+    __m128i invalid = _mm_or_si128(_mm_cmpgt_epi32(codes, _mm_set1_epi32(0x10FFFF)), _mm_cmplt_epi32(codes, _mm_setzero_si128()));
+    if (_mm_movemask_epi8(invalid))
+        return 0;
+
+    if (bigEndian) {
+        codes = _mm_shufflehi_epi16(_mm_shufflelo_epi16(codes, 0xB1), 0xB1);
+        codes = _mm_or_si128(_mm_slli_epi16(codes, 8), _mm_srli_epi16(codes, 8));
     }
+    _mm_storeu_si128((__m128i *) p_buff, codes);
+    return 1;
+}
+#endif
+
+static __Cml_FORCE_INLINE size_t CmlUTF32_encodeCodes(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len, int bigEndian)
+{
+    size_t n = *p_n;
+    size_t written = 0;
+    size_t i = 0;
+
+    while (i < n) {
+        size_t end = n;
+#ifdef __SSE2__
+        if (i + CmlUTF32_BLOCK_SIZE <= n) {
+            if (written + CmlUTF32_BLOCK_SIZE * 4 <= len && CmlUTF32_encodeBlock(p_codes + i, p_buff + written, bigEndian)) {
+                i += CmlUTF32_BLOCK_SIZE;
+                written += CmlUTF32_BLOCK_SIZE * 4;
+                continue;
+            }
+
+            end = i + CmlUTF32_BLOCK_SIZE;
+        }
+#endif
+
+        for (; i < end; i++) {
+            if (written + 4 > len) {
+                errno = ENOBUFS;
+                goto done;
+            }
+
+            size_t octetsLength = bigEndian
+                ? CmlUTF32_BE_encode(p_codes[i], p_buff + written, 4)
+                : CmlUTF32_LE_encode(p_codes[i], p_buff + written, 4);
+            if (octetsLength == 0)
+                goto done;
+            written += octetsLength;
+        }
+    }
+
+    done:
+    *p_n = i;
+    return written;
+}
 
-    return (p_buff[0] << 24) | (p_buff[1] << 16) | (p_buff[2] << 8) | p_buff[3];
+size_t CmlUTF32_LE_encodeCodes(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len)
+{
+    return CmlUTF32_encodeCodes(p_codes, p_n, p_buff, len, 0);
+}
+
+size_t CmlUTF32_BE_encodeCodes(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len)
+{
+    return CmlUTF32_encodeCodes(p_codes, p_n, p_buff, len, 1);
 }
 
 enum Cml_Endianness CmlUTF32_detectEndianness(unsigned char *p_buff, size_t len)
@@ -82,9 +151,9 @@ enum Cml_Endianness CmlUTF32_detectEndianness(unsigned char *p_buff, size_t len)
         goto defaultEndian;
     }
 
-    if (p_buff[0] == 0xFE && p_buff[1] == 0xFF && !(p_buff[2]) && !(p_buff[3])) {
+    if (!(p_buff[0]) && !(p_buff[1]) && p_buff[2] == 0xFE && p_buff[3] == 0xFF) {
         return Cml_BE;
-    } else if (!(p_buff[0]) && !(p_buff[1]) && p_buff[2] == 0xFF && p_buff[3] == 0xFE) {
+    } else if (p_buff[0] == 0xFF && p_buff[1] == 0xFE && !(p_buff[2]) && !(p_buff[3])) {
         return Cml_LE;
     } else {
         defaultEndian:
@@ -96,6 +165,22 @@ enum Cml_Endianness CmlUTF32_detectEndianness(unsigned char *p_buff, size_t len)
     }
 }
 
+static struct CmlUTF_Codec CmlUTF32_codec = {
+    CmlUTF_UTF32,
+    &CmlUTF32_LE_encode,
+    &CmlUTF32_BE_encode,
+    &CmlUTF32_LE_encodeCodes,
+    &CmlUTF32_BE_encodeCodes,
+    &CmlUTF32_LE_decode,
+    &CmlUTF32_BE_decode,
+    &CmlUTF32_getOctetsLength,
+    &CmlUTF32_getOctetsLength,
+    &CmlUTF32_count,
+    &CmlUTF32_count,
+    &CmlUTF32_getOctetsLength,
+    &CmlUTF32_getOctetsLength
+};
+
 void CmlUTF32_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t offset, size_t len, enum Cml_Endianness endian)
 {
     if (p_buff == NULL) {
@@ -106,14 +191,31 @@ void CmlUTF32_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t off
     p_utf->buff = p_buff;
     p_utf->currIndex = 0;
     p_utf->offset = offset;
-    p_utf->endian = endian == 0 ? CmlUTF32_detectEndianness(p_buff, len) : endian;
+    p_utf->moffset = offset;
+    p_utf->mcurrIndex = 0;
+    p_utf->endian = endian == Cml_DETECT ? CmlUTF32_detectEndianness(p_buff, len) : endian;
     p_utf->len = len;
+    p_utf->segments = NULL;
+    p_utf->segmentsLen = 0;
+    p_utf->currSegment = 0;
+    p_utf->segmentOffset = 0;
+
+    p_utf->codec = &CmlUTF32_codec;
+}
+
+void CmlUTF32_newv(struct CmlUTF_Buffer *p_utf, struct iovec *p_segments, size_t segmentsLen, size_t offset, enum Cml_Endianness endian)
+{
+    if (p_segments == NULL || segmentsLen == 0 || p_segments[0].iov_base == NULL) {
+        errno = EINVAL;
+        return;
+    }
 
-    p_utf->codec = malloc(sizeof(struct CmlUTF_Codec));
-    p_utf->codec->encodeBE = &CmlUTF32_BE_encode;
-    p_utf->codec->encodeLE = &CmlUTF32_LE_encode;
-    p_utf->codec->decodeLE = &CmlUTF32_LE_decode;
-    p_utf->codec->decodeBE = &CmlUTF32_BE_decode;
-    p_utf->codec->getOctetsLengthBE = &CmlUTF32_getOctetsLength;
-    p_utf->codec->getOctetsLengthLE = &CmlUTF32_getOctetsLength;
+    CmlUTF32_new(p_utf, p_segments[0].iov_base, offset, p_segments[0].iov_len, Cml_LE);
+    CmlUTF_setSegments(p_utf, p_segments, segmentsLen);
+    if (endian == Cml_DETECT) {
+        unsigned char bom[4];
+        p_utf->endian = CmlUTF32_detectEndianness(bom, CmlUTF_gather(p_utf, bom, sizeof(bom)));
+    } else {
+        p_utf->endian = endian;
+    }
 }
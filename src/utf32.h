@@ -21,15 +21,45 @@ along with this program; if not, see
 #ifndef __UTF_32_H
 #define __UTF_32_H
 
+#include <errno.h>
 #include "def.h"
 #include "utf.h"
 
+static __Cml_FORCE_INLINE size_t __CmlUTF32_getOctetsLength(unsigned char *p_buff, size_t len)
+{
+    return 4;
+}
+
+static __Cml_FORCE_INLINE CmlUTF_Code __CmlUTF32_LE_decode(unsigned char *p_buff, size_t len)
+{
+    if (len < 4) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ((CmlUTF_Code) p_buff[3] << 24) | (p_buff[2] << 16) | (p_buff[1] << 8) | p_buff[0];
+}
+
+static __Cml_FORCE_INLINE CmlUTF_Code __CmlUTF32_BE_decode(unsigned char *p_buff, size_t len)
+{
+    if (len < 4) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ((CmlUTF_Code) p_buff[0] << 24) | (p_buff[1] << 16) | (p_buff[2] << 8) | p_buff[3];
+}
+
 size_t CmlUTF32_getOctetsLength(unsigned char *p_buff, size_t len);
-void CmlUTF32_LE_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+size_t CmlUTF32_count(unsigned char *p_buff, size_t len);
+size_t CmlUTF32_LE_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len);
 CmlUTF_Code CmlUTF32_LE_decode(unsigned char *p_buff, size_t len);
-void CmlUTF32_BE_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+size_t CmlUTF32_BE_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+size_t CmlUTF32_LE_encodeCodes(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len);
+size_t CmlUTF32_BE_encodeCodes(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len);
 CmlUTF_Code CmlUTF32_BE_decode(unsigned char *p_buff, size_t len);
 enum Cml_Endianness CmlUTF32_detectEndianness(unsigned char *p_buff, size_t len);
 void CmlUTF32_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t offset, size_t len, enum Cml_Endianness endian);
+void CmlUTF32_newv(struct CmlUTF_Buffer *p_utf, struct iovec *p_segments, size_t segmentsLen, size_t offset, enum Cml_Endianness endian);
 
 #endif
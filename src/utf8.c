@@ -20,32 +20,44 @@ along with this program; if not, see
 
 #include <stddef.h>
 #include <errno.h>
-#include <stdlib.h>
+#include <string.h>
 #include "def.h"
 #include "utf.h"
 #include "utf8.h"
 
-__Cml_INLINE int CmlUTF8_detectBOM(unsigned char *p_buff, size_t len) {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CmlUTF8_BLOCK_SIZE 16
+
+static __Cml_INLINE int CmlUTF8_detectBOM(unsigned char *p_buff, size_t len) {
     return len >= 3 && p_buff[0] == 0xEF && p_buff[1] == 0xBB && p_buff[2] == 0xBF;
 }
 
 size_t CmlUTF8_getOctetsLength(unsigned char *p_buff, size_t len)
 {
-    size_t octetsLength = 0;
-    if (!(p_buff[0] & 0x80)) {
-        octetsLength = 1;
-    } else if ((p_buff[0] & 0xE0) == 0xC0) {
-        octetsLength = 2;
-    } else if ((p_buff[0] & 0xF0) == 0xE0) {
-        octetsLength = 3;
-    } else if ((p_buff[0] & 0xF8) == 0xF0) {
-        octetsLength = 4;
+    return __CmlUTF8_getOctetsLength(p_buff, len);
+}
+
+size_t CmlUTF8_count(unsigned char *p_buff, size_t len)
+{
+    size_t count = len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        unsigned long long word;
+        memcpy(&word, p_buff + i, 8);
+        word = (word & ~(word << 1)) & 0x8080808080808080ULL;
+        count -= ((word >> 7) * 0x0101010101010101ULL) >> 56;
     }
 
-    return len < octetsLength ? 0 : octetsLength;
+    for (; i < len; i++)
+        count -= (p_buff[i] & 0xC0) == 0x80;
+
+    return count;
 }
 
-void CmlUTF8_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len)
+size_t CmlUTF8_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len)
 {
     if (len == 0) {
         goto bufferTooSmallError;
@@ -68,7 +80,7 @@ void CmlUTF8_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len)
         octetsLength = 4;
     } else {
         errno = EINVAL;
-        return;
+        return 0;
     }
 
     if (len < octetsLength) {
@@ -81,56 +93,100 @@ void CmlUTF8_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len)
         p_buff[i] = 0x80 | ((code >> (6 * (octetsLength - 1 - i))) & 0x3F);
     }
 
-    return;
+    return octetsLength;
 
     bufferTooSmallError:
     errno = ERANGE;
-    return;
+    return 0;
 }
 
-CmlUTF_Code CmlUTF8_decode(unsigned char *p_buff, size_t len)
+#ifdef __SSE2__
+static __Cml_INLINE int CmlUTF8_encodeASCIIBlock(CmlUTF_Code *p_codes, unsigned char *p_buff)
 {
-    if (len == 0) {
-        goto bufferTooSmallError;
-    }
-
-    CmlUTF_Code code = 0;
-    size_t octetsLength = CmlUTF8_getOctetsLength(p_buff, len);
-    switch (octetsLength) {
-        case 1: code = p_buff[0];
-        break;
-        case 2: code = p_buff[0] & 0x1F;
-        break;
-        case 3: code = p_buff[0] & 0xF;
-        break;
-        case 4: code = p_buff[0] & 0x7;
-        break;
-        default: goto invalidUTF8Error;
-    }
-
-    if (len < octetsLength) {
-        goto bufferTooSmallError;
-    }
+    __m128i a = _mm_loadu_si128((__m128i *) p_codes);
+    __m128i b = _mm_loadu_si128((__m128i *) (p_codes + 4));
+    __m128i c = _mm_loadu_si128((__m128i *) (p_codes + 8));
+    __m128i d = _mm_loadu_si128((__m128i *) (p_codes + 12));
+    __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), _mm_set1_epi32(~0x7F));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xFFFF)
+        return 0;
+
+    _mm_storeu_si128((__m128i *) p_buff, _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    return 1;
+}
+#endif
 
-    size_t i = 1;
-    for (; i < octetsLength; i++) {
-        if ((p_buff[i] & 0xC0) != 0x80) {
-            goto invalidUTF8Error;
+size_t CmlUTF8_encodeCodes(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len)
+{
+    size_t n = *p_n;
+    size_t written = 0;
+    size_t i = 0;
+
+    while (i < n) {
+        size_t end = n;
+#ifdef __SSE2__
+        if (i + CmlUTF8_BLOCK_SIZE <= n) {
+            if (written + CmlUTF8_BLOCK_SIZE <= len && CmlUTF8_encodeASCIIBlock(p_codes + i, p_buff + written)) {
+                i += CmlUTF8_BLOCK_SIZE;
+                written += CmlUTF8_BLOCK_SIZE;
+                continue;
+            }
+
+            end = i + CmlUTF8_BLOCK_SIZE;
+        }
+#endif
+
+        for (; i < end; i++) {
+            CmlUTF_Code code = p_codes[i];
+            size_t octetsLength = code < 0x80 ? 1 : code < 0x800 ? 2 : code < 0x10000 ? 3 : 4;
+            if (code > 0x10FFFF) {
+                errno = EINVAL;
+                goto done;
+            }
+            if (written + octetsLength > len) {
+                errno = ENOBUFS;
+                goto done;
+            }
+
+            if (octetsLength == 1)
+                p_buff[written] = code;
+            else
+                CmlUTF8_encode(code, p_buff + written, octetsLength);
+            written += octetsLength;
         }
-        code = (code << 6) | (p_buff[i] & 0x3F);
     }
 
-    return code;
+    done:
+    *p_n = i;
+    return written;
+}
 
-    bufferTooSmallError:
-    errno = ERANGE;
-    return -1;
+size_t CmlUTF8_getPrevOctetsLength(unsigned char *p_buff, size_t len)
+{
+    return __CmlUTF8_getPrevOctetsLength(p_buff, len);
+}
 
-    invalidUTF8Error:
-    errno = EINVAL;
-    return -1;
+CmlUTF_Code CmlUTF8_decode(unsigned char *p_buff, size_t len)
+{
+    return __CmlUTF8_decode(p_buff, len);
 }
 
+static struct CmlUTF_Codec CmlUTF8_codec = {
+    CmlUTF_UTF8,
+    &CmlUTF8_encode,
+    &CmlUTF8_encode,
+    &CmlUTF8_encodeCodes,
+    &CmlUTF8_encodeCodes,
+    &CmlUTF8_decode,
+    &CmlUTF8_decode,
+    &CmlUTF8_getOctetsLength,
+    &CmlUTF8_getOctetsLength,
+    &CmlUTF8_count,
+    &CmlUTF8_count,
+    &CmlUTF8_getPrevOctetsLength,
+    &CmlUTF8_getPrevOctetsLength
+};
+
 void CmlUTF8_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t offset, size_t len)
 {
     if (p_buff == NULL) {
@@ -141,14 +197,25 @@ void CmlUTF8_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t offs
     p_utf->buff = p_buff;
     p_utf->currIndex = 0;
     p_utf->offset = offset;
+    p_utf->moffset = offset;
+    p_utf->mcurrIndex = 0;
     p_utf->endian = Cml_BE;
     p_utf->len = len;
+    p_utf->segments = NULL;
+    p_utf->segmentsLen = 0;
+    p_utf->currSegment = 0;
+    p_utf->segmentOffset = 0;
+
+    p_utf->codec = &CmlUTF8_codec;
+}
+
+void CmlUTF8_newv(struct CmlUTF_Buffer *p_utf, struct iovec *p_segments, size_t segmentsLen, size_t offset)
+{
+    if (p_segments == NULL || segmentsLen == 0 || p_segments[0].iov_base == NULL) {
+        errno = EINVAL;
+        return;
+    }
 
-    p_utf->codec = malloc(sizeof(struct CmlUTF_Codec));
-    p_utf->codec->encodeLE = &CmlUTF8_encode;
-    p_utf->codec->encodeBE = &CmlUTF8_encode;
-    p_utf->codec->decodeLE = &CmlUTF8_decode;
-    p_utf->codec->decodeBE = &CmlUTF8_decode;
-    p_utf->codec->getOctetsLengthBE = &CmlUTF8_getOctetsLength;
-    p_utf->codec->getOctetsLengthLE = &CmlUTF8_getOctetsLength;
+    CmlUTF8_new(p_utf, p_segments[0].iov_base, offset, p_segments[0].iov_len);
+    CmlUTF_setSegments(p_utf, p_segments, segmentsLen);
 }
@@ -21,12 +21,103 @@ along with this program; if not, see
 #ifndef __UTF8_H
 #define __UTF8_H
 
+#include <errno.h>
 #include "def.h"
 #include "utf.h"
 
+static __Cml_FORCE_INLINE size_t __CmlUTF8_getLeadOctetsLength(unsigned char *p_buff, size_t len)
+{
+    size_t octetsLength = 0;
+    if (!(p_buff[0] & 0x80)) {
+        octetsLength = 1;
+    } else if ((p_buff[0] & 0xE0) == 0xC0) {
+        octetsLength = 2;
+    } else if ((p_buff[0] & 0xF0) == 0xE0) {
+        octetsLength = 3;
+    } else if ((p_buff[0] & 0xF8) == 0xF0) {
+        octetsLength = 4;
+    }
+
+    return len < octetsLength ? 0 : octetsLength;
+}
+
+/* An invalid or cut off sequence is one octet long, so a cursor always moves */
+static __Cml_FORCE_INLINE size_t __CmlUTF8_getOctetsLength(unsigned char *p_buff, size_t len)
+{
+    if (len == 0)
+        return 0;
+
+    size_t octetsLength = __CmlUTF8_getLeadOctetsLength(p_buff, len);
+    size_t i = 1;
+    for (; i < octetsLength; i++) {
+        if ((p_buff[i] & 0xC0) != 0x80)
+            return 1;
+    }
+
+    return octetsLength != 0 ? octetsLength : 1;
+}
+
+/* p_buff + len is the end of the code; a stray continuation octet steps back alone */
+static __Cml_FORCE_INLINE size_t __CmlUTF8_getPrevOctetsLength(unsigned char *p_buff, size_t len)
+{
+    if (len == 0)
+        return 0;
+
+    size_t i = len - 1;
+    while (i != 0 && len - i < CmlUTF_MAX_OCTETS_LENGTH && (p_buff[i] & 0xC0) == 0x80)
+        i--;
+
+    return __CmlUTF8_getOctetsLength(p_buff + i, len - i) == len - i ? len - i : 1;
+}
+
+static __Cml_FORCE_INLINE CmlUTF_Code __CmlUTF8_decode(unsigned char *p_buff, size_t len)
+{
+    if (len == 0) {
+        goto bufferTooSmallError;
+    }
+
+    if (!(p_buff[0] & 0x80)) {
+        return p_buff[0];
+    }
+
+    CmlUTF_Code code = 0;
+    size_t octetsLength = __CmlUTF8_getLeadOctetsLength(p_buff, len);
+    switch (octetsLength) {
+        case 2: code = p_buff[0] & 0x1F;
+        break;
+        case 3: code = p_buff[0] & 0xF;
+        break;
+        case 4: code = p_buff[0] & 0x7;
+        break;
+        default: goto invalidUTF8Error;
+    }
+
+    size_t i = 1;
+    for (; i < octetsLength; i++) {
+        if ((p_buff[i] & 0xC0) != 0x80) {
+            goto invalidUTF8Error;
+        }
+        code = (code << 6) | (p_buff[i] & 0x3F);
+    }
+
+    return code;
+
+    bufferTooSmallError:
+    errno = ERANGE;
+    return -1;
+
+    invalidUTF8Error:
+    errno = EINVAL;
+    return -1;
+}
+
 size_t CmlUTF8_getOctetsLength(unsigned char *p_buff, size_t len);
-void CmlUTF8_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+size_t CmlUTF8_count(unsigned char *p_buff, size_t len);
+size_t CmlUTF8_getPrevOctetsLength(unsigned char *p_buff, size_t len);
+size_t CmlUTF8_encode(CmlUTF_Code code, unsigned char *p_buff, size_t len);
+size_t CmlUTF8_encodeCodes(CmlUTF_Code *p_codes, size_t *p_n, unsigned char *p_buff, size_t len);
 CmlUTF_Code CmlUTF8_decode(unsigned char *p_buff, size_t len);
 void CmlUTF8_new(struct CmlUTF_Buffer *p_utf, unsigned char *p_buff, size_t offset, size_t len);
+void CmlUTF8_newv(struct CmlUTF_Buffer *p_utf, struct iovec *p_segments, size_t segmentsLen, size_t offset);
 
 #endif